@@ -12,6 +12,12 @@ android {
   }
   ndkVersion = "25.2.9519653"
 
+  // optional TLS for DNS over TLS/HTTPS upstreams (dns_tls.cpp), see
+  // adblock.tlsPrefab in gradle.properties
+  buildFeatures {
+    prefab = true
+  }
+
   namespace = "com.example.adblocker"
   compileSdk = 35
 
@@ -48,4 +54,6 @@ dependencies {
   implementation("com.squareup.okhttp3:okhttp:4.11.0")
   implementation("androidx.work:work-runtime-ktx:2.8.1")
   implementation("com.google.code.gson:gson:2.10.1")
+  // without it the native build leaves TLS out and DNS goes upstream over UDP
+  providers.gradleProperty("adblock.tlsPrefab").orNull?.let { implementation(it) }
 }
@@ -1,60 +1,146 @@
 #include <jni.h>
 #include <string>
 #include <vector>
-#include <set>
 #include <algorithm>
 #include <cctype>
+#include <cstring>
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <android/log.h>
 
+#include "blocklist_file.h"
+#include "network_filter.h"
+#include "subscription_compiler.h"
+
 #define LOG_TAG "adblock_bridge"
 #define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 
 struct Engine {
-    std::set<std::string> hosts;
-    std::vector<std::string> rules;
+    // Mapped DNS blocklist (see nativeLoadBlocklist) and filter rules, each
+    // replaced whole by a reload or subscription update. Published with
+    // std::atomic_store so a matching thread keeps the ones it started with,
+    // mapping included, while a reload swaps in the next.
+    std::shared_ptr<const DomainIndex> hosts;
+    std::shared_ptr<const SubscriptionSet> rules;
+};
+
+static std::shared_ptr<const DomainIndex> hosts_of(const Engine* e) {
+    return std::atomic_load(&e->hosts);
+}
+
+static std::shared_ptr<const SubscriptionSet> rules_of(const Engine* e) {
+    return std::atomic_load(&e->rules);
+}
+
+static bool host_suffix_match(const DomainIndex* blocked, std::string_view host) {
+    // exact host or any parent domain, label boundaries only
+    return blocked && blocked->match(host);
+}
+
+static bool host_blocked(const DomainIndex* hosts, const SubscriptionSet* rules, std::string_view host) {
+    return host_suffix_match(hosts, host) || (rules && rules->match_host(host));
+}
+
+// Reused by every shouldBlock call on a thread, so matching does not allocate.
+static thread_local NetworkFilterSet::MatchContext tls_match;
+
+static bool url_blocked(const DomainIndex* hosts, const SubscriptionSet* rules, std::string_view url,
+                        std::string_view source, std::string_view type) {
+    if (!rules) return host_suffix_match(hosts, url_host(url));
+    FilterRequest req;
+    req.url = url;
+    req.sourceHost = source;
+    req.type = request_type_from_name(type);
+    // the mapped host list blocks like `||host^` filters; @@ exceptions still win
+    return rules->match(req, tls_match, hosts) == FilterVerdict::Blocked;
+}
+
+// Modified UTF-8 of `s` copied into `buf`, or an empty view if it does not
+// fit; saves the heap copy GetStringUTFChars makes.
+static std::string_view string_region(JNIEnv* env, jstring s, char* buf, size_t cap) {
+    if (!s) return {};
+    jsize bytes = env->GetStringUTFLength(s);
+    if ((size_t)bytes >= cap) return {};
+    env->GetStringUTFRegion(s, 0, env->GetStringLength(s), buf);
+    return {buf, (size_t)bytes};
+}
+
+// Batches cross JNI as one direct ByteBuffer of items, each a 4-byte
+// big-endian length (ByteBuffer's default order) followed by that many bytes
+// of UTF-8.
+class PackedReader {
+public:
+    PackedReader(const uint8_t* p, size_t n) : p_(p), end_(p + n) {}
+
+    bool next(std::string_view* out) {
+        if (end_ - p_ < 4) return false;
+        uint32_t len = (uint32_t)p_[0] << 24 | (uint32_t)p_[1] << 16 | (uint32_t)p_[2] << 8 | p_[3];
+        p_ += 4;
+        if ((size_t)(end_ - p_) < len) return false;
+        *out = std::string_view(reinterpret_cast<const char*>(p_), len);
+        p_ += len;
+        return true;
+    }
+
+private:
+    const uint8_t* p_;
+    const uint8_t* end_;
 };
 
-static std::string tolower_str(std::string s) {
-    std::transform(s.begin(), s.end(), s.begin(), [](unsigned char c){ return (char)std::tolower(c); });
-    return s;
-}
-
-static std::string sanitize_host(const std::string& in) {
-    std::string s = tolower_str(in);
-    // strip protocol
-    auto pos = s.find("://");
-    if (pos != std::string::npos) s = s.substr(pos + 3);
-    // strip leading ||
-    if (s.rfind("||", 0) == 0) s = s.substr(2);
-    // strip path / params / anchors
-    for (char cut : {'/', '^', '$'}) {
-        auto p = s.find(cut);
-        if (p != std::string::npos) s = s.substr(0, p);
+static const uint8_t* direct_buffer(JNIEnv* env, jobject buf, size_t* cap) {
+    if (!buf) return nullptr;
+    void* addr = env->GetDirectBufferAddress(buf);
+    jlong n = env->GetDirectBufferCapacity(buf);
+    if (!addr || n < 0) return nullptr;
+    *cap = (size_t)n;
+    return static_cast<const uint8_t*>(addr);
+}
+
+// Verdicts of a batch as a bitmap: bit i (LSB first) of byte i / 8.
+// Returns the number of items that matched, or -1 if a buffer is not direct,
+// too small, or ends before `count` items.
+template <size_t Fields, typename Fn>
+static jint match_packed(JNIEnv* env, jobject items, jint count, jobject out, Fn blocked) {
+    size_t inCap = 0, outCap = 0;
+    const uint8_t* in = direct_buffer(env, items, &inCap);
+    uint8_t* bits = const_cast<uint8_t*>(direct_buffer(env, out, &outCap));
+    if (!in || !bits || count < 0 || outCap < ((size_t)count + 7) / 8) return -1;
+    memset(bits, 0, ((size_t)count + 7) / 8);
+    PackedReader r(in, inCap);
+    jint hits = 0;
+    for (jint i = 0; i < count; ++i) {
+        std::string_view f[Fields];
+        for (size_t k = 0; k < Fields; ++k) {
+            if (!r.next(&f[k])) return -1;
+        }
+        if (blocked(f)) {
+            bits[i >> 3] |= (uint8_t)(1u << (i & 7));
+            ++hits;
+        }
     }
-    if (!s.empty() && s[0] == '.') s.erase(0, 1);
-    // strip port
-    auto c = s.find(':');
-    if (c != std::string::npos) s = s.substr(0, c);
-    // remove wildcards
-    s.erase(std::remove(s.begin(), s.end(), '*'), s.end());
-    return s;
-}
-
-static bool host_suffix_match(const std::set<std::string>& blocked, const std::string& host) {
-    if (blocked.empty()) return false;
-    std::string h = tolower_str(host);
-    if (h.empty()) return false;
-    if (blocked.find(h) != blocked.end()) return true;
-    // Check suffixes
-    auto dot = h.find('.');
-    while (dot != std::string::npos) {
-        std::string sub = h.substr(dot + 1);
-        if (blocked.find(sub) != blocked.end()) return true;
-        dot = h.find('.', dot + 1);
+    return hits;
+}
+
+// Compiles newline-separated list text into the engine's filter set.
+static void load_rules(Engine* e, const char* text, size_t len) {
+    NetworkFilterSet filters;
+    size_t lines = 0, used = 0;
+    for (size_t i = 0; i < len;) {
+        const char* nl = static_cast<const char*>(memchr(text + i, '\n', len - i));
+        size_t end = nl ? (size_t)(nl - text) : len;
+        if (filters.add(std::string_view(text + i, end - i))) used++;
+        lines++;
+        i = end + 1;
     }
-    return false;
+    filters.build();
+    size_t hosts = filters.hosts().size();
+    std::atomic_store(&e->rules, SubscriptionSet::from_filters(std::move(filters)));
+    ALOGI("Loaded %zu lines, %zu network filters, %zu hosts", lines, used, hosts);
 }
 
 extern "C" JNIEXPORT jlong JNICALL
@@ -68,76 +154,191 @@ Java_com_example_adblocker_filter_AdblockEngine_nativeCreateEngine(JNIEnv* env,
     return reinterpret_cast<jlong>(e);
 }
 
+// Rules as one buffer of list text (as read from the file), so loading costs
+// one JNI call however many lines there are.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeLoadRulesBuffer(JNIEnv* env, jclass clazz, jlong ptr, jobject buf, jint length) {
+    Engine* e = reinterpret_cast<Engine*>(ptr);
+    if (!e || length < 0) return JNI_FALSE;
+    size_t cap = 0;
+    const uint8_t* text = length ? direct_buffer(env, buf, &cap) : nullptr;  // an empty buffer may have no address
+    if (length && (!text || (size_t)length > cap)) return JNI_FALSE;
+    load_rules(e, reinterpret_cast<const char*>(text), (size_t)length);
+    return JNI_TRUE;
+}
+
+// Same, straight from a list file; the text is mapped rather than copied.
 extern "C" JNIEXPORT jboolean JNICALL
-Java_com_example_adblocker_filter_AdblockEngine_nativeLoadRules(JNIEnv* env, jclass clazz, jlong ptr, jobjectArray rules) {
+Java_com_example_adblocker_filter_AdblockEngine_nativeLoadRulesFile(JNIEnv* env, jclass clazz, jlong ptr, jstring jpath) {
+    Engine* e = reinterpret_cast<Engine*>(ptr);
+    if (!e || !jpath) return JNI_FALSE;
+    const char* c = env->GetStringUTFChars(jpath, nullptr);
+    if (!c) return JNI_FALSE;
+    std::string path(c);
+    env->ReleaseStringUTFChars(jpath, c);
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGE("Cannot open %s", path.c_str());
+        return JNI_FALSE;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return JNI_FALSE;
+    }
+    size_t len = (size_t)st.st_size;
+    void* addr = len ? mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (len && addr == MAP_FAILED) {
+        ALOGE("mmap failed for %s", path.c_str());
+        return JNI_FALSE;
+    }
+    if (addr) madvise(addr, len, MADV_SEQUENTIAL);
+    load_rules(e, static_cast<const char*>(addr), len);
+    if (addr) munmap(addr, len);
+    return JNI_TRUE;
+}
+
+// Brings the rules up to date with the subscription files at `paths`,
+// recompiling only the lists whose text changed since the last call. Host-only
+// rules are written to `hostsPath` (text) and its ".bin" for the proxies.
+// Returns the number of blocked domains, or -1.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeCompileSubscriptions(JNIEnv* env, jclass clazz, jlong ptr, jobjectArray jpaths, jstring jhostsPath) {
     Engine* e = reinterpret_cast<Engine*>(ptr);
-    if (!e) return JNI_FALSE;
-    e->rules.clear();
-    e->hosts.clear();
-
-    jsize len = env->GetArrayLength(rules);
-    for (jsize i = 0; i < len; ++i) {
-        jstring jstr = (jstring) env->GetObjectArrayElement(rules, i);
-        if (!jstr) continue;
-        const char* cstr = env->GetStringUTFChars(jstr, nullptr);
-        if (!cstr) { env->DeleteLocalRef(jstr); continue; }
-        std::string line(cstr);
-        env->ReleaseStringUTFChars(jstr, cstr);
-        env->DeleteLocalRef(jstr);
-
-        // store rule
-        e->rules.push_back(line);
-
-        // very simple host extraction like Kotlin helper
-        std::string l = line;
-        // skip comments and exceptions
-        if (!l.empty() && (l[0] == '!' || l[0] == '#')) continue;
-        if (l.rfind("@@", 0) == 0) continue;
-
-        // ||example.com^ or plain domain or http(s)://host/...
-        std::string host = sanitize_host(l);
-        if (!host.empty() && host.find('.') != std::string::npos) {
-            e->hosts.insert(host);
+    if (!e || !jpaths || !jhostsPath) return -1;
+    std::vector<std::string> paths;
+    jsize n = env->GetArrayLength(jpaths);
+    for (jsize i = 0; i < n; ++i) {
+        jstring js = (jstring) env->GetObjectArrayElement(jpaths, i);
+        if (!js) continue;
+        const char* c = env->GetStringUTFChars(js, nullptr);
+        if (c) {
+            paths.emplace_back(c);
+            env->ReleaseStringUTFChars(js, c);
         }
+        env->DeleteLocalRef(js);
     }
-    ALOGI("Loaded %d rules, %zu hosts", (int)len, e->hosts.size());
+    const char* c = env->GetStringUTFChars(jhostsPath, nullptr);
+    if (!c) return -1;
+    std::string hostsPath(c);
+    env->ReleaseStringUTFChars(jhostsPath, c);
+
+    SubscriptionStats stats;
+    std::shared_ptr<const SubscriptionSet> next = update_subscriptions(rules_of(e), paths, hostsPath, &stats);
+    if (!next) return -1;
+    std::atomic_store(&e->rules, std::move(next));
+    return (jint)stats.hosts;
+}
+
+// Replaces the host index with a compiled blocklist mapped read-only; the
+// pages are shared with the DNS and HTTP proxies that map the same file.
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeLoadBlocklist(JNIEnv* env, jclass clazz, jlong ptr, jstring jpath) {
+    Engine* e = reinterpret_cast<Engine*>(ptr);
+    if (!e || !jpath) return JNI_FALSE;
+    const char* c = env->GetStringUTFChars(jpath, nullptr);
+    if (!c) return JNI_FALSE;
+    std::string path(c);
+    env->ReleaseStringUTFChars(jpath, c);
+    auto hosts = std::make_shared<DomainIndex>(blocklist_load(path));
+    if (hosts->node_count() == 0) return JNI_FALSE;
+    ALOGI("Mapped %zu hosts from %s", hosts->size(), path.c_str());
+    // the previous mapping goes away with its last reader
+    std::atomic_store(&e->hosts, std::shared_ptr<const DomainIndex>(std::move(hosts)));
     return JNI_TRUE;
 }
 
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeCompileBlocklist(JNIEnv* env, jclass clazz, jstring jtext, jstring jout) {
+    if (!jtext || !jout) return JNI_FALSE;
+    const char* t = env->GetStringUTFChars(jtext, nullptr);
+    const char* o = env->GetStringUTFChars(jout, nullptr);
+    std::string textPath(t ? t : ""), outPath(o ? o : "");
+    if (t) env->ReleaseStringUTFChars(jtext, t);
+    if (o) env->ReleaseStringUTFChars(jout, o);
+    if (textPath.empty() || outPath.empty()) return JNI_FALSE;
+    return blocklist_compile(textPath, outPath) ? JNI_TRUE : JNI_FALSE;
+}
+
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_example_adblocker_filter_AdblockEngine_nativeMatchHostname(JNIEnv* env, jclass clazz, jlong ptr, jstring jhost) {
     Engine* e = reinterpret_cast<Engine*>(ptr);
     if (!e || !jhost) return JNI_FALSE;
-    const char* c = env->GetStringUTFChars(jhost, nullptr);
-    if (!c) return JNI_FALSE;
-    std::string host(c);
-    env->ReleaseStringUTFChars(jhost, c);
-    bool blocked = host_suffix_match(e->hosts, host);
-    return blocked ? JNI_TRUE : JNI_FALSE;
+    char buf[256];  // longest DNS name is 253
+    std::string_view host = string_region(env, jhost, buf, sizeof(buf));
+    return !host.empty() && host_blocked(hosts_of(e).get(), rules_of(e).get(), host) ? JNI_TRUE : JNI_FALSE;
 }
 
 extern "C" JNIEXPORT jboolean JNICALL
 Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlock(JNIEnv* env, jclass clazz, jlong ptr, jstring jurl, jstring jsourceHost, jstring jtype) {
     Engine* e = reinterpret_cast<Engine*>(ptr);
     if (!e || !jurl) return JNI_FALSE;
-    const char* curl = env->GetStringUTFChars(jurl, nullptr);
-    if (!curl) return JNI_FALSE;
-    std::string url(curl);
-    env->ReleaseStringUTFChars(jurl, curl);
-
-    // First: host-level decision
-    std::string host = sanitize_host(url);
-    if (host_suffix_match(e->hosts, host)) return JNI_TRUE;
-
-    // Fallback: naive substring match of rules (placeholder)
-    for (const auto& r : e->rules) {
-        if (r.empty()) continue;
-        if (r[0] == '!' || r[0] == '#') continue;
-        if (r.find("##") != std::string::npos) continue; // cosmetic
-        if (r.rfind("@@", 0) == 0) continue; // exception ignored here
-        if (url.find(r) != std::string::npos) return JNI_TRUE;
+    char sourceBuf[256], typeBuf[32], urlBuf[2048];
+    std::string_view source = string_region(env, jsourceHost, sourceBuf, sizeof(sourceBuf));
+    std::string_view type = string_region(env, jtype, typeBuf, sizeof(typeBuf));
+    std::string_view url = string_region(env, jurl, urlBuf, sizeof(urlBuf));
+    std::shared_ptr<const DomainIndex> hosts = hosts_of(e);
+    std::shared_ptr<const SubscriptionSet> rules = rules_of(e);
+    if (!url.empty()) return url_blocked(hosts.get(), rules.get(), url, source, type) ? JNI_TRUE : JNI_FALSE;
+
+    // longer than the stack buffer
+    const char* c = env->GetStringUTFChars(jurl, nullptr);
+    if (!c) return JNI_FALSE;
+    bool blocked = url_blocked(hosts.get(), rules.get(), c, source, type);
+    env->ReleaseStringUTFChars(jurl, c);
+    return blocked ? JNI_TRUE : JNI_FALSE;
+}
+
+// `count` hosts packed into `items`; verdicts go to the bitmap in `out`.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeMatchHostsPacked(JNIEnv* env, jclass clazz, jlong ptr, jobject items, jint count, jobject out) {
+    Engine* e = reinterpret_cast<Engine*>(ptr);
+    if (!e) return -1;
+    std::shared_ptr<const DomainIndex> hosts = hosts_of(e);
+    std::shared_ptr<const SubscriptionSet> rules = rules_of(e);
+    return match_packed<1>(env, items, count, out, [&hosts, &rules](const std::string_view* f) {
+        return !f[0].empty() && host_blocked(hosts.get(), rules.get(), f[0]);
+    });
+}
+
+// `count` requests packed as url, source host, type; verdicts as above.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlockPacked(JNIEnv* env, jclass clazz, jlong ptr, jobject items, jint count, jobject out) {
+    Engine* e = reinterpret_cast<Engine*>(ptr);
+    if (!e) return -1;
+    std::shared_ptr<const DomainIndex> hosts = hosts_of(e);
+    std::shared_ptr<const SubscriptionSet> rules = rules_of(e);
+    return match_packed<3>(env, items, count, out, [&hosts, &rules](const std::string_view* f) {
+        return !f[0].empty() && url_blocked(hosts.get(), rules.get(), f[0], f[1], f[2]);
+    });
+}
+
+// [blocklistDomains, blocklistBytes, blocklistFilterBytes, blocklistFilterFpPpm,
+//  ruleHosts, ruleHostBytes, ruleHostFilterBytes, ruleHostFilterFpPpm, ruleBytes]
+// The filter columns describe the prefilter in front of each host index; its
+// false positive rate is measured when the index is built.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_adblocker_filter_AdblockEngine_nativeGetStats(JNIEnv* env, jclass clazz, jlong ptr) {
+    Engine* e = reinterpret_cast<Engine*>(ptr);
+    jlong vals[9] = {};
+    if (e) {
+        std::shared_ptr<const DomainIndex> hosts = hosts_of(e);
+        std::shared_ptr<const SubscriptionSet> rules = rules_of(e);
+        const DomainIndex* indexes[2] = {hosts.get(), rules ? &rules->hosts() : nullptr};
+        for (int i = 0; i < 2; ++i) {
+            if (!indexes[i]) continue;
+            vals[i * 4] = (jlong)indexes[i]->size();
+            vals[i * 4 + 1] = (jlong)indexes[i]->memory_bytes();
+            vals[i * 4 + 2] = (jlong)indexes[i]->filter().memory_bytes();
+            vals[i * 4 + 3] = (jlong)indexes[i]->filter().fp_per_million();
+        }
+        if (rules) vals[8] = (jlong)rules->memory_bytes();
     }
-    return JNI_FALSE;
+    jlongArray arr = env->NewLongArray(9);
+    if (arr) env->SetLongArrayRegion(arr, 0, 9, vals);
+    return arr;
 }
 
 extern "C" JNIEXPORT void JNICALL
@@ -0,0 +1,95 @@
+#include "async_resolver.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+struct AsyncResolver::Shared {
+    struct Job {
+        uint64_t tag;
+        std::string host;
+        std::string port;
+    };
+
+    std::mutex lock;
+    std::condition_variable cv;
+    std::deque<Job> jobs;
+    std::vector<Result> done;
+    bool stopping = false;
+    int efd = -1;
+
+    ~Shared() {
+        for (auto& r : done) {
+            if (r.addrs) freeaddrinfo(r.addrs);
+        }
+        if (efd >= 0) close(efd);
+    }
+};
+
+AsyncResolver::~AsyncResolver() {
+    if (!shared_) return;
+    std::lock_guard<std::mutex> g(shared_->lock);
+    shared_->stopping = true;
+    shared_->jobs.clear();
+    shared_->cv.notify_all();
+}
+
+bool AsyncResolver::start(size_t threads) {
+    shared_ = std::make_shared<Shared>();
+    shared_->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shared_->efd < 0) return false;
+    for (size_t i = 0; i < threads; ++i) {
+        std::thread(run, shared_).detach();
+    }
+    return true;
+}
+
+int AsyncResolver::fd() const {
+    return shared_ ? shared_->efd : -1;
+}
+
+void AsyncResolver::submit(uint64_t tag, const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> g(shared_->lock);
+    shared_->jobs.push_back(Shared::Job{tag, host, port});
+    shared_->cv.notify_one();
+}
+
+void AsyncResolver::collect(std::vector<Result>& out) {
+    uint64_t v;
+    while (read(shared_->efd, &v, sizeof(v)) > 0) {}
+    std::lock_guard<std::mutex> g(shared_->lock);
+    out.insert(out.end(), shared_->done.begin(), shared_->done.end());
+    shared_->done.clear();
+}
+
+void AsyncResolver::run(std::shared_ptr<Shared> s) {
+    while (true) {
+        Shared::Job job;
+        {
+            std::unique_lock<std::mutex> g(s->lock);
+            s->cv.wait(g, [&] { return s->stopping || !s->jobs.empty(); });
+            if (s->stopping) return;
+            job = std::move(s->jobs.front());
+            s->jobs.pop_front();
+        }
+
+        struct addrinfo hints{}, *res = nullptr;
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int rv = getaddrinfo(job.host.c_str(), job.port.c_str(), &hints, &res);
+
+        std::lock_guard<std::mutex> g(s->lock);
+        if (s->stopping) {
+            if (res) freeaddrinfo(res);
+            return;
+        }
+        s->done.push_back(Result{job.tag, rv, rv == 0 ? res : nullptr});
+        if (rv != 0 && res) freeaddrinfo(res);
+        uint64_t one = 1;
+        (void)write(s->efd, &one, sizeof(one));
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <netdb.h>
+#include <string>
+#include <vector>
+
+// Runs getaddrinfo() off an event loop. Lookups are queued to a couple of
+// helper threads; the loop polls fd() and calls collect() when it is readable.
+//
+// Destroying the resolver never waits for a lookup in progress: the helper
+// threads are detached and drop their result when they finish.
+class AsyncResolver {
+public:
+    struct Result {
+        uint64_t tag;
+        int error;       // getaddrinfo() return value
+        addrinfo* addrs; // owned by the caller, release with freeaddrinfo()
+    };
+
+    AsyncResolver() = default;
+    ~AsyncResolver();
+    AsyncResolver(const AsyncResolver&) = delete;
+    AsyncResolver& operator=(const AsyncResolver&) = delete;
+
+    bool start(size_t threads = 2);
+
+    // eventfd that becomes readable when results are waiting.
+    int fd() const;
+
+    void submit(uint64_t tag, const std::string& host, const std::string& port);
+
+    // Appends finished lookups to `out`.
+    void collect(std::vector<Result>& out);
+
+private:
+    struct Shared;
+    static void run(std::shared_ptr<Shared> s);
+
+    std::shared_ptr<Shared> shared_;
+};
@@ -0,0 +1,1391 @@
+// Host benchmarks for the native hot paths, built by the host profile in
+// CMakeLists.txt.
+//
+//   native_bench [--quick] [--only name,...] [--duration seconds] [--clients n]
+//                [--rules file] [--urls file] [--out file]
+//
+// Benchmarks: domain_lookup, tls_sni, dns_codec, should_block, blocklist_load,
+// metrics, event_log, dns_udp, dns_tls and http_proxy. The last three start the real DNS and
+// HTTP proxies through their JNI entry points, point them at a fake upstream
+// on loopback and drive them with a load generator. dns_tls (only when built
+// with OpenSSL) uses a stand-in DoT/DoH resolver with a self-signed
+// certificate. Results go to stdout (or --out) as
+// one JSON object, progress to stderr.
+//
+// should_block uses a generated EasyList-like rule set and URL corpus unless
+// --rules (a filter list) and --urls (lines of "url [sourceHost [type]]") are
+// given.
+
+#include <jni.h>
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "blocklist_file.h"
+#include "dns_codec.h"
+#include "domain_index.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "tls_client_hello.h"
+
+#if defined(ADBLOCK_DNS_TLS)
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#endif
+
+extern "C" {
+jlong Java_com_example_adblocker_filter_AdblockEngine_nativeCreateEngine(JNIEnv*, jclass);
+jboolean Java_com_example_adblocker_filter_AdblockEngine_nativeLoadRulesBuffer(JNIEnv*, jclass, jlong, jobject, jint);
+jboolean Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlock(JNIEnv*, jclass, jlong, jstring, jstring,
+                                                                           jstring);
+jint Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlockPacked(JNIEnv*, jclass, jlong, jobject, jint,
+                                                                             jobject);
+jlongArray Java_com_example_adblocker_filter_AdblockEngine_nativeGetStats(JNIEnv*, jclass, jlong);
+void Java_com_example_adblocker_filter_AdblockEngine_nativeRelease(JNIEnv*, jclass, jlong);
+jlong Java_com_example_adblocker_native_NativeProxy_startDnsProxy(JNIEnv*, jclass, jint, jstring, jstring, jint);
+void Java_com_example_adblocker_native_NativeProxy_stopDnsProxy(JNIEnv*, jclass, jlong);
+jlongArray Java_com_example_adblocker_native_NativeProxy_getDnsUpstreamStats(JNIEnv*, jclass, jstring);
+jboolean Java_com_example_adblocker_native_NativeProxy_setDnsTrustAnchors(JNIEnv*, jclass, jstring);
+jlong Java_com_example_adblocker_native_NativeProxy_startAdvancedProxy(JNIEnv*, jclass, jint, jstring);
+void Java_com_example_adblocker_native_NativeProxy_stopAdvancedProxy(JNIEnv*, jclass, jlong);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    bool quick = false;
+    std::vector<std::string> only;
+    double duration = 2.0;  // seconds per load test phase
+    int clients = 4;
+    std::string rulesPath;
+    std::string urlsPath;
+    std::string outPath;
+};
+
+double seconds_since(Clock::time_point t) {
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+// Keeps results alive so the measured work is not optimized away.
+volatile uint64_t g_sink;
+
+// Average ns per call of fn(i) over i = 0..n-1, repeated until at least
+// `minSeconds` have passed.
+template <typename Fn>
+double ns_per_op(size_t n, double minSeconds, Fn fn) {
+    uint64_t sink = 0;
+    for (size_t i = 0; i < std::min<size_t>(n, 1000); ++i) sink += fn(i);  // warm up
+    size_t ops = 0;
+    Clock::time_point t0 = Clock::now();
+    double elapsed;
+    do {
+        for (size_t i = 0; i < n; ++i) sink += fn(i);
+        ops += n;
+        elapsed = seconds_since(t0);
+    } while (elapsed < minSeconds);
+    g_sink = sink;
+    return elapsed * 1e9 / (double)ops;
+}
+
+// One benchmark case: a name and flat fields.
+class Result {
+public:
+    explicit Result(std::string name) { add("name", std::move(name)); }
+
+    void add(const std::string& key, std::string value) {
+        std::string quoted = "\"";
+        for (char c : value) {
+            if (c == '"' || c == '\\') quoted += '\\';
+            if ((unsigned char)c >= 0x20) quoted += c;
+        }
+        fields_.emplace_back(key, quoted + "\"");
+    }
+    void add(const std::string& key, double value) {
+        char buf[64];
+        if (value == (double)(int64_t)value && std::abs(value) < 1e15) snprintf(buf, sizeof(buf), "%lld", (long long)value);
+        else snprintf(buf, sizeof(buf), "%.3f", value);
+        fields_.emplace_back(key, buf);
+    }
+
+    std::string json() const {
+        std::string s = "{";
+        for (size_t i = 0; i < fields_.size(); ++i) {
+            if (i) s += ", ";
+            s += "\"" + fields_[i].first + "\": " + fields_[i].second;
+        }
+        return s + "}";
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> fields_;
+};
+
+// --- synthetic data ---
+
+const char* const kTlds[] = {"com", "com", "com", "net", "org", "io", "de", "co.uk", "ru", "jp", "fr", "info"};
+const char* const kAdWords[] = {"ad", "ads", "adserver", "banner", "track", "tracker", "pixel", "promo", "sponsor",
+                                "analytics", "beacon", "metrics", "popunder", "affiliate", "click", "stats"};
+const char* const kWords[] = {"static", "assets", "img", "images", "js", "css", "api", "media", "news", "video",
+                              "user", "profile", "search", "cart", "product", "article", "comments", "feed",
+                              "cdn", "lib", "fonts", "thumb", "photo", "home", "blog", "shop", "account"};
+const char* const kTypes[] = {"script", "image", "xhr", "stylesheet", "subdocument", "font", "media", "other"};
+
+template <size_t N>
+const char* pick(std::mt19937_64& rng, const char* const (&list)[N]) {
+    return list[rng() % N];
+}
+
+std::string random_label(std::mt19937_64& rng, size_t minLen, size_t maxLen) {
+    static const char kChars[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    size_t n = minLen + rng() % (maxLen - minLen + 1);
+    std::string s;
+    for (size_t i = 0; i < n; ++i) s += kChars[rng() % (i == 0 ? 26 : 36)];
+    return s;
+}
+
+std::string random_domain(std::mt19937_64& rng) {
+    std::string d = random_label(rng, 4, 14) + "." + pick(rng, kTlds);
+    if (rng() % 3 == 0) d = random_label(rng, 2, 8) + "." + d;
+    return d;
+}
+
+std::string hex(std::mt19937_64& rng, size_t n) {
+    std::string s;
+    for (size_t i = 0; i < n; ++i) s += "0123456789abcdef"[rng() % 16];
+    return s;
+}
+
+// --- domain_lookup ---
+
+void bench_domain_lookup(const Options& o, std::vector<Result>& out) {
+    std::vector<size_t> sizes = {1000, 100000, 1000000};
+    if (o.quick) sizes.pop_back();
+    for (size_t n : sizes) {
+        std::mt19937_64 rng(n);
+        std::vector<std::string> names;
+        names.reserve(n);
+        DomainIndexBuilder builder;
+        for (size_t i = 0; i < n; ++i) {
+            names.push_back(random_domain(rng));
+            builder.add(names.back());
+        }
+        Clock::time_point t0 = Clock::now();
+        DomainIndex index = builder.build();
+        double buildMs = seconds_since(t0) * 1e3;
+
+        std::vector<std::string> hits, misses;
+        for (size_t i = 0; i < 10000; ++i) {
+            hits.push_back(std::string(pick(rng, kWords)) + "." + names[rng() % names.size()]);
+            misses.push_back(std::string(pick(rng, kWords)) + "." + random_domain(rng));
+        }
+        double minSec = o.quick ? 0.05 : 0.3;
+        double hitNs = ns_per_op(hits.size(), minSec, [&](size_t i) { return index.match(hits[i]); });
+        double missNs = ns_per_op(misses.size(), minSec, [&](size_t i) { return index.match(misses[i]); });
+
+        Result r("domain_lookup");
+        r.add("entries", (double)index.size());
+        r.add("build_ms", buildMs);
+        r.add("index_bytes", (double)index.memory_bytes());
+        r.add("filter_bytes", (double)index.filter().memory_bytes());
+        r.add("filter_fp_ppm", (double)index.filter().fp_per_million());
+        r.add("hit_ns", hitNs);
+        r.add("miss_ns", missNs);
+        out.push_back(r);
+    }
+}
+
+// --- tls_sni ---
+
+void put16(std::vector<uint8_t>& v, size_t x) {
+    v.push_back((uint8_t)(x >> 8));
+    v.push_back((uint8_t)x);
+}
+
+void put_ext(std::vector<uint8_t>& v, uint16_t type, const std::vector<uint8_t>& body) {
+    put16(v, type);
+    put16(v, body.size());
+    v.insert(v.end(), body.begin(), body.end());
+}
+
+// A browser-like ClientHello for `sni` with a key share of `keyShareBytes`,
+// split into handshake records of at most `recordMax` bytes.
+std::vector<uint8_t> client_hello(const std::string& sni, size_t keyShareBytes, size_t recordMax) {
+    std::mt19937_64 rng(7);
+    std::vector<uint8_t> body;
+    put16(body, 0x0303);
+    for (int i = 0; i < 32; ++i) body.push_back((uint8_t)rng());
+    body.push_back(32);
+    for (int i = 0; i < 32; ++i) body.push_back((uint8_t)rng());
+    static const uint16_t kSuites[] = {0x1301, 0x1302, 0x1303, 0xc02b, 0xc02f, 0xc02c, 0xc030, 0xcca9,
+                                       0xcca8, 0xc013, 0xc014, 0x009c, 0x009d, 0x002f, 0x0035};
+    put16(body, sizeof(kSuites));
+    for (uint16_t s : kSuites) put16(body, s);
+    body.push_back(1);
+    body.push_back(0);
+
+    std::vector<uint8_t> exts, e;
+    put16(e, sni.size() + 3);
+    e.push_back(0);
+    put16(e, sni.size());
+    e.insert(e.end(), sni.begin(), sni.end());
+    put_ext(exts, 0x0000, e);
+    e = {0x00, 0x08, 0x11, 0xec, 0x00, 0x1d, 0x00, 0x17, 0x00, 0x18};  // supported_groups
+    put_ext(exts, 0x000a, e);
+    e = {0x00, 0x0c, 0x02, 'h', '2', 0x08, 'h', 't', 't', 'p', '/', '1', '.', '1'};
+    put_ext(exts, 0x0010, e);
+    e = {0x04, 0x03, 0x04, 0x03, 0x03};  // supported_versions
+    put_ext(exts, 0x002b, e);
+    e.clear();
+    put16(e, keyShareBytes + 4);
+    put16(e, keyShareBytes > 32 ? 0x11ec : 0x001d);
+    put16(e, keyShareBytes);
+    for (size_t i = 0; i < keyShareBytes; ++i) e.push_back((uint8_t)rng());
+    put_ext(exts, 0x0033, e);
+    put16(body, exts.size());
+    body.insert(body.end(), exts.begin(), exts.end());
+
+    std::vector<uint8_t> hs = {0x01, (uint8_t)(body.size() >> 16), (uint8_t)(body.size() >> 8), (uint8_t)body.size()};
+    hs.insert(hs.end(), body.begin(), body.end());
+    std::vector<uint8_t> out;
+    for (size_t off = 0; off < hs.size(); off += recordMax) {
+        size_t n = std::min(recordMax, hs.size() - off);
+        out.push_back(0x16);
+        put16(out, 0x0301);
+        put16(out, n);
+        out.insert(out.end(), hs.begin() + off, hs.begin() + off + n);
+    }
+    return out;
+}
+
+void bench_tls_sni(const Options& o, std::vector<Result>& out) {
+    struct Case {
+        const char* variant;
+        size_t keyShare;
+        size_t recordMax;
+    } cases[] = {{"x25519", 32, 16384}, {"x25519mlkem768", 1216, 16384}, {"x25519mlkem768_fragmented", 1216, 512}};
+    std::vector<uint8_t> scratch(kTlsMaxHelloLen);
+    for (const Case& c : cases) {
+        std::vector<uint8_t> hello = client_hello("www.example-news-site.com", c.keyShare, c.recordMax);
+        TlsClientHello h;
+        bool ok = tls_parse_client_hello(hello.data(), hello.size(), scratch.data(), &h) == TlsParseResult::Complete
+            && h.sni == "www.example-news-site.com";
+        double ns = ns_per_op(1000, o.quick ? 0.05 : 0.3, [&](size_t) {
+            TlsClientHello hh;
+            return (uint64_t)tls_parse_client_hello(hello.data(), hello.size(), scratch.data(), &hh) + hh.sni.size();
+        });
+        Result r("tls_sni");
+        r.add("variant", c.variant);
+        r.add("bytes", (double)hello.size());
+        r.add("parsed", ok ? 1.0 : 0.0);
+        r.add("parse_ns", ns);
+        out.push_back(r);
+    }
+}
+
+// --- dns_codec ---
+
+// Standard query for `name` with an EDNS OPT record.
+std::vector<uint8_t> dns_query(uint16_t id, const std::string& name, uint16_t qtype) {
+    std::vector<uint8_t> q = {(uint8_t)(id >> 8), (uint8_t)id, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 1};
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) dot = name.size();
+        q.push_back((uint8_t)(dot - start));
+        q.insert(q.end(), name.begin() + start, name.begin() + dot);
+        start = dot + 1;
+    }
+    q.push_back(0);
+    put16(q, qtype);
+    put16(q, 1);
+    // OPT: root name, type 41, UDP size 1232, no extended flags, no options
+    std::vector<uint8_t> opt = {0, 0, 41, 0x04, 0xd0, 0, 0, 0, 0, 0, 0};
+    q.insert(q.end(), opt.begin(), opt.end());
+    return q;
+}
+
+void bench_dns_codec(const Options& o, std::vector<Result>& out) {
+    std::mt19937_64 rng(53);
+    std::vector<std::vector<uint8_t>> queries;
+    for (int i = 0; i < 1000; ++i) {
+        queries.push_back(dns_query((uint16_t)rng(), std::string(pick(rng, kWords)) + "." + random_domain(rng),
+                                    i % 2 ? kDnsTypeAAAA : kDnsTypeA));
+    }
+    double minSec = o.quick ? 0.05 : 0.3;
+    double parseNs = ns_per_op(queries.size(), minSec, [&](size_t i) {
+        DnsQuery q;
+        return dns_parse_query(queries[i].data(), queries[i].size(), &q) ? (uint64_t)q.nameLen : 0;
+    });
+    std::vector<DnsQuery> parsed(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) dns_parse_query(queries[i].data(), queries[i].size(), &parsed[i]);
+    uint8_t resp[512];
+    double buildNs = ns_per_op(queries.size(), minSec, [&](size_t i) {
+        return (uint64_t)dns_build_block_response(queries[i].data(), parsed[i], DnsBlockPolicy::NullIpNoData, resp,
+                                                  sizeof(resp));
+    });
+    Result r("dns_codec");
+    r.add("query_bytes", (double)queries[0].size());
+    r.add("parse_ns", parseNs);
+    r.add("build_block_ns", buildNs);
+    out.push_back(r);
+}
+
+// --- should_block ---
+
+struct UrlCase {
+    std::string url, source, type;
+};
+
+// EasyList-like: mostly host rules, then path fragments, wildcards, options
+// and a few exceptions. `adHosts` receives the hosts it blocks.
+std::string generate_rules(size_t n, std::mt19937_64& rng, std::vector<std::string>* adHosts) {
+    std::string text = "[Adblock Plus 2.0]\n! Title: generated\n";
+    for (size_t i = 0; i < n; ++i) {
+        unsigned k = rng() % 100;
+        std::string host = std::string(pick(rng, kAdWords)) + random_label(rng, 1, 6) + "." + random_domain(rng);
+        std::string word = std::string(pick(rng, kAdWords)) + random_label(rng, 0, 3);
+        if (k < 50) {
+            text += "||" + host + "^\n";
+            adHosts->push_back(host);
+        } else if (k < 60) {
+            text += "||" + host + "^$third-party\n";
+            adHosts->push_back(host);
+        } else if (k < 72) {
+            static const char* const kShapes[] = {"/%s/", "/%s.", "-%s-", "_%s_", "&%s=", "/%s_", ".%s."};
+            char buf[128];
+            snprintf(buf, sizeof(buf), pick(rng, kShapes), word.c_str());
+            text += std::string(buf) + "\n";
+        } else if (k < 82) {
+            text += "||" + std::string(pick(rng, kWords)) + random_label(rng, 1, 4) + "." + random_domain(rng) + "/"
+                + word + "/*." + (rng() % 2 ? "js$script" : "gif$image") + "\n";
+        } else if (k < 88) {
+            text += "/" + word + "/*$domain=" + random_domain(rng) + "|" + random_domain(rng) + "\n";
+        } else if (k < 92) {
+            text += "|https://" + host + "/" + word + "^\n";
+        } else if (k < 96) {
+            text += "@@||" + random_domain(rng) + "/" + word + "^$script\n";
+        } else if (k < 98) {
+            text += "||" + host + "^$image,important\n";
+        } else {
+            text += "example.com##." + word + "-box\n";  // cosmetic, skipped
+        }
+    }
+    return text;
+}
+
+// A page load's worth of requests per site: first-party assets and API
+// calls, shared CDNs and analytics, and some ad and tracker hosts.
+std::vector<UrlCase> generate_urls(size_t n, std::mt19937_64& rng, const std::vector<std::string>& adHosts) {
+    std::vector<std::string> sites, cdns;
+    for (int i = 0; i < 500; ++i) sites.push_back("www." + random_label(rng, 5, 12) + "." + pick(rng, kTlds));
+    for (int i = 0; i < 50; ++i) cdns.push_back(std::string(pick(rng, kWords)) + random_label(rng, 1, 3) + "." + random_domain(rng));
+    std::vector<UrlCase> urls;
+    urls.reserve(n);
+    while (urls.size() < n) {
+        const std::string& site = sites[rng() % sites.size()];
+        unsigned k = rng() % 100;
+        UrlCase u;
+        u.source = site;
+        u.type = pick(rng, kTypes);
+        if (k < 55) {
+            u.url = "https://" + site + "/" + pick(rng, kWords) + "/" + pick(rng, kWords) + "." + hex(rng, 8)
+                + (u.type == "image" ? ".jpg?w=640&h=480" : u.type == "script" ? ".js" : "?id=" + hex(rng, 6));
+        } else if (k < 80) {
+            u.url = "https://" + cdns[rng() % cdns.size()] + "/" + pick(rng, kWords) + "/" + pick(rng, kWords)
+                + "-" + hex(rng, 6) + ".min.js";
+        } else if (k < 90 && !adHosts.empty()) {
+            u.url = "https://" + adHosts[rng() % adHosts.size()] + "/" + pick(rng, kAdWords) + "/" + hex(rng, 12)
+                + "?cb=" + std::to_string(rng() % 1000000);
+        } else {
+            u.url = "https://" + site + "/" + pick(rng, kWords) + "/" + pick(rng, kAdWords) + "_" + hex(rng, 4)
+                + ".gif?ref=" + site;
+        }
+        urls.push_back(u);
+    }
+    return urls;
+}
+
+bool read_file(const std::string& path, std::string* out) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) out->append(buf, n);
+    fclose(f);
+    return true;
+}
+
+void bench_should_block(const Options& o, std::vector<Result>& out) {
+    std::mt19937_64 rng(99);
+    std::string rules;
+    std::vector<std::string> adHosts;
+    if (!o.rulesPath.empty()) {
+        if (!read_file(o.rulesPath, &rules)) {
+            fprintf(stderr, "cannot read %s\n", o.rulesPath.c_str());
+            return;
+        }
+    } else {
+        rules = generate_rules(o.quick ? 10000 : 50000, rng, &adHosts);
+    }
+    std::vector<UrlCase> urls;
+    if (!o.urlsPath.empty()) {
+        std::string text;
+        if (!read_file(o.urlsPath, &text)) {
+            fprintf(stderr, "cannot read %s\n", o.urlsPath.c_str());
+            return;
+        }
+        size_t pos = 0;
+        while (pos < text.size()) {
+            size_t nl = text.find('\n', pos);
+            if (nl == std::string::npos) nl = text.size();
+            char url[4096] = {}, source[256] = {}, type[32] = {};
+            std::string line = text.substr(pos, nl - pos);
+            if (sscanf(line.c_str(), "%4095s %255s %31s", url, source, type) >= 1) urls.push_back({url, source, type});
+            pos = nl + 1;
+        }
+    } else {
+        urls = generate_urls(o.quick ? 5000 : 20000, rng, adHosts);
+    }
+    if (urls.empty()) return;
+
+    JNIEnv env;
+    jlong engine = Java_com_example_adblocker_filter_AdblockEngine_nativeCreateEngine(&env, nullptr);
+    _jdirectBuffer ruleBuf(&rules[0], (jlong)rules.size());
+    Clock::time_point t0 = Clock::now();
+    Java_com_example_adblocker_filter_AdblockEngine_nativeLoadRulesBuffer(&env, nullptr, engine, &ruleBuf,
+                                                                          (jint)rules.size());
+    double loadMs = seconds_since(t0) * 1e3;
+    jlongArray stats = Java_com_example_adblocker_filter_AdblockEngine_nativeGetStats(&env, nullptr, engine);
+
+    std::vector<_jstring> jurl, jsource, jtype;
+    for (const UrlCase& u : urls) {
+        jurl.emplace_back(u.url);
+        jsource.emplace_back(u.source);
+        jtype.emplace_back(u.type);
+    }
+    size_t blocked = 0;
+    for (size_t i = 0; i < urls.size(); ++i) {
+        blocked += Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlock(&env, nullptr, engine, &jurl[i],
+                                                                                     &jsource[i], &jtype[i]);
+    }
+    double minSec = o.quick ? 0.1 : 0.5;
+    double callNs = ns_per_op(urls.size(), minSec, [&](size_t i) {
+        return (uint64_t)Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlock(
+            &env, nullptr, engine, &jurl[i], &jsource[i], &jtype[i]);
+    });
+
+    // the same corpus as one packed batch
+    std::vector<uint8_t> packed;
+    for (const UrlCase& u : urls) {
+        for (const std::string* f : {&u.url, &u.source, &u.type}) {
+            uint32_t n = (uint32_t)f->size();
+            uint8_t len[4] = {(uint8_t)(n >> 24), (uint8_t)(n >> 16), (uint8_t)(n >> 8), (uint8_t)n};
+            packed.insert(packed.end(), len, len + 4);
+            packed.insert(packed.end(), f->begin(), f->end());
+        }
+    }
+    std::vector<uint8_t> bits((urls.size() + 7) / 8);
+    _jdirectBuffer items(packed.data(), (jlong)packed.size()), verdicts(bits.data(), (jlong)bits.size());
+    double batchNs = ns_per_op(1, minSec, [&](size_t) {
+        return (uint64_t)Java_com_example_adblocker_filter_AdblockEngine_nativeShouldBlockPacked(
+            &env, nullptr, engine, &items, (jint)urls.size(), &verdicts);
+    }) / (double)urls.size();
+
+    Result r("should_block");
+    r.add("corpus", o.urlsPath.empty() ? "generated" : o.urlsPath);
+    r.add("rule_bytes", (double)rules.size());
+    r.add("urls", (double)urls.size());
+    r.add("load_ms", loadMs);
+    if (stats) r.add("rule_memory_bytes", (double)stats->items[8]);
+    r.add("blocked_pct", 100.0 * (double)blocked / (double)urls.size());
+    r.add("call_ns", callNs);
+    r.add("packed_ns_per_url", batchNs);
+    out.push_back(r);
+    delete stats;
+    Java_com_example_adblocker_filter_AdblockEngine_nativeRelease(&env, nullptr, engine);
+}
+
+// --- blocklist_load ---
+
+std::string temp_dir() {
+    char tmpl[] = "/tmp/native_bench.XXXXXX";
+    const char* d = mkdtemp(tmpl);
+    return d ? d : "/tmp";
+}
+
+void remove_tree(const std::string& dir, const std::vector<std::string>& files) {
+    for (const std::string& f : files) unlink((dir + "/" + f).c_str());
+    rmdir(dir.c_str());
+}
+
+size_t file_size(const std::string& path) {
+    struct stat st{};
+    return stat(path.c_str(), &st) == 0 ? (size_t)st.st_size : 0;
+}
+
+// A hosts-style list of `n` names; returns them too when `names` is given.
+bool write_host_list(const std::string& path, size_t n, uint64_t seed, std::vector<std::string>* names) {
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::mt19937_64 rng(seed);
+    fputs("# generated\n", f);
+    for (size_t i = 0; i < n; ++i) {
+        std::string d = random_domain(rng);
+        if (i % 4 == 0) fprintf(f, "0.0.0.0 %s\n", d.c_str());
+        else fprintf(f, "%s\n", d.c_str());
+        if (names) names->push_back(std::move(d));
+    }
+    return fclose(f) == 0;
+}
+
+void bench_blocklist_load(const Options& o, std::vector<Result>& out) {
+    std::vector<size_t> sizes = {100000, 1000000};
+    if (o.quick) sizes.pop_back();
+    std::string dir = temp_dir();
+    std::string text = dir + "/hosts.txt", bin = text + ".bin";
+    for (size_t n : sizes) {
+        if (!write_host_list(text, n, n, nullptr)) continue;
+        Clock::time_point t0 = Clock::now();
+        bool ok = blocklist_compile(text, bin);
+        double compileMs = seconds_since(t0) * 1e3;
+        size_t entries = 0;
+        double mapUs = ns_per_op(1, 0.05, [&](size_t) {
+            DomainIndex idx = blocklist_map(bin);
+            entries = idx.size();
+            return (uint64_t)idx.node_count();
+        }) / 1e3;
+        // the proxies' path: text list with an up-to-date compiled copy
+        double loadUs = ns_per_op(1, 0.05, [&](size_t) { return (uint64_t)blocklist_load(text).size(); }) / 1e3;
+        // first lookups after mapping touch cold pages
+        double firstLookupUs = ns_per_op(1, 0.05, [&](size_t) {
+            DomainIndex idx = blocklist_map(bin);
+            return (uint64_t)idx.match("www.example.com");
+        }) / 1e3 - mapUs;
+
+        Result r("blocklist_load");
+        r.add("entries", (double)entries);
+        r.add("compiled", ok ? 1.0 : 0.0);
+        r.add("text_bytes", (double)file_size(text));
+        r.add("bin_bytes", (double)file_size(bin));
+        r.add("compile_ms", compileMs);
+        r.add("map_us", mapUs);
+        r.add("load_us", loadUs);
+        r.add("first_lookup_us", std::max(0.0, firstLookupUs));
+        out.push_back(r);
+    }
+    remove_tree(dir, {"hosts.txt", "hosts.txt.bin"});
+}
+
+// --- metrics ---
+
+void bench_metrics(const Options& o, std::vector<Result>& out) {
+    double minSec = o.quick ? 0.05 : 0.3;
+    double addNs = ns_per_op(1000, minSec, [](size_t) {
+        metric_add(Metric::DnsQueries);
+        return 0;
+    });
+    double recordNs = ns_per_op(1000, minSec, [](size_t i) {
+        metric_record(Latency::DnsUpstreamRtt, 100 + i);
+        return 0;
+    });
+
+    // every thread counts into its own shard; the sum has to come out exact
+    MetricsSnapshot before, after;
+    metrics_snapshot(&before);
+    const int threads = std::max(2, o.clients);
+    const uint64_t perThread = o.quick ? 200000 : 2000000;
+    Clock::time_point t0 = Clock::now();
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([perThread] {
+            for (uint64_t i = 0; i < perThread; ++i) metric_add(Metric::ProxyBytesUp, 3);
+        });
+    }
+    for (auto& t : pool) t.join();
+    double contendedNs = seconds_since(t0) * 1e9 / (double)perThread;
+    metrics_snapshot(&after);
+    uint64_t counted = after.counters[(size_t)Metric::ProxyBytesUp] - before.counters[(size_t)Metric::ProxyBytesUp];
+
+    Clock::time_point s0 = Clock::now();
+    for (int i = 0; i < 100; ++i) metrics_snapshot(&after);
+    double snapshotUs = seconds_since(s0) * 1e6 / 100;
+
+    Result r("metrics");
+    r.add("add_ns", addNs);
+    r.add("record_ns", recordNs);
+    r.add("threads", (double)threads);
+    r.add("threaded_add_ns", contendedNs);
+    r.add("exact", counted == 3 * perThread * (uint64_t)threads ? 1.0 : 0.0);
+    r.add("snapshot_us", snapshotUs);
+    out.push_back(r);
+}
+
+// --- event_log ---
+
+void bench_event_log(const Options& o, std::vector<Result>& out) {
+    double minSec = o.quick ? 0.05 : 0.3;
+    std::mt19937_64 rng(5);
+    std::vector<std::string> names;
+    for (int i = 0; i < 1000; ++i) names.push_back(std::string(pick(rng, kWords)) + "." + random_domain(rng));
+    double internNs = ns_per_op(names.size(), minSec, [&](size_t i) { return (uint64_t)event_host_id(names[i]); });
+    double recordNs = ns_per_op(names.size(), minSec, [&](size_t i) {
+        event_log(EventComponent::DnsProxy, EventKind::Dns, names[i], EventVerdict::Blocked, names[i]);
+        return 0;
+    });
+    std::vector<EventRecord> buf(4096);
+    uint64_t lost = 0;
+    while (event_log_drain(buf.data(), buf.size(), &lost) > 0) {}
+    for (size_t i = 0; i < kEventRingSize; ++i) event_log_record(EventComponent::Tun, EventKind::Tls, 1, EventVerdict::Allowed);
+    Clock::time_point t0 = Clock::now();
+    size_t drained = event_log_drain(buf.data(), buf.size(), &lost);
+    double drainNs = seconds_since(t0) * 1e9 / (double)std::max<size_t>(drained, 1);
+
+    Result r("event_log");
+    r.add("intern_ns", internNs);
+    r.add("record_ns", recordNs);
+    r.add("drain_ns_per_event", drainNs);
+    r.add("drained", (double)drained);
+    out.push_back(r);
+}
+
+// --- load tests ---
+
+// A port nothing listens on right now, for the proxies (they take a number).
+int free_port(int type) {
+    int fd = socket(AF_INET, type, 0);
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(a);
+    int port = 0;
+    if (bind(fd, (sockaddr*)&a, sizeof(a)) == 0 && getsockname(fd, (sockaddr*)&a, &len) == 0) port = ntohs(a.sin_port);
+    close(fd);
+    return port;
+}
+
+int bound_socket(int type, int* port) {
+    int fd = socket(AF_INET, type | SOCK_CLOEXEC, 0);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(a);
+    if (bind(fd, (sockaddr*)&a, sizeof(a)) != 0 || getsockname(fd, (sockaddr*)&a, &len) != 0) {
+        close(fd);
+        return -1;
+    }
+    *port = ntohs(a.sin_port);
+    return fd;
+}
+
+sockaddr_in loopback(int port) {
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    a.sin_port = htons((uint16_t)port);
+    return a;
+}
+
+struct Latencies {
+    std::vector<uint32_t> us;
+    uint64_t errors = 0;
+
+    void merge(const Latencies& o) {
+        us.insert(us.end(), o.us.begin(), o.us.end());
+        errors += o.errors;
+    }
+    double percentile(double p) {
+        if (us.empty()) return 0;
+        size_t k = std::min(us.size() - 1, (size_t)(p / 100.0 * (double)us.size()));
+        std::nth_element(us.begin(), us.begin() + (long)k, us.end());
+        return us[k];
+    }
+};
+
+// Turns the query in `buf` into an answer with one A record, in place; `buf`
+// needs 16 bytes of room past the question. Returns the length or 0.
+size_t fake_answer(uint8_t* buf, size_t n) {
+    if (n < 12) return 0;
+    size_t qend = dns_skip_name(buf, n, 12);
+    if (qend == 0 || qend + 4 > n) return 0;
+    qend += 4;
+    buf[2] |= 0x80;  // QR
+    buf[3] = 0x80;   // RA, NOERROR
+    buf[6] = 0;
+    buf[7] = 1;  // ANCOUNT
+    buf[8] = buf[9] = buf[10] = buf[11] = 0;
+    static const uint8_t kAnswer[] = {0xc0, 0x0c, 0, 1, 0, 1, 0, 0, 0x01, 0x2c, 0, 4, 192, 0, 2, 1};
+    memcpy(buf + qend, kAnswer, sizeof(kAnswer));
+    return qend + sizeof(kAnswer);
+}
+
+// Fake upstream resolver: answers every query with one A record.
+class FakeDnsUpstream {
+public:
+    bool start() {
+        fd_ = bound_socket(SOCK_DGRAM, &port_);
+        if (fd_ < 0) return false;
+        timeval tv{0, 100000};
+        setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        thread_ = std::thread([this] { run(); });
+        return true;
+    }
+    void stop() {
+        running_ = false;
+        if (thread_.joinable()) thread_.join();
+        if (fd_ >= 0) close(fd_);
+    }
+    int port() const { return port_; }
+
+private:
+    void run() {
+        uint8_t buf[1500];
+        while (running_) {
+            sockaddr_storage from{};
+            socklen_t fromLen = sizeof(from);
+            ssize_t n = recvfrom(fd_, buf, sizeof(buf) - 16, 0, (sockaddr*)&from, &fromLen);
+            size_t len = n > 0 ? fake_answer(buf, (size_t)n) : 0;
+            if (len) sendto(fd_, buf, len, 0, (sockaddr*)&from, fromLen);
+        }
+    }
+
+    int fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{true};
+    std::thread thread_;
+};
+
+// One client socket keeping `window` queries in flight for `seconds`.
+// names(i) gives the i-th name this client asks for.
+template <typename Names>
+Latencies dns_client(int proxyPort, double seconds, int window, Names names) {
+    Latencies lat;
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in to = loopback(proxyPort);
+    if (connect(fd, (sockaddr*)&to, sizeof(to)) != 0) {
+        lat.errors++;
+        close(fd);
+        return lat;
+    }
+    std::vector<Clock::time_point> sent(65536);
+    std::vector<bool> pending(65536, false);
+    uint16_t nextId = 1;
+    uint64_t seq = 0;
+    int inFlight = 0;
+    auto send_one = [&] {
+        std::vector<uint8_t> q = dns_query(nextId, names(seq++), kDnsTypeA);
+        if (send(fd, q.data(), q.size(), 0) == (ssize_t)q.size()) {
+            sent[nextId] = Clock::now();
+            pending[nextId] = true;
+            ++inFlight;
+        } else {
+            lat.errors++;
+        }
+        ++nextId;
+    };
+    Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    uint8_t buf[1500];
+    while (Clock::now() < end) {
+        while (inFlight < window) send_one();
+        pollfd p{fd, POLLIN, 0};
+        if (poll(&p, 1, 500) <= 0) {
+            // lost answers: forget them and refill the window
+            lat.errors += (uint64_t)inFlight;
+            std::fill(pending.begin(), pending.end(), false);
+            inFlight = 0;
+            continue;
+        }
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 12) continue;
+        uint16_t id = (uint16_t)(buf[0] << 8 | buf[1]);
+        if (!pending[id]) continue;
+        pending[id] = false;
+        --inFlight;
+        lat.us.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sent[id]).count());
+    }
+    close(fd);
+    return lat;
+}
+
+void bench_dns_udp(const Options& o, std::vector<Result>& out) {
+    std::string dir = temp_dir();
+    std::string list = dir + "/blocked.txt";
+    std::vector<std::string> blockedNames;
+    if (!write_host_list(list, 10000, 1, &blockedNames)) return;
+    FakeDnsUpstream upstream;
+    if (!upstream.start()) {
+        fprintf(stderr, "dns_udp: cannot start upstream\n");
+        return;
+    }
+    JNIEnv env;
+    int port = free_port(SOCK_DGRAM);
+    _jstring jlist(list), jupstream("127.0.0.1:" + std::to_string(upstream.port()));
+    int workers = std::max(1, std::min(4, (int)std::thread::hardware_concurrency() / 2));
+    jlong proxy = Java_com_example_adblocker_native_NativeProxy_startDnsProxy(&env, nullptr, port, &jlist, &jupstream,
+                                                                              workers);
+    if (!proxy) {
+        fprintf(stderr, "dns_udp: proxy did not start\n");
+        upstream.stop();
+        remove_tree(dir, {"blocked.txt", "blocked.txt.bin"});
+        return;
+    }
+
+    struct Phase {
+        const char* name;
+        int kind;  // 0 unique names (upstream), 1 repeated names (cache), 2 blocked
+    } phases[] = {{"upstream", 0}, {"cached", 1}, {"blocked", 2}};
+    double seconds = o.quick ? std::min(o.duration, 0.5) : o.duration;
+    for (const Phase& ph : phases) {
+        std::vector<Latencies> per(o.clients);
+        std::vector<std::thread> threads;
+        for (int c = 0; c < o.clients; ++c) {
+            threads.emplace_back([&, c] {
+                std::mt19937_64 rng(c + 1);
+                per[c] = dns_client(port, seconds, 16, [&, c](uint64_t i) -> std::string {
+                    switch (ph.kind) {
+                    case 0: return "q" + std::to_string(i) + "-" + std::to_string(c) + ".bench.test";
+                    case 1: return "cached" + std::to_string(i % 256) + ".bench.test";
+                    default: return blockedNames[rng() % blockedNames.size()];
+                    }
+                });
+            });
+        }
+        for (auto& t : threads) t.join();
+        Latencies all;
+        for (const Latencies& l : per) all.merge(l);
+        Result r("dns_udp");
+        r.add("phase", ph.name);
+        r.add("workers", (double)workers);
+        r.add("clients", (double)o.clients);
+        r.add("qps", (double)all.us.size() / seconds);
+        r.add("p50_us", all.percentile(50));
+        r.add("p99_us", all.percentile(99));
+        r.add("lost", (double)all.errors);
+        out.push_back(r);
+    }
+    Java_com_example_adblocker_native_NativeProxy_stopDnsProxy(&env, nullptr, proxy);
+    upstream.stop();
+    remove_tree(dir, {"blocked.txt", "blocked.txt.bin"});
+}
+
+#if defined(ADBLOCK_DNS_TLS)
+// Stand-in encrypted resolver with a self-signed certificate for "localhost"
+// and 127.0.0.1. It serves DoT and DoH on one port (a POST tells them apart)
+// with a thread per connection. DoT answers to each batch of queries read
+// together go out in reverse order, so the forwarder has to match them by
+// ID. After `closeAfter` answers (0 = never) it closes the connection, as
+// real servers do, which exercises reconnecting, resuming and resending.
+class FakeTlsUpstream {
+public:
+    ~FakeTlsUpstream() {
+        stop();
+        SSL_CTX_free(ctx_);
+        X509_free(cert_);
+        EVP_PKEY_free(key_);
+    }
+
+    bool start(uint32_t closeAfter) {
+        closeAfter_ = closeAfter;
+        if (!make_cert()) return false;
+        ctx_ = SSL_CTX_new(TLS_server_method());
+        if (!ctx_ || SSL_CTX_use_certificate(ctx_, cert_) != 1 || SSL_CTX_use_PrivateKey(ctx_, key_) != 1) return false;
+        fd_ = bound_socket(SOCK_STREAM, &port_);
+        if (fd_ < 0 || listen(fd_, 64) != 0) return false;
+        acceptor_ = std::thread([this] { accept_loop(); });
+        return true;
+    }
+    void stop() {
+        if (!running_.exchange(false)) return;
+        if (acceptor_.joinable()) acceptor_.join();
+        {
+            std::lock_guard<std::mutex> lk(lock_);
+            for (int fd : conns_) shutdown(fd, SHUT_RDWR);
+        }
+        for (auto& t : threads_) t.join();
+        if (fd_ >= 0) close(fd_);
+    }
+    int port() const { return port_; }
+    uint64_t closes() const { return closes_.load(); }
+
+    bool write_cert(const std::string& path) const {
+        FILE* f = fopen(path.c_str(), "w");
+        if (!f) return false;
+        bool ok = PEM_write_X509(f, cert_) == 1;
+        fclose(f);
+        return ok;
+    }
+
+private:
+    bool make_cert() {
+        EVP_PKEY_CTX* kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        if (!kctx || EVP_PKEY_keygen_init(kctx) != 1
+            || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) != 1
+            || EVP_PKEY_keygen(kctx, &key_) != 1) {
+            EVP_PKEY_CTX_free(kctx);
+            return false;
+        }
+        EVP_PKEY_CTX_free(kctx);
+        cert_ = X509_new();
+        X509_set_version(cert_, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert_), (long)(std::random_device()() & 0x7fffffff));
+        X509_gmtime_adj(X509_getm_notBefore(cert_), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(cert_), 86400);
+        X509_set_pubkey(cert_, key_);
+        X509_NAME* name = X509_get_subject_name(cert_);
+        // a distinct subject per server, or the trust store would mix them up
+        std::string cn = "bench resolver " + std::to_string(std::random_device()());
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)cn.c_str(), -1, -1, 0);
+        X509_set_issuer_name(cert_, name);
+        X509V3_CTX v3;
+        X509V3_set_ctx_nodb(&v3);
+        X509V3_set_ctx(&v3, cert_, cert_, nullptr, nullptr, 0);
+        X509_EXTENSION* san = X509V3_EXT_conf_nid(nullptr, &v3, NID_subject_alt_name, "DNS:localhost,IP:127.0.0.1");
+        if (!san) return false;
+        X509_add_ext(cert_, san, -1);
+        X509_EXTENSION_free(san);
+        return X509_sign(cert_, key_, EVP_sha256()) > 0;
+    }
+
+    void accept_loop() {
+        while (running_) {
+            pollfd p{fd_, POLLIN, 0};
+            if (poll(&p, 1, 100) <= 0) continue;
+            int c = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0) continue;
+            int one = 1;
+            setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            std::lock_guard<std::mutex> lk(lock_);
+            conns_.push_back(c);
+            threads_.emplace_back([this, c] { serve(c); });
+        }
+    }
+
+    void serve(int fd) {
+        SSL* ssl = SSL_new(ctx_);
+        SSL_set_fd(ssl, fd);
+        std::vector<uint8_t> in, out;
+        uint8_t buf[16384];
+        uint64_t answered = 0;
+        bool open = SSL_accept(ssl) == 1;
+        while (open && running_) {
+            int n = SSL_read(ssl, buf, sizeof(buf));
+            if (n <= 0) break;
+            in.insert(in.end(), buf, buf + n);
+            size_t pos = 0;
+            std::vector<std::vector<uint8_t>> batch;
+            bool http = !in.empty() && in[0] == 'P';
+            while (true) {
+                size_t start, len;
+                if (http) {
+                    auto head = std::search(in.begin() + (long)pos, in.end(), "\r\n\r\n", "\r\n\r\n" + 4);
+                    if (head == in.end()) break;
+                    std::string h(in.begin() + (long)pos, head);
+                    size_t cl = h.find("Content-Length: ");
+                    if (cl == std::string::npos) break;
+                    len = (size_t)atoi(h.c_str() + cl + 16);
+                    start = (size_t)(head - in.begin()) + 4;
+                } else {
+                    if (in.size() - pos < 2) break;
+                    len = (size_t)in[pos] << 8 | in[pos + 1];
+                    start = pos + 2;
+                }
+                if (in.size() - start < len) break;
+                std::vector<uint8_t> a(in.begin() + (long)start, in.begin() + (long)(start + len));
+                a.resize(len + 16);
+                a.resize(fake_answer(a.data(), len));
+                batch.push_back(std::move(a));
+                pos = start + len;
+            }
+            in.erase(in.begin(), in.begin() + (long)pos);
+            if (!http) std::reverse(batch.begin(), batch.end());
+            out.clear();
+            for (const auto& a : batch) {
+                bool last = closeAfter_ && ++answered >= closeAfter_;
+                if (http) {
+                    char head[160];
+                    int h = snprintf(head, sizeof(head),
+                                     "HTTP/1.1 200 OK\r\nContent-Type: application/dns-message\r\n"
+                                     "Content-Length: %zu\r\n%s\r\n", a.size(), last ? "Connection: close\r\n" : "");
+                    out.insert(out.end(), head, head + h);
+                } else {
+                    out.push_back((uint8_t)(a.size() >> 8));
+                    out.push_back((uint8_t)a.size());
+                }
+                out.insert(out.end(), a.begin(), a.end());
+                if (last) {
+                    open = false;
+                    break;
+                }
+            }
+            if (!out.empty() && SSL_write(ssl, out.data(), (int)out.size()) <= 0) break;
+        }
+        if (!open && answered) closes_++;
+        SSL_free(ssl);
+        std::lock_guard<std::mutex> lk(lock_);
+        conns_.erase(std::find(conns_.begin(), conns_.end(), fd));
+        close(fd);
+    }
+
+    SSL_CTX* ctx_ = nullptr;
+    X509* cert_ = nullptr;
+    EVP_PKEY* key_ = nullptr;
+    uint32_t closeAfter_ = 0;
+    int fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{true};
+    std::atomic<uint64_t> closes_{0};
+    std::thread acceptor_;
+    std::mutex lock_;
+    std::vector<int> conns_;
+    std::vector<std::thread> threads_;
+};
+
+// getDnsUpstreamStats(), field by field; empty if the upstream is unknown.
+std::vector<jlong> upstream_stats(const std::string& spec) {
+    JNIEnv env;
+    _jstring jspec(spec);
+    jlongArray a = Java_com_example_adblocker_native_NativeProxy_getDnsUpstreamStats(&env, nullptr, &jspec);
+    if (!a) return {};
+    std::vector<jlong> v = a->items;
+    delete a;
+    return v;
+}
+enum {
+    kUpQueries = 1, kUpAnswers, kUpTimeouts, kUpFailed, kUpConnects, kUpResumed, kUpOpen, kUpSrtt, kUpRttVar, kUpMinRtt,
+    kUpDropped
+};
+
+// Latency of one query from a fresh client socket, or -1 if unanswered.
+double one_query_us(int proxyPort, const std::string& name, int* rcode = nullptr) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    sockaddr_in to = loopback(proxyPort);
+    std::vector<uint8_t> q = dns_query(0x4242, name, kDnsTypeA);
+    Clock::time_point t0 = Clock::now();
+    double us = -1;
+    uint8_t buf[1500];
+    pollfd p{fd, POLLIN, 0};
+    if (sendto(fd, q.data(), q.size(), 0, (sockaddr*)&to, sizeof(to)) == (ssize_t)q.size() && poll(&p, 1, 3000) > 0
+        && recv(fd, buf, sizeof(buf), 0) >= 12) {
+        us = (double)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count();
+        if (rcode) *rcode = buf[3] & 0x0f;
+    }
+    close(fd);
+    return us;
+}
+
+// The DNS proxy forwarding to the stand-in over DoT and DoH: a query right
+// after start (the pool should already be connected), then load with the
+// server closing connections every 2000 answers, then a server whose
+// certificate is not trusted, which must get no connection at all and a
+// SERVFAIL (rcode 2) for the query.
+void bench_dns_tls(const Options& o, std::vector<Result>& out) {
+    std::string dir = temp_dir();
+    std::string list = dir + "/blocked.txt";
+    if (!write_host_list(list, 1000, 1, nullptr)) return;
+    JNIEnv env;
+    _jstring jlist(list);
+    int workers = std::max(1, std::min(4, (int)std::thread::hardware_concurrency() / 2));
+    double seconds = o.quick ? std::min(o.duration, 0.5) : o.duration;
+    const char* const kSchemes[] = {"tls://", "https://", "untrusted"};
+    for (const char* scheme : kSchemes) {
+        bool trusted = strcmp(scheme, "untrusted") != 0;
+        FakeTlsUpstream server;
+        if (!server.start(2000)) {
+            fprintf(stderr, "dns_tls: cannot start the stand-in resolver\n");
+            break;
+        }
+        std::string cert = dir + "/resolver.pem";
+        if (trusted) {
+            _jstring jcert(cert);
+            if (!server.write_cert(cert)
+                || !Java_com_example_adblocker_native_NativeProxy_setDnsTrustAnchors(&env, nullptr, &jcert)) {
+                fprintf(stderr, "dns_tls: cannot trust the stand-in certificate\n");
+                break;
+            }
+        }
+        std::string spec = (trusted ? scheme : "tls://") + std::string("127.0.0.1:") + std::to_string(server.port())
+                         + (strcmp(scheme, "https://") == 0 ? "/dns-query" : "") + "#localhost";
+        int port = free_port(SOCK_DGRAM);
+        _jstring jspec(spec);
+        jlong proxy = Java_com_example_adblocker_native_NativeProxy_startDnsProxy(&env, nullptr, port, &jlist, &jspec,
+                                                                                  workers);
+        if (!proxy) {
+            fprintf(stderr, "dns_tls: proxy did not start for %s\n", spec.c_str());
+            break;
+        }
+        // the pool connects at startup; give the handshakes a moment
+        Clock::time_point t0 = Clock::now();
+        while (seconds_since(t0) < (trusted ? 2.0 : 0.5)) {
+            std::vector<jlong> st = upstream_stats(spec);
+            if (trusted && st.size() > kUpOpen && st[kUpOpen] >= workers) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        Result r("dns_tls");
+        r.add("transport", trusted ? std::string(scheme, strlen(scheme) - 3) : "untrusted");
+        r.add("workers", (double)workers);
+        if (trusted) {
+            r.add("first_query_us", one_query_us(port, "first.bench.test"));
+            std::vector<Latencies> per(o.clients);
+            std::vector<std::thread> threads;
+            for (int c = 0; c < o.clients; ++c) {
+                threads.emplace_back([&, c] {
+                    per[c] = dns_client(port, seconds, 16, [c](uint64_t i) {
+                        return "q" + std::to_string(i) + "-" + std::to_string(c) + ".bench.test";
+                    });
+                });
+            }
+            for (auto& t : threads) t.join();
+            Latencies all;
+            for (const Latencies& l : per) all.merge(l);
+            r.add("clients", (double)o.clients);
+            r.add("qps", (double)all.us.size() / seconds);
+            r.add("p50_us", all.percentile(50));
+            r.add("p99_us", all.percentile(99));
+            r.add("lost", (double)all.errors);
+            r.add("server_closes", (double)server.closes());
+        } else {
+            int rcode = -1;
+            r.add("first_query_us", one_query_us(port, "first.bench.test", &rcode));
+            r.add("first_rcode", (double)rcode);
+        }
+        std::vector<jlong> st = upstream_stats(spec);
+        if (st.size() > kUpDropped) {
+            r.add("connects", (double)st[kUpConnects]);
+            r.add("resumed", (double)st[kUpResumed]);
+            r.add("upstream_failed", (double)st[kUpFailed]);
+            r.add("upstream_dropped", (double)st[kUpDropped]);
+            r.add("upstream_timeouts", (double)st[kUpTimeouts]);
+            r.add("srtt_us", (double)st[kUpSrtt]);
+        }
+        out.push_back(r);
+        Java_com_example_adblocker_native_NativeProxy_stopDnsProxy(&env, nullptr, proxy);
+        server.stop();
+    }
+    remove_tree(dir, {"blocked.txt", "blocked.txt.bin", "resolver.pem"});
+}
+#endif
+
+// Fake origin server: reads a request head, answers 200 and closes.
+class FakeHttpUpstream {
+public:
+    bool start(int threads) {
+        fd_ = bound_socket(SOCK_STREAM, &port_);
+        if (fd_ < 0 || listen(fd_, 1024) != 0) return false;
+        for (int i = 0; i < threads; ++i) threads_.emplace_back([this] { run(); });
+        return true;
+    }
+    void stop() {
+        running_ = false;
+        shutdown(fd_, SHUT_RDWR);
+        for (auto& t : threads_) t.join();
+        close(fd_);
+    }
+    int port() const { return port_; }
+
+private:
+    void run() {
+        static const char kResponse[] = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\nok";
+        char buf[4096];
+        while (running_) {
+            int c = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (c < 0) continue;
+            std::string head;
+            while (head.find("\r\n\r\n") == std::string::npos) {
+                ssize_t n = recv(c, buf, sizeof(buf), 0);
+                if (n <= 0) break;
+                head.append(buf, (size_t)n);
+            }
+            send(c, kResponse, sizeof(kResponse) - 1, MSG_NOSIGNAL);
+            close(c);
+        }
+    }
+
+    int fd_ = -1;
+    int port_ = 0;
+    std::atomic<bool> running_{true};
+    std::vector<std::thread> threads_;
+};
+
+// New connection per request through the proxy, for `seconds`.
+Latencies http_client(int proxyPort, int upstreamPort, double seconds) {
+    Latencies lat;
+    std::string req = "GET /bench HTTP/1.1\r\nHost: 127.0.0.1:" + std::to_string(upstreamPort)
+        + "\r\nUser-Agent: native_bench\r\nConnection: close\r\n\r\n";
+    sockaddr_in to = loopback(proxyPort);
+    Clock::time_point end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    char buf[4096];
+    while (Clock::now() < end) {
+        Clock::time_point t0 = Clock::now();
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        timeval tv{2, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        // reset on close: no TIME_WAIT, so a long run does not run out of ports
+        linger lg{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        bool ok = connect(fd, (sockaddr*)&to, sizeof(to)) == 0
+            && send(fd, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size();
+        std::string resp;
+        while (ok) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) break;
+            resp.append(buf, (size_t)n);
+        }
+        close(fd);
+        if (ok && resp.compare(0, 12, "HTTP/1.1 200") == 0) {
+            lat.us.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - t0).count());
+        } else {
+            lat.errors++;
+        }
+    }
+    return lat;
+}
+
+void bench_http_proxy(const Options& o, std::vector<Result>& out) {
+    std::string dir = temp_dir();
+    std::string list = dir + "/blocked.txt";
+    if (!write_host_list(list, 10000, 2, nullptr)) return;
+    FakeHttpUpstream upstream;
+    if (!upstream.start(4)) {
+        fprintf(stderr, "http_proxy: cannot start upstream\n");
+        return;
+    }
+    JNIEnv env;
+    int port = free_port(SOCK_STREAM);
+    _jstring jlist(list);
+    jlong proxy = Java_com_example_adblocker_native_NativeProxy_startAdvancedProxy(&env, nullptr, port, &jlist);
+    if (!proxy) {
+        fprintf(stderr, "http_proxy: proxy did not start\n");
+        upstream.stop();
+        remove_tree(dir, {"blocked.txt", "blocked.txt.bin"});
+        return;
+    }
+    double seconds = o.quick ? std::min(o.duration, 0.5) : o.duration;
+    std::vector<Latencies> per(o.clients);
+    std::vector<std::thread> threads;
+    for (int c = 0; c < o.clients; ++c) {
+        threads.emplace_back([&, c] { per[c] = http_client(port, upstream.port(), seconds); });
+    }
+    for (auto& t : threads) t.join();
+    Latencies all;
+    for (const Latencies& l : per) all.merge(l);
+    Result r("http_proxy");
+    r.add("clients", (double)o.clients);
+    r.add("conns_per_sec", (double)all.us.size() / seconds);
+    r.add("p50_us", all.percentile(50));
+    r.add("p99_us", all.percentile(99));
+    r.add("errors", (double)all.errors);
+    out.push_back(r);
+
+    Java_com_example_adblocker_native_NativeProxy_stopAdvancedProxy(&env, nullptr, proxy);
+    upstream.stop();
+    remove_tree(dir, {"blocked.txt", "blocked.txt.bin"});
+}
+
+struct Bench {
+    const char* name;
+    void (*run)(const Options&, std::vector<Result>&);
+};
+
+const Bench kBenches[] = {
+    {"domain_lookup", bench_domain_lookup}, {"tls_sni", bench_tls_sni},
+    {"dns_codec", bench_dns_codec},         {"should_block", bench_should_block},
+    {"blocklist_load", bench_blocklist_load}, {"metrics", bench_metrics},
+    {"event_log", bench_event_log},         {"dns_udp", bench_dns_udp},
+#if defined(ADBLOCK_DNS_TLS)
+    {"dns_tls", bench_dns_tls},
+#endif
+    {"http_proxy", bench_http_proxy},
+};
+
+void usage() {
+    fprintf(stderr, "usage: native_bench [--quick] [--only name,...] [--duration seconds] [--clients n]\n"
+                    "                    [--rules file] [--urls file] [--out file]\nbenchmarks:");
+    for (const Bench& b : kBenches) fprintf(stderr, " %s", b.name);
+    fputc('\n', stderr);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    // the stand-in servers write to sockets their client may already have
+    // closed; as on Android, where the runtime ignores SIGPIPE, that must
+    // be an EPIPE and not the end of the process
+    signal(SIGPIPE, SIG_IGN);
+    Options o;
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--quick") {
+            o.quick = true;
+        } else if (a == "--only" && hasValue) {
+            std::string list = argv[++i];
+            for (size_t p = 0; p <= list.size();) {
+                size_t c = list.find(',', p);
+                if (c == std::string::npos) c = list.size();
+                if (c > p) o.only.push_back(list.substr(p, c - p));
+                p = c + 1;
+            }
+        } else if (a == "--duration" && hasValue) {
+            o.duration = atof(argv[++i]);
+        } else if (a == "--clients" && hasValue) {
+            o.clients = std::max(1, atoi(argv[++i]));
+        } else if (a == "--rules" && hasValue) {
+            o.rulesPath = argv[++i];
+        } else if (a == "--urls" && hasValue) {
+            o.urlsPath = argv[++i];
+        } else if (a == "--out" && hasValue) {
+            o.outPath = argv[++i];
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (o.duration <= 0) o.duration = 2.0;
+
+    std::vector<Result> results;
+    for (const Bench& b : kBenches) {
+        if (!o.only.empty() && std::find(o.only.begin(), o.only.end(), b.name) == o.only.end()) continue;
+        fprintf(stderr, "running %s...\n", b.name);
+        b.run(o, results);
+    }
+
+    std::string json = "{\n  \"schema\": 1,\n  \"quick\": ";
+    json += o.quick ? "true" : "false";
+    json += ",\n  \"cpus\": " + std::to_string(std::thread::hardware_concurrency()) + ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) json += "    " + results[i].json() + (i + 1 < results.size() ? ",\n" : "\n");
+    json += "  ]\n}\n";
+    FILE* f = o.outPath.empty() ? stdout : fopen(o.outPath.c_str(), "w");
+    if (!f) {
+        fprintf(stderr, "cannot write %s\n", o.outPath.c_str());
+        return 1;
+    }
+    fputs(json.c_str(), f);
+    if (f != stdout) fclose(f);
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include "blocklist_file.h"
+
+#include <android/log.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOG_TAG "blocklist_file"
+#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+struct Mapping {
+    void* addr = MAP_FAILED;
+    size_t len = 0;
+    ~Mapping() {
+        if (addr != MAP_FAILED) munmap(addr, len);
+    }
+};
+
+uint64_t align8(uint64_t v) { return (v + 7) & ~uint64_t(7); }
+
+bool write_all(int fd, const void* data, size_t len) {
+    const char* p = static_cast<const char*>(data);
+    while (len > 0) {
+        ssize_t w = write(fd, p, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        len -= (size_t)w;
+    }
+    return true;
+}
+
+bool write_padding(int fd, uint64_t from, uint64_t to) {
+    static const char zeros[8] = {};
+    return to == from || write_all(fd, zeros, (size_t)(to - from));
+}
+
+// Pulls the domain out of one text line: "domain", "0.0.0.0 domain", "domain # note".
+bool extract_domain(const char* p, size_t n, const char** out, size_t* outLen) {
+    size_t b = 0;
+    while (b < n && (p[b] == ' ' || p[b] == '\t')) ++b;
+    if (b == n || p[b] == '#' || p[b] == '!') return false;
+    size_t e = b;
+    while (e < n && p[e] != ' ' && p[e] != '\t' && p[e] != '#' && p[e] != '\r') ++e;
+    // hosts-file style: skip the address column
+    size_t nb = e;
+    while (nb < n && (p[nb] == ' ' || p[nb] == '\t')) ++nb;
+    if (nb < n && p[nb] != '#' && p[nb] != '\r') {
+        size_t ne = nb;
+        while (ne < n && p[ne] != ' ' && p[ne] != '\t' && p[ne] != '#' && p[ne] != '\r') ++ne;
+        b = nb;
+        e = ne;
+    }
+    *out = p + b;
+    *outLen = e - b;
+    return e > b;
+}
+
+} // namespace
+
+bool blocklist_write(const DomainIndex& index, const std::string& path) {
+    BlocklistHeader h{};
+    memcpy(h.magic, kBlocklistMagic, sizeof(h.magic));
+    h.version = kBlocklistVersion;
+    h.header_size = sizeof(BlocklistHeader);
+    h.entry_count = index.size();
+    h.nodes_off = align8(sizeof(BlocklistHeader));
+    h.node_count = index.node_count();
+    h.pool_off = align8(h.nodes_off + h.node_count * sizeof(DomainIndex::Node));
+    h.pool_size = index.pool_size();
+    h.filter_off = align8(h.pool_off + h.pool_size);
+    h.filter = index.filter().params();
+    h.file_size = h.filter_off + index.filter().memory_bytes();
+
+    // unique temp name: the reload thread and the JNI compile call may race
+    static std::atomic<uint32_t> seq{0};
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(seq.fetch_add(1));
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        ALOGE("cannot create %s: %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = write_all(fd, &h, sizeof(h))
+        && write_padding(fd, sizeof(h), h.nodes_off)
+        && write_all(fd, index.nodes(), h.node_count * sizeof(DomainIndex::Node))
+        && write_padding(fd, h.nodes_off + h.node_count * sizeof(DomainIndex::Node), h.pool_off)
+        && write_all(fd, index.pool(), h.pool_size)
+        && write_padding(fd, h.pool_off + h.pool_size, h.filter_off)
+        && write_all(fd, index.filter().fingerprints(), index.filter().memory_bytes());
+    ok = (fsync(fd) == 0) && ok;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        ALOGE("failed to write compiled blocklist %s", path.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Streams a text list through the builder straight from the page cache.
+static bool parse_text_list(const std::string& textPath, DomainIndexBuilder& builder) {
+    int fd = open(textPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGI("Blocklist file not found: %s", textPath.c_str());
+        return false;
+    }
+    struct stat st{};
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if (st.st_size > 0) {
+        void* addr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(addr, (size_t)st.st_size, MADV_SEQUENTIAL);
+        const char* p = static_cast<const char*>(addr);
+        const char* end = p + st.st_size;
+        while (p < end) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', (size_t)(end - p)));
+            if (!nl) nl = end;
+            const char* d;
+            size_t dlen;
+            if (extract_domain(p, (size_t)(nl - p), &d, &dlen)) builder.add(std::string_view(d, dlen));
+            p = nl + 1;
+        }
+        munmap(addr, (size_t)st.st_size);
+    }
+    close(fd);
+    return true;
+}
+
+bool blocklist_compile(const std::string& textPath, const std::string& outPath) {
+    DomainIndexBuilder builder;
+    if (!parse_text_list(textPath, builder)) return false;
+    DomainIndex index = builder.build();
+    if (!blocklist_write(index, outPath)) return false;
+    ALOGI("Compiled %zu domains into %s (%zu bytes, prefilter %zu bytes, %u false positives per million)",
+          index.size(), outPath.c_str(), index.memory_bytes(), index.filter().memory_bytes(),
+          index.filter().fp_per_million());
+    return true;
+}
+
+DomainIndex blocklist_map(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return DomainIndex();
+    struct stat st{};
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(BlocklistHeader)) {
+        close(fd);
+        return DomainIndex();
+    }
+    auto m = std::make_shared<Mapping>();
+    m->len = (size_t)st.st_size;
+    m->addr = mmap(nullptr, m->len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m->addr == MAP_FAILED) {
+        ALOGE("mmap failed for %s", path.c_str());
+        return DomainIndex();
+    }
+
+    const char* base = static_cast<const char*>(m->addr);
+    BlocklistHeader h;
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, kBlocklistMagic, sizeof(h.magic)) != 0 || h.version != kBlocklistVersion
+        || h.header_size != sizeof(BlocklistHeader) || h.file_size != m->len
+        || h.nodes_off % 8 != 0 || h.node_count == 0
+        || h.node_count > (m->len - h.nodes_off) / sizeof(DomainIndex::Node)
+        || h.pool_off < h.nodes_off + h.node_count * sizeof(DomainIndex::Node)
+        || h.pool_off > m->len || h.pool_size > m->len - h.pool_off
+        || h.filter_off % 8 != 0 || h.filter_off < h.pool_off + h.pool_size || h.filter_off > m->len) {
+        ALOGE("Invalid compiled blocklist %s", path.c_str());
+        return DomainIndex();
+    }
+    auto nodes = reinterpret_cast<const DomainIndex::Node*>(base + h.nodes_off);
+    const char* pool = base + h.pool_off;
+    // A filter that does not fit is left out; lookups then go to the trie.
+    FuseFilter filter;
+    if (h.filter.array_length > 0) {
+        filter = FuseFilter::from_view(h.filter, reinterpret_cast<const uint16_t*>(base + h.filter_off),
+                                       (m->len - h.filter_off) / sizeof(uint16_t));
+    }
+    return DomainIndex::from_view(nodes, (size_t)h.node_count, pool, (size_t)h.pool_size,
+                                  (size_t)h.entry_count, std::move(filter), std::move(m));
+}
+
+DomainIndex blocklist_load(const std::string& path) {
+    char magic[sizeof(kBlocklistMagic)] = {};
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ALOGI("Blocklist file not found: %s", path.c_str());
+        return DomainIndex();
+    }
+    ssize_t n = read(fd, magic, sizeof(magic));
+    close(fd);
+    if (n == (ssize_t)sizeof(magic) && memcmp(magic, kBlocklistMagic, sizeof(magic)) == 0) {
+        return blocklist_map(path);
+    }
+
+    std::string bin = path + ".bin";
+    struct stat ts{}, bs{};
+    bool stale = stat(path.c_str(), &ts) != 0 || stat(bin.c_str(), &bs) != 0
+        || bs.st_mtime < ts.st_mtime
+        || (bs.st_mtime == ts.st_mtime && bs.st_mtim.tv_nsec < ts.st_mtim.tv_nsec);
+    if (!stale) {
+        DomainIndex mapped = blocklist_map(bin);
+        if (mapped.node_count() > 0) return mapped;
+    }
+    DomainIndexBuilder builder;
+    if (!parse_text_list(path, builder)) return DomainIndex();
+    DomainIndex index = builder.build();
+    // If the compiled copy cannot be written (read-only dir), serve from memory.
+    if (!blocklist_write(index, bin)) return index;
+    ALOGI("Compiled %zu domains into %s", index.size(), bin.c_str());
+    DomainIndex mapped = blocklist_map(bin);
+    return mapped.node_count() > 0 ? std::move(mapped) : std::move(index);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "domain_index.h"
+
+// Compiled blocklist file.
+//
+// The text list exported by FilterManager is compiled once into a flat binary
+// image of a DomainIndex that every native component maps read-only, so
+// startup does no parsing and all readers share the same page-cache pages.
+//
+// Layout (host byte order, every section 8-byte aligned):
+//   BlocklistHeader
+//   DomainIndex::Node[node_count]   trie nodes, children sorted by label hash
+//   char[pool_size]                 deduplicated label bytes
+//   uint16_t[filter.array_length]   FuseFilter fingerprints (none if empty)
+struct BlocklistHeader {
+    char magic[8];          // "ADBLKIDX"
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t file_size;
+    uint64_t entry_count;
+    uint64_t nodes_off;
+    uint64_t node_count;
+    uint64_t pool_off;
+    uint64_t pool_size;
+    uint64_t filter_off;
+    FuseFilter::Params filter;
+};
+
+static constexpr char kBlocklistMagic[8] = {'A', 'D', 'B', 'L', 'K', 'I', 'D', 'X'};
+static constexpr uint32_t kBlocklistVersion = 2;
+
+// Writes `index` to `path` atomically (temp file + rename).
+bool blocklist_write(const DomainIndex& index, const std::string& path);
+
+// Parses a text list (one domain per line, '#'/'!' comments, hosts-file
+// lines allowed) and writes the compiled image to outPath.
+bool blocklist_compile(const std::string& textPath, const std::string& outPath);
+
+// Maps a compiled image read-only. Returns an empty index on any error.
+DomainIndex blocklist_map(const std::string& path);
+
+// Opens `path` whether it is compiled or text. Text lists are compiled to
+// "<path>.bin" first when that file is missing or older than the text.
+DomainIndex blocklist_load(const std::string& path);
@@ -0,0 +1,210 @@
+#include "blocklist_snapshot.h"
+
+#include <android/log.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <sys/stat.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "blocklist_file.h"
+#include "metrics.h"
+
+#define LOG_TAG "blocklist_snapshot"
+#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr int kMaxReaderSlots = 128;
+constexpr auto kPollInterval = std::chrono::seconds(2);
+
+struct alignas(64) ReaderSlot {
+    std::atomic<uint64_t> epoch{0};  // 0 = not inside a read section
+    std::atomic<bool> used{false};
+};
+
+ReaderSlot g_slots[kMaxReaderSlots];
+// Readers that could not get a slot (more than kMaxReaderSlots live threads)
+// are counted here; reclamation waits until this drops to zero.
+std::atomic<uint32_t> g_overflowReaders{0};
+std::atomic<uint64_t> g_epoch{1};
+
+const BlocklistSnapshot g_emptySnapshot{};
+std::atomic<const BlocklistSnapshot*> g_current{&g_emptySnapshot};
+
+// Writer side only.
+std::mutex g_writeMutex;
+std::vector<std::pair<const BlocklistSnapshot*, uint64_t>> g_retired;
+uint64_t g_generation = 0;
+
+struct ThreadSlot {
+    int index = -1;
+    int depth = 0;
+    ThreadSlot() {
+        for (int i = 0; i < kMaxReaderSlots; ++i) {
+            bool expected = false;
+            if (!g_slots[i].used.load(std::memory_order_relaxed)
+                && g_slots[i].used.compare_exchange_strong(expected, true)) {
+                index = i;
+                break;
+            }
+        }
+    }
+    ~ThreadSlot() {
+        if (index >= 0) {
+            g_slots[index].epoch.store(0);
+            g_slots[index].used.store(false);
+        }
+    }
+};
+
+thread_local ThreadSlot t_slot;
+
+// Frees retired snapshots that no reader can still hold. Caller holds g_writeMutex.
+void reclaim_locked() {
+    if (g_retired.empty() || g_overflowReaders.load() != 0) return;
+    uint64_t oldest = UINT64_MAX;
+    for (const auto& s : g_slots) {
+        uint64_t e = s.epoch.load();
+        if (e != 0 && e < oldest) oldest = e;
+    }
+    auto it = g_retired.begin();
+    while (it != g_retired.end()) {
+        if (it->second <= oldest) {
+            delete it->first;
+            it = g_retired.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+struct FileStamp {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = -1;
+    int64_t mtimeNs = 0;
+    bool operator==(const FileStamp& o) const {
+        return dev == o.dev && ino == o.ino && size == o.size && mtimeNs == o.mtimeNs;
+    }
+};
+
+FileStamp stamp_of(const std::string& path) {
+    FileStamp fs;
+    struct stat st{};
+    if (stat(path.c_str(), &st) == 0) {
+        fs.dev = st.st_dev;
+        fs.ino = st.st_ino;
+        fs.size = st.st_size;
+        fs.mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+    return fs;
+}
+
+std::mutex g_watchMutex;
+std::condition_variable g_watchCv;
+std::thread* g_watchThread = nullptr;
+int g_watchRefs = 0;
+bool g_watchStop = false;
+std::string g_watchPath;
+FileStamp g_watchStamp;
+
+void reload(const std::string& path, const FileStamp& stamp) {
+    uint64_t t0 = metrics_now_us();
+    DomainIndex domains = blocklist_load(path);
+    size_t count = domains.size();
+    blocklist_publish(std::move(domains));
+    uint64_t us = metrics_now_us() - t0;
+    metric_add(Metric::BlocklistReloads);
+    metric_record(Latency::BlocklistReload, us);
+    ALOGI("Reloaded %zu blocked domains from %s in %llu ms", count, path.c_str(), (unsigned long long)(us / 1000));
+    std::lock_guard<std::mutex> lk(g_watchMutex);
+    g_watchStamp = stamp;
+}
+
+void watch_loop() {
+    std::unique_lock<std::mutex> lk(g_watchMutex);
+    while (!g_watchStop) {
+        g_watchCv.wait_for(lk, kPollInterval, [] { return g_watchStop; });
+        if (g_watchStop) break;
+        std::string path = g_watchPath;
+        FileStamp known = g_watchStamp;
+        lk.unlock();
+        FileStamp now = stamp_of(path);
+        if (!(now == known)) {
+            reload(path, now);
+        } else {
+            std::lock_guard<std::mutex> wl(g_writeMutex);
+            reclaim_locked();
+        }
+        lk.lock();
+    }
+}
+
+} // namespace
+
+BlocklistReader::BlocklistReader() : slot_(t_slot.index) {
+    if (slot_ < 0) {
+        g_overflowReaders.fetch_add(1);
+    } else if (t_slot.depth++ == 0) {
+        g_slots[slot_].epoch.store(g_epoch.load());
+    }
+    snap_ = g_current.load();
+}
+
+BlocklistReader::~BlocklistReader() {
+    if (slot_ < 0) {
+        g_overflowReaders.fetch_sub(1);
+    } else if (--t_slot.depth == 0) {
+        g_slots[slot_].epoch.store(0, std::memory_order_release);
+    }
+}
+
+bool blocklist_match(std::string_view host, std::string_view* entry) {
+    BlocklistReader r;
+    return r.snapshot().domains.match(host, entry);
+}
+
+void blocklist_publish(DomainIndex domains) {
+    std::lock_guard<std::mutex> lk(g_writeMutex);
+    auto* next = new BlocklistSnapshot{std::move(domains), ++g_generation};
+    const BlocklistSnapshot* prev = g_current.exchange(next);
+    // Readers that entered before this bump may still hold `prev`.
+    uint64_t retireEpoch = g_epoch.fetch_add(1) + 1;
+    if (prev != &g_emptySnapshot) g_retired.emplace_back(prev, retireEpoch);
+    reclaim_locked();
+}
+
+void blocklist_watch_start(const std::string& path) {
+    FileStamp stamp = stamp_of(path);
+    bool load;
+    {
+        std::lock_guard<std::mutex> lk(g_watchMutex);
+        load = path != g_watchPath || !(stamp == g_watchStamp) || g_current.load() == &g_emptySnapshot;
+        g_watchPath = path;
+        if (g_watchRefs++ == 0) {
+            g_watchStop = false;
+            g_watchThread = new std::thread(watch_loop);
+        }
+    }
+    if (load) reload(path, stamp);
+}
+
+void blocklist_watch_stop() {
+    std::thread* t = nullptr;
+    {
+        std::lock_guard<std::mutex> lk(g_watchMutex);
+        if (g_watchRefs == 0 || --g_watchRefs > 0) return;
+        g_watchStop = true;
+        t = g_watchThread;
+        g_watchThread = nullptr;
+    }
+    g_watchCv.notify_all();
+    if (t) {
+        if (t->joinable()) t->join();
+        delete t;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "domain_index.h"
+
+// Process-wide blocklist shared by the DNS and HTTP proxies.
+//
+// The current list is an immutable snapshot published through an atomic
+// pointer. Readers take no locks: they announce the epoch they entered in a
+// per-thread slot, load the pointer and use the snapshot until they leave.
+// A replaced snapshot is freed only once every active reader has moved past
+// the epoch in which it was retired, so readers never see a half-built or
+// freed list. Reloads happen on a background thread that stats the file and
+// only rebuilds when its inode, size or mtime changed.
+struct BlocklistSnapshot {
+    DomainIndex domains;
+    uint64_t generation = 0;
+};
+
+// RAII read-side critical section. Cheap (two atomic stores), reentrant.
+class BlocklistReader {
+public:
+    BlocklistReader();
+    ~BlocklistReader();
+    BlocklistReader(const BlocklistReader&) = delete;
+    BlocklistReader& operator=(const BlocklistReader&) = delete;
+
+    // Never null; an empty snapshot is returned before the first load.
+    const BlocklistSnapshot& snapshot() const { return *snap_; }
+
+private:
+    const BlocklistSnapshot* snap_;
+    int slot_;
+};
+
+// One-shot lookup against the current snapshot; see DomainIndex::match.
+bool blocklist_match(std::string_view host, std::string_view* entry = nullptr);
+
+// Replaces the current snapshot; the old one is reclaimed once unreferenced.
+void blocklist_publish(DomainIndex domains);
+
+// Loads `path` synchronously, then keeps a background thread watching it.
+// Calls are reference counted so several components can share one watcher.
+void blocklist_watch_start(const std::string& path);
+void blocklist_watch_stop();
@@ -0,0 +1,247 @@
+#include "dns_cache.h"
+#include "dns_codec.h"
+
+#include <algorithm>
+#include <cstring>
+
+static inline uint16_t rd16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline uint32_t rd32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+static inline void wr16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static inline void wr32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+// Last byte of the cache key. An answer carries an OPT record only if the
+// query had one, and DNSSEC records only for DO or CD, so it is served only
+// to clients that asked the same way.
+enum : uint8_t { kKeyEdns = 1, kKeyDo = 2, kKeyCd = 4 };
+
+// Key bits from the header and the OPT record among the records after the
+// question at `pos`; `udpSize` gets the largest answer the sender takes over
+// UDP. Returns -1 if the records are malformed.
+static int edns_bits(const uint8_t* msg, size_t len, size_t pos, size_t* udpSize) {
+    int bits = (msg[3] & 0x10) ? kKeyCd : 0;
+    *udpSize = 512;
+    uint32_t rest = (uint32_t)rd16(msg + 6) + rd16(msg + 8) + rd16(msg + 10);
+    for (uint32_t i = 0; i < rest; ++i) {
+        size_t owner = pos;
+        pos = dns_skip_name(msg, len, pos);
+        if (!pos || pos + 10 > len) return -1;
+        if (rd16(msg + pos) == kDnsTypeOPT && msg[owner] == 0) {
+            bits |= kKeyEdns | ((msg[pos + 6] & 0x80) ? kKeyDo : 0);
+            *udpSize = std::max<size_t>(512, rd16(msg + pos + 2));
+        }
+        pos += 10 + rd16(msg + pos + 8);
+        if (pos > len) return -1;
+    }
+    return bits;
+}
+
+// Builds the cache key (case-folded question name, qtype, qclass, EDNS bits)
+// and returns the offset just past the question, or 0 if the message is
+// unusable.
+static size_t question_key(const uint8_t* msg, size_t len, uint8_t* key, size_t* keyLen, size_t* udpSize) {
+    if (len < 12 || rd16(msg + 4) != 1) return 0;
+    size_t pos = 12, k = 0;
+    while (true) {
+        if (pos >= len) return 0;
+        uint8_t l = msg[pos];
+        if (l > 63 || pos + 1 + l > len) return 0;  // no compression in questions
+        if (k + 1 + l > 255) return 0;              // names are at most 255 bytes
+        key[k++] = l;
+        for (size_t i = 0; i < l; ++i) {
+            uint8_t c = msg[pos + 1 + i];
+            key[k++] = (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 32) : c;
+        }
+        pos += 1 + l;
+        if (l == 0) break;
+    }
+    if (pos + 4 > len) return 0;
+    memcpy(key + k, msg + pos, 4);
+    int bits = edns_bits(msg, len, pos + 4, udpSize);
+    if (bits < 0) return 0;
+    key[k + 4] = (uint8_t)bits;
+    *keyLen = k + 5;
+    return pos + 4;
+}
+
+static uint64_t hash_bytes(const uint8_t* p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) h = (h ^ p[i]) * 1099511628211ULL;
+    return h;
+}
+
+size_t DnsCache::lookup(const uint8_t* query, size_t len, uint8_t* out, size_t outCap, uint64_t nowMs) {
+    uint8_t key[kMaxKeyLen];
+    size_t keyLen, udpSize;
+    size_t qend = question_key(query, len, key, &keyLen, &udpSize);
+    if (!qend) return 0;
+    auto it = index_.find(hash_bytes(key, keyLen));
+    if (it == index_.end()) {
+        ++stats_.misses;
+        return 0;
+    }
+    Entry& e = entries_[it->second];
+    if (e.key.size() != keyLen || memcmp(e.key.data(), key, keyLen) != 0) {
+        ++stats_.misses;
+        return 0;
+    }
+    if (nowMs >= e.expiresMs) {
+        evict(it->second);
+        ++stats_.misses;
+        return 0;
+    }
+    if (e.resp.size() > udpSize) {
+        // too big for the client: header and question with TC set, so it
+        // asks again over TCP, plus an OPT record if it sent one
+        bool edns = key[keyLen - 1] & kKeyEdns;
+        if (qend + 11 > outCap) {
+            ++stats_.misses;
+            return 0;
+        }
+        memcpy(out, query, qend);
+        out[2] = (uint8_t)(0x80 | 0x02 | (query[2] & 0x79));  // QR, TC, opcode and RD echoed
+        out[3] = e.resp[3];                                   // RA, AD, CD and rcode as cached
+        wr16(out + 6, 0);
+        wr16(out + 8, 0);
+        wr16(out + 10, edns ? 1 : 0);
+        size_t pos = qend;
+        if (edns) {
+            out[pos++] = 0;  // root owner
+            wr16(out + pos, kDnsTypeOPT);
+            wr16(out + pos + 2, 1232);
+            wr32(out + pos + 4, (uint32_t)(key[keyLen - 1] & kKeyDo) << 14);  // DO echoed
+            wr16(out + pos + 8, 0);
+            pos += 10;
+        }
+        e.ref = true;
+        ++stats_.hits;
+        return pos;
+    }
+    if (e.resp.size() > outCap || qend > e.resp.size()) {
+        ++stats_.misses;
+        return 0;
+    }
+
+    memcpy(out, e.resp.data(), e.resp.size());
+    out[0] = query[0];
+    out[1] = query[1];
+    out[2] = (uint8_t)((out[2] & ~0x01) | (query[2] & 0x01));  // echo RD
+    memcpy(out + 12, query + 12, qend - 12);                     // keep the client's 0x20 casing
+    uint32_t aged = (uint32_t)((nowMs - e.storedMs) / 1000);
+    for (uint8_t i = 0; i < e.ttlCount; ++i) {
+        uint8_t* p = out + e.ttlOffs[i];
+        uint32_t ttl = rd32(p);
+        wr32(p, ttl > aged ? ttl - aged : 0);
+    }
+    e.ref = true;
+    ++stats_.hits;
+    return e.resp.size();
+}
+
+void DnsCache::insert(const uint8_t* resp, size_t len, uint64_t nowMs) {
+    if (len < 12 || len > 65535) return;
+    uint8_t flags = resp[2];
+    uint8_t rcode = resp[3] & 0x0F;
+    if (!(flags & 0x80) || (flags & 0x02) || (flags & 0x78) != 0) return;  // QR set, not truncated, QUERY
+    if (rcode != 0 && rcode != 3) return;
+
+    uint8_t key[kMaxKeyLen];
+    size_t keyLen, udpSize;
+    size_t pos = question_key(resp, len, key, &keyLen, &udpSize);
+    if (!pos) return;
+
+    uint16_t an = rd16(resp + 6), ns = rd16(resp + 8), ar = rd16(resp + 10);
+    uint16_t ttlOffs[kMaxTtlFields];
+    size_t ttlCount = 0;
+    uint32_t minAnswer = UINT32_MAX, negative = UINT32_MAX;
+    for (uint32_t i = 0; i < (uint32_t)an + ns + ar; ++i) {
+        pos = dns_skip_name(resp, len, pos);
+        if (!pos || pos + 10 > len) return;
+        uint16_t type = rd16(resp + pos);
+        uint32_t ttl = rd32(resp + pos + 4);
+        size_t rdlen = rd16(resp + pos + 8);
+        size_t rdata = pos + 10;
+        if (rdata + rdlen > len) return;
+        if (type != kDnsTypeOPT) {  // the OPT pseudo-record's "TTL" holds EDNS flags
+            if (ttlCount == kMaxTtlFields) return;
+            ttlOffs[ttlCount++] = (uint16_t)(pos + 4);
+        }
+        if (i < an) {
+            minAnswer = std::min(minAnswer, ttl);
+        } else if (i < (uint32_t)an + ns && type == kDnsTypeSOA && rdlen >= 22) {
+            // SOA MINIMUM is the last field of the RDATA
+            negative = std::min(ttl, rd32(resp + rdata + rdlen - 4));
+        }
+        pos = rdata + rdlen;
+    }
+
+    uint32_t ttl;
+    if (rcode == 0 && an > 0) ttl = minAnswer;
+    else if (negative != UINT32_MAX) ttl = negative;  // NXDOMAIN / NODATA per RFC 2308
+    else return;
+    ttl = std::min(ttl, kMaxTtlSeconds);
+    if (ttl == 0) return;
+
+    uint64_t h = hash_bytes(key, keyLen);
+    auto it = index_.find(h);
+    if (it != index_.end()) evict(it->second);
+
+    size_t need = sizeof(Entry) + keyLen + len + 32;
+    if (need > budget_) return;
+    uint32_t idx = take_slot(need);
+    Entry& e = entries_[idx];
+    e.hash = h;
+    e.storedMs = nowMs;
+    e.expiresMs = nowMs + (uint64_t)ttl * 1000;
+    e.key.assign(key, key + keyLen);
+    e.resp.assign(resp, resp + len);
+    memcpy(e.ttlOffs, ttlOffs, ttlCount * sizeof(uint16_t));
+    e.ttlCount = (uint8_t)ttlCount;
+    e.ref = false;
+    e.used = true;
+    index_[h] = idx;
+    bytes_ += cost(e);
+    ++stats_.inserts;
+    stats_.entries = index_.size();
+    stats_.bytes = bytes_;
+}
+
+void DnsCache::evict(uint32_t idx) {
+    Entry& e = entries_[idx];
+    if (!e.used) return;
+    bytes_ -= cost(e);
+    index_.erase(e.hash);
+    e.used = false;
+    e.key.clear();
+    e.resp.clear();
+    free_.push_back(idx);
+    stats_.entries = index_.size();
+    stats_.bytes = bytes_;
+}
+
+uint32_t DnsCache::take_slot(size_t need) {
+    // CLOCK: sweep, giving referenced entries a second chance
+    size_t sweeps = 0;
+    while (bytes_ + need > budget_ && !entries_.empty() && sweeps < entries_.size() * 2) {
+        hand_ = (hand_ + 1) % entries_.size();
+        ++sweeps;
+        Entry& e = entries_[hand_];
+        if (!e.used) continue;
+        if (e.ref) {
+            e.ref = false;
+            continue;
+        }
+        evict((uint32_t)hand_);
+        ++stats_.evictions;
+    }
+    if (!free_.empty()) {
+        uint32_t idx = free_.back();
+        free_.pop_back();
+        return idx;
+    }
+    entries_.emplace_back();
+    return (uint32_t)(entries_.size() - 1);
+}
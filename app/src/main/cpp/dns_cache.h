@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// In-process DNS answer cache keyed by (qname, qtype, qclass) and whether the
+// query had EDNS, DO and CD, since the answer's OPT and DNSSEC records
+// follow those.
+//
+// Positive answers live for the smallest TTL in the answer section;
+// NXDOMAIN and NODATA answers are cached for min(SOA TTL, SOA MINIMUM) as in
+// RFC 2308 and are not cached at all without an SOA. The cache holds at most
+// `budgetBytes` of entries and evicts with the CLOCK algorithm. A hit is
+// served by copying the stored answer, patching in the client's ID and
+// question bytes and aging every TTL by the time spent in the cache. An
+// answer larger than the client takes over UDP (512 bytes, or its EDNS size)
+// is replaced by a truncated one with TC set.
+class DnsCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t inserts = 0;
+        uint64_t evictions = 0;
+        uint64_t entries = 0;
+        uint64_t bytes = 0;
+    };
+
+    static constexpr size_t kDefaultBudget = 1 << 20;
+    static constexpr uint32_t kMaxTtlSeconds = 86400;
+
+    explicit DnsCache(size_t budgetBytes = kDefaultBudget) : budget_(budgetBytes) {}
+
+    // On a hit writes the answer for `query` to `out` and returns its length, else 0.
+    size_t lookup(const uint8_t* query, size_t len, uint8_t* out, size_t outCap, uint64_t nowMs);
+
+    // Stores a cacheable upstream answer. Anything else is ignored.
+    void insert(const uint8_t* resp, size_t len, uint64_t nowMs);
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    static constexpr size_t kMaxTtlFields = 32;
+    static constexpr size_t kMaxKeyLen = 261;
+
+    struct Entry {
+        uint64_t hash = 0;
+        uint64_t storedMs = 0;
+        uint64_t expiresMs = 0;
+        std::vector<uint8_t> key;
+        std::vector<uint8_t> resp;
+        uint16_t ttlOffs[kMaxTtlFields];
+        uint8_t ttlCount = 0;
+        bool ref = false;
+        bool used = false;
+    };
+
+    void evict(uint32_t idx);
+    size_t cost(const Entry& e) const { return sizeof(Entry) + e.key.size() + e.resp.size() + 32; }
+    uint32_t take_slot(size_t need);
+
+    size_t budget_;
+    size_t bytes_ = 0;
+    size_t hand_ = 0;
+    std::vector<Entry> entries_;
+    std::vector<uint32_t> free_;
+    std::unordered_map<uint64_t, uint32_t> index_;
+    Stats stats_;
+};
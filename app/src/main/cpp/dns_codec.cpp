@@ -0,0 +1,188 @@
+#include "dns_codec.h"
+
+#include <cstring>
+
+static inline uint16_t rd16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline void wr16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static inline void wr32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+size_t dns_skip_name(const uint8_t* msg, size_t len, size_t pos) {
+    while (pos < len) {
+        uint8_t l = msg[pos];
+        if ((l & 0xC0) == 0xC0) return pos + 2 <= len ? pos + 2 : 0;
+        if (l > 63) return 0;
+        pos += 1 + l;
+        if (l == 0) return pos <= len ? pos : 0;
+    }
+    return 0;
+}
+
+// Decodes the name at `pos` into q->name, following compression pointers.
+// Returns the offset after the name as it appears at `pos`, or 0.
+static size_t read_name(const uint8_t* msg, size_t len, size_t pos, DnsQuery* q) {
+    size_t end = 0;
+    int jumps = 0;
+    q->nameLen = 0;
+    q->labelCount = 0;
+    while (true) {
+        if (pos >= len) return 0;
+        uint8_t l = msg[pos];
+        if ((l & 0xC0) == 0xC0) {
+            if (pos + 2 > len || ++jumps > 16) return 0;
+            if (!end) end = pos + 2;
+            pos = ((size_t)(l & 0x3F) << 8) | msg[pos + 1];
+            q->questionCompressed = true;
+            continue;
+        }
+        if (l > 63) return 0;
+        if (l == 0) {
+            if (!end) end = pos + 1;
+            break;
+        }
+        if (pos + 1 + l > len || q->labelCount == DnsQuery::kMaxLabels) return 0;
+        size_t need = q->nameLen + (q->labelCount ? 1 : 0) + l;
+        if (need > DnsQuery::kMaxName) return 0;
+        if (q->labelCount) q->name[q->nameLen++] = '.';
+        q->labelOff[q->labelCount] = (uint8_t)q->nameLen;
+        q->labelLen[q->labelCount] = l;
+        q->labelCount++;
+        for (size_t i = 0; i < l; ++i) {
+            char c = (char)msg[pos + 1 + i];
+            q->name[q->nameLen++] = (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+        }
+        pos += 1 + l;
+    }
+    q->name[q->nameLen] = '\0';
+    return end;
+}
+
+bool dns_parse_query(const uint8_t* msg, size_t len, DnsQuery* q) {
+    if (len < 12) return false;
+    q->id = rd16(msg);
+    q->flags = rd16(msg + 2);
+    q->questionCompressed = false;
+    q->hasEdns = false;
+    q->dnssecOk = false;
+    q->ednsUdpSize = 0;
+    if ((q->flags & 0x8000) || ((q->flags >> 11) & 0xF) != 0) return false;  // must be a QUERY
+    if (rd16(msg + 4) != 1) return false;
+
+    size_t pos = read_name(msg, len, 12, q);
+    if (!pos || pos + 4 > len) return false;
+    q->qtype = rd16(msg + pos);
+    q->qclass = rd16(msg + pos + 2);
+    pos += 4;
+    q->questionEnd = pos;
+
+    // look for OPT among the remaining records
+    uint32_t rest = (uint32_t)rd16(msg + 6) + rd16(msg + 8) + rd16(msg + 10);
+    for (uint32_t i = 0; i < rest; ++i) {
+        size_t nameStart = pos;
+        pos = dns_skip_name(msg, len, pos);
+        if (!pos || pos + 10 > len) break;
+        uint16_t type = rd16(msg + pos);
+        size_t rdlen = rd16(msg + pos + 8);
+        if (type == kDnsTypeOPT && msg[nameStart] == 0) {
+            q->hasEdns = true;
+            q->ednsUdpSize = rd16(msg + pos + 2);
+            q->dnssecOk = (msg[pos + 6] & 0x80) != 0;
+        }
+        pos += 10 + rdlen;
+        if (pos > len) break;
+    }
+    return true;
+}
+
+size_t dns_build_servfail(const uint8_t* req, size_t len, uint8_t* out, size_t outCap) {
+    if (len < 12 || (req[2] & 0x80)) return 0;
+    size_t end = 12;
+    if (rd16(req + 4) == 1) {
+        size_t name = dns_skip_name(req, len, 12);
+        if (name && name + 4 <= len) end = name + 4;
+    }
+    if (outCap < end) return 0;
+    memcpy(out, req, end);
+    // QR, opcode and RD echoed, RA set
+    out[2] = (uint8_t)(0x80 | (req[2] & 0x79));
+    out[3] = (uint8_t)(0x80 | kDnsServFail);
+    wr16(out + 4, end > 12 ? 1 : 0);
+    wr16(out + 6, 0);
+    wr16(out + 8, 0);
+    wr16(out + 10, 0);
+    return end;
+}
+
+size_t dns_build_block_response(const uint8_t* req, const DnsQuery& q, DnsBlockPolicy policy,
+                                uint8_t* out, size_t outCap) {
+    bool addr = policy != DnsBlockPolicy::NxDomain && (q.qtype == kDnsTypeA || q.qtype == kDnsTypeAAAA);
+    bool nx = !addr && policy != DnsBlockPolicy::NullIpNoData;
+
+    // header + question + (answer of up to 28 bytes | SOA of 36 bytes) + OPT of 11 bytes
+    size_t qlen = q.questionCompressed ? q.nameLen + 2 + 4 : q.questionEnd - 12;
+    if (outCap < 12 + qlen + 36 + 11) return 0;
+
+    wr16(out, q.id);
+    // QR, opcode 0, RD echoed, RA set
+    out[2] = (uint8_t)(0x80 | ((q.flags >> 8) & 0x01));
+    out[3] = (uint8_t)(0x80 | (nx ? kDnsNxDomain : kDnsNoError));
+    wr16(out + 4, 1);
+    wr16(out + 6, addr ? 1 : 0);
+    wr16(out + 8, addr ? 0 : 1);
+    wr16(out + 10, q.hasEdns ? 1 : 0);
+
+    size_t pos = 12;
+    if (!q.questionCompressed) {
+        memcpy(out + pos, req + 12, qlen);  // keeps the client's casing
+        pos += qlen;
+    } else {
+        for (size_t i = 0; i < q.labelCount; ++i) {
+            out[pos++] = q.labelLen[i];
+            memcpy(out + pos, q.name + q.labelOff[i], q.labelLen[i]);
+            pos += q.labelLen[i];
+        }
+        out[pos++] = 0;
+        wr16(out + pos, q.qtype);
+        wr16(out + pos + 2, q.qclass);
+        pos += 4;
+    }
+
+    // every record below is owned by the question name (pointer to offset 12)
+    out[pos++] = 0xC0;
+    out[pos++] = 0x0C;
+    if (addr) {
+        size_t alen = q.qtype == kDnsTypeA ? 4 : 16;
+        wr16(out + pos, q.qtype);
+        wr16(out + pos + 2, q.qclass);
+        wr32(out + pos + 4, kDnsBlockTtl);
+        wr16(out + pos + 8, (uint16_t)alen);
+        pos += 10;
+        memset(out + pos, 0, alen);
+        pos += alen;
+    } else {
+        wr16(out + pos, kDnsTypeSOA);
+        wr16(out + pos + 2, q.qclass);
+        wr32(out + pos + 4, kDnsBlockTtl);
+        wr16(out + pos + 8, 24);
+        pos += 10;
+        out[pos++] = 0xC0; out[pos++] = 0x0C;  // MNAME
+        out[pos++] = 0xC0; out[pos++] = 0x0C;  // RNAME
+        wr32(out + pos, 1);                    // serial
+        wr32(out + pos + 4, 3600);             // refresh
+        wr32(out + pos + 8, 600);              // retry
+        wr32(out + pos + 12, 86400);           // expire
+        wr32(out + pos + 16, kDnsBlockTtl);    // minimum (negative TTL)
+        pos += 20;
+    }
+
+    if (q.hasEdns) {
+        out[pos++] = 0;                      // root owner
+        wr16(out + pos, kDnsTypeOPT);
+        wr16(out + pos + 2, 1232);           // our UDP payload size
+        wr32(out + pos + 4, 0);              // ext-rcode, version, flags
+        wr16(out + pos + 8, 0);              // no options
+        pos += 10;
+    }
+    return pos;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// DNS wire helpers for the proxy hot path. Nothing here allocates: a query
+// is decoded into a fixed-size struct on the caller's stack and responses
+// are written into a caller-provided buffer.
+
+enum DnsType : uint16_t {
+    kDnsTypeA = 1,
+    kDnsTypeSOA = 6,
+    kDnsTypeAAAA = 28,
+    kDnsTypeOPT = 41,
+};
+
+enum DnsRcode : uint8_t {
+    kDnsNoError = 0,
+    kDnsFormErr = 1,
+    kDnsServFail = 2,
+    kDnsNxDomain = 3,
+};
+
+// What a blocked name resolves to. A and AAAA always get the unspecified
+// address (0.0.0.0 / ::) under the NULL_IP policies so clients fail fast
+// instead of retrying over the other family.
+enum class DnsBlockPolicy : int {
+    NullIpNoData = 0,    // A/AAAA -> unspecified address, other types -> NODATA
+    NullIpNxDomain = 1,  // A/AAAA -> unspecified address, other types -> NXDOMAIN
+    NxDomain = 2,        // every type -> NXDOMAIN
+};
+
+// Current policy as set through setDnsBlockPolicy(); shared by the DNS proxy
+// and the TUN engine.
+DnsBlockPolicy dns_block_policy();
+
+struct DnsQuery {
+    static constexpr size_t kMaxName = 255;
+    static constexpr size_t kMaxLabels = 128;
+
+    uint16_t id = 0;
+    uint16_t flags = 0;
+    uint16_t qtype = 0;
+    uint16_t qclass = 0;
+    size_t questionEnd = 0;  // offset just past the question section
+    bool questionCompressed = false;
+
+    bool hasEdns = false;
+    bool dnssecOk = false;
+    uint16_t ednsUdpSize = 0;
+
+    // Lowercased, dot-separated, no trailing dot; labels index into `name`.
+    char name[kMaxName + 1];
+    size_t nameLen = 0;
+    uint8_t labelCount = 0;
+    uint8_t labelOff[kMaxLabels];
+    uint8_t labelLen[kMaxLabels];
+
+    std::string_view host() const { return std::string_view(name, nameLen); }
+    std::string_view label(size_t i) const { return std::string_view(name + labelOff[i], labelLen[i]); }
+};
+
+// Decodes header, the single question (compression pointers allowed) and an
+// EDNS OPT record if present. Returns false for anything that is not a
+// one-question standard query.
+bool dns_parse_query(const uint8_t* msg, size_t len, DnsQuery* q);
+
+// Writes the answer for a blocked query: question echoed, A/AAAA answered
+// with the unspecified address or a NODATA/NXDOMAIN with a synthetic SOA so
+// clients cache the negative answer, and an OPT record if the query had one.
+// Returns the response length or 0 if `out` is too small.
+size_t dns_build_block_response(const uint8_t* req, const DnsQuery& q, DnsBlockPolicy policy,
+                                uint8_t* out, size_t outCap);
+
+// Writes a SERVFAIL for a query that could not be sent upstream: header and
+// question echoed (the question only if it is a single, well-formed one), no
+// records. Returns 0 for responses and anything shorter than a header.
+size_t dns_build_servfail(const uint8_t* req, size_t len, uint8_t* out, size_t outCap);
+
+// Skips a possibly compressed name; returns the next offset or 0 on error.
+size_t dns_skip_name(const uint8_t* msg, size_t len, size_t pos);
+
+// TTL used for synthesized block answers.
+static constexpr uint32_t kDnsBlockTtl = 60;
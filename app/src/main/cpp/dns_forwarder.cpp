@@ -0,0 +1,490 @@
+#include "dns_forwarder.h"
+
+#include <algorithm>
+#include <android/log.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#if !defined(__ANDROID__)
+#include <sys/random.h>
+#endif
+
+#define LOG_TAG "dns_forwarder"
+#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+static void fill_random(uint8_t* buf, size_t len) {
+#if defined(__ANDROID__)
+    arc4random_buf(buf, len);
+#else
+    while (len > 0) {
+        ssize_t r = getrandom(buf, len, 0);
+        if (r <= 0) continue;
+        buf += r;
+        len -= (size_t)r;
+    }
+#endif
+}
+
+static bool same_address(const sockaddr_storage& a, socklen_t alen, const sockaddr_storage& b) {
+    if (a.ss_family != b.ss_family) return false;
+    if (a.ss_family == AF_INET) {
+        auto x = (const sockaddr_in*)&a;
+        auto y = (const sockaddr_in*)&b;
+        return x->sin_port == y->sin_port && x->sin_addr.s_addr == y->sin_addr.s_addr;
+    }
+    if (a.ss_family == AF_INET6) {
+        auto x = (const sockaddr_in6*)&a;
+        auto y = (const sockaddr_in6*)&b;
+        return x->sin6_port == y->sin6_port && memcmp(&x->sin6_addr, &y->sin6_addr, sizeof(x->sin6_addr)) == 0;
+    }
+    return memcmp(&a, &b, alen) == 0;
+}
+
+DnsForwarder::~DnsForwarder() {
+    for (auto& u : sockets_) {
+        if (!u.conn && u.fd >= 0) close(u.fd);  // a TLS connection closes itself
+    }
+}
+
+bool DnsForwarder::question_hash(const uint8_t* msg, size_t len, uint64_t* out) {
+    if (len < 12 || msg[4] != 0 || msg[5] != 1) return false;  // QDCOUNT must be 1
+    uint64_t h = 1469598103934665603ULL;
+    size_t pos = 12;
+    while (true) {
+        if (pos >= len) return false;
+        uint8_t l = msg[pos++];
+        if (l == 0) break;
+        if (l > 63 || pos + l > len) return false;
+        h = (h ^ l) * 1099511628211ULL;
+        for (size_t i = 0; i < l; ++i) {
+            uint8_t c = msg[pos + i];
+            if (c >= 'A' && c <= 'Z') c = (uint8_t)(c + 32);
+            h = (h ^ c) * 1099511628211ULL;
+        }
+        pos += l;
+    }
+    if (pos + 4 > len) return false;
+    for (size_t i = 0; i < 4; ++i) h = (h ^ msg[pos + i]) * 1099511628211ULL;
+    *out = h;
+    return true;
+}
+
+int DnsForwarder::open_socket() {
+    int fd = socket(upstream_.addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    // connect() makes the kernel pick a random ephemeral port and drop
+    // datagrams from any other source before they reach us
+    if (connect(fd, (const sockaddr*)&upstream_.addr, upstream_.addrLen) != 0) {
+        close(fd);
+        return -1;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool DnsForwarder::init(int epfd, const DnsUpstream& upstream, size_t poolSize) {
+    epfd_ = epfd;
+    upstream_ = upstream;
+    stream_ = upstream.encrypted();
+    poolSize_ = poolSize ? poolSize : stream_ ? 2 : 4;
+    entries_.assign(kMaxPending, Pending{});
+    free_.clear();
+    for (size_t i = kMaxPending; i > 0; --i) free_.push_back((uint32_t)(i - 1));
+    idMap_.assign(65536, 0);
+    if (stream_) {
+        if (!dns_tls_available()) {
+            ALOGE("%s: built without TLS support", upstream.spec.c_str());
+            return false;
+        }
+        // connect now so the first queries find the pool ready; a connection
+        // that fails is retried from expire()
+        uint64_t nowMs = metrics_now_us() / 1000;
+        lastQueryMs_ = nowMs;
+        sockets_.resize(poolSize_);
+        for (Upstream& u : sockets_) {
+            u.conn.reset(new DnsTlsConn());
+            open_stream(u, nowMs);
+        }
+        return true;
+    }
+    for (size_t i = 0; i < poolSize_; ++i) {
+        int fd = open_socket();
+        if (fd < 0) {
+            ALOGE("failed to open upstream socket: %s", strerror(errno));
+            return false;
+        }
+        Upstream u;
+        u.fd = fd;
+        u.key = ++nextKey_;
+        sockets_.push_back(std::move(u));
+    }
+    return true;
+}
+
+uint16_t DnsForwarder::random_id() {
+    if (rndPos_ + 2 > sizeof(rnd_)) {
+        fill_random(rnd_, sizeof(rnd_));
+        rndPos_ = 0;
+    }
+    uint16_t v = (uint16_t)((rnd_[rndPos_] << 8) | rnd_[rndPos_ + 1]);
+    rndPos_ += 2;
+    return v;
+}
+
+bool DnsForwarder::owns(int fd) const {
+    for (const auto& u : sockets_) {
+        if (u.fd == fd) return true;
+    }
+    return false;
+}
+
+DnsForwarder::Upstream* DnsForwarder::find_upstream(int fd) {
+    for (auto& u : sockets_) {
+        if (u.fd == fd) return &u;
+    }
+    return nullptr;
+}
+
+DnsForwarder::Upstream* DnsForwarder::find_key(uint32_t key) {
+    for (auto& u : sockets_) {
+        if (u.key == key) return &u;
+    }
+    return nullptr;
+}
+
+DnsForwarder::Upstream* DnsForwarder::pick_upstream() {
+    // random start so consecutive queries do not share a source port
+    size_t n = sockets_.size();
+    size_t start = n ? random_id() % n : 0;
+    for (size_t i = 0; i < n; ++i) {
+        Upstream& u = sockets_[(start + i) % n];
+        if (!u.retiring) return &u;
+    }
+    return nullptr;
+}
+
+// Ready connections first, then the least loaded; reopens a lost one if none
+// is usable, including one found dead since the last drain() or expire().
+DnsForwarder::Upstream* DnsForwarder::pick_stream(uint64_t nowMs) {
+    Upstream* best = nullptr;
+    for (auto& u : sockets_) {
+        if (!u.conn->usable()) continue;
+        bool ready = u.conn->ready();
+        if (!best || (ready && !best->conn->ready()) || (ready == best->conn->ready() && u.inflight < best->inflight)) {
+            best = &u;
+        }
+    }
+    if (best) return best;
+    for (auto& u : sockets_) {
+        if (u.fd >= 0 && !u.conn->alive()) stream_lost(u, nowMs);
+        if (u.fd >= 0 && u.conn->usable()) return &u;
+        if (u.fd < 0 && nowMs >= u.retryAtMs && open_stream(u, nowMs)) return &u;
+    }
+    return nullptr;
+}
+
+// Where a query from a lost connection goes: one still handshaking, or opened
+// or answering within kLiveMs, the least loaded of them. A ready connection
+// gone quiet may be on its way out as well.
+DnsForwarder::Upstream* DnsForwarder::pick_resend(uint64_t nowMs) {
+    Upstream* best = nullptr;
+    for (auto& u : sockets_) {
+        if (!u.conn->usable()) continue;
+        if (u.conn->ready() && nowMs > std::max(u.openedMs, u.answeredMs) + kLiveMs) continue;
+        if (!best || u.inflight < best->inflight) best = &u;
+    }
+    return best;
+}
+
+bool DnsForwarder::open_stream(Upstream& u, uint64_t nowMs) {
+    // back off while attempts keep failing; an answer resets `failures`
+    uint32_t delay = kReconnectMinMs << std::min<uint32_t>(u.failures, 10);
+    u.retryAtMs = nowMs + std::min(delay, kReconnectMaxMs);
+    u.failures++;
+    u.openedMs = u.lastSendMs = nowMs;
+    u.answeredMs = 0;
+    u.timeouts = 0;
+    u.key = ++nextKey_;
+    if (!u.conn->open(epfd_, upstream_, &tlsSession_)) {
+        u.conn->close();
+        u.fd = -1;
+        return false;
+    }
+    u.fd = u.conn->fd();
+    return true;
+}
+
+bool DnsForwarder::take_id(uint16_t* out) {
+    uint16_t id = random_id();
+    for (int tries = 0; idMap_[id] != 0 && tries < 16; ++tries) id = random_id();
+    if (idMap_[id] != 0) return false;
+    *out = id;
+    return true;
+}
+
+uint32_t DnsForwarder::add_pending(const uint8_t* query, uint64_t qhash, uint16_t id, const Upstream& u,
+                                   uint64_t nowMs) {
+    uint32_t idx = free_.back();
+    free_.pop_back();
+    Pending& p = entries_[idx];
+    p.clientLen = 0;
+    p.qhash = qhash;
+    p.deadlineMs = nowMs + kTimeoutMs;
+    p.sentUs = metrics_now_us();
+    p.hostId = 0;
+    p.gen++;
+    p.clientId = (uint16_t)((query[0] << 8) | query[1]);
+    p.upstreamId = id;
+    p.upstreamKey = u.key;
+    p.used = true;
+    p.resends = 0;
+    p.wireEnd = u.conn ? u.conn->queued() : 0;
+    idMap_[id] = (uint16_t)(idx + 1);
+    if (wheelTick_ == 0) wheelTick_ = nowMs / kTickMs;
+    // the first tick that starts at or after the deadline, so expire() never
+    // visits the entry early and keeps it for another turn of the wheel
+    uint64_t tick = (p.deadlineMs + kTickMs - 1) / kTickMs;
+    wheel_[tick % kWheelSlots].push_back(((uint64_t)p.gen << 32) | idx);
+    upstream_.stats->queries.fetch_add(1, std::memory_order_relaxed);
+    return idx;
+}
+
+// A query that never went upstream.
+void DnsForwarder::dropped(uint32_t hostId) {
+    ++stats_.dropped;
+    upstream_.stats->dropped.fetch_add(1, std::memory_order_relaxed);
+    if (hostId) event_log_record(component_, EventKind::Dns, hostId, EventVerdict::Failed);
+}
+
+bool DnsForwarder::forward(const uint8_t* query, size_t len, const sockaddr_storage& client, socklen_t clientLen,
+                           uint64_t nowMs, uint32_t hostId) {
+    uint64_t qhash;
+    if (len > 4096 || !question_hash(query, len, &qhash) || free_.empty()) {
+        dropped(hostId);
+        return false;
+    }
+    lastQueryMs_ = nowMs;
+    Upstream* u = stream_ ? pick_stream(nowMs) : pick_upstream();
+    uint16_t id;
+    if (!u || !take_id(&id)) {
+        dropped(hostId);
+        return false;
+    }
+
+    uint8_t out[4096];
+    memcpy(out, query, len);
+    out[0] = (uint8_t)(id >> 8);
+    out[1] = (uint8_t)(id & 0xff);
+    bool sent = stream_ ? u->conn->send(out, len) : send(u->fd, out, len, 0) == (ssize_t)len;
+    if (!sent) {
+        dropped(hostId);
+        return false;
+    }
+
+    uint32_t idx = add_pending(query, qhash, id, *u, nowMs);
+    Pending& p = entries_[idx];
+    p.client = client;
+    p.clientLen = clientLen;
+    p.hostId = hostId;
+    u->inflight++;
+    ++stats_.forwarded;
+    metric_add(Metric::DnsUpstreamQueries);
+    if (stream_) {
+        p.wire.assign(out, out + len);
+        u->lastSendMs = nowMs;
+        return true;
+    }
+
+    if (++u->sent >= kRotateAfter) {
+        // replace with a fresh socket (new port); the old one drains first
+        int fd = open_socket();
+        if (fd >= 0) {
+            u->retiring = true;
+            Upstream fresh;
+            fresh.fd = fd;
+            fresh.key = ++nextKey_;
+            sockets_.push_back(std::move(fresh));  // may invalidate u
+        } else {
+            u->sent = 0;
+        }
+    }
+    return true;
+}
+
+// Keeps an idle connection from being closed by the server (or a NAT on the
+// way) with a query for the root NS set, which every resolver has cached.
+bool DnsForwarder::send_probe(Upstream& u, uint64_t nowMs) {
+    static const uint8_t kProbe[] = {0, 0, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 2, 0, 1};
+    uint8_t q[sizeof(kProbe)];
+    uint64_t qhash;
+    uint16_t id;
+    if (free_.empty() || !take_id(&id)) return false;
+    memcpy(q, kProbe, sizeof(q));
+    q[0] = (uint8_t)(id >> 8);
+    q[1] = (uint8_t)(id & 0xff);
+    if (!question_hash(q, sizeof(q), &qhash) || !u.conn->send(q, sizeof(q))) return false;
+    uint32_t idx = add_pending(q, qhash, id, u, nowMs);
+    entries_[idx].wire.assign(q, q + sizeof(q));
+    u.inflight++;
+    u.lastSendMs = nowMs;
+    return true;
+}
+
+// Closes a lost connection and moves its unanswered queries elsewhere (see
+// pick_resend()). A query fails after kMaxResends moves off connections that
+// failed with it on the wire; a server closing the connection, or a query
+// still queued on this end, does not count, and the deadline bounds those.
+void DnsForwarder::stream_lost(Upstream& u, uint64_t nowMs) {
+    uint32_t key = u.key;
+    bool counts = !u.conn->closed_by_peer();
+    uint64_t written = u.conn->written();
+    u.conn->close();
+    u.fd = -1;
+    u.inflight = 0;
+    // a server closing a connection that answered is normal: reconnect at
+    // once, before moving the queries, so they have somewhere to go even when
+    // the server closed the whole pool together
+    if (nowMs < lastQueryMs_ + kWarmMs && (u.failures == 0 || nowMs >= u.retryAtMs)) open_stream(u, nowMs);
+    for (uint32_t i = 0; i < entries_.size(); ++i) {
+        Pending& p = entries_[i];
+        if (!p.used || p.upstreamKey != key) continue;
+        bool charged = counts && p.wireEnd <= written;
+        Upstream* to = !charged || p.resends < kMaxResends ? pick_resend(nowMs) : nullptr;
+        if (to && to->conn->send(p.wire.data(), p.wire.size())) {
+            p.upstreamKey = to->key;
+            p.wireEnd = to->conn->queued();
+            if (charged) p.resends++;
+            to->inflight++;
+            to->lastSendMs = nowMs;
+            ++stats_.resent;
+            continue;
+        }
+        upstream_.stats->failed.fetch_add(1, std::memory_order_relaxed);
+        if (p.hostId) {
+            event_log_record(component_, EventKind::Dns, p.hostId, EventVerdict::Failed, 0,
+                             (uint32_t)(metrics_now_us() - p.sentUs));
+        }
+        release(i);
+    }
+}
+
+// drain() stamps reconnects with the current time while nowMs is from the top
+// of the loop, so the stamps below may be a little ahead of it: compare by
+// adding, never by subtracting.
+void DnsForwarder::maintain_streams(uint64_t nowMs) {
+    bool warm = nowMs < lastQueryMs_ + kWarmMs;
+    for (Upstream& u : sockets_) {
+        if (u.fd < 0) {
+            if (warm && nowMs >= u.retryAtMs) open_stream(u, nowMs);
+            continue;
+        }
+        if (!u.conn->alive()) {
+            stream_lost(u, nowMs);
+        } else if (u.timeouts >= kMaxStreamTimeouts) {
+            ALOGE("%s: %u queries unanswered, reconnecting", upstream_.spec.c_str(), u.timeouts);
+            stream_lost(u, nowMs);
+        } else if (!u.conn->ready() && nowMs >= u.openedMs + kTimeoutMs) {
+            ALOGE("%s: handshake timed out", upstream_.spec.c_str());
+            stream_lost(u, nowMs);
+        } else if (warm && u.conn->ready() && u.inflight == 0 && nowMs >= u.lastSendMs + kKeepaliveMs) {
+            send_probe(u, nowMs);
+        }
+    }
+}
+
+bool DnsForwarder::accept_answer(const Upstream& u, uint8_t* buf, size_t n, const sockaddr_storage* from,
+                                 uint32_t* idxOut) {
+    uint64_t qhash;
+    if (n < 12 || !(buf[2] & 0x80) || (from && !same_address(upstream_.addr, upstream_.addrLen, *from))) {
+        ++stats_.rejected;
+        return false;
+    }
+    uint16_t id = (uint16_t)((buf[0] << 8) | buf[1]);
+    uint16_t slot = idMap_[id];
+    if (slot == 0) {
+        ++stats_.rejected;
+        return false;
+    }
+    uint32_t idx = slot - 1u;
+    const Pending& p = entries_[idx];
+    if (!p.used || p.upstreamKey != u.key || !question_hash(buf, n, &qhash) || qhash != p.qhash) {
+        ++stats_.rejected;
+        return false;
+    }
+    *idxOut = idx;
+    return true;
+}
+
+void DnsForwarder::release(uint32_t idx) {
+    Pending& p = entries_[idx];
+    if (!p.used) return;
+    p.used = false;
+    idMap_[p.upstreamId] = 0;
+    if (Upstream* u = find_key(p.upstreamKey)) {
+        if (u->inflight > 0) u->inflight--;
+    }
+    free_.push_back(idx);
+}
+
+void DnsForwarder::retire_idle() {
+    for (size_t i = 0; i < sockets_.size();) {
+        Upstream& u = sockets_[i];
+        if (u.retiring && u.inflight == 0) {
+            epoll_ctl(epfd_, EPOLL_CTL_DEL, u.fd, nullptr);
+            close(u.fd);
+            sockets_.erase(sockets_.begin() + (ptrdiff_t)i);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void DnsForwarder::expire(uint64_t nowMs) {
+    uint64_t nowTick = nowMs / kTickMs;
+    if (wheelTick_ == 0) {
+        wheelTick_ = nowTick;
+        return;
+    }
+    // a long stall only needs one pass over the wheel
+    if (nowTick > wheelTick_ + kWheelSlots) wheelTick_ = nowTick - kWheelSlots;
+    while (wheelTick_ < nowTick) {
+        ++wheelTick_;
+        auto& slot = wheel_[wheelTick_ % kWheelSlots];
+        size_t keep = 0;
+        for (uint64_t v : slot) {
+            uint32_t idx = (uint32_t)v;
+            uint32_t gen = (uint32_t)(v >> 32);
+            Pending& p = entries_[idx];
+            if (!p.used || p.gen != gen) continue;
+            if (p.deadlineMs > nowMs) {
+                slot[keep++] = v;
+                continue;
+            }
+            ++stats_.timeouts;
+            metric_add(Metric::DnsUpstreamTimeouts);
+            upstream_.stats->timeouts.fetch_add(1, std::memory_order_relaxed);
+            if (stream_) {
+                if (Upstream* u = find_key(p.upstreamKey)) u->timeouts++;
+            }
+            if (p.hostId) {
+                event_log_record(component_, EventKind::Dns, p.hostId, EventVerdict::Failed, 0,
+                                 (uint32_t)(metrics_now_us() - p.sentUs));
+            }
+            release(idx);
+        }
+        slot.resize(keep);
+    }
+    if (stream_) maintain_streams(nowMs);
+    else retire_idle();
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+#include "dns_tls.h"
+#include "dns_upstream.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "udp_batch.h"
+
+// Multiplexes client DNS queries onto a small pool of persistent upstream UDP
+// sockets from a single epoll thread.
+//
+// Every forwarded query gets a fresh random transaction ID that indexes the
+// pending-query table; the client's own ID is restored on the way back.
+// Answers are only accepted from the configured upstream address, on the
+// socket the query left from, with a matching question section. Sockets are
+// bound to random ephemeral ports and rotated after a number of queries, and
+// pending entries expire on a timer wheel instead of a per-query timeout.
+//
+// An encrypted upstream (DoT or DoH) gets a pool of TLS connections instead,
+// opened up front and kept open: every query is pipelined onto the least
+// loaded one, a dropped connection is reopened (resuming the TLS session) and
+// its unanswered queries are sent again on a fresh connection or one that has
+// just answered, and while clients are active an idle connection is kept warm
+// with a probe query, so a query never waits for a handshake. Only failed
+// connections count against a query's resends; one the server closed, or a
+// query that was never written, does not.
+class DnsForwarder {
+public:
+    struct Stats {
+        uint64_t forwarded = 0;
+        uint64_t answered = 0;
+        uint64_t timeouts = 0;
+        uint64_t dropped = 0;   // table full or send failure
+        uint64_t rejected = 0;  // unknown ID, wrong source or question mismatch
+        uint64_t resent = 0;    // moved to another connection after one was lost
+    };
+
+    static constexpr uint32_t kTimeoutMs = 5000;
+
+    DnsForwarder() = default;
+    ~DnsForwarder();
+    DnsForwarder(const DnsForwarder&) = delete;
+    DnsForwarder& operator=(const DnsForwarder&) = delete;
+
+    // Opens the socket or connection pool and registers it with `epfd`;
+    // poolSize 0 picks 4 UDP sockets or 2 TLS connections.
+    bool init(int epfd, const DnsUpstream& upstream, size_t poolSize = 0);
+
+    // Sends a client query upstream. Returns false if it had to be dropped;
+    // the caller answers it with dns_build_servfail().
+    // A nonzero `hostId` (event_host_id of the question) logs the outcome.
+    bool forward(const uint8_t* query, size_t len, const sockaddr_storage& client, socklen_t clientLen,
+                 uint64_t nowMs, uint32_t hostId = 0);
+
+    // Component named in event log records.
+    void set_event_component(EventComponent c) { component_ = c; }
+
+    // True if `fd` is one of the upstream sockets.
+    bool owns(int fd) const;
+
+    // Datagrams read per recvmmsg call in drain().
+    void set_batch(size_t n) { batch_ = n; }
+
+    // Reads every pending datagram on `fd` and hands matched answers (with the
+    // client's transaction ID restored) to
+    //   deliver(const uint8_t* resp, size_t len, const sockaddr_storage& client, socklen_t clientLen)
+    template <typename Deliver>
+    void drain(int fd, Deliver&& deliver);
+
+    // Expires pending queries whose deadline has passed; for TLS upstreams
+    // also reopens lost connections and keeps idle ones warm.
+    void expire(uint64_t nowMs);
+
+    size_t in_flight() const { return kMaxPending - free_.size(); }
+    const Stats& stats() const { return stats_; }
+
+    // Hash of a message's question section (name case-folded, type, class).
+    static bool question_hash(const uint8_t* msg, size_t len, uint64_t* out);
+
+private:
+    static constexpr size_t kMaxPending = 4096;
+    static constexpr uint32_t kTickMs = 100;
+    static constexpr size_t kWheelSlots = 64;  // must cover kTimeoutMs
+    static constexpr uint32_t kRotateAfter = 2000;
+    static constexpr uint32_t kKeepaliveMs = 20000;    // probe a connection idle this long
+    static constexpr uint32_t kWarmMs = 5 * 60 * 1000;  // ... while a client asked within this
+    static constexpr uint32_t kReconnectMinMs = 250;
+    static constexpr uint32_t kReconnectMaxMs = 30000;
+    static constexpr uint32_t kMaxStreamTimeouts = 3;   // unanswered in a row before reconnecting
+    static constexpr uint8_t kMaxResends = 2;           // moves off a failed connection per query
+    static constexpr uint32_t kLiveMs = 1000;           // opened or answered this recently: fit for resends
+
+    struct Upstream {
+        int fd = -1;
+        uint32_t key = 0;  // new for every socket or connection, unlike fd numbers
+        uint32_t sent = 0;
+        uint32_t inflight = 0;
+        bool retiring = false;
+        // TLS upstreams only
+        std::unique_ptr<DnsTlsConn> conn;
+        uint64_t openedMs = 0;
+        uint64_t lastSendMs = 0;
+        uint64_t retryAtMs = 0;
+        uint64_t answeredMs = 0;
+        uint32_t failures = 0;  // connection attempts since the last answer
+        uint32_t timeouts = 0;  // queries timed out since the last answer
+    };
+
+    struct Pending {
+        sockaddr_storage client;
+        socklen_t clientLen = 0;
+        uint64_t qhash = 0;
+        uint64_t deadlineMs = 0;
+        uint64_t sentUs = 0;
+        uint32_t hostId = 0;
+        uint32_t gen = 0;
+        uint16_t clientId = 0;
+        uint16_t upstreamId = 0;
+        uint32_t upstreamKey = 0;  // Upstream::key it was sent on
+        bool used = false;
+        uint8_t resends = 0;
+        uint64_t wireEnd = 0;       // TLS: DnsTlsConn::queued() just after it
+        std::vector<uint8_t> wire;  // the query as sent, for TLS upstreams
+    };
+
+    int open_socket();
+    Upstream* pick_upstream();
+    Upstream* pick_stream(uint64_t nowMs);
+    Upstream* pick_resend(uint64_t nowMs);
+    Upstream* find_upstream(int fd);
+    Upstream* find_key(uint32_t key);
+    bool open_stream(Upstream& u, uint64_t nowMs);
+    void stream_lost(Upstream& u, uint64_t nowMs);
+    void maintain_streams(uint64_t nowMs);
+    bool send_probe(Upstream& u, uint64_t nowMs);
+    uint32_t add_pending(const uint8_t* query, uint64_t qhash, uint16_t id, const Upstream& u, uint64_t nowMs);
+    void dropped(uint32_t hostId);
+    void release(uint32_t idx);
+    void retire_idle();
+    uint16_t random_id();
+    bool take_id(uint16_t* id);
+    bool accept_answer(const Upstream& u, uint8_t* buf, size_t n, const sockaddr_storage* from, uint32_t* idxOut);
+    template <typename Deliver>
+    void answered(uint32_t idx, uint8_t* buf, size_t n, Deliver& deliver);
+
+    int epfd_ = -1;
+    DnsUpstream upstream_;
+    bool stream_ = false;
+    size_t poolSize_ = 0;
+    std::vector<Upstream> sockets_;
+    DnsTlsSession tlsSession_;
+    uint64_t lastQueryMs_ = 0;
+    uint32_t nextKey_ = 0;
+
+    std::vector<Pending> entries_;
+    std::vector<uint32_t> free_;
+    std::vector<uint16_t> idMap_;  // upstream ID -> entry index + 1, 0 = free
+    std::vector<uint64_t> wheel_[kWheelSlots];  // (gen << 32) | entry index
+    uint64_t wheelTick_ = 0;
+
+    UdpRecvBatch rx_;
+    size_t batch_ = 16;
+
+    uint8_t rnd_[256];
+    size_t rndPos_ = sizeof(rnd_);
+
+    Stats stats_;
+    EventComponent component_ = EventComponent::DnsProxy;
+};
+
+template <typename Deliver>
+void DnsForwarder::answered(uint32_t idx, uint8_t* buf, size_t n, Deliver& deliver) {
+    Pending& p = entries_[idx];
+    buf[0] = (uint8_t)(p.clientId >> 8);
+    buf[1] = (uint8_t)(p.clientId & 0xff);
+    if (p.clientLen) deliver(static_cast<const uint8_t*>(buf), n, p.client, p.clientLen);  // 0: keepalive probe
+    uint64_t rtt = metrics_now_us() - p.sentUs;
+    metric_record(Latency::DnsUpstreamRtt, rtt);
+    upstream_.stats->record_rtt(rtt);
+    upstream_.stats->answers.fetch_add(1, std::memory_order_relaxed);
+    if (p.hostId) event_log_record(component_, EventKind::Dns, p.hostId, EventVerdict::Allowed, 0, (uint32_t)rtt);
+    ++stats_.answered;
+    release(idx);
+}
+
+template <typename Deliver>
+void DnsForwarder::drain(int fd, Deliver&& deliver) {
+    if (stream_) {
+        Upstream* u = find_upstream(fd);
+        if (!u) return;
+        u->conn->service();
+        uint8_t* buf;
+        size_t n;
+        uint32_t idx;
+        while (u->conn->next_answer(&buf, &n)) {
+            if (!accept_answer(*u, buf, n, nullptr, &idx)) continue;
+            u->failures = u->timeouts = 0;
+            u->answeredMs = metrics_now_us() / 1000;
+            answered(idx, buf, n, deliver);
+        }
+        if (!u->conn->alive()) stream_lost(*u, metrics_now_us() / 1000);
+        return;
+    }
+    Upstream* u = find_upstream(fd);
+    while (u) {
+        size_t got = rx_.recv(fd, batch_);
+        for (size_t i = 0; i < got; ++i) {
+            uint8_t* buf = rx_.data(i);
+            uint32_t idx;
+            if (accept_answer(*u, buf, rx_.len(i), &rx_.addr(i), &idx)) answered(idx, buf, rx_.len(i), deliver);
+        }
+        if (got < batch_) break;  // short batch: the socket is drained
+    }
+    retire_idle();
+}
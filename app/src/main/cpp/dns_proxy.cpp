@@ -12,80 +12,197 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
-#include <set>
-#include <fstream>
-#include <sstream>
+#include <sys/epoll.h>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+
+#include "blocklist_snapshot.h"
+#include "dns_cache.h"
+#include "dns_codec.h"
+#include "dns_forwarder.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "udp_batch.h"
 
 #define LOG_TAG "dns_proxy"
 #define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 
-static std::thread* dnsThread = nullptr;
 static std::atomic_bool dnsRunning(false);
 
-static std::set<std::string> blockedDomains;
+static constexpr int kMaxDnsWorkers = 16;
 
-static void load_blocklist(const std::string& path) {
-    blockedDomains.clear();
-    std::ifstream ifs(path);
-    if (!ifs.good()) {
-        ALOGI("Blocklist file not found: %s", path.c_str());
-        return;
+// Handle returned to Kotlin by startDnsProxy
+struct DnsProxy {
+    std::vector<std::thread> workers;
+};
+
+// Counters published by each worker once per loop turn, summed by getDnsStats()
+enum DnsStat {
+    kStatQueries, kStatBlocked, kStatCacheHits, kStatCacheMisses,
+    kStatCacheEntries, kStatCacheBytes, kStatUpstreamTimeouts,
+    kStatRecvCalls, kStatRecvPackets, kStatSendCalls, kStatSendPackets, kStatCount
+};
+struct alignas(64) DnsWorkerStats {
+    std::atomic<uint64_t> v[kStatCount];
+};
+static DnsWorkerStats workerStats[kMaxDnsWorkers];
+
+static std::atomic<int> blockPolicy((int)DnsBlockPolicy::NullIpNoData);
+
+DnsBlockPolicy dns_block_policy() {
+    return (DnsBlockPolicy)blockPolicy.load(std::memory_order_relaxed);
+}
+// datagrams per recvmmsg/sendmmsg; 1 disables batching
+static std::atomic<int> batchSize(16);
+
+static uint64_t now_ms() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// One UDP socket per worker; SO_REUSEPORT lets the kernel spread clients
+// across them by source address, so a client keeps hitting the same cache shard.
+static int open_listen_socket(int port) {
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (sock < 0) return -1;
+    int opt = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) != 0) {
+        ALOGE("SO_REUSEPORT unavailable: %s", strerror(errno));
     }
-    std::string line;
-    while (std::getline(ifs, line)) {
-        std::string s;
-        for (char c : line) {
-            if (c == '\r' || c == '\n') break;
-            s += c;
-        }
-        if (s.empty()) continue;
-        // normalize: lowercase and trim
-        for (auto &ch : s) ch = tolower(ch);
-        blockedDomains.insert(s);
+
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
     }
-    ALOGI("Loaded %zu blocked domains", blockedDomains.size());
+    return sock;
 }
 
-// Very small DNS packet parser to extract the queried name (assumes standard queries)
-static std::string parse_query_name(const unsigned char* buf, ssize_t len) {
-    if (len < 12) return "";
-    int pos = 12;
-    std::string name;
-    while (pos < len) {
-        unsigned char l = buf[pos++];
-        if (l == 0) break;
-        if (pos + l > len) return "";
-        if (!name.empty()) name += '.';
-        name.append((const char*)(buf + pos), l);
-        pos += l;
-    }
-    return name;
+static void pin_to_cpu(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    // best effort: cpusets on Android may refuse
+    sched_setaffinity(0, sizeof(set), &set);
 }
 
-// Build a simple DNS response that returns 127.0.0.1 for blocked domains
-static ssize_t build_block_response(const unsigned char* req, ssize_t req_len, unsigned char* out, ssize_t out_size) {
-    if (req_len > out_size) return -1;
-    // Copy transaction ID + flags from request, set response flag (0x8180)
-    memcpy(out, req, req_len);
-    out[2] = 0x81; out[3] = 0x80; // standard query response, no error
-    // QDCOUNT - leave as is. ANCOUNT = 1
-    out[6] = 0x00; out[7] = 0x01;
-    // NSCOUNT = 0, ARCOUNT = 0 already in copied
-    // Append answer: pointer to name (0xc0 0x0c), type A (0x00 0x01), class IN (0x00 0x01), TTL 60, RDLENGTH 4, RDATA 127.0.0.1
-    ssize_t pos = req_len;
-    if (pos + 16 > out_size) return -1;
-    out[pos++] = 0xc0; out[pos++] = 0x0c;
-    out[pos++] = 0x00; out[pos++] = 0x01;
-    out[pos++] = 0x00; out[pos++] = 0x01;
-    out[pos++] = 0x00; out[pos++] = 0x00; out[pos++] = 0x00; out[pos++] = 0x3c; // TTL = 60
-    out[pos++] = 0x00; out[pos++] = 0x04; // RDLENGTH
-    out[pos++] = 127; out[pos++] = 0; out[pos++] = 0; out[pos++] = 1;
-    return pos;
+static void dns_worker(int index, int sock, DnsUpstream upstream, size_t upstreamPool, size_t cacheBudget) {
+    unsigned ncpu = std::thread::hardware_concurrency();
+    if (ncpu > 1) pin_to_cpu(index % (int)ncpu);
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    DnsForwarder forwarder;
+    if (ep < 0 || epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev) != 0
+        || !forwarder.init(ep, upstream, upstreamPool)) {
+        ALOGE("failed to set up dns event loop %d", index);
+        if (ep >= 0) close(ep);
+        close(sock);
+        return;
+    }
+
+    // everything below is owned by this thread; only the blocklist snapshot is shared
+    DnsCache cache(cacheBudget);
+    DnsWorkerStats& stats = workerStats[index];
+    uint64_t queries = 0, blockedCount = 0;
+    uint64_t now = now_ms();
+    size_t batch = (size_t)batchSize.load(std::memory_order_relaxed);
+    UdpRecvBatch rx;
+    UdpSendBatch tx;
+    auto reply = [sock, &cache, &now, &tx, &batch](const uint8_t* resp, size_t len, const sockaddr_storage& client, socklen_t clientLen) {
+        cache.insert(resp, len, now);
+        tx.push(sock, resp, len, client, clientLen, batch);
+    };
+
+    struct epoll_event events[32];
+    while (dnsRunning.load(std::memory_order_relaxed)) {
+        // the timeout bounds both the timer-wheel tick and the stop latency
+        int ne = epoll_wait(ep, events, 32, 100);
+        now = now_ms();
+        batch = (size_t)batchSize.load(std::memory_order_relaxed);
+        forwarder.set_batch(batch);
+        for (int i = 0; i < ne; ++i) {
+            int fd = events[i].data.fd;
+            if (fd != sock) {
+                forwarder.drain(fd, reply);
+                continue;
+            }
+            while (true) {
+                size_t got = rx.recv(sock, batch);
+                for (size_t m = 0; m < got; ++m) {
+                    const uint8_t* buf = rx.data(m);
+                    size_t n = rx.len(m);
+                    if (n == 0) continue;
+                    const sockaddr_storage& clientAddr = rx.addr(m);
+                    socklen_t clientLen = rx.addr_len(m);
+                    DnsQuery q;
+                    bool parsed = dns_parse_query(buf, n, &q);
+                    if (parsed && log_events()) ALOGI("DNS query for %s", q.name);
+
+                    // exact or parent-domain match on label boundaries; the list is
+                    // reloaded by the snapshot watcher, never on this path
+                    std::string_view entry;
+                    bool blocked = parsed && blocklist_match(q.host(), &entry);
+                    ++queries;
+                    metric_add(Metric::DnsQueries);
+
+                    // answers are built straight into the send ring
+                    size_t respLen = 0;
+                    if (blocked) {
+                        ++blockedCount;
+                        metric_add(Metric::DnsBlocked);
+                        event_log(EventComponent::DnsProxy, EventKind::Dns, q.host(), EventVerdict::Blocked, entry);
+                        respLen = dns_build_block_response(buf, q, dns_block_policy(),
+                                                           tx.slot(), kUdpSlotSize);
+                    } else if (!parsed || (respLen = cache.lookup(buf, n, tx.slot(), kUdpSlotSize, now)) == 0) {
+                        // hand off upstream (unparsed ones too, the cache never holds
+                        // them); the answer comes back through drain()
+                        if (!forwarder.forward(buf, n, clientAddr, clientLen, now, parsed ? event_host_id(q.host()) : 0)) {
+                            respLen = dns_build_servfail(buf, n, tx.slot(), kUdpSlotSize);
+                        }
+                    } else {
+                        metric_add(Metric::DnsCacheHits);
+                        if (parsed) event_log(EventComponent::DnsProxy, EventKind::Dns, q.host(), EventVerdict::Cached);
+                    }
+                    if (respLen > 0) tx.push(sock, respLen, clientAddr, clientLen, batch);
+                }
+                if (got < batch) break;  // short batch: the socket is drained
+            }
+        }
+        tx.flush(sock);
+        forwarder.expire(now);
+
+        const DnsCache::Stats& cs = cache.stats();
+        stats.v[kStatQueries].store(queries, std::memory_order_relaxed);
+        stats.v[kStatBlocked].store(blockedCount, std::memory_order_relaxed);
+        stats.v[kStatCacheHits].store(cs.hits, std::memory_order_relaxed);
+        stats.v[kStatCacheMisses].store(cs.misses, std::memory_order_relaxed);
+        stats.v[kStatCacheEntries].store(cs.entries, std::memory_order_relaxed);
+        stats.v[kStatCacheBytes].store(cs.bytes, std::memory_order_relaxed);
+        stats.v[kStatUpstreamTimeouts].store(forwarder.stats().timeouts, std::memory_order_relaxed);
+        stats.v[kStatRecvCalls].store(rx.calls(), std::memory_order_relaxed);
+        stats.v[kStatRecvPackets].store(rx.packets(), std::memory_order_relaxed);
+        stats.v[kStatSendCalls].store(tx.calls(), std::memory_order_relaxed);
+        stats.v[kStatSendPackets].store(tx.packets(), std::memory_order_relaxed);
+    }
+
+    close(ep);
+    close(sock);
+    ALOGI("dns worker %d exiting", index);
 }
 
+// workers <= 0 picks one per core.
 extern "C" JNIEXPORT jlong JNICALL
-Java_com_example_adblocker_native_NativeProxy_startDnsProxy(JNIEnv* env, jclass clazz, jint listenPort, jstring blocklistPath, jstring upstreamDns) {
+Java_com_example_adblocker_native_NativeProxy_startDnsProxy(JNIEnv* env, jclass clazz, jint listenPort, jstring blocklistPath, jstring upstreamDns, jint workers) {
     const char* blPath = env->GetStringUTFChars(blocklistPath, 0);
     const char* upDns = env->GetStringUTFChars(upstreamDns, 0);
     int lp = listenPort;
@@ -98,127 +215,83 @@ Java_com_example_adblocker_native_NativeProxy_startDnsProxy(JNIEnv* env, jclass
         ALOGI("DNS proxy already running");
         return 0;
     }
-    dnsRunning.store(true);
-    load_blocklist(blp);
-
-    dnsThread = new std::thread([lp, blp, upstream]() {
-        int sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock < 0) {
-            ALOGE("failed to create udp socket");
-            dnsRunning.store(false);
-            return;
-        }
-        int opt = 1;
-        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-
-        struct sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(lp);
-
-        if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
-            ALOGE("bind failed for dns proxy");
-            close(sock);
-            dnsRunning.store(false);
-            return;
-        }
-        ALOGI("dns proxy listening on %d", lp);
-
-        // parse upstream dns
-        std::string upHost = upstream;
-        int upPort = 53;
-        size_t colon = upstream.find(':');
-        if (colon != std::string::npos) {
-            upHost = upstream.substr(0, colon);
-            upPort = atoi(upstream.substr(colon+1).c_str());
-        }
 
-        struct addrinfo hints{}, *res = nullptr;
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_DGRAM;
-        char portBuf[16]; snprintf(portBuf, sizeof(portBuf), "%d", upPort);
-        if (getaddrinfo(upHost.c_str(), portBuf, &hints, &res) != 0) {
-            ALOGE("upstream getaddrinfo failed");
-            close(sock);
-            dnsRunning.store(false);
-            return;
-        }
-        // choose first
-        struct sockaddr_storage upstreamAddr{};
-        socklen_t upstreamAddrLen = 0;
-        if (res) {
-            memcpy(&upstreamAddr, res->ai_addr, res->ai_addrlen);
-            upstreamAddrLen = res->ai_addrlen;
-            freeaddrinfo(res);
-        }
-
-        unsigned char buf[4096];
-        unsigned char out[4096];
-        while (dnsRunning.load()) {
-            struct sockaddr_storage clientAddr{};
-            socklen_t clientLen = sizeof(clientAddr);
-            ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr*)&clientAddr, &clientLen);
-            if (n <= 0) continue;
-            std::string qname = parse_query_name(buf, n);
-            std::string qlow = qname;
-            for (auto &c : qlow) c = tolower(c);
-            ALOGI("DNS query for %s", qname.c_str());
-
-            // reload blocklist occasionally (simple strategy: every 30s)
-            static uint64_t counter = 0;
-            if (++counter % 100 == 0) {
-                load_blocklist(blp);
-            }
-
-            bool blocked = false;
-            // direct match or suffix match (block subdomains)
-            if (blockedDomains.find(qlow) != blockedDomains.end()) blocked = true;
-            else {
-                // suffix match
-                for (const auto& bd : blockedDomains) {
-                    if (bd.size() > 0 && qlow.size() >= bd.size()) {
-                        if (qlow.compare(qlow.size()-bd.size(), bd.size(), bd) == 0) {
-                            blocked = true; break;
-                        }
-                    }
-                }
-            }
+    DnsUpstream up;
+    if (!parse_upstream(upstream, &up)) {
+        ALOGE("bad or unresolvable upstream %s", upstream.c_str());
+        return 0;
+    }
 
-            if (blocked) {
-                ssize_t respLen = build_block_response(buf, n, out, sizeof(out));
-                if (respLen > 0) {
-                    sendto(sock, out, respLen, 0, (struct sockaddr*)&clientAddr, clientLen);
-                }
-            } else {
-                // forward to upstream and relay back
-                int upstreamSock = socket(upstreamAddr.ss_family, SOCK_DGRAM, 0);
-                if (upstreamSock < 0) continue;
-                sendto(upstreamSock, buf, n, 0, (struct sockaddr*)&upstreamAddr, upstreamAddrLen);
-                struct timeval tv; tv.tv_sec = 5; tv.tv_usec = 0;
-                setsockopt(upstreamSock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof tv);
-                ssize_t r = recvfrom(upstreamSock, out, sizeof(out), 0, nullptr, nullptr);
-                if (r > 0) {
-                    sendto(sock, out, r, 0, (struct sockaddr*)&clientAddr, clientLen);
-                }
-                close(upstreamSock);
-            }
-        }
+    int n = workers > 0 ? workers : (int)std::thread::hardware_concurrency();
+    if (n < 1) n = 1;
+    if (n > kMaxDnsWorkers) n = kMaxDnsWorkers;
+    std::vector<int> socks;
+    for (int i = 0; i < n; ++i) {
+        int sock = open_listen_socket(lp);
+        if (sock < 0) break;
+        socks.push_back(sock);
+    }
+    if (socks.empty()) {
+        ALOGE("bind failed for dns proxy");
+        return 0;
+    }
 
-        close(sock);
-        ALOGI("dns proxy exiting");
-    });
+    dnsRunning.store(true);
+    blocklist_watch_start(blp);
+    for (auto& st : workerStats) {
+        for (auto& v : st.v) v.store(0);
+    }
 
-    return reinterpret_cast<jlong>(dnsThread);
+    size_t cacheBudget = DnsCache::kDefaultBudget * 2 / socks.size();
+    if (cacheBudget < DnsCache::kDefaultBudget / 4) cacheBudget = DnsCache::kDefaultBudget / 4;
+    // every worker keeps the default pool of two TLS connections, so a query
+    // still has somewhere to go while the server's close of one is handled
+    size_t upstreamPool = 0;
+    auto* proxy = new DnsProxy();
+    for (size_t i = 0; i < socks.size(); ++i) {
+        proxy->workers.emplace_back(dns_worker, (int)i, socks[i], up, upstreamPool, cacheBudget);
+    }
+    ALOGI("dns proxy listening on %d with %zu workers", lp, socks.size());
+    return reinterpret_cast<jlong>(proxy);
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_adblocker_native_NativeProxy_stopDnsProxy(JNIEnv* env, jclass clazz, jlong ptr) {
     if (!dnsRunning.load()) return;
     dnsRunning.store(false);
-    std::thread* t = reinterpret_cast<std::thread*>(ptr);
-    if (t) {
-        if (t->joinable()) t->join();
-        delete t;
+    DnsProxy* proxy = reinterpret_cast<DnsProxy*>(ptr);
+    if (proxy) {
+        for (auto& t : proxy->workers) {
+            if (t.joinable()) t.join();
+        }
+        delete proxy;
     }
+    blocklist_watch_stop();
     ALOGI("DNS proxy stopped");
 }
+
+// [queries, blocked, cacheHits, cacheMisses, cacheEntries, cacheBytes, upstreamTimeouts,
+//  recvCalls, recvPackets, sendCalls, sendPackets]; packets / calls is the average batch size
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_adblocker_native_NativeProxy_getDnsStats(JNIEnv* env, jclass clazz) {
+    jlong vals[kStatCount] = {};
+    for (const auto& st : workerStats) {
+        for (int i = 0; i < kStatCount; ++i) vals[i] += (jlong)st.v[i].load(std::memory_order_relaxed);
+    }
+    jlongArray arr = env->NewLongArray(kStatCount);
+    if (arr) env->SetLongArrayRegion(arr, 0, kStatCount, vals);
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_adblocker_native_NativeProxy_setDnsBlockPolicy(JNIEnv* env, jclass clazz, jint policy) {
+    if (policy < (jint)DnsBlockPolicy::NullIpNoData || policy > (jint)DnsBlockPolicy::NxDomain) return;
+    blockPolicy.store(policy);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_adblocker_native_NativeProxy_setDnsBatchSize(JNIEnv* env, jclass clazz, jint size) {
+    if (size < 1) size = 1;
+    if (size > (jint)kUdpMaxBatch) size = (jint)kUdpMaxBatch;
+    batchSize.store(size);
+}
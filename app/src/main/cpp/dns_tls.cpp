@@ -0,0 +1,546 @@
+#include "dns_tls.h"
+
+#include <algorithm>
+#include <android/log.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <jni.h>
+#include <mutex>
+
+#if defined(ADBLOCK_DNS_TLS)
+#include <dirent.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define LOG_TAG "dns_tls"
+#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+#if defined(ADBLOCK_DNS_TLS)
+
+namespace {
+
+constexpr size_t kMaxQueued = 256 * 1024;  // unwritten output per connection
+constexpr size_t kReadChunk = 16 * 1024;
+constexpr size_t kMaxInput = 4 * 1024 * 1024;
+constexpr size_t kMaxHead = 8 * 1024;
+
+std::mutex g_ctxLock;
+SSL_CTX* g_ctx = nullptr;
+
+// A new ticket replaces the upstream's previous one.
+int on_new_session(SSL* ssl, SSL_SESSION* s) {
+    auto* slot = static_cast<DnsTlsSession*>(SSL_get_app_data(ssl));
+    if (!slot) return 0;
+    if (slot->session) SSL_SESSION_free(slot->session);
+    slot->session = s;
+    return 1;  // we keep the reference
+}
+
+// The socket BIO OpenSSL ships writes with write(2), which raises SIGPIPE
+// when the server has reset the connection; this one sends with MSG_NOSIGNAL.
+int bio_write(BIO* b, const char* buf, int len) {
+    ssize_t n = ::send((int)(intptr_t)BIO_get_data(b), buf, (size_t)len, MSG_NOSIGNAL);
+    BIO_clear_retry_flags(b);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) BIO_set_retry_write(b);
+    return (int)n;
+}
+
+int bio_read(BIO* b, char* buf, int len) {
+    ssize_t n = recv((int)(intptr_t)BIO_get_data(b), buf, (size_t)len, 0);
+    BIO_clear_retry_flags(b);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) BIO_set_retry_read(b);
+    return (int)n;
+}
+
+long bio_ctrl(BIO*, int cmd, long, void*) {
+    return cmd == BIO_CTRL_FLUSH ? 1 : 0;
+}
+
+int bio_create(BIO* b) {
+    BIO_set_init(b, 1);
+    return 1;
+}
+
+BIO_METHOD* socket_method() {
+    static BIO_METHOD* m = [] {
+        BIO_METHOD* bm = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK | BIO_TYPE_DESCRIPTOR, "dns socket");
+        BIO_meth_set_write(bm, bio_write);
+        BIO_meth_set_read(bm, bio_read);
+        BIO_meth_set_ctrl(bm, bio_ctrl);
+        BIO_meth_set_create(bm, bio_create);
+        return bm;
+    }();
+    return m;
+}
+
+// A reset from the server is how many of them close an idle connection.
+bool peer_reset() {
+    return ERR_peek_error() == 0 && (errno == ECONNRESET || errno == EPIPE);
+}
+
+#if defined(__ANDROID__)
+// The system store is a directory of PEM files; newer releases ship it in the
+// Conscrypt APEX. Loaded once, when the first connection is made.
+void load_system_anchors(X509_STORE* store) {
+    static const char* const kDirs[] = {"/apex/com.android.conscrypt/cacerts", "/system/etc/security/cacerts"};
+    for (const char* dir : kDirs) {
+        DIR* d = opendir(dir);
+        if (!d) continue;
+        size_t loaded = 0;
+        while (dirent* e = readdir(d)) {
+            if (e->d_name[0] == '.') continue;
+            std::string path = std::string(dir) + "/" + e->d_name;
+            FILE* f = fopen(path.c_str(), "r");
+            if (!f) continue;
+            while (X509* cert = PEM_read_X509(f, nullptr, nullptr, nullptr)) {
+                if (X509_STORE_add_cert(store, cert) == 1) ++loaded;
+                X509_free(cert);
+            }
+            fclose(f);
+        }
+        closedir(d);
+        ERR_clear_error();
+        ALOGI("loaded %zu trust anchors from %s", loaded, dir);
+        return;
+    }
+    ALOGE("no system trust store found");
+}
+#endif
+
+// Shared by every connection; SSL_CTX is safe to use from several threads.
+SSL_CTX* tls_context_locked() {
+    if (g_ctx) return g_ctx;
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx) return nullptr;
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+#ifdef SSL_OP_IGNORE_UNEXPECTED_EOF
+    // OpenSSL 3 otherwise reports a close without close_notify as an error
+    SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+    // sessions live in DnsTlsSession, not in the context's cache
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, on_new_session);
+#if defined(__ANDROID__)
+    load_system_anchors(SSL_CTX_get_cert_store(ctx));
+#else
+    SSL_CTX_set_default_verify_paths(ctx);
+#endif
+    g_ctx = ctx;
+    return ctx;
+}
+
+SSL_CTX* tls_context() {
+    std::lock_guard<std::mutex> lk(g_ctxLock);
+    return tls_context_locked();
+}
+
+bool header_is(const char* line, size_t len, const char* name) {
+    size_t n = strlen(name);
+    return len > n && line[n] == ':' && strncasecmp(line, name, n) == 0;
+}
+
+bool value_has(const char* line, size_t len, const char* token) {
+    size_t n = strlen(token);
+    for (size_t i = 0; i + n <= len; ++i) {
+        if (strncasecmp(line + i, token, n) == 0) return true;
+    }
+    return false;
+}
+
+} // namespace
+
+DnsTlsSession::~DnsTlsSession() {
+    if (session) SSL_SESSION_free(session);
+}
+
+bool DnsTlsConn::open(int epfd, const DnsUpstream& upstream, DnsTlsSession* session) {
+    close();
+    SSL_CTX* ctx = tls_context();
+    if (!ctx) return false;
+    stats_ = upstream.stats;
+    https_ = upstream.transport == DnsTransport::Https;
+    const std::string& name = upstream.name.empty() ? upstream.host : upstream.name;
+    host_ = name.find(':') != std::string::npos ? "[" + name + "]" : name;
+    path_ = upstream.path;
+
+    fd_ = socket(upstream.addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+        ALOGE("%s: socket: %s", host_.c_str(), strerror(errno));
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(fd_, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd_;
+    if ((connect(fd_, (const sockaddr*)&upstream.addr, upstream.addrLen) != 0 && errno != EINPROGRESS)
+        || epoll_ctl(epfd, EPOLL_CTL_ADD, fd_, &ev) != 0) {
+        ALOGE("%s: connect: %s", host_.c_str(), strerror(errno));
+        ::close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    epfd_ = epfd;
+
+    ssl_ = SSL_new(ctx);
+    BIO* bio = ssl_ ? BIO_new(socket_method()) : nullptr;
+    if (!bio) {
+        fail("setup");
+        return false;
+    }
+    BIO_set_data(bio, (void*)(intptr_t)fd_);
+    SSL_set_bio(ssl_, bio, bio);
+    SSL_set_connect_state(ssl_);
+    SSL_set_app_data(ssl_, session);
+    if (!upstream.name.empty()) {
+        SSL_set_tlsext_host_name(ssl_, upstream.name.c_str());
+        X509_VERIFY_PARAM_set1_host(SSL_get0_param(ssl_), upstream.name.c_str(), 0);
+    } else {
+        X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl_), upstream.host.c_str());
+    }
+    static const unsigned char kAlpnDot[] = "\x03" "dot";
+    static const unsigned char kAlpnHttp[] = "\x08" "http/1.1";
+    if (https_) SSL_set_alpn_protos(ssl_, kAlpnHttp, sizeof(kAlpnHttp) - 1);
+    else SSL_set_alpn_protos(ssl_, kAlpnDot, sizeof(kAlpnDot) - 1);
+    if (session && session->session) SSL_set_session(ssl_, session->session);
+
+    state_ = State::Handshaking;
+    handshake();
+    return !broken_;
+}
+
+void DnsTlsConn::close() {
+    if (ssl_) {
+        if (state_ == State::Ready && !broken_) {
+            // best effort close_notify, never waiting for the server's. Marking
+            // the shutdown complete keeps SSL_free() from invalidating the
+            // session: a server closing an idle connection is no reason not
+            // to resume it.
+            if (!peerClosed_) SSL_shutdown(ssl_);
+            SSL_set_shutdown(ssl_, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+        }
+        SSL_free(ssl_);
+        ssl_ = nullptr;
+    }
+    if (state_ == State::Ready && stats_) stats_->open.fetch_sub(1, std::memory_order_relaxed);
+    if (fd_ >= 0) {
+        epoll_ctl(epfd_, EPOLL_CTL_DEL, fd_, nullptr);
+        ::close(fd_);
+        fd_ = -1;
+    }
+    ERR_clear_error();
+    state_ = State::Closed;
+    broken_ = peerClosed_ = closing_ = false;
+    out_.clear();
+    outPos_ = 0;
+    queued_ = written_ = 0;
+    inLen_ = inPos_ = 0;
+    haveHead_ = chunked_ = false;
+    status_ = 0;
+    bodyLeft_ = 0;
+}
+
+void DnsTlsConn::fail(const char* what) {
+    unsigned long e = ERR_get_error();
+    if (e) {
+        char buf[256];
+        ERR_error_string_n(e, buf, sizeof(buf));
+        ALOGE("%s: %s failed: %s", host_.c_str(), what, buf);
+    } else {
+        ALOGE("%s: %s failed: %s", host_.c_str(), what, errno ? strerror(errno) : "connection closed");
+    }
+    ERR_clear_error();
+    broken_ = true;
+}
+
+void DnsTlsConn::handshake() {
+    int r = SSL_connect(ssl_);
+    if (r == 1) {
+        state_ = State::Ready;
+        if (stats_) {
+            stats_->connects.fetch_add(1, std::memory_order_relaxed);
+            if (SSL_session_reused(ssl_)) stats_->resumed.fetch_add(1, std::memory_order_relaxed);
+            stats_->open.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    int err = SSL_get_error(ssl_, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return;
+    long verify = SSL_get_verify_result(ssl_);
+    if (verify != X509_V_OK) {
+        ALOGE("%s: certificate rejected: %s", host_.c_str(), X509_verify_cert_error_string(verify));
+        ERR_clear_error();
+        broken_ = true;
+        return;
+    }
+    fail("handshake");
+}
+
+bool DnsTlsConn::send(const uint8_t* msg, size_t len) {
+    if (!usable() || len > 65535 || out_.size() - outPos_ + len > kMaxQueued) return false;
+    size_t before = out_.size();
+    if (https_) {
+        char head[512];
+        int n = snprintf(head, sizeof(head),
+                         "POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: application/dns-message\r\n"
+                         "Accept: application/dns-message\r\nContent-Length: %zu\r\n\r\n",
+                         path_.c_str(), host_.c_str(), len);
+        if (n <= 0 || (size_t)n >= sizeof(head)) return false;
+        out_.insert(out_.end(), head, head + n);
+    } else {
+        out_.push_back((uint8_t)(len >> 8));
+        out_.push_back((uint8_t)len);
+    }
+    out_.insert(out_.end(), msg, msg + len);
+    queued_ += out_.size() - before;
+    if (state_ == State::Ready) flush();
+    return true;
+}
+
+void DnsTlsConn::flush() {
+    while (outPos_ < out_.size()) {
+        int n = SSL_write(ssl_, out_.data() + outPos_, (int)std::min<size_t>(out_.size() - outPos_, 1 << 20));
+        if (n > 0) {
+            outPos_ += (size_t)n;
+            written_ += (uint64_t)n;
+            continue;
+        }
+        int err = SSL_get_error(ssl_, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return;
+        if (err == SSL_ERROR_SYSCALL && peer_reset()) {
+            peerClosed_ = true;
+            return;
+        }
+        fail("write");
+        return;
+    }
+    out_.clear();
+    outPos_ = 0;
+}
+
+void DnsTlsConn::read_input() {
+    // answers handed out by next_answer() are done with by now
+    if (inPos_ > 0) {
+        memmove(in_.data(), in_.data() + inPos_, inLen_ - inPos_);
+        inLen_ -= inPos_;
+        inPos_ = 0;
+    }
+    while (true) {
+        if (in_.size() - inLen_ < kReadChunk) {
+            if (inLen_ + kReadChunk > kMaxInput) {
+                ALOGE("%s: answers not consumed", host_.c_str());
+                broken_ = true;
+                return;
+            }
+            in_.resize(inLen_ + kReadChunk);
+        }
+        int n = SSL_read(ssl_, in_.data() + inLen_, (int)(in_.size() - inLen_));
+        if (n > 0) {
+            inLen_ += (size_t)n;
+            continue;
+        }
+        int err = SSL_get_error(ssl_, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return;
+        if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && (peer_reset() || (ERR_peek_error() == 0 && n == 0)))) {
+            // servers drop idle connections, often without close_notify
+            ERR_clear_error();
+            peerClosed_ = true;
+            return;
+        }
+        fail("read");
+        return;
+    }
+}
+
+void DnsTlsConn::service() {
+    if (state_ == State::Closed || broken_) return;
+    if (state_ == State::Handshaking) handshake();
+    if (state_ != State::Ready || broken_) return;
+    flush();
+    if (!broken_) read_input();
+    if (!broken_ && outPos_ < out_.size()) flush();
+}
+
+bool DnsTlsConn::next_answer(uint8_t** msg, size_t* len) {
+    if (broken_ || state_ == State::Closed) return false;
+    if (https_) return next_http_answer(msg, len);
+    if (inLen_ - inPos_ < 2) return false;
+    size_t n = (size_t)in_[inPos_] << 8 | in_[inPos_ + 1];
+    if (inLen_ - inPos_ < 2 + n) return false;
+    *msg = in_.data() + inPos_ + 2;
+    *len = n;
+    inPos_ += 2 + n;
+    return true;
+}
+
+bool DnsTlsConn::next_http_answer(uint8_t** msg, size_t* len) {
+    while (true) {
+        if (!haveHead_) {
+            const char* p = (const char*)in_.data() + inPos_;
+            size_t avail = inLen_ - inPos_;
+            const char* end = (const char*)memmem(p, avail, "\r\n\r\n", 4);
+            if (!end) {
+                if (avail > kMaxHead) {
+                    ALOGE("%s: response head too large", host_.c_str());
+                    broken_ = true;
+                }
+                return false;
+            }
+            size_t headLen = (size_t)(end - p) + 4;
+            if (headLen < 12 || strncmp(p, "HTTP/1.", 7) != 0) {
+                ALOGE("%s: not an HTTP/1.x response", host_.c_str());
+                broken_ = true;
+                return false;
+            }
+            status_ = atoi(p + 9);
+            bool haveLength = false;
+            chunked_ = false;
+            bodyLeft_ = 0;
+            for (const char* line = (const char*)memchr(p, '\n', headLen) + 1; line < end;) {
+                const char* eol = (const char*)memchr(line, '\r', (size_t)(end - line));
+                if (!eol) eol = end;
+                size_t n = (size_t)(eol - line);
+                if (header_is(line, n, "content-length")) {
+                    bodyLeft_ = (size_t)strtoul(line + 15, nullptr, 10);
+                    haveLength = true;
+                } else if (header_is(line, n, "transfer-encoding") && value_has(line, n, "chunked")) {
+                    chunked_ = true;
+                } else if (header_is(line, n, "connection") && value_has(line, n, "close")) {
+                    closing_ = true;
+                }
+                line = eol + 2;
+            }
+            if (!haveLength && !chunked_ && status_ != 204 && status_ != 304) {
+                ALOGE("%s: response without length", host_.c_str());
+                broken_ = true;
+                return false;
+            }
+            if (bodyLeft_ > 65535) {
+                ALOGE("%s: response body too large", host_.c_str());
+                broken_ = true;
+                return false;
+            }
+            inPos_ += headLen;
+            haveHead_ = true;
+        }
+
+        uint8_t* body;
+        size_t bodyLen;
+        if (!chunked_) {
+            if (inLen_ - inPos_ < bodyLeft_) return false;
+            body = in_.data() + inPos_;
+            bodyLen = bodyLeft_;
+            inPos_ += bodyLeft_;
+        } else {
+            // decode only once the whole body is here; DNS answers are small
+            body_.clear();
+            size_t pos = inPos_;
+            while (true) {
+                const char* p = (const char*)in_.data() + pos;
+                const char* eol = (const char*)memmem(p, inLen_ - pos, "\r\n", 2);
+                if (!eol) return false;
+                size_t size = (size_t)strtoul(p, nullptr, 16);
+                pos += (size_t)(eol - p) + 2;
+                if (size == 0) {
+                    // no trailers expected: the body ends with an empty line
+                    if (inLen_ - pos < 2) return false;
+                    pos += 2;
+                    break;
+                }
+                if (body_.size() + size > 65535) {
+                    ALOGE("%s: response body too large", host_.c_str());
+                    broken_ = true;
+                    return false;
+                }
+                if (inLen_ - pos < size + 2) return false;
+                body_.insert(body_.end(), in_.data() + pos, in_.data() + pos + size);
+                pos += size + 2;
+            }
+            inPos_ = pos;
+            body = body_.data();
+            bodyLen = body_.size();
+        }
+        haveHead_ = false;
+        // an error status carries no DNS message; that query times out
+        if (status_ == 200 && bodyLen > 0) {
+            *msg = body;
+            *len = bodyLen;
+            return true;
+        }
+        if (status_ != 200) ALOGE("%s: HTTP status %d", host_.c_str(), status_);
+    }
+}
+
+bool dns_tls_available() {
+    return true;
+}
+
+bool dns_tls_add_trust_anchors(const std::string& path) {
+    std::lock_guard<std::mutex> lk(g_ctxLock);
+    SSL_CTX* ctx = tls_context_locked();
+    if (!ctx || SSL_CTX_load_verify_locations(ctx, path.c_str(), nullptr) != 1) {
+        ERR_clear_error();
+        ALOGE("cannot load trust anchors from %s", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+#else  // !ADBLOCK_DNS_TLS
+
+DnsTlsSession::~DnsTlsSession() = default;
+
+bool DnsTlsConn::open(int, const DnsUpstream&, DnsTlsSession*) {
+    return false;
+}
+
+void DnsTlsConn::close() {}
+
+bool DnsTlsConn::send(const uint8_t*, size_t) {
+    return false;
+}
+
+void DnsTlsConn::service() {}
+
+bool DnsTlsConn::next_answer(uint8_t**, size_t*) {
+    return false;
+}
+
+bool dns_tls_available() {
+    return false;
+}
+
+bool dns_tls_add_trust_anchors(const std::string&) {
+    return false;
+}
+
+#endif  // ADBLOCK_DNS_TLS
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_adblocker_native_NativeProxy_isDnsTlsAvailable(JNIEnv* env, jclass clazz) {
+    return dns_tls_available() ? JNI_TRUE : JNI_FALSE;
+}
+
+extern "C" JNIEXPORT jboolean JNICALL
+Java_com_example_adblocker_native_NativeProxy_setDnsTrustAnchors(JNIEnv* env, jclass clazz, jstring pemPath) {
+    const char* p = env->GetStringUTFChars(pemPath, 0);
+    std::string path(p ? p : "");
+    env->ReleaseStringUTFChars(pemPath, p);
+    return dns_tls_add_trust_anchors(path) ? JNI_TRUE : JNI_FALSE;
+}
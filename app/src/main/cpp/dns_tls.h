@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dns_upstream.h"
+
+struct ssl_st;
+struct ssl_session_st;
+
+// One long-lived TLS connection to an encrypted DNS upstream (dns_upstream.h),
+// driven by the forwarder's epoll thread.
+//
+// Queries may be sent at any time, even before the handshake finishes; they
+// are framed (a 2-byte length for DoT, an HTTP/1.1 POST for DoH) and queued,
+// and written as the socket allows. Nothing waits for an answer before the
+// next query goes out: DoT servers may answer out of order, DoH answers come
+// back in order on the pipelined connection, and the caller matches them by
+// DNS ID either way.
+//
+// The socket is registered edge-triggered for both directions, so service()
+// must be called on every readiness event. Certificates are verified against
+// the system trust store plus dns_tls_add_trust_anchors().
+//
+// Built without TLS support (no ADBLOCK_DNS_TLS), open() always fails.
+
+// Latest session ticket for an upstream, shared by its connections so a
+// reconnect resumes instead of running a full handshake.
+struct DnsTlsSession {
+    ssl_session_st* session = nullptr;
+
+    DnsTlsSession() = default;
+    ~DnsTlsSession();
+    DnsTlsSession(const DnsTlsSession&) = delete;
+    DnsTlsSession& operator=(const DnsTlsSession&) = delete;
+};
+
+class DnsTlsConn {
+public:
+    DnsTlsConn() = default;
+    ~DnsTlsConn() { close(); }
+    DnsTlsConn(const DnsTlsConn&) = delete;
+    DnsTlsConn& operator=(const DnsTlsConn&) = delete;
+
+    // Starts a non-blocking connect and handshake; the socket is added to
+    // `epfd` with data.fd set. `session` must outlive the connection.
+    bool open(int epfd, const DnsUpstream& upstream, DnsTlsSession* session);
+    void close();
+
+    int fd() const { return fd_; }
+    bool ready() const { return state_ == State::Ready; }
+    // False once the connection failed or the server closed or is closing it.
+    bool alive() const { return state_ != State::Closed && !broken_ && !peerClosed_; }
+    // Whether send() takes more queries.
+    bool usable() const { return alive() && !closing_; }
+    // The server ended the connection (EOF, close_notify or a reset once it
+    // worked), as servers routinely do, rather than a TLS or protocol error.
+    bool closed_by_peer() const { return peerClosed_ && !broken_; }
+
+    // Bytes queued by send() and handed to TLS so far since open(); a query
+    // whose end lies past written() never left this end.
+    uint64_t queued() const { return queued_; }
+    uint64_t written() const { return written_; }
+
+    // Queues one DNS message. False if unusable or too much is queued.
+    bool send(const uint8_t* msg, size_t len);
+
+    // Advances the handshake, writes queued output and reads what arrived.
+    void service();
+
+    // Next complete answer read by service(); valid until service() or close().
+    bool next_answer(uint8_t** msg, size_t* len);
+
+private:
+    enum class State : uint8_t { Closed, Handshaking, Ready };
+
+    void handshake();
+    void flush();
+    void read_input();
+    void fail(const char* what);
+    bool next_http_answer(uint8_t** msg, size_t* len);
+
+    int fd_ = -1;
+    int epfd_ = -1;
+    ssl_st* ssl_ = nullptr;
+    State state_ = State::Closed;
+    bool broken_ = false;
+    bool peerClosed_ = false;
+    bool closing_ = false;  // DoH: the server sent "Connection: close"
+    bool https_ = false;
+    std::string host_;  // DoH Host header
+    std::string path_;
+    DnsUpstreamStats* stats_ = nullptr;
+
+    std::vector<uint8_t> out_;
+    size_t outPos_ = 0;
+    uint64_t queued_ = 0;
+    uint64_t written_ = 0;
+    std::vector<uint8_t> in_;
+    size_t inLen_ = 0;
+    size_t inPos_ = 0;
+
+    // DoH response being parsed
+    bool haveHead_ = false;
+    bool chunked_ = false;
+    int status_ = 0;
+    size_t bodyLeft_ = 0;
+    std::vector<uint8_t> body_;
+};
+
+// False when built without TLS support.
+bool dns_tls_available();
+
+// Trusts the PEM certificates in `path` as well, e.g. a local test resolver's
+// self-signed certificate.
+bool dns_tls_add_trust_anchors(const std::string& path);
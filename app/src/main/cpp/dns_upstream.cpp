@@ -0,0 +1,165 @@
+#include "dns_upstream.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <jni.h>
+#include <mutex>
+#include <netdb.h>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Never destroyed: forwarders on other threads keep pointers into it.
+struct StatsRegistry {
+    std::mutex lock;
+    std::vector<std::pair<std::string, DnsUpstreamStats*>> all;
+};
+
+StatsRegistry& registry() {
+    static StatsRegistry* r = new StatsRegistry();
+    return *r;
+}
+
+DnsUpstreamStats* find_stats(const std::string& spec, bool create) {
+    StatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lk(r.lock);
+    for (auto& e : r.all) {
+        if (e.first == spec) return e.second;
+    }
+    if (!create) return nullptr;
+    r.all.emplace_back(spec, new DnsUpstreamStats());
+    return r.all.back().second;
+}
+
+bool is_ip_literal(const std::string& host) {
+    in6_addr a;
+    return inet_pton(AF_INET, host.c_str(), &a) == 1 || inet_pton(AF_INET6, host.c_str(), &a) == 1;
+}
+
+bool parse_port(const std::string& s, uint16_t* out) {
+    if (s.empty() || s.size() > 5 || s.find_first_not_of("0123456789") != std::string::npos) return false;
+    unsigned long v = strtoul(s.c_str(), nullptr, 10);
+    if (v == 0 || v > 65535) return false;
+    *out = (uint16_t)v;
+    return true;
+}
+
+bool starts_with(const std::string& s, const char* prefix) {
+    return s.compare(0, strlen(prefix), prefix) == 0;
+}
+
+} // namespace
+
+void DnsUpstreamStats::record_rtt(uint64_t us) {
+    uint64_t srtt = srttUs.load(std::memory_order_relaxed);
+    uint64_t var = rttVarUs.load(std::memory_order_relaxed);
+    if (srtt == 0) {
+        srtt = us;
+        var = us / 2;
+    } else {
+        uint64_t delta = us > srtt ? us - srtt : srtt - us;
+        var = var - var / 4 + delta / 4;
+        srtt = srtt - srtt / 8 + us / 8;
+    }
+    srttUs.store(srtt, std::memory_order_relaxed);
+    rttVarUs.store(var, std::memory_order_relaxed);
+    uint64_t min = minRttUs.load(std::memory_order_relaxed);
+    while ((min == 0 || us < min) && !minRttUs.compare_exchange_weak(min, us, std::memory_order_relaxed)) {}
+}
+
+bool parse_upstream(const std::string& spec, DnsUpstream* out) {
+    DnsUpstream u;
+    u.spec = spec;
+    std::string rest = spec;
+    if (starts_with(rest, "tls://")) {
+        u.transport = DnsTransport::Tls;
+        u.port = 853;
+        rest.erase(0, 6);
+    } else if (starts_with(rest, "https://")) {
+        u.transport = DnsTransport::Https;
+        u.port = 443;
+        u.path = "/dns-query";
+        rest.erase(0, 8);
+    }
+    size_t hash = rest.find('#');
+    if (hash != std::string::npos) {
+        if (!u.encrypted()) return false;
+        u.name = rest.substr(hash + 1);
+        rest.resize(hash);
+    }
+    if (u.transport == DnsTransport::Https) {
+        size_t slash = rest.find('/');
+        if (slash != std::string::npos) {
+            u.path = rest.substr(slash);
+            rest.resize(slash);
+        }
+    }
+
+    // [v6]:port, bare v6 (more than one colon), or host:port
+    if (!rest.empty() && rest[0] == '[') {
+        size_t close = rest.find(']');
+        if (close == std::string::npos) return false;
+        u.host = rest.substr(1, close - 1);
+        if (close + 1 < rest.size()) {
+            if (rest[close + 1] != ':' || !parse_port(rest.substr(close + 2), &u.port)) return false;
+        }
+    } else if (std::count(rest.begin(), rest.end(), ':') == 1) {
+        size_t colon = rest.find(':');
+        u.host = rest.substr(0, colon);
+        if (!parse_port(rest.substr(colon + 1), &u.port)) return false;
+    } else {
+        u.host = rest;
+    }
+    if (u.host.empty()) return false;
+    if (u.name.empty() && !is_ip_literal(u.host)) u.name = u.host;
+
+    addrinfo hints{}, *res = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = u.encrypted() ? SOCK_STREAM : SOCK_DGRAM;
+    char portBuf[8];
+    snprintf(portBuf, sizeof(portBuf), "%u", u.port);
+    if (getaddrinfo(u.host.c_str(), portBuf, &hints, &res) != 0 || !res) return false;
+    memcpy(&u.addr, res->ai_addr, res->ai_addrlen);
+    u.addrLen = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    u.stats = find_stats(spec, true);
+    *out = std::move(u);
+    return true;
+}
+
+// [transport, queries, answers, timeouts, failed, connects, resumed, open,
+//  srttUs, rttVarUs, minRttUs, dropped] for an upstream string in use since
+// the library was loaded, or null.
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_adblocker_native_NativeProxy_getDnsUpstreamStats(JNIEnv* env, jclass clazz, jstring upstream) {
+    const char* s = upstream ? env->GetStringUTFChars(upstream, 0) : nullptr;
+    std::string spec(s ? s : "");
+    if (s) env->ReleaseStringUTFChars(upstream, s);
+    const DnsUpstreamStats* st = find_stats(spec, false);
+    if (!st) return nullptr;
+    jlong transport = starts_with(spec, "tls://") ? (jlong)DnsTransport::Tls
+                    : starts_with(spec, "https://") ? (jlong)DnsTransport::Https : (jlong)DnsTransport::Udp;
+    jlong vals[] = {
+        transport,
+        (jlong)st->queries.load(std::memory_order_relaxed),
+        (jlong)st->answers.load(std::memory_order_relaxed),
+        (jlong)st->timeouts.load(std::memory_order_relaxed),
+        (jlong)st->failed.load(std::memory_order_relaxed),
+        (jlong)st->connects.load(std::memory_order_relaxed),
+        (jlong)st->resumed.load(std::memory_order_relaxed),
+        (jlong)st->open.load(std::memory_order_relaxed),
+        (jlong)st->srttUs.load(std::memory_order_relaxed),
+        (jlong)st->rttVarUs.load(std::memory_order_relaxed),
+        (jlong)st->minRttUs.load(std::memory_order_relaxed),
+        (jlong)st->dropped.load(std::memory_order_relaxed),
+    };
+    jsize n = (jsize)(sizeof(vals) / sizeof(vals[0]));
+    jlongArray arr = env->NewLongArray(n);
+    if (arr) env->SetLongArrayRegion(arr, 0, n, vals);
+    return arr;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <sys/socket.h>
+
+// The resolver forwarded queries go to, as given to startDnsProxy() and
+// startTun():
+//   host[:port]                         plain UDP, port 53
+//   tls://host[:port][#name]            DNS over TLS (RFC 7858), port 853
+//   https://host[:port][/path][#name]   DNS over HTTPS (RFC 8484), port 443,
+//                                       path /dns-query
+// `name` is sent as SNI and checked against the certificate; it defaults to
+// `host`. With an IP literal and no name the certificate must carry that IP.
+// IPv6 literals go in brackets when a port follows.
+
+enum class DnsTransport : uint8_t {
+    Udp = 0,
+    Tls = 1,
+    Https = 2,
+};
+
+// Shared by every forwarder using the same upstream string, so the DNS proxy
+// workers and the TUN engine add up. RTTs are smoothed as in TCP (RFC 6298);
+// concurrent updates from several threads may drop a sample.
+struct DnsUpstreamStats {
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> answers{0};
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> failed{0};      // lost with their connection and not resent
+    std::atomic<uint64_t> dropped{0};     // never sent: no connection, table full or unparsable
+    std::atomic<uint64_t> connects{0};    // TLS handshakes completed
+    std::atomic<uint64_t> resumed{0};     // ... of which resumed a session
+    std::atomic<int64_t> open{0};         // established connections right now
+    std::atomic<uint64_t> srttUs{0};
+    std::atomic<uint64_t> rttVarUs{0};
+    std::atomic<uint64_t> minRttUs{0};
+
+    void record_rtt(uint64_t us);
+};
+
+struct DnsUpstream {
+    std::string spec;  // as given
+    DnsTransport transport = DnsTransport::Udp;
+    std::string host;
+    std::string name;  // TLS server name; empty for an IP literal without #name
+    std::string path;  // HTTPS request path
+    uint16_t port = 53;
+    sockaddr_storage addr{};
+    socklen_t addrLen = 0;
+    DnsUpstreamStats* stats = nullptr;  // never freed
+
+    bool encrypted() const { return transport != DnsTransport::Udp; }
+};
+
+// Parses `spec` and resolves its host with getaddrinfo (which may block).
+bool parse_upstream(const std::string& spec, DnsUpstream* out);
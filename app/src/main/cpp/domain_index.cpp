@@ -0,0 +1,245 @@
+#include "domain_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+static inline char lower_ascii(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+uint32_t DomainIndex::hash_label(const char* p, size_t n) {
+    // FNV-1a, good enough to spread sibling labels
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (unsigned char)p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint64_t DomainIndex::suffix_key(uint64_t parent, const char* label, size_t n) {
+    // FNV-1a 64 over the labels right to left, each after a dot
+    uint64_t h = (parent ^ '.') * 1099511628211ull;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)label[i]) * 1099511628211ull;
+    return h;
+}
+
+DomainIndex DomainIndex::from_view(const Node* nodes, size_t node_count, const char* pool, size_t pool_size,
+                                   size_t entries, FuseFilter filter, std::shared_ptr<const void> backing) {
+    DomainIndex idx;
+    idx.nodes_ = nodes;
+    idx.node_count_ = node_count;
+    idx.pool_ = pool;
+    idx.pool_size_ = pool_size;
+    idx.entries_ = entries;
+    idx.filter_ = std::move(filter);
+    idx.backing_ = std::move(backing);
+    return idx;
+}
+
+// Names are assembled right to left in buf: a node's label goes in front of
+// its parent's, which already ends the buffer.
+static void walk(const DomainIndex::Node* nodes, size_t nodeCount, const char* pool, size_t poolSize,
+                 uint32_t node, char* buf, size_t start, size_t end,
+                 const std::function<void(std::string_view)>& fn) {
+    const DomainIndex::Node& n = nodes[node];
+    if ((size_t)n.first_child + n.child_count > nodeCount) return;
+    for (uint32_t i = 0; i < n.child_count; ++i) {
+        uint32_t c = n.first_child + i;
+        const DomainIndex::Node& k = nodes[c];
+        size_t dot = start == end ? 0 : 1;
+        if (k.label_len + dot > start || (size_t)k.label_off + k.label_len > poolSize) continue;
+        size_t s = start - dot - k.label_len;
+        memcpy(buf + s, pool + k.label_off, k.label_len);
+        if (dot) buf[s + k.label_len] = '.';
+        if (k.flags & DomainIndex::kTerminal) fn(std::string_view(buf + s, end - s));
+        else walk(nodes, nodeCount, pool, poolSize, c, buf, s, end, fn);
+    }
+}
+
+void DomainIndex::for_each(const std::function<void(std::string_view)>& fn) const {
+    if (node_count_ == 0) return;
+    char buf[kMaxNameLen];
+    walk(nodes_, node_count_, pool_, pool_size_, 0, buf, sizeof(buf), sizeof(buf), fn);
+}
+
+bool DomainIndex::match(std::string_view host, std::string_view* entry) const {
+    if (node_count_ == 0 || entries_ == 0) return false;
+    size_t n = host.size();
+    while (n > 0 && host[n - 1] == '.') --n;
+    if (n == 0 || n > kMaxNameLen) return false;
+
+    char buf[kMaxNameLen];
+    for (size_t i = 0; i < n; ++i) buf[i] = lower_ascii(host[i]);
+
+    if (!filter_.empty()) {
+        uint64_t key = kRootKey;
+        size_t end = n;
+        while (true) {
+            size_t start = end;
+            while (start > 0 && buf[start - 1] != '.') --start;
+            if (start == end) return false;
+            key = suffix_key(key, buf + start, end - start);
+            if (filter_.contains(key)) break;
+            if (start == 0) return false;  // no suffix can be blocked
+            end = start - 1;
+        }
+    }
+
+    const Node* cur = &nodes_[0];
+    size_t end = n;
+    while (true) {
+        size_t start = end;
+        while (start > 0 && buf[start - 1] != '.') --start;
+        size_t len = end - start;
+        if (len == 0) return false;
+
+        // children are sorted by hash; find the first candidate and verify bytes.
+        // Ranges are checked because the arrays may come from a file on disk.
+        if ((size_t)cur->first_child + cur->child_count > node_count_) return false;
+        uint32_t h = hash_label(buf + start, len);
+        const Node* lo = nodes_ + cur->first_child;
+        const Node* hi = lo + cur->child_count;
+        lo = std::lower_bound(lo, hi, h, [](const Node& a, uint32_t v) { return a.label_hash < v; });
+        const Node* next = nullptr;
+        for (; lo != hi && lo->label_hash == h; ++lo) {
+            if (lo->label_len == len && (size_t)lo->label_off + len <= pool_size_ &&
+                memcmp(pool_ + lo->label_off, buf + start, len) == 0) {
+                next = lo;
+                break;
+            }
+        }
+        if (!next) return false;
+        if (next->flags & kTerminal) {
+            if (entry) *entry = host.substr(start, n - start);
+            return true;
+        }
+        if (start == 0) return false;
+        cur = next;
+        end = start - 1;
+    }
+}
+
+bool DomainIndexBuilder::add(std::string_view domain) {
+    size_t b = 0, e = domain.size();
+    while (b < e && (domain[b] == ' ' || domain[b] == '\t')) ++b;
+    while (e > b && (domain[e - 1] == ' ' || domain[e - 1] == '\t' || domain[e - 1] == '\r' || domain[e - 1] == '.')) --e;
+    if (e - b >= 2 && domain[b] == '*' && domain[b + 1] == '.') b += 2;
+    while (b < e && domain[b] == '.') ++b;
+    if (b >= e || e - b > DomainIndex::kMaxNameLen) return false;
+
+    // Keys are stored with labels reversed and joined by \x01 so that a plain
+    // string sort keeps every domain right after its parent.
+    std::string key;
+    key.reserve(e - b);
+    size_t end = e;
+    while (true) {
+        size_t start = end;
+        while (start > b && domain[start - 1] != '.') --start;
+        if (start == end) return false; // empty label
+        if (!key.empty()) key.push_back('\x01');
+        for (size_t i = start; i < end; ++i) key.push_back(lower_ascii(domain[i]));
+        if (start == b) break;
+        end = start - 1;
+    }
+    domains_.push_back(std::move(key));
+    return true;
+}
+
+DomainIndex DomainIndexBuilder::build() {
+    struct TmpNode {
+        std::string_view label;
+        bool terminal = false;
+        std::vector<uint32_t> children;
+    };
+
+    std::sort(domains_.begin(), domains_.end());
+    domains_.erase(std::unique(domains_.begin(), domains_.end()), domains_.end());
+
+    std::vector<TmpNode> tmp(1);
+    std::vector<uint64_t> filterKeys;
+    for (const auto& key : domains_) {
+        uint32_t cur = 0;
+        size_t pos = 0;
+        bool covered = false;
+        uint64_t filterKey = DomainIndex::kRootKey;
+        while (pos <= key.size()) {
+            size_t sep = key.find('\x01', pos);
+            if (sep == std::string::npos) sep = key.size();
+            std::string_view label(key.data() + pos, sep - pos);
+            filterKey = DomainIndex::suffix_key(filterKey, label.data(), label.size());
+            // sorted input: an existing child with this label is always the last one added
+            auto& kids = tmp[cur].children;
+            if (!kids.empty() && tmp[kids.back()].label == label) {
+                cur = kids.back();
+            } else {
+                uint32_t idx = (uint32_t)tmp.size();
+                tmp[cur].children.push_back(idx);
+                tmp.push_back(TmpNode{label, false, {}});
+                cur = idx;
+            }
+            if (tmp[cur].terminal) { covered = true; break; }
+            pos = sep + 1;
+        }
+        if (!covered) {
+            tmp[cur].terminal = true;
+            filterKeys.push_back(filterKey);
+        }
+    }
+
+    DomainIndex idx;
+    std::unordered_map<std::string_view, uint32_t> interned;
+    auto intern = [&](std::string_view s) -> uint32_t {
+        auto it = interned.find(s);
+        if (it != interned.end()) return it->second;
+        uint32_t off = (uint32_t)idx.pool_storage_.size();
+        idx.pool_storage_.insert(idx.pool_storage_.end(), s.begin(), s.end());
+        interned.emplace(s, off);
+        return off;
+    };
+
+    // Breadth-first flatten so that siblings are contiguous.
+    idx.node_storage_.reserve(tmp.size());
+    idx.node_storage_.push_back(DomainIndex::Node{0, 0, 0, 0, 0, 0});
+    std::vector<std::pair<uint32_t, uint32_t>> queue; // (tmp index, out index)
+    queue.reserve(tmp.size());
+    queue.emplace_back(0, 0);
+    for (size_t qi = 0; qi < queue.size(); ++qi) {
+        uint32_t ti = queue[qi].first;
+        uint32_t oi = queue[qi].second;
+        auto kids = std::move(tmp[ti].children);
+        std::vector<std::pair<uint32_t, uint32_t>> order; // (hash, tmp index)
+        order.reserve(kids.size());
+        for (uint32_t k : kids) {
+            order.emplace_back(DomainIndex::hash_label(tmp[k].label.data(), tmp[k].label.size()), k);
+        }
+        std::sort(order.begin(), order.end(), [&](const auto& a, const auto& b) {
+            if (a.first != b.first) return a.first < b.first;
+            return tmp[a.second].label < tmp[b.second].label;
+        });
+        idx.node_storage_[oi].first_child = (uint32_t)idx.node_storage_.size();
+        idx.node_storage_[oi].child_count = (uint32_t)order.size();
+        for (const auto& o : order) {
+            const TmpNode& t = tmp[o.second];
+            DomainIndex::Node n{};
+            n.label_hash = o.first;
+            n.label_off = intern(t.label);
+            n.label_len = (uint16_t)t.label.size();
+            n.flags = t.terminal ? DomainIndex::kTerminal : 0;
+            if (t.terminal) ++idx.entries_;
+            queue.emplace_back(o.second, (uint32_t)idx.node_storage_.size());
+            idx.node_storage_.push_back(n);
+        }
+    }
+
+    idx.nodes_ = idx.node_storage_.data();
+    idx.node_count_ = idx.node_storage_.size();
+    idx.pool_ = idx.pool_storage_.data();
+    idx.pool_size_ = idx.pool_storage_.size();
+    idx.filter_ = FuseFilter::build(std::move(filterKeys));
+    domains_.clear();
+    domains_.shrink_to_fit();
+    return idx;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "fuse_filter.h"
+
+// Domain index shared by the DNS proxy, the HTTP proxy and the adblock engine.
+//
+// Blocked domains are stored as a trie keyed by reversed labels
+// ("ads.example.com" becomes com -> example -> ads). All nodes live in one
+// flat array with the children of a node stored contiguously and sorted by
+// (label hash, label), and all label bytes live in a single deduplicated
+// string pool. A lookup walks the query right to left one label at a time,
+// so its cost depends on the number of labels in the host and not on the
+// number of blocked entries, and a match can only happen on a label boundary.
+//
+// Most looked-up names are not blocked, so a FuseFilter over the hashes of
+// the blocked names is checked first, once per suffix of the query; only a
+// name with a suffix that may be in the index goes on to the trie.
+class DomainIndex {
+public:
+    struct Node {
+        uint32_t label_hash;
+        uint32_t label_off;    // offset of the label bytes in the string pool
+        uint32_t first_child;  // index of the first child in the node array
+        uint32_t child_count;
+        uint16_t label_len;
+        uint16_t flags;
+    };
+    static constexpr uint16_t kTerminal = 0x1;
+
+    // Longest name we will look at; anything longer is not a valid DNS name.
+    static constexpr size_t kMaxNameLen = 255;
+
+    DomainIndex() = default;
+    DomainIndex(DomainIndex&&) = default;
+    DomainIndex& operator=(DomainIndex&&) = default;
+    DomainIndex(const DomainIndex&) = delete;
+    DomainIndex& operator=(const DomainIndex&) = delete;
+
+    // True if host or any of its parent domains is in the index.
+    // Case-insensitive, ignores a trailing dot, never allocates. `entry`, if
+    // given, is set to the listed name that matched, as a suffix of `host`.
+    bool match(std::string_view host, std::string_view* entry = nullptr) const;
+
+    // Calls fn with every entry as a dotted name, in trie order.
+    void for_each(const std::function<void(std::string_view)>& fn) const;
+
+    bool empty() const { return entries_ == 0; }
+    size_t size() const { return entries_; }
+    size_t node_count() const { return node_count_; }
+    size_t memory_bytes() const { return node_count_ * sizeof(Node) + pool_size_ + filter_.memory_bytes(); }
+    const FuseFilter& filter() const { return filter_; }
+
+    const Node* nodes() const { return nodes_; }
+    const char* pool() const { return pool_; }
+    size_t pool_size() const { return pool_size_; }
+
+    // Wraps externally owned arrays (e.g. a mapped compiled blocklist) without
+    // copying. `backing` keeps that memory alive for the life of the index.
+    static DomainIndex from_view(const Node* nodes, size_t node_count, const char* pool, size_t pool_size,
+                                 size_t entries, FuseFilter filter, std::shared_ptr<const void> backing);
+
+    static uint32_t hash_label(const char* p, size_t n);
+
+    // Filter key of a name, built from the right one label at a time:
+    // suffix_key(suffix_key(kRootKey, "com"), "example") is "example.com".
+    static constexpr uint64_t kRootKey = 14695981039346656037ull;
+    static uint64_t suffix_key(uint64_t parent, const char* label, size_t n);
+
+private:
+    friend class DomainIndexBuilder;
+
+    const Node* nodes_ = nullptr;
+    size_t node_count_ = 0;
+    const char* pool_ = nullptr;
+    size_t pool_size_ = 0;
+    size_t entries_ = 0;
+    FuseFilter filter_;
+
+    std::vector<Node> node_storage_;
+    std::vector<char> pool_storage_;
+    std::shared_ptr<const void> backing_;
+};
+
+// Collects domains and flattens them into a DomainIndex. Entries that are
+// already covered by a blocked parent domain are dropped during build().
+class DomainIndexBuilder {
+public:
+    // Normalizes (lowercase, strips "*." / leading and trailing dots) and
+    // queues one domain. Returns false if nothing usable was left.
+    bool add(std::string_view domain);
+    size_t pending() const { return domains_.size(); }
+    DomainIndex build();
+
+private:
+    std::vector<std::string> domains_;
+};
@@ -0,0 +1,391 @@
+#include "event_log.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <jni.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+
+namespace {
+
+constexpr uint64_t kRingMask = kEventRingSize - 1;
+static_assert((kEventRingSize & kRingMask) == 0, "kEventRingSize must be a power of two");
+
+// Single producer (the owning thread), any number of drains under the
+// registry lock. Slots are three atomic words so that a drain racing an
+// overwrite reads stale values, never undefined ones.
+struct EventRing {
+    std::atomic<uint64_t> claimed{0};    // records the producer has started
+    std::atomic<uint64_t> published{0};  // records fully written
+    uint64_t drained = 0;                // next record to hand out; drain side only
+    std::atomic<uint64_t> slots[kEventRingSize][3] = {};
+};
+
+// Never destroyed, like the metrics shards.
+struct RingRegistry {
+    std::mutex lock;
+    std::vector<EventRing*> all;
+    std::vector<EventRing*> free;
+    size_t nextDrain = 0;  // ring the next drain starts at, so a small buffer is shared out fairly
+};
+
+RingRegistry& rings() {
+    static RingRegistry* r = new RingRegistry();
+    return *r;
+}
+
+thread_local EventRing* t_ring = nullptr;
+
+struct RingOwner {
+    EventRing* ring = nullptr;
+    ~RingOwner() {
+        if (!ring) return;
+        t_ring = nullptr;
+        RingRegistry& r = rings();
+        std::lock_guard<std::mutex> lk(r.lock);
+        r.free.push_back(ring);
+    }
+};
+
+thread_local RingOwner t_ringOwner;
+
+EventRing& ring_attach() {
+    RingRegistry& r = rings();
+    std::lock_guard<std::mutex> lk(r.lock);
+    EventRing* ring;
+    if (!r.free.empty()) {
+        ring = r.free.back();
+        r.free.pop_back();
+    } else {
+        ring = new EventRing();
+        r.all.push_back(ring);
+    }
+    t_ringOwner.ring = ring;
+    t_ring = ring;
+    return *ring;
+}
+
+uint64_t wall_us() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+// Open-addressing table from name hash to slot. A slot is claimed by CAS on
+// its key; the slot number is published after the name is in the arena.
+constexpr size_t kHostSlots = (size_t)kMaxEventHosts * 2;
+constexpr size_t kHostArenaBytes = 1u << 20;
+constexpr uint32_t kNoId = UINT32_MAX;  // key claimed but the table was full
+constexpr uint32_t kHostGenerations = 0xffff;  // 1..65535; 0 marks a table being reset
+constexpr size_t kHostTables = 3;  // current, previous, and the next one to reset
+static_assert(kHostGenerations % kHostTables == 0, "generations must wrap onto the same table order");
+
+struct HostTable {
+    std::atomic<uint64_t> keys[kHostSlots] = {};
+    std::atomic<uint32_t> ids[kHostSlots] = {};
+    // slot -> offset of its length byte in `arena`; 0 until the name is written
+    std::atomic<uint32_t> names[kMaxEventHosts + 1] = {};
+    std::atomic<uint32_t> nextId{1};
+    std::atomic<uint32_t> arenaUsed{1};  // arena[0] is the empty name
+    // Threads inside the table. A reset first clears `gen`, then waits for
+    // this to drain; users check `gen` after announcing themselves.
+    std::atomic<uint32_t> users{0};
+    std::atomic<uint32_t> gen{0};
+    char arena[kHostArenaBytes];  // left uninitialized: pages are touched as names arrive
+
+    HostTable() { arena[0] = 0; }
+
+    void reset() {
+        for (auto& k : keys) k.store(0, std::memory_order_relaxed);
+        for (auto& i : ids) i.store(0, std::memory_order_relaxed);
+        for (auto& n : names) n.store(0, std::memory_order_relaxed);
+        nextId.store(1, std::memory_order_relaxed);
+        arenaUsed.store(1, std::memory_order_relaxed);
+    }
+};
+
+// Never destroyed; tables are allocated as generations first reach them and
+// then reused round robin.
+struct HostTables {
+    std::atomic<uint32_t> current{1};
+    std::atomic<HostTable*> tables[kHostTables] = {};
+    std::mutex rotateLock;
+
+    HostTables() {
+        HostTable* t = new HostTable;
+        t->gen.store(1, std::memory_order_relaxed);
+        tables[1 % kHostTables].store(t, std::memory_order_release);
+    }
+};
+
+HostTables& hosts() {
+    static HostTables* t = new HostTables;
+    return *t;
+}
+
+uint32_t gen_of(uint32_t id) { return id >> kEventHostGenShift; }
+uint32_t slot_of(uint32_t id) { return id & ((1u << kEventHostGenShift) - 1); }
+
+// Holds a table open at one generation, or nothing if that generation is
+// gone or being reset.
+class TableRef {
+public:
+    explicit TableRef(uint32_t gen) {
+        if (gen == 0 || gen > kHostGenerations) return;
+        HostTable* t = hosts().tables[gen % kHostTables].load(std::memory_order_acquire);
+        if (!t) return;
+        t->users.fetch_add(1, std::memory_order_seq_cst);
+        if (t->gen.load(std::memory_order_seq_cst) != gen) {
+            t->users.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+        t_ = t;
+    }
+    ~TableRef() {
+        if (t_) t_->users.fetch_sub(1, std::memory_order_release);
+    }
+    TableRef(const TableRef&) = delete;
+    TableRef& operator=(const TableRef&) = delete;
+
+    HostTable* get() const { return t_; }
+
+private:
+    HostTable* t_ = nullptr;
+};
+
+// Moves interning on from a full generation `gen`, resetting the table two
+// generations back. Rare, so a lock; whoever lost the race finds it done.
+void rotate(uint32_t gen) {
+    HostTables& h = hosts();
+    std::lock_guard<std::mutex> lk(h.rotateLock);
+    if (h.current.load(std::memory_order_acquire) != gen) return;
+    uint32_t next = gen == kHostGenerations ? 1 : gen + 1;
+    std::atomic<HostTable*>& slot = h.tables[next % kHostTables];
+    HostTable* t = slot.load(std::memory_order_acquire);
+    if (!t) {
+        t = new HostTable;
+    } else {
+        // readers of the recycled generation let go within a few stores
+        t->gen.store(0, std::memory_order_seq_cst);
+        while (t->users.load(std::memory_order_seq_cst) != 0) std::this_thread::yield();
+        t->reset();
+    }
+    t->gen.store(next, std::memory_order_release);
+    slot.store(t, std::memory_order_release);
+    h.current.store(next, std::memory_order_release);
+}
+
+uint64_t name_hash(const char* s, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= (uint8_t)s[i];
+        h *= 0x100000001b3ull;
+    }
+    return h | 1;  // 0 marks a free slot
+}
+
+// Stores the name for a fresh slot.
+void publish_name(HostTable& t, uint32_t id, const char* s, size_t n) {
+    uint32_t off = t.arenaUsed.fetch_add((uint32_t)n + 1, std::memory_order_relaxed);
+    if ((size_t)off + n + 1 > kHostArenaBytes) {
+        off = 0;
+    } else {
+        t.arena[off] = (char)(uint8_t)n;
+        memcpy(t.arena + off + 1, s, n);
+    }
+    t.names[id].store(off + 1, std::memory_order_release);
+}
+
+// Slot of the name in `t`, or kNoId if the table is full.
+uint32_t intern(HostTable& t, const char* buf, size_t n) {
+    uint64_t h = name_hash(buf, n);
+    for (size_t probe = 0, i = h & (kHostSlots - 1); probe < kHostSlots; ++probe, i = (i + 1) & (kHostSlots - 1)) {
+        uint64_t k = t.keys[i].load(std::memory_order_acquire);
+        if (k == 0) {
+            if (t.nextId.load(std::memory_order_relaxed) > kMaxEventHosts
+                || t.arenaUsed.load(std::memory_order_relaxed) + n + 1 > kHostArenaBytes) {
+                return kNoId;
+            }
+            if (!t.keys[i].compare_exchange_strong(k, h, std::memory_order_acq_rel)) {
+                if (k != h) continue;
+            } else {
+                uint32_t id = t.nextId.fetch_add(1, std::memory_order_relaxed);
+                if (id > kMaxEventHosts) {
+                    t.ids[i].store(kNoId, std::memory_order_release);
+                    return kNoId;
+                }
+                publish_name(t, id, buf, n);
+                t.ids[i].store(id, std::memory_order_release);
+                return id;
+            }
+        } else if (k != h) {
+            continue;
+        }
+        // same hash: another thread may still be publishing the id, which
+        // takes it a few stores
+        while (true) {
+            uint32_t id = t.ids[i].load(std::memory_order_acquire);
+            if (id != 0) return id;
+            std::this_thread::yield();
+        }
+    }
+    return kNoId;
+}
+
+std::string_view slot_name(const HostTable& t, uint32_t slot) {
+    if (slot == 0 || slot > kMaxEventHosts) return {};
+    uint32_t off = t.names[slot].load(std::memory_order_acquire);
+    if (off == 0) return {};
+    return std::string_view(t.arena + off, (uint8_t)t.arena[off - 1]);
+}
+
+} // namespace
+
+uint32_t event_host_id(std::string_view host) {
+    size_t n = host.size();
+    while (n > 0 && host[n - 1] == '.') --n;
+    if (n == 0 || n > 255) return 0;
+    char buf[255];
+    for (size_t i = 0; i < n; ++i) {
+        char c = host[i];
+        buf[i] = c >= 'A' && c <= 'Z' ? (char)(c + 32) : c;
+    }
+    // a full generation is rotated out and the name interned in the next;
+    // the second miss can only come from another rotation racing this one
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        uint32_t gen = hosts().current.load(std::memory_order_acquire);
+        uint32_t slot;
+        {
+            TableRef ref(gen);
+            if (!ref.get()) continue;
+            slot = intern(*ref.get(), buf, n);
+        }
+        if (slot != kNoId) return gen << kEventHostGenShift | slot;
+        rotate(gen);
+    }
+    return 0;
+}
+
+std::string event_host_name(uint32_t id) {
+    TableRef ref(gen_of(id));
+    if (!ref.get()) return {};
+    return std::string(slot_name(*ref.get(), slot_of(id)));
+}
+
+uint32_t event_host_generation() {
+    return hosts().current.load(std::memory_order_acquire);
+}
+
+void event_log_record(EventComponent component, EventKind kind, uint32_t hostId, EventVerdict verdict,
+                      uint32_t ruleId, uint32_t latencyUs) {
+    EventRing* ring = t_ring;
+    if (!ring) ring = &ring_attach();
+    uint64_t n = ring->published.load(std::memory_order_relaxed);
+    // announce the overwrite before touching the slot (seqlock writer)
+    ring->claimed.store(n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::atomic<uint64_t>* s = ring->slots[n & kRingMask];
+    s[0].store(wall_us(), std::memory_order_relaxed);
+    s[1].store((uint64_t)hostId | (uint64_t)ruleId << 32, std::memory_order_relaxed);
+    s[2].store((uint64_t)latencyUs | (uint64_t)component << 32 | (uint64_t)kind << 40 | (uint64_t)verdict << 48,
+               std::memory_order_relaxed);
+    ring->published.store(n + 1, std::memory_order_release);
+}
+
+size_t event_log_drain(EventRecord* out, size_t max, uint64_t* overwritten) {
+    RingRegistry& r = rings();
+    std::lock_guard<std::mutex> lk(r.lock);
+    size_t got = 0;
+    uint64_t lost = 0;
+    size_t count = r.all.size();
+    for (size_t k = 0; k < count && got < max; ++k) {
+        EventRing& ring = *r.all[(r.nextDrain + k) % count];
+        uint64_t pub = ring.published.load(std::memory_order_acquire);
+        uint64_t from = ring.drained;
+        if (pub - from > kEventRingSize) {
+            lost += pub - from - kEventRingSize;
+            from = pub - kEventRingSize;
+        }
+        uint64_t to = std::min<uint64_t>(pub, from + (max - got));
+        for (uint64_t i = from; i < to; ++i) {
+            const std::atomic<uint64_t>* s = ring.slots[i & kRingMask];
+            uint64_t w0 = s[0].load(std::memory_order_relaxed);
+            uint64_t w1 = s[1].load(std::memory_order_relaxed);
+            uint64_t w2 = s[2].load(std::memory_order_relaxed);
+            EventRecord& e = out[got + (i - from)];
+            e.timeUs = w0;
+            e.hostId = (uint32_t)w1;
+            e.ruleId = (uint32_t)(w1 >> 32);
+            e.latencyUs = (uint32_t)w2;
+            e.component = (uint8_t)(w2 >> 32);
+            e.kind = (uint8_t)(w2 >> 40);
+            e.verdict = (uint8_t)(w2 >> 48);
+            e.reserved = 0;
+        }
+        // records the producer has since started overwriting may be torn
+        std::atomic_thread_fence(std::memory_order_acquire);
+        uint64_t claimed = ring.claimed.load(std::memory_order_relaxed);
+        uint64_t firstIntact = claimed > kEventRingSize ? claimed - kEventRingSize : 0;
+        if (firstIntact > from) {
+            uint64_t keepFrom = std::min(firstIntact, to);
+            lost += firstIntact - from;
+            memmove(out + got, out + got + (keepFrom - from), (size_t)(to - keepFrom) * sizeof(EventRecord));
+            got += (size_t)(to - keepFrom);
+            ring.drained = std::max(firstIntact, to);
+        } else {
+            got += (size_t)(to - from);
+            ring.drained = to;
+        }
+    }
+    if (count > 0) r.nextDrain = (r.nextDrain + 1) % count;
+    if (overwritten) *overwritten = lost;
+    return got;
+}
+
+// Fills the direct `buffer` with as many EventRecords (24 bytes each, native
+// byte order) as fit; returns the count or -1 if the buffer is not direct.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_adblocker_native_NativeProxy_drainEvents(JNIEnv* env, jclass clazz, jobject buffer) {
+    void* addr = buffer ? env->GetDirectBufferAddress(buffer) : nullptr;
+    jlong cap = buffer ? env->GetDirectBufferCapacity(buffer) : -1;
+    if (!addr || cap < 0) return -1;
+    uint64_t lost = 0;
+    size_t n = event_log_drain(static_cast<EventRecord*>(addr), (size_t)cap / sizeof(EventRecord), &lost);
+    if (lost) metric_add(Metric::EventsOverwritten, lost);
+    return (jint)n;
+}
+
+// Names of host ids fromId, fromId + 1, ... of fromId's generation, packed
+// into the direct `buffer` as a 4-byte big-endian length then UTF-8. Returns
+// how many were written, stopping early at a name still being published; 0
+// once the generation is recycled, -1 if not direct.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_example_adblocker_native_NativeProxy_drainEventHosts(JNIEnv* env, jclass clazz, jint fromId, jobject buffer) {
+    uint8_t* p = buffer ? static_cast<uint8_t*>(env->GetDirectBufferAddress(buffer)) : nullptr;
+    jlong cap = buffer ? env->GetDirectBufferCapacity(buffer) : -1;
+    if (!p || cap < 0 || slot_of((uint32_t)fromId) < 1) return -1;
+    uint8_t* end = p + cap;
+    TableRef ref(gen_of((uint32_t)fromId));
+    const HostTable* t = ref.get();
+    if (!t) return 0;
+    uint32_t last = std::min(t->nextId.load(std::memory_order_relaxed) - 1, kMaxEventHosts);
+    jint written = 0;
+    for (uint32_t slot = slot_of((uint32_t)fromId); slot <= last; ++slot) {
+        if (t->names[slot].load(std::memory_order_acquire) == 0) break;
+        std::string_view name = slot_name(*t, slot);
+        if ((size_t)(end - p) < 4 + name.size()) break;
+        uint32_t n = (uint32_t)name.size();
+        p[0] = (uint8_t)(n >> 24);
+        p[1] = (uint8_t)(n >> 16);
+        p[2] = (uint8_t)(n >> 8);
+        p[3] = (uint8_t)n;
+        memcpy(p + 4, name.data(), n);
+        p += 4 + n;
+        ++written;
+    }
+    return written;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Recent-request log for LogsActivity, drained through
+// NativeProxy.drainEvents().
+//
+// Every recording thread appends fixed-size records to a ring of its own.
+// Recording takes no lock and never waits: when the ring is full the oldest
+// records are overwritten. A drain copies each ring out and then checks that
+// the producer has not claimed the slots it just read, so torn records are
+// dropped instead of returned. Rings are allocated once per thread and
+// reused after the thread exits.
+//
+// Hosts are interned into a process-wide table, so a record carries a 32-bit
+// id instead of the name: the table's generation in the high 16 bits and a
+// slot from 1 to kMaxEventHosts in the low ones. When a generation fills up
+// (random subdomains do that quickly), interning moves on to a fresh one.
+// The previous generation stays readable, so a reader that is one turn
+// behind still resolves its ids; older ones resolve to nothing.
+
+enum class EventComponent : uint8_t {
+    DnsProxy = 1,
+    HttpProxy = 2,
+    Tun = 3,
+};
+
+enum class EventKind : uint8_t {
+    Dns = 1,   // a query; the host is the question name
+    Http = 2,  // Host header
+    Tls = 3,   // ClientHello SNI
+};
+
+enum class EventVerdict : uint8_t {
+    Allowed = 0,  // forwarded or connected
+    Blocked = 1,
+    Cached = 2,   // answered from the DNS cache
+    Failed = 3,   // upstream timeout or no connection
+};
+
+// As written by drainEvents(), in native byte order.
+struct EventRecord {
+    uint64_t timeUs;     // wall clock, microseconds since the epoch
+    uint32_t hostId;
+    uint32_t ruleId;     // host id of the blocklist entry that matched, 0 if none
+    uint32_t latencyUs;  // upstream round trip or connect time; 0 when answered locally
+    uint8_t component;   // EventComponent
+    uint8_t kind;        // EventKind
+    uint8_t verdict;     // EventVerdict
+    uint8_t reserved;
+};
+static_assert(sizeof(EventRecord) == 24, "drainEvents() record layout");
+
+static constexpr size_t kEventRingSize = 2048;  // records per thread, power of two
+static constexpr uint32_t kMaxEventHosts = 1u << 15;  // per generation
+static constexpr uint32_t kEventHostGenShift = 16;
+
+// Interns `host` (lower-cased, trailing dot dropped); 0 if the name is empty
+// or too long.
+uint32_t event_host_id(std::string_view host);
+
+void event_log_record(EventComponent component, EventKind kind, uint32_t hostId, EventVerdict verdict,
+                      uint32_t ruleId = 0, uint32_t latencyUs = 0);
+
+// Interns the host and, for blocks, the matched blocklist entry.
+inline void event_log(EventComponent component, EventKind kind, std::string_view host, EventVerdict verdict,
+                      std::string_view ruleEntry = {}, uint32_t latencyUs = 0) {
+    event_log_record(component, kind, event_host_id(host), verdict,
+                     ruleEntry.empty() ? 0 : event_host_id(ruleEntry), latencyUs);
+}
+
+// Copies up to `max` records not drained before into `out`, oldest first
+// per thread. `overwritten` gets the number lost to full rings since the
+// last drain. Safe against concurrent recording; drains are serialized.
+size_t event_log_drain(EventRecord* out, size_t max, uint64_t* overwritten);
+
+// Name of host id `id`, or empty if unknown or its generation was recycled.
+std::string event_host_name(uint32_t id);
+
+// Generation new ids are handed out from.
+uint32_t event_host_generation();
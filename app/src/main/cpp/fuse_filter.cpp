@@ -0,0 +1,137 @@
+#include "fuse_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+static constexpr int kMaxAttempts = 100;
+static constexpr uint32_t kFpProbes = 1u << 20;
+
+static uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+FuseFilter FuseFilter::build(std::vector<uint64_t> keys) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    FuseFilter f;
+    uint32_t size = (uint32_t)keys.size();
+    if (size == 0) return f;
+
+    // Sizing as in the reference implementation for arity 3.
+    uint32_t segLen = size == 1 ? 4 : 1u << (int)std::floor(std::log((double)size) / std::log(3.33) + 2.25);
+    segLen = std::min<uint32_t>(segLen, 1u << 18);
+    double factor = size <= 1 ? 0.0 : std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log((double)size));
+    int64_t capacity = size <= 1 ? 0 : (int64_t)std::llround(size * factor);
+    int64_t segCount = (capacity + segLen - 1) / segLen - 2;
+    if (segCount < 1) segCount = 1;
+    Params& p = f.params_;
+    p.segment_length = segLen;
+    p.segment_count_length = (uint32_t)segCount * segLen;
+    p.array_length = (uint32_t)(segCount + 2) * segLen;
+
+    uint32_t cap = p.array_length;
+    std::vector<uint64_t> order(size + 1);  // hashes, grouped by segment, then in peel order
+    std::vector<uint8_t> count(cap);        // (keys on slot << 2) | xor of their slot numbers
+    std::vector<uint64_t> xorHash(cap);     // xor of the hashes of keys on slot
+    std::vector<uint32_t> alone(cap);
+    std::vector<uint8_t> slotOf(size);      // which of its three slots a peeled key owns
+    uint32_t blockBits = 1;
+    while ((1ull << blockBits) < (uint64_t)segCount) ++blockBits;
+    uint32_t blocks = 1u << blockBits;
+    std::vector<uint32_t> start(blocks);
+
+    uint64_t rng = 0x726b2b9d438b9d4dull;
+    bool built = false;
+    for (int attempt = 0; attempt < kMaxAttempts && !built; ++attempt) {
+        p.seed = splitmix64(&rng);
+        std::fill(order.begin(), order.end(), 0);
+        order[size] = 1;
+        std::fill(count.begin(), count.end(), 0);
+        std::fill(xorHash.begin(), xorHash.end(), 0);
+
+        // Bucket the hashes by their high bits, which pick the segment, so
+        // that the counting pass below walks the arrays mostly in order.
+        for (uint32_t i = 0; i < blocks; ++i) start[i] = (uint32_t)(((uint64_t)i * size) >> blockBits);
+        for (uint64_t k : keys) {
+            uint64_t h = mix(k + p.seed);
+            uint32_t b = (uint32_t)(h >> (64 - blockBits));
+            while (order[start[b]] != 0) b = (b + 1) & (blocks - 1);
+            order[start[b]++] = h;
+        }
+        bool overflow = false;
+        for (uint32_t i = 0; i < size; ++i) {
+            uint64_t h = order[i];
+            uint32_t s[3];
+            f.positions(h, &s[0], &s[1], &s[2]);
+            for (uint8_t j = 0; j < 3; ++j) {
+                count[s[j]] = (uint8_t)((count[s[j]] + 4) ^ j);
+                xorHash[s[j]] ^= h;
+                overflow = overflow || count[s[j]] < 4;  // more than 63 keys on one slot
+            }
+        }
+        if (overflow) continue;
+
+        // Peel: a slot with one key left is that key's to set.
+        uint32_t queued = 0;
+        for (uint32_t i = 0; i < cap; ++i) {
+            alone[queued] = i;
+            queued += (count[i] >> 2) == 1 ? 1 : 0;
+        }
+        uint32_t peeled = 0;
+        while (queued > 0) {
+            uint32_t i = alone[--queued];
+            if ((count[i] >> 2) != 1) continue;
+            uint64_t h = xorHash[i];
+            uint32_t s[3];
+            f.positions(h, &s[0], &s[1], &s[2]);
+            uint8_t found = count[i] & 3;
+            slotOf[peeled] = found;
+            order[peeled++] = h;
+            for (uint8_t j = 0; j < 3; ++j) {
+                if (j == found) continue;
+                uint32_t o = s[j];
+                alone[queued] = o;
+                queued += (count[o] >> 2) == 2 ? 1 : 0;
+                count[o] = (uint8_t)((count[o] - 4) ^ j);
+                xorHash[o] ^= h;
+            }
+        }
+        built = peeled == size;
+    }
+    if (!built) return FuseFilter();
+
+    // Assign in reverse peel order, so each key's slot is set after the
+    // other two slots it reads are final.
+    f.storage_.assign(cap, 0);
+    for (uint32_t i = size; i-- > 0;) {
+        uint64_t h = order[i];
+        uint32_t s[3];
+        f.positions(h, &s[0], &s[1], &s[2]);
+        uint8_t found = slotOf[i];
+        f.storage_[s[found]] = (uint16_t)(fingerprint(h) ^ f.storage_[s[(found + 1) % 3]] ^ f.storage_[s[(found + 2) % 3]]);
+    }
+    f.fp_ = f.storage_.data();
+
+    // Keys drawn at random are all but certainly outside the set.
+    uint64_t probe = p.seed ^ 0x5851f42d4c957f2dull;
+    uint32_t hits = 0;
+    for (uint32_t i = 0; i < kFpProbes; ++i) hits += f.contains(splitmix64(&probe)) ? 1 : 0;
+    p.fp_per_million = (uint32_t)((uint64_t)hits * 1000000 / kFpProbes);
+    return f;
+}
+
+FuseFilter FuseFilter::from_view(const Params& params, const uint16_t* fingerprints, size_t count) {
+    FuseFilter f;
+    uint64_t seg = params.segment_length;
+    if (seg == 0 || (seg & (seg - 1)) != 0 || params.segment_count_length == 0
+        || params.segment_count_length % seg != 0 || params.array_length != params.segment_count_length + 2 * seg
+        || params.array_length > count) {
+        return f;
+    }
+    f.params_ = params;
+    f.fp_ = fingerprints;
+    return f;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Binary fuse filter (Graf & Lemire, 2022) over 64-bit keys.
+//
+// A static set-membership filter: contains() is never wrong for a key that
+// was in the set, and says yes to any other key with probability about
+// 2^-16. Each key costs about 2.25 bytes of 16-bit fingerprints, and a lookup
+// reads three of them from within a small window of the array, so a miss
+// costs a hash and a few cache lines.
+//
+// Used by DomainIndex to answer most lookups for names that are not blocked
+// without walking the trie.
+class FuseFilter {
+public:
+    // Everything needed to interpret the fingerprint array; stored as is in
+    // the compiled blocklist.
+    struct Params {
+        uint64_t seed = 0;
+        uint32_t segment_length = 0;        // power of two
+        uint32_t segment_count_length = 0;  // segment_length * segment count
+        uint32_t array_length = 0;          // fingerprints
+        uint32_t fp_per_million = 0;        // false positives measured at build time
+    };
+
+    FuseFilter() = default;
+    FuseFilter(FuseFilter&&) = default;
+    FuseFilter& operator=(FuseFilter&&) = default;
+    FuseFilter(const FuseFilter&) = delete;
+    FuseFilter& operator=(const FuseFilter&) = delete;
+
+    // Builds a filter over `keys` (duplicates allowed). Returns an empty
+    // filter if there are none or construction keeps failing.
+    static FuseFilter build(std::vector<uint64_t> keys);
+
+    // Wraps an externally owned fingerprint array, e.g. in a mapped file.
+    // Returns an empty filter if `params` do not fit `count` fingerprints.
+    static FuseFilter from_view(const Params& params, const uint16_t* fingerprints, size_t count);
+
+    // An empty filter contains everything: callers fall back to the exact index.
+    bool empty() const { return params_.array_length == 0; }
+
+    bool contains(uint64_t key) const {
+        if (empty()) return true;
+        uint64_t h = mix(key + params_.seed);
+        uint32_t i0, i1, i2;
+        positions(h, &i0, &i1, &i2);
+        return (uint16_t)(fingerprint(h) ^ fp_[i0] ^ fp_[i1] ^ fp_[i2]) == 0;
+    }
+
+    const Params& params() const { return params_; }
+    const uint16_t* fingerprints() const { return fp_; }
+    size_t memory_bytes() const { return (size_t)params_.array_length * sizeof(uint16_t); }
+    // Measured share of non-member keys that pass, in parts per million.
+    uint32_t fp_per_million() const { return params_.fp_per_million; }
+
+private:
+    static uint64_t mix(uint64_t h) {
+        // murmur3 finalizer
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+    static uint16_t fingerprint(uint64_t h) { return (uint16_t)(h ^ (h >> 32)); }
+
+    // The key's three slots: one in each of three consecutive segments.
+    void positions(uint64_t h, uint32_t* i0, uint32_t* i1, uint32_t* i2) const {
+        uint32_t mask = params_.segment_length - 1;
+        // high half of h * segment_count_length, without 128-bit types (32-bit ABIs)
+        uint64_t n = params_.segment_count_length;
+        uint32_t h0 = (uint32_t)(((h >> 32) * n + (((h & 0xffffffffu) * n) >> 32)) >> 32);
+        *i0 = h0;
+        *i1 = (h0 + params_.segment_length) ^ ((uint32_t)(h >> 18) & mask);
+        *i2 = (h0 + 2 * params_.segment_length) ^ ((uint32_t)h & mask);
+    }
+
+    Params params_;
+    const uint16_t* fp_ = nullptr;
+    std::vector<uint16_t> storage_;
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+// Host (Linux) stand-in for the NDK's <android/log.h>, used by the host build
+// profile in CMakeLists.txt. Messages go to stderr; below ANDROID_LOG_WARN
+// they are dropped unless ADBLOCK_LOG=verbose is set, so per-request logging
+// does not drown a benchmark.
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+enum android_LogPriority {
+    ANDROID_LOG_UNKNOWN = 0,
+    ANDROID_LOG_DEFAULT,
+    ANDROID_LOG_VERBOSE,
+    ANDROID_LOG_DEBUG,
+    ANDROID_LOG_INFO,
+    ANDROID_LOG_WARN,
+    ANDROID_LOG_ERROR,
+    ANDROID_LOG_FATAL,
+    ANDROID_LOG_SILENT,
+};
+
+inline int __android_log_print(int prio, const char* tag, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+inline int __android_log_print(int prio, const char* tag, const char* fmt, ...) {
+    static const int minPrio = [] {
+        const char* v = getenv("ADBLOCK_LOG");
+        return v && strcmp(v, "verbose") == 0 ? (int)ANDROID_LOG_VERBOSE : (int)ANDROID_LOG_WARN;
+    }();
+    if (prio < minPrio) return 0;
+    static const char kLevels[] = "??VDIWEFS";
+    char line[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    return fprintf(stderr, "%c/%s: %s\n", kLevels[prio < 0 || prio > ANDROID_LOG_SILENT ? 0 : prio], tag, line);
+}
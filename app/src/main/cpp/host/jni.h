@@ -0,0 +1,132 @@
+#pragma once
+
+// Host (Linux) stand-in for <jni.h>, used by the host build profile in
+// CMakeLists.txt so the JNI entry points can be called from a plain C++
+// program such as bench/native_bench.cpp.
+//
+// Only what the native sources use is declared. Java objects are ordinary
+// C++ objects owned by the caller: there are no references, no garbage
+// collection and no pending exceptions, and DeleteLocalRef does nothing.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define JNIEXPORT __attribute__((visibility("default")))
+#define JNICALL
+#define JNI_FALSE 0
+#define JNI_TRUE 1
+
+typedef uint8_t jboolean;
+typedef int8_t jbyte;
+typedef uint16_t jchar;
+typedef int16_t jshort;
+typedef int32_t jint;
+typedef int64_t jlong;
+typedef float jfloat;
+typedef double jdouble;
+typedef jint jsize;
+
+class _jobject {
+public:
+    virtual ~_jobject() = default;
+};
+class _jclass : public _jobject {};
+class _jarray : public _jobject {};
+
+// java.lang.String, kept as UTF-8.
+class _jstring : public _jobject {
+public:
+    explicit _jstring(std::string s) : utf(std::move(s)) {}
+    std::string utf;
+};
+
+class _jobjectArray : public _jarray {
+public:
+    std::vector<_jobject*> items;
+};
+
+class _jlongArray : public _jarray {
+public:
+    std::vector<jlong> items;
+};
+
+// A java.nio.ByteBuffer from allocateDirect(), over caller-owned memory.
+class _jdirectBuffer : public _jobject {
+public:
+    _jdirectBuffer(void* a, jlong c) : addr(a), capacity(c) {}
+    void* addr;
+    jlong capacity;
+};
+
+typedef _jobject* jobject;
+typedef _jclass* jclass;
+typedef _jstring* jstring;
+typedef _jarray* jarray;
+typedef _jobjectArray* jobjectArray;
+typedef _jlongArray* jlongArray;
+
+struct _JNIEnv {
+    const char* GetStringUTFChars(jstring s, jboolean* isCopy) {
+        if (isCopy) *isCopy = JNI_FALSE;
+        return s ? s->utf.c_str() : nullptr;
+    }
+    void ReleaseStringUTFChars(jstring, const char*) {}
+    jsize GetStringUTFLength(jstring s) { return (jsize)s->utf.size(); }
+
+    // Lengths and offsets in UTF-16 code units, as in Java.
+    jsize GetStringLength(jstring s) {
+        jsize n = 0;
+        for (unsigned char c : s->utf) {
+            if ((c & 0xc0) != 0x80) n += c >= 0xf0 ? 2 : 1;
+        }
+        return n;
+    }
+    void GetStringUTFRegion(jstring s, jsize start, jsize len, char* buf) {
+        const std::string& u = s->utf;
+        size_t i = 0, b = 0;
+        jsize unit = 0;
+        while (i < u.size() && unit < start + len) {
+            unsigned char c = (unsigned char)u[i];
+            size_t n = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : c >= 0xc0 ? 2 : 1;
+            if (unit >= start) {
+                memcpy(buf + b, u.data() + i, n);
+                b += n;
+            }
+            unit += c >= 0xf0 ? 2 : 1;
+            i += n;
+        }
+        buf[b] = '\0';
+    }
+
+    jsize GetArrayLength(jarray a) {
+        if (auto* o = dynamic_cast<_jobjectArray*>(a)) return (jsize)o->items.size();
+        if (auto* l = dynamic_cast<_jlongArray*>(a)) return (jsize)l->items.size();
+        return 0;
+    }
+    jobject GetObjectArrayElement(jobjectArray a, jsize i) { return a->items[(size_t)i]; }
+    void DeleteLocalRef(jobject) {}
+
+    void* GetDirectBufferAddress(jobject buf) {
+        auto* d = dynamic_cast<_jdirectBuffer*>(buf);
+        return d ? d->addr : nullptr;
+    }
+    jlong GetDirectBufferCapacity(jobject buf) {
+        auto* d = dynamic_cast<_jdirectBuffer*>(buf);
+        return d ? d->capacity : -1;
+    }
+
+    // The caller deletes the array.
+    jlongArray NewLongArray(jsize n) {
+        auto* a = new _jlongArray();
+        a->items.assign((size_t)n, 0);
+        return a;
+    }
+    void SetLongArrayRegion(jlongArray a, jsize start, jsize len, const jlong* v) {
+        std::copy(v, v + len, a->items.begin() + start);
+    }
+};
+typedef _JNIEnv JNIEnv;
@@ -0,0 +1,113 @@
+#include "http_parser.h"
+
+#include <cstring>
+
+static inline char lower(char c) {
+    return (c >= 'A' && c <= 'Z') ? (char)(c + 32) : c;
+}
+
+bool http_name_equals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (lower(a[i]) != lower(b[i])) return false;
+    }
+    return true;
+}
+
+size_t http_find_head_end(const char* data, size_t len, size_t* scanned) {
+    size_t pos = *scanned;
+    while (pos < len) {
+        // memchr is vectorized in libc; '\n' is rare enough that it skips whole lines at once
+        const char* nl = (const char*)memchr(data + pos, '\n', len - pos);
+        if (!nl) {
+            *scanned = len;
+            return 0;
+        }
+        size_t i = (size_t)(nl - data);
+        if (i + 1 >= len) {
+            *scanned = i;
+            return 0;
+        }
+        if (data[i + 1] == '\n') return i + 2;  // bare LF, tolerated
+        if (data[i + 1] == '\r') {
+            if (i + 2 >= len) {
+                *scanned = i;
+                return 0;
+            }
+            if (data[i + 2] == '\n') return i + 3;
+        }
+        pos = i + 1;
+    }
+    *scanned = len;
+    return 0;
+}
+
+// Next line in [pos, end) without its CRLF; advances pos past the LF.
+static std::string_view next_line(const char* data, size_t end, size_t* pos) {
+    size_t start = *pos;
+    const char* nl = (const char*)memchr(data + start, '\n', end - start);
+    size_t stop = nl ? (size_t)(nl - data) : end;
+    *pos = nl ? stop + 1 : end;
+    if (stop > start && data[stop - 1] == '\r') --stop;
+    return std::string_view(data + start, stop - start);
+}
+
+static std::string_view trim(std::string_view v) {
+    while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+    while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+    return v;
+}
+
+// Authority of an absolute-form target ("http://user@host:port/path"), or empty.
+static std::string_view absolute_authority(std::string_view target) {
+    size_t scheme = target.find("://");
+    if (scheme == std::string_view::npos || scheme == 0 || scheme > 8) return {};
+    std::string_view rest = target.substr(scheme + 3);
+    size_t stop = rest.find_first_of("/?#");
+    if (stop != std::string_view::npos) rest = rest.substr(0, stop);
+    size_t at = rest.rfind('@');
+    if (at != std::string_view::npos) rest = rest.substr(at + 1);
+    return rest;
+}
+
+HttpParseResult http_parse_request(const char* data, size_t len, size_t* scanned, HttpRequestHead* out) {
+    size_t end = http_find_head_end(data, len, scanned);
+    if (!end) return HttpParseResult::Incomplete;
+    out->headEnd = end;
+    out->headerCount = 0;
+    out->host = {};
+
+    size_t pos = 0;
+    std::string_view line = next_line(data, end, &pos);
+    size_t sp1 = line.find(' ');
+    size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if (sp1 == 0 || sp2 == std::string_view::npos || sp2 == sp1 + 1) return HttpParseResult::Invalid;
+    out->method = line.substr(0, sp1);
+    out->target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    out->version = line.substr(sp2 + 1);
+    for (char c : out->method) {
+        if (c < 'A' || c > 'Z') return HttpParseResult::Invalid;
+    }
+    if (out->version.substr(0, 7) != "HTTP/1.") return HttpParseResult::Invalid;
+
+    std::string_view hostHeader;
+    while (pos < end) {
+        line = next_line(data, end, &pos);
+        if (line.empty()) break;
+        if (line.front() == ' ' || line.front() == '\t') return HttpParseResult::Invalid;  // obs-fold
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) return HttpParseResult::Invalid;
+        std::string_view name = line.substr(0, colon);
+        if (name.back() == ' ' || name.back() == '\t') return HttpParseResult::Invalid;
+        std::string_view value = trim(line.substr(colon + 1));
+        if (out->headerCount < HttpRequestHead::kMaxHeaders) {
+            out->headers[out->headerCount++] = HttpHeader{name, value};
+        }
+        if (hostHeader.empty() && http_name_equals(name, "host")) hostHeader = value;
+    }
+
+    if (out->method == "CONNECT") out->host = out->target;
+    else out->host = absolute_authority(out->target);
+    if (out->host.empty()) out->host = hostHeader;
+    return HttpParseResult::Complete;
+}
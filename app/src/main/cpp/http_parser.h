@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Incremental HTTP/1.x request-head parser for the proxy. It works on the
+// connection's receive buffer in place: every field is a view into that
+// buffer, nothing is copied or allocated, and the caller just calls it again
+// with the same buffer after more bytes arrive.
+
+struct HttpHeader {
+    std::string_view name;
+    std::string_view value;  // surrounding whitespace trimmed
+};
+
+struct HttpRequestHead {
+    static constexpr size_t kMaxHeaders = 64;
+
+    std::string_view method;
+    std::string_view target;
+    std::string_view version;
+    std::string_view host;  // authority to connect to, see http_parse_request()
+    HttpHeader headers[kMaxHeaders];
+    size_t headerCount = 0;  // headers past kMaxHeaders are checked but not kept
+    size_t headEnd = 0;      // bytes up to and including the blank line
+};
+
+enum class HttpParseResult {
+    Complete,
+    Incomplete,  // no blank line yet
+    Invalid,
+};
+
+// Returns the offset just past the blank line ending the head, or 0 if it is
+// not in `data` yet. `*scanned` carries the search position between calls so
+// each byte is only looked at once.
+size_t http_find_head_end(const char* data, size_t len, size_t* scanned);
+
+// Parses the head in data[0, len). The host is the authority of a CONNECT
+// or absolute-form target, else the Host header.
+HttpParseResult http_parse_request(const char* data, size_t len, size_t* scanned, HttpRequestHead* out);
+
+// Case-insensitive ASCII compare for header names.
+bool http_name_equals(std::string_view a, std::string_view b);
@@ -0,0 +1,180 @@
+#include "ip_packet.h"
+
+#include <netinet/in.h>
+
+static inline uint16_t rd16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline uint32_t rd32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+static inline void wr16(uint8_t* p, uint16_t v) { p[0] = (uint8_t)(v >> 8); p[1] = (uint8_t)v; }
+static inline void wr32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16); p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static uint32_t csum_add(uint32_t sum, const uint8_t* p, size_t n) {
+    while (n >= 2) {
+        sum += (uint32_t)((p[0] << 8) | p[1]);
+        p += 2;
+        n -= 2;
+    }
+    if (n) sum += (uint32_t)(p[0] << 8);
+    return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+bool ip_parse(const uint8_t* pkt, size_t len, PacketView* out) {
+    if (len < 20) return false;
+    uint8_t version = pkt[0] >> 4;
+    size_t hl;
+    size_t total;
+    uint8_t proto;
+    FlowKey& k = out->key;
+    k = FlowKey{};
+    if (version == 4) {
+        hl = (size_t)(pkt[0] & 0x0f) * 4;
+        total = rd16(pkt + 2);
+        if (hl < 20 || total < hl || total > len) return false;
+        if (rd16(pkt + 6) & 0x3fff) return false;  // MF or fragment offset
+        proto = pkt[9];
+        k.family = 4;
+        memcpy(k.src, pkt + 12, 4);
+        memcpy(k.dst, pkt + 16, 4);
+    } else if (version == 6) {
+        if (len < 40) return false;
+        hl = 40;
+        total = 40 + (size_t)rd16(pkt + 4);
+        if (total > len) return false;
+        proto = pkt[6];
+        k.family = 6;
+        memcpy(k.src, pkt + 8, 16);
+        memcpy(k.dst, pkt + 24, 16);
+    } else {
+        return false;
+    }
+    k.proto = proto;
+    const uint8_t* l4 = pkt + hl;
+    size_t l4Len = total - hl;
+    out->l4 = l4;
+    out->l4Len = l4Len;
+
+    if (proto == kIpProtoUdp) {
+        if (l4Len < 8) return false;
+        k.sport = rd16(l4);
+        k.dport = rd16(l4 + 2);
+        size_t ulen = rd16(l4 + 4);
+        if (ulen < 8 || ulen > l4Len) return false;
+        out->payload = l4 + 8;
+        out->payloadLen = ulen - 8;
+        return true;
+    }
+    if (proto == kIpProtoTcp) {
+        if (l4Len < 20) return false;
+        size_t doff = (size_t)(l4[12] >> 4) * 4;
+        if (doff < 20 || doff > l4Len) return false;
+        k.sport = rd16(l4);
+        k.dport = rd16(l4 + 2);
+        out->seq = rd32(l4 + 4);
+        out->ack = rd32(l4 + 8);
+        out->flags = l4[13];
+        out->window = rd16(l4 + 14);
+        out->options = l4 + 20;
+        out->optionsLen = doff - 20;
+        out->payload = l4 + doff;
+        out->payloadLen = l4Len - doff;
+        return true;
+    }
+    return false;
+}
+
+// Writes the IP header ending at `l4` and returns the packet start.
+static uint8_t* ip_header(uint8_t* l4, size_t l4Len, const FlowKey& k, uint8_t proto, uint32_t* pseudo) {
+    if (k.family == 4) {
+        uint8_t* ip = l4 - 20;
+        ip[0] = 0x45;
+        ip[1] = 0;
+        wr16(ip + 2, (uint16_t)(20 + l4Len));
+        wr16(ip + 4, 0);
+        wr16(ip + 6, 0x4000);  // DF
+        ip[8] = 64;
+        ip[9] = proto;
+        wr16(ip + 10, 0);
+        memcpy(ip + 12, k.dst, 4);  // reply direction
+        memcpy(ip + 16, k.src, 4);
+        wr16(ip + 10, csum_fold(csum_add(0, ip, 20)));
+        uint32_t sum = csum_add(0, ip + 12, 8);
+        *pseudo = sum + proto + (uint32_t)l4Len;
+        return ip;
+    }
+    uint8_t* ip = l4 - 40;
+    wr32(ip, 0x60000000);
+    wr16(ip + 4, (uint16_t)l4Len);
+    ip[6] = proto;
+    ip[7] = 64;
+    memcpy(ip + 8, k.dst, 16);
+    memcpy(ip + 24, k.src, 16);
+    uint32_t sum = csum_add(0, ip + 8, 32);
+    *pseudo = sum + proto + (uint32_t)l4Len;
+    return ip;
+}
+
+uint8_t* tcp_build(uint8_t* hdrEnd, const uint8_t* payload, size_t payloadLen, const FlowKey& k, uint32_t seq,
+                   uint32_t ack, uint8_t flags, uint16_t window, const uint8_t* opts, size_t optsLen,
+                   size_t* hdrLen) {
+    size_t optPad = (optsLen + 3) & ~(size_t)3;
+    size_t thl = 20 + optPad;
+    uint8_t* tcp = hdrEnd - thl;
+    wr16(tcp, k.dport);
+    wr16(tcp + 2, k.sport);
+    wr32(tcp + 4, seq);
+    wr32(tcp + 8, ack);
+    tcp[12] = (uint8_t)((thl / 4) << 4);
+    tcp[13] = flags;
+    wr16(tcp + 14, window);
+    wr16(tcp + 16, 0);
+    wr16(tcp + 18, 0);
+    if (optsLen) {
+        memcpy(tcp + 20, opts, optsLen);
+        memset(tcp + 20 + optsLen, 1, optPad - optsLen);  // NOP padding
+    }
+    uint32_t pseudo;
+    uint8_t* ip = ip_header(tcp, thl + payloadLen, k, kIpProtoTcp, &pseudo);
+    // the header length is even, so the payload sum simply continues it
+    wr16(tcp + 16, csum_fold(csum_add(csum_add(pseudo, tcp, thl), payload, payloadLen)));
+    *hdrLen = (size_t)(hdrEnd - ip);
+    return ip;
+}
+
+uint8_t* udp_build(uint8_t* payload, size_t payloadLen, const FlowKey& k, size_t* pktLen) {
+    uint8_t* udp = payload - 8;
+    size_t l4Len = 8 + payloadLen;
+    wr16(udp, k.dport);
+    wr16(udp + 2, k.sport);
+    wr16(udp + 4, (uint16_t)l4Len);
+    wr16(udp + 6, 0);
+    uint32_t pseudo;
+    uint8_t* ip = ip_header(udp, l4Len, k, kIpProtoUdp, &pseudo);
+    uint16_t c = csum_fold(csum_add(pseudo, udp, l4Len));
+    wr16(udp + 6, c ? c : 0xffff);
+    *pktLen = (size_t)(payload + payloadLen - ip);
+    return ip;
+}
+
+socklen_t flow_dst_sockaddr(const FlowKey& k, sockaddr_storage* out) {
+    memset(out, 0, sizeof(*out));
+    if (k.family == 4) {
+        auto* a = reinterpret_cast<sockaddr_in*>(out);
+        a->sin_family = AF_INET;
+        a->sin_port = htons(k.dport);
+        memcpy(&a->sin_addr, k.dst, 4);
+        return sizeof(sockaddr_in);
+    }
+    auto* a = reinterpret_cast<sockaddr_in6*>(out);
+    a->sin6_family = AF_INET6;
+    a->sin6_port = htons(k.dport);
+    memcpy(&a->sin6_addr, k.dst, 16);
+    return sizeof(sockaddr_in6);
+}
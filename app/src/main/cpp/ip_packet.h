@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/socket.h>
+
+#include "packet_pool.h"
+
+// IPv4/IPv6 + TCP/UDP wire helpers for the TUN engine. Parsing yields views
+// into the packet; building writes headers in front of a payload the caller
+// already placed, or for TCP into a separate header buffer that goes out
+// together with the payload in one writev(), so payloads are never copied.
+
+static constexpr uint8_t kIpProtoTcp = 6;
+static constexpr uint8_t kIpProtoUdp = 17;
+
+static constexpr uint8_t kTcpFin = 0x01;
+static constexpr uint8_t kTcpSyn = 0x02;
+static constexpr uint8_t kTcpRst = 0x04;
+static constexpr uint8_t kTcpPsh = 0x08;
+static constexpr uint8_t kTcpAck = 0x10;
+
+// Largest IP header + TCP header with options we ever write.
+static constexpr size_t kMaxHeaderRoom = 40 + 60;
+
+// One direction of a transport flow, as seen in packets from the device.
+struct FlowKey {
+    uint8_t family = 0;  // 4 or 6
+    uint8_t proto = 0;
+    uint16_t sport = 0;  // host order
+    uint16_t dport = 0;
+    uint8_t src[16] = {};
+    uint8_t dst[16] = {};
+
+    bool operator==(const FlowKey& o) const {
+        return family == o.family && proto == o.proto && sport == o.sport && dport == o.dport
+            && memcmp(src, o.src, 16) == 0 && memcmp(dst, o.dst, 16) == 0;
+    }
+};
+
+struct FlowKeyHash {
+    size_t operator()(const FlowKey& k) const {
+        uint64_t h = 1469598103934665603ULL;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(&k);
+        for (size_t i = 0; i < sizeof(FlowKey); ++i) h = (h ^ p[i]) * 1099511628211ULL;
+        return (size_t)h;
+    }
+};
+
+struct PacketView {
+    FlowKey key;
+    const uint8_t* l4 = nullptr;  // transport header
+    size_t l4Len = 0;
+    const uint8_t* payload = nullptr;
+    size_t payloadLen = 0;
+
+    // TCP only
+    uint32_t seq = 0;
+    uint32_t ack = 0;
+    uint16_t window = 0;
+    uint8_t flags = 0;
+    const uint8_t* options = nullptr;
+    size_t optionsLen = 0;
+
+    // pool buffer the packet was read into, so parts of it can be kept without a copy
+    PacketPool::Handle buf = PacketPool::kNone;
+};
+
+// Parses an IP packet carrying TCP or UDP. Fragments, other protocols and
+// IPv6 extension headers are rejected. Checksums are not verified: packets
+// come from the local kernel.
+bool ip_parse(const uint8_t* pkt, size_t len, PacketView* out);
+
+// Writes the IP and TCP headers for a segment travelling opposite to `k`
+// (from k.dst:k.dport to k.src:k.sport) so that they end right at `hdrEnd`.
+// The payload may follow them in the same buffer or live anywhere else; it
+// is only read for the checksum. Returns the start of the packet; `*hdrLen`
+// gets the length of the headers.
+uint8_t* tcp_build(uint8_t* hdrEnd, const uint8_t* payload, size_t payloadLen, const FlowKey& k, uint32_t seq,
+                   uint32_t ack, uint8_t flags, uint16_t window, const uint8_t* opts, size_t optsLen,
+                   size_t* hdrLen);
+
+// Writes the IP and UDP headers so that they end right at `payload`. Returns
+// the start of the packet; `*pktLen` gets its total length.
+uint8_t* udp_build(uint8_t* payload, size_t payloadLen, const FlowKey& k, size_t* pktLen);
+
+// Fills a sockaddr for k.dst:k.dport; returns its length.
+socklen_t flow_dst_sockaddr(const FlowKey& k, sockaddr_storage* out);
+
+static inline bool seq_lt(uint32_t a, uint32_t b) { return (int32_t)(a - b) < 0; }
+static inline bool seq_le(uint32_t a, uint32_t b) { return (int32_t)(a - b) <= 0; }
+static inline bool seq_gt(uint32_t a, uint32_t b) { return (int32_t)(a - b) > 0; }
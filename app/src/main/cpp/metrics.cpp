@@ -0,0 +1,135 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <jni.h>
+#include <mutex>
+#include <vector>
+
+thread_local MetricShard* t_metricShard = nullptr;
+std::atomic<bool> g_logEvents(false);
+
+namespace {
+
+// Layout version of the getMetrics() array.
+constexpr jlong kMetricsLayout = 1;
+constexpr size_t kLatencyFields = 7;
+
+// Never destroyed: threads may still exit, and hand back shards, during
+// static destruction.
+struct ShardRegistry {
+    std::mutex lock;
+    std::vector<MetricShard*> all;
+    std::vector<MetricShard*> free;
+};
+
+ShardRegistry& registry() {
+    static ShardRegistry* r = new ShardRegistry();
+    return *r;
+}
+
+// Hands the thread's shard back when the thread exits.
+struct ShardOwner {
+    MetricShard* shard = nullptr;
+    ~ShardOwner() {
+        if (!shard) return;
+        t_metricShard = nullptr;
+        ShardRegistry& r = registry();
+        std::lock_guard<std::mutex> lk(r.lock);
+        r.free.push_back(shard);
+    }
+};
+
+thread_local ShardOwner t_owner;
+
+// Largest value that falls in bucket `i`.
+uint64_t bucket_high(size_t i) {
+    if (i < (1u << kLatencySubBits)) return i;
+    int exp = (int)(i >> kLatencySubBits) + kLatencySubBits - 1;
+    uint64_t width = 1ull << (exp - kLatencySubBits);
+    uint64_t low = ((1ull << kLatencySubBits) + (i & ((1u << kLatencySubBits) - 1))) * width;
+    return low + width - 1;
+}
+
+void summarize(const uint64_t* buckets, uint64_t sumUs, uint64_t maxUs, LatencySummary* out) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < kLatencyBuckets; ++i) count += buckets[i];
+    out->count = count;
+    out->sumUs = sumUs;
+    out->maxUs = maxUs;
+    if (count == 0) return;
+    struct Quantile {
+        uint64_t perMille;
+        uint64_t* value;
+    } qs[] = {{500, &out->p50Us}, {900, &out->p90Us}, {990, &out->p99Us}, {999, &out->p999Us}};
+    uint64_t seen = 0;
+    size_t q = 0;
+    for (size_t i = 0; i < kLatencyBuckets && q < 4; ++i) {
+        seen += buckets[i];
+        while (q < 4 && seen * 1000 >= qs[q].perMille * count && seen > 0) {
+            *qs[q].value = std::min(bucket_high(i), maxUs);
+            ++q;
+        }
+    }
+}
+
+} // namespace
+
+MetricShard& metrics_attach() {
+    ShardRegistry& r = registry();
+    std::lock_guard<std::mutex> lk(r.lock);
+    MetricShard* s;
+    if (!r.free.empty()) {
+        s = r.free.back();
+        r.free.pop_back();
+    } else {
+        s = new MetricShard();
+        r.all.push_back(s);
+    }
+    t_owner.shard = s;
+    t_metricShard = s;
+    return *s;
+}
+
+void metrics_snapshot(MetricsSnapshot* out) {
+    *out = MetricsSnapshot();
+    uint64_t buckets[kLatencyCount][kLatencyBuckets] = {};
+    uint64_t sums[kLatencyCount] = {};
+    uint64_t maxes[kLatencyCount] = {};
+    {
+        ShardRegistry& r = registry();
+        std::lock_guard<std::mutex> lk(r.lock);
+        for (const MetricShard* s : r.all) {
+            for (size_t i = 0; i < kMetricCount; ++i) out->counters[i] += s->counters[i].load(std::memory_order_relaxed);
+            for (size_t l = 0; l < kLatencyCount; ++l) {
+                const MetricShard::Histogram& h = s->latency[l];
+                for (size_t b = 0; b < kLatencyBuckets; ++b) buckets[l][b] += h.buckets[b].load(std::memory_order_relaxed);
+                sums[l] += h.sumUs.load(std::memory_order_relaxed);
+                maxes[l] = std::max(maxes[l], h.maxUs.load(std::memory_order_relaxed));
+            }
+        }
+    }
+    for (size_t l = 0; l < kLatencyCount; ++l) summarize(buckets[l], sums[l], maxes[l], &out->latency[l]);
+}
+
+// [layout, counterCount, latencyCount, counters...,
+//  then per latency: count, sumUs, maxUs, p50Us, p90Us, p99Us, p999Us]
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_example_adblocker_native_NativeProxy_getMetrics(JNIEnv* env, jclass clazz) {
+    MetricsSnapshot snap;
+    metrics_snapshot(&snap);
+    std::vector<jlong> vals = {kMetricsLayout, (jlong)kMetricCount, (jlong)kLatencyCount};
+    for (uint64_t c : snap.counters) vals.push_back((jlong)c);
+    for (const LatencySummary& l : snap.latency) {
+        jlong f[kLatencyFields] = {(jlong)l.count, (jlong)l.sumUs, (jlong)l.maxUs, (jlong)l.p50Us,
+                                   (jlong)l.p90Us, (jlong)l.p99Us, (jlong)l.p999Us};
+        vals.insert(vals.end(), f, f + kLatencyFields);
+    }
+    jlongArray arr = env->NewLongArray((jsize)vals.size());
+    if (arr) env->SetLongArrayRegion(arr, 0, (jsize)vals.size(), vals.data());
+    return arr;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_example_adblocker_native_NativeProxy_setEventLogging(JNIEnv* env, jclass clazz, jboolean enabled) {
+    g_logEvents.store(enabled != JNI_FALSE);
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+// Process-wide counters and latency histograms for the native components,
+// read by NativeProxy.getMetrics().
+//
+// Each recording thread owns a shard, so recording is a plain load and store
+// on lines no other thread writes: no locked instructions and no contention.
+// A snapshot sums the shards with relaxed loads. Shards of exited threads are
+// reused by new threads with their totals kept, so sums only grow.
+//
+// Latencies are in microseconds, in log-linear buckets (as in HdrHistogram):
+// exact below 8, then 8 buckets per power of two, so reported quantiles are
+// within 12.5% of the true value.
+
+enum class Metric : uint16_t {
+    DnsQueries,           // DNS proxy and TUN engine
+    DnsBlocked,
+    DnsCacheHits,
+    DnsUpstreamQueries,   // forwarded upstream
+    DnsUpstreamTimeouts,
+    ProxyConnections,     // HTTP proxy clients accepted
+    ProxyBlocked,
+    ProxyBytesUp,         // relayed client -> remote
+    ProxyBytesDown,       // relayed remote -> client
+    TunConnections,       // TCP flows seen by the TUN engine
+    TunBlocked,
+    BlocklistReloads,
+    EventsOverwritten,    // event log records lost to full rings before a drain
+    Count
+};
+
+enum class Latency : uint16_t {
+    DnsUpstreamRtt,   // query sent upstream -> answer received
+    ProxyConnect,     // request parsed -> remote connected (includes resolving)
+    BlocklistReload,  // load and publish of a changed list
+    Count
+};
+
+static constexpr size_t kMetricCount = (size_t)Metric::Count;
+static constexpr size_t kLatencyCount = (size_t)Latency::Count;
+static constexpr int kLatencySubBits = 3;
+// values up to 2^32 us (71 minutes); larger ones land in the last bucket
+static constexpr size_t kLatencyBuckets = (32 - kLatencySubBits + 1) << kLatencySubBits;
+
+struct MetricShard {
+    std::atomic<uint64_t> counters[kMetricCount];
+    struct Histogram {
+        std::atomic<uint64_t> buckets[kLatencyBuckets];
+        std::atomic<uint64_t> sumUs;
+        std::atomic<uint64_t> maxUs;
+    } latency[kLatencyCount];
+};
+
+extern thread_local MetricShard* t_metricShard;
+
+// Assigns the calling thread its shard.
+MetricShard& metrics_attach();
+
+inline MetricShard& metrics_shard() {
+    MetricShard* s = t_metricShard;
+    return s ? *s : metrics_attach();
+}
+
+// Only the owning thread writes a shard, so increments need no atomic RMW.
+inline void metric_bump(std::atomic<uint64_t>& v, uint64_t n) {
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void metric_add(Metric m, uint64_t n = 1) {
+    metric_bump(metrics_shard().counters[(size_t)m], n);
+}
+
+inline size_t latency_bucket(uint64_t us) {
+    if (us < (1u << kLatencySubBits)) return (size_t)us;
+    if (us >> 32) us = 0xffffffffu;
+    int exp = 63 - __builtin_clzll(us);
+    return ((size_t)(exp - kLatencySubBits + 1) << kLatencySubBits)
+        + (size_t)((us >> (exp - kLatencySubBits)) & ((1u << kLatencySubBits) - 1));
+}
+
+inline void metric_record(Latency l, uint64_t us) {
+    MetricShard::Histogram& h = metrics_shard().latency[(size_t)l];
+    metric_bump(h.buckets[latency_bucket(us)], 1);
+    metric_bump(h.sumUs, us);
+    if (us > h.maxUs.load(std::memory_order_relaxed)) h.maxUs.store(us, std::memory_order_relaxed);
+}
+
+inline uint64_t metrics_now_us() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+struct LatencySummary {
+    uint64_t count = 0;
+    uint64_t sumUs = 0;
+    uint64_t maxUs = 0;
+    uint64_t p50Us = 0;
+    uint64_t p90Us = 0;
+    uint64_t p99Us = 0;
+    uint64_t p999Us = 0;
+};
+
+struct MetricsSnapshot {
+    uint64_t counters[kMetricCount] = {};
+    LatencySummary latency[kLatencyCount];
+};
+
+void metrics_snapshot(MetricsSnapshot* out);
+
+// Per-request and per-query log lines (blocked hosts, passthrough SNI, each
+// DNS query) are off unless enabled through NativeProxy.setEventLogging().
+extern std::atomic<bool> g_logEvents;
+
+inline bool log_events() {
+    return g_logEvents.load(std::memory_order_relaxed);
+}
@@ -10,6 +10,8 @@
 #include <unistd.h>
 #include <netdb.h>
 
+#include "splice_relay.h"
+
 #define LOG_TAG "nativeproxy"
 #define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
@@ -49,13 +51,7 @@ static void relay_loop(int clientFd, const char* remoteHost, int remotePort) {
     }
 
     auto forward = [](int inFd, int outFd) {
-        std::vector<char> buf(4096);
-        while (true) {
-            ssize_t r = recv(inFd, buf.data(), buf.size(), 0);
-            if (r <= 0) break;
-            ssize_t s = send(outFd, buf.data(), r, 0);
-            if (s <= 0) break;
-        }
+        relay_blocking(inFd, outFd);
         shutdown(inFd, SHUT_RD);
         shutdown(outFd, SHUT_WR);
     };
@@ -0,0 +1,557 @@
+#include "network_filter.h"
+
+#include <algorithm>
+
+static constexpr uint8_t kAnyParty = NetworkFilter::kFirstParty | NetworkFilter::kThirdParty;
+static constexpr uint32_t kDefaultTypes = kTypeAll & ~kTypeDocument;
+
+static const struct {
+    const char* name;
+    uint32_t bit;
+} kTypeNames[] = {
+    {"script", kTypeScript},         {"image", kTypeImage},
+    {"stylesheet", kTypeStylesheet}, {"css", kTypeStylesheet},
+    {"object", kTypeObject},         {"xmlhttprequest", kTypeXhr},
+    {"xhr", kTypeXhr},               {"subdocument", kTypeSubdocument},
+    {"frame", kTypeSubdocument},     {"sub_frame", kTypeSubdocument},
+    {"ping", kTypePing},             {"beacon", kTypePing},
+    {"media", kTypeMedia},           {"font", kTypeFont},
+    {"websocket", kTypeWebsocket},   {"other", kTypeOther},
+    {"document", kTypeDocument},     {"doc", kTypeDocument},
+    {"main_frame", kTypeDocument},
+};
+
+static char lower(char c) { return (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c; }
+
+// Same into an existing string, keeping its capacity.
+static void assign_lower(std::string& out, std::string_view s) {
+    out.assign(s.data(), s.size());
+    for (char& c : out) c = lower(c);
+}
+
+static bool equals_nocase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (lower(a[i]) != b[i]) return false;
+    }
+    return true;
+}
+
+uint32_t request_type_from_name(std::string_view name) {
+    if (name.empty()) return kTypeAll;
+    for (const auto& t : kTypeNames) {
+        if (equals_nocase(name, t.name)) return t.bit;
+    }
+    return kTypeOther;
+}
+
+std::string_view url_host(std::string_view url) {
+    size_t b = url.find("://");
+    b = b == std::string_view::npos ? 0 : b + 3;
+    size_t e = url.find_first_of("/?#", b);
+    std::string_view h = url.substr(b, e == std::string_view::npos ? std::string_view::npos : e - b);
+    size_t at = h.rfind('@');
+    if (at != std::string_view::npos) h.remove_prefix(at + 1);
+    if (!h.empty() && h.front() == '[') {
+        size_t rb = h.find(']');
+        return h.substr(1, rb == std::string_view::npos ? std::string_view::npos : rb - 1);
+    }
+    return h.substr(0, h.find(':'));
+}
+
+static bool is_token_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '%';
+}
+
+// What `^` stands for: ASCII other than letters, digits and _ - . %
+static bool is_separator(char c) {
+    unsigned char u = (unsigned char)c;
+    if (u >= 0x80) return false;
+    if ((u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') || (u >= '0' && u <= '9')) return false;
+    return c != '_' && c != '-' && c != '.' && c != '%';
+}
+
+static uint32_t token_hash(const char* p, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (uint8_t)lower(p[i])) * 16777619u;
+    return h;
+}
+
+// Tokens a matching URL must contain whole: a run cut short by `*` or by an
+// unanchored end of the pattern may only be part of a longer URL token.
+template <typename Fn>
+static void for_each_filter_token(std::string_view p, uint8_t anchors, Fn fn) {
+    size_t n = p.size();
+    for (size_t i = 0; i < n;) {
+        if (!is_token_char(lower(p[i]))) {
+            ++i;
+            continue;
+        }
+        size_t j = i;
+        while (j < n && is_token_char(lower(p[j]))) ++j;
+        bool startOk = i > 0 ? p[i - 1] != '*'
+                             : (anchors & (NetworkFilter::kAnchorLeft | NetworkFilter::kAnchorHost)) != 0;
+        bool endOk = j < n ? p[j] != '*' : (anchors & NetworkFilter::kAnchorRight) != 0;
+        if (startOk && endOk) fn(token_hash(p.data() + i, j - i), j - i);
+        i = j;
+    }
+}
+
+bool is_cosmetic_filter(std::string_view s) {
+    for (size_t h = s.find('#'); h != std::string_view::npos && h + 1 < s.size(); h = s.find('#', h + 1)) {
+        char c = s[h + 1];
+        if (c == '#') return true;  // ##, ##+js(...)
+        // #@#, #?#, #$#, #@$#, #%#
+        if ((c == '@' || c == '?' || c == '$' || c == '%') && s.find('#', h + 2) != std::string_view::npos) return true;
+    }
+    return false;
+}
+
+// Entries as written; the caller lowercases and stores them.
+struct DomainOptions {
+    std::vector<std::string_view> on;
+    std::vector<std::string_view> off;
+};
+
+static void parse_domains(std::string_view list, DomainOptions* out) {
+    while (!list.empty()) {
+        size_t bar = list.find('|');
+        std::string_view d = list.substr(0, bar);
+        list = bar == std::string_view::npos ? std::string_view() : list.substr(bar + 1);
+        bool neg = !d.empty() && d.front() == '~';
+        if (neg) d.remove_prefix(1);
+        if (d.empty()) continue;
+        (neg ? out->off : out->on).push_back(d);
+    }
+}
+
+static bool parse_options(std::string_view opts, NetworkFilter* f, DomainOptions* domains, bool* badfilter) {
+    uint32_t types = 0;
+    uint32_t notTypes = 0;
+    while (!opts.empty()) {
+        size_t comma = opts.find(',');
+        std::string_view o = opts.substr(0, comma);
+        opts = comma == std::string_view::npos ? std::string_view() : opts.substr(comma + 1);
+        bool neg = !o.empty() && o.front() == '~';
+        if (neg) o.remove_prefix(1);
+
+        if (o == "third-party" || o == "3p") {
+            f->party = neg ? NetworkFilter::kFirstParty : NetworkFilter::kThirdParty;
+            continue;
+        }
+        if (o == "first-party" || o == "1p") {
+            f->party = neg ? NetworkFilter::kThirdParty : NetworkFilter::kFirstParty;
+            continue;
+        }
+        uint32_t bit = 0;
+        for (const auto& t : kTypeNames) {
+            if (o == t.name) bit = t.bit;
+        }
+        if (bit) {
+            (neg ? notTypes : types) |= bit;
+            continue;
+        }
+        if (neg) return false;
+        if (o == "all") types |= kTypeAll;
+        else if (o == "match-case") f->matchCase = true;
+        else if (o == "important") f->important = true;
+        else if (o == "badfilter") *badfilter = true;
+        else if (o.rfind("domain=", 0) == 0) parse_domains(o.substr(7), domains);
+        else if (o.rfind("from=", 0) == 0) parse_domains(o.substr(5), domains);
+        else if (o.rfind("redirect=", 0) == 0 && !f->exception) continue;  // blocks; we have no resources to serve
+        else return false;
+    }
+    if (types || notTypes) f->types = (types ? types : kDefaultTypes) & ~notTypes;
+    return f->types != 0;
+}
+
+// Lines the old host extraction understood: "ads.example.com"
+static bool is_plain_host(std::string_view p) {
+    if (p.empty() || p.find('.') == std::string_view::npos) return false;
+    if (p.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789.-") != std::string_view::npos) return false;
+    return p.front() != '.' && p.front() != '-' && p.back() >= 'a' && p.back() <= 'z';
+}
+
+// FNV-1a 64 of a rule line, to match $badfilter against it without keeping
+// the text
+static uint64_t text_hash(std::string_view s, uint64_t h = 14695981039346656037ull) {
+    for (char c : s) h = (h ^ (uint8_t)c) * 1099511628211ull;
+    return h;
+}
+
+bool NetworkFilterSet::add(std::string_view line) {
+    while (!line.empty() && (line.front() == ' ' || line.front() == '\t')) line.remove_prefix(1);
+    while (!line.empty() && (line.back() == ' ' || line.back() == '\t' || line.back() == '\r')) line.remove_suffix(1);
+    if (line.empty() || line.front() == '!' || line.front() == '[' || line.front() == '#') return false;
+    if (line.find_first_of(" \t") != std::string_view::npos || is_cosmetic_filter(line)) return false;
+
+    Pending p;
+    NetworkFilter& f = p.filter;
+    std::string_view pat = line;
+    if (pat.rfind("@@", 0) == 0) {
+        f.exception = true;
+        pat.remove_prefix(2);
+    }
+    bool badfilter = false;
+    DomainOptions domains;
+    size_t dollar = pat.rfind('$');
+    std::string_view opts;
+    if (dollar != std::string_view::npos) {
+        opts = pat.substr(dollar + 1);
+        pat = pat.substr(0, dollar);
+        if (!parse_options(opts, &f, &domains, &badfilter)) return false;
+    }
+    if (badfilter) {
+        // cancels the same filter written without $badfilter
+        std::string_view head = line.substr(0, line.size() - opts.size() - 1);
+        uint64_t h = text_hash(head);
+        bool first = true;
+        while (!opts.empty()) {
+            size_t comma = opts.find(',');
+            std::string_view o = opts.substr(0, comma);
+            opts = comma == std::string_view::npos ? std::string_view() : opts.substr(comma + 1);
+            if (o == "badfilter") continue;
+            h = text_hash(first ? "$" : ",", h);
+            h = text_hash(o, h);
+            first = false;
+        }
+        badfilters_.insert(h);
+        return true;
+    }
+    if (pat.size() >= 2 && pat.front() == '/' && pat.back() == '/') return false;  // regex
+    if (domains.on.size() > UINT16_MAX || domains.off.size() > UINT16_MAX) return false;
+
+    if (pat.rfind("||", 0) == 0) {
+        f.anchors |= NetworkFilter::kAnchorHost;
+        pat.remove_prefix(2);
+        if (pat.empty()) return false;
+    } else if (!pat.empty() && pat.front() == '|') {
+        f.anchors |= NetworkFilter::kAnchorLeft;
+        pat.remove_prefix(1);
+    }
+    if (!pat.empty() && pat.back() == '|') {
+        f.anchors |= NetworkFilter::kAnchorRight;
+        pat.remove_suffix(1);
+    }
+    if (f.matchCase) {
+        f.pattern = strings_.intern(pat);
+    } else {
+        assign_lower(scratch_, pat);
+        f.pattern = strings_.intern(scratch_);
+    }
+    if (f.exception) f.important = false;
+    f.domains = (uint32_t)pendingDomains_.size();
+    f.domainCount = (uint16_t)domains.on.size();
+    f.notDomainCount = (uint16_t)domains.off.size();
+    for (const auto* list : {&domains.on, &domains.off}) {
+        for (std::string_view d : *list) {
+            assign_lower(scratch_, d);
+            pendingDomains_.push_back(strings_.intern(scratch_));
+        }
+    }
+    if (keepText_) f.text = strings_.intern(line);
+    p.textHash = text_hash(line);
+
+    // `||host^` and bare hosts without options go to the domain trie
+    p.host = false;
+    if (!f.exception && dollar == std::string_view::npos) {
+        std::string_view h = strings_.view(f.pattern);
+        if ((f.anchors & NetworkFilter::kAnchorHost) && h.size() > 1 && h.back() == '^') {
+            h.remove_suffix(1);
+            p.host = h.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789.-_") == std::string_view::npos;
+        } else if (f.anchors == 0) {
+            p.host = is_plain_host(h);
+        }
+    }
+    pending_.push_back(p);
+    return true;
+}
+
+void NetworkFilterSet::build(DomainIndexBuilder* hostsOut) {
+    DomainIndexBuilder local;
+    DomainIndexBuilder& hosts = hostsOut ? *hostsOut : local;
+    // The kept filters' strings move to a fresh pool, leaving behind those of
+    // host rules (copied into the trie) and of cancelled filters.
+    StringPool kept;
+    std::vector<StringPool::Ref> domains;
+    std::vector<NetworkFilter> important, block, exceptions;
+    for (Pending& p : pending_) {
+        if (!badfilters_.empty() && badfilters_.count(p.textHash)) continue;
+        NetworkFilter f = p.filter;
+        std::string_view pat = strings_.view(f.pattern);
+        if (p.host) {
+            hosts.add(pat.back() == '^' ? pat.substr(0, pat.size() - 1) : pat);
+            continue;
+        }
+        f.pattern = kept.intern(pat);
+        if (keepText_) f.text = kept.intern(strings_.view(f.text));
+        uint32_t n = (uint32_t)f.domainCount + f.notDomainCount;
+        for (uint32_t i = 0; i < n; ++i) domains.push_back(kept.intern(strings_.view(pendingDomains_[f.domains + i])));
+        f.domains = (uint32_t)(domains.size() - n);
+        if (f.exception) exceptions.push_back(f);
+        else if (f.important) important.push_back(f);
+        else block.push_back(f);
+    }
+    pending_ = std::vector<Pending>();
+    pendingDomains_ = std::vector<StringPool::Ref>();
+    badfilters_ = std::unordered_set<uint64_t>();
+    scratch_ = std::string();
+    kept.freeze();
+    strings_ = std::move(kept);
+    domains.shrink_to_fit();
+    domains_ = std::move(domains);
+    hosts_ = hostsOut ? DomainIndex() : local.build();
+
+    std::unordered_map<uint32_t, uint32_t> counts;
+    for (const auto* list : {&important, &block, &exceptions}) {
+        for (const NetworkFilter& f : *list) {
+            for_each_filter_token(pattern(f), f.anchors, [&](uint32_t h, size_t) { ++counts[h]; });
+        }
+    }
+    index(important_, std::move(important), counts);
+    index(block_, std::move(block), counts);
+    index(exceptions_, std::move(exceptions), counts);
+}
+
+void NetworkFilterSet::index(Index& idx, std::vector<NetworkFilter>&& filters,
+                             const std::unordered_map<uint32_t, uint32_t>& counts) const {
+    idx.filters = std::move(filters);
+    idx.filters.shrink_to_fit();
+    idx.buckets.clear();
+    idx.bucketFilters.clear();
+    idx.anywhere.clear();
+    idx.literalFilter.clear();
+    std::vector<std::string_view> literals;
+    std::vector<std::pair<uint32_t, uint32_t>> filed;  // token hash, filter
+    for (uint32_t i = 0; i < (uint32_t)idx.filters.size(); ++i) {
+        const NetworkFilter& f = idx.filters[i];
+        std::string_view pat = pattern(f);
+        if (f.anchors == 0 && !f.matchCase && !pat.empty() && pat.find_first_of("*^") == std::string_view::npos) {
+            literals.push_back(pat);
+            idx.literalFilter.push_back(i);
+            continue;
+        }
+        // rarest token wins, the longer one on a tie
+        uint32_t best = 0, bestCount = UINT32_MAX;
+        size_t bestLen = 0;
+        for_each_filter_token(pat, f.anchors, [&](uint32_t h, size_t len) {
+            uint32_t c = counts.at(h);
+            if (c < bestCount || (c == bestCount && len > bestLen)) {
+                best = h;
+                bestCount = c;
+                bestLen = len;
+            }
+        });
+        if (bestCount == UINT32_MAX) idx.anywhere.push_back(i);
+        else filed.emplace_back(best, i);
+    }
+    // one flat array, each token's filters in list order
+    std::sort(filed.begin(), filed.end());
+    idx.bucketFilters.reserve(filed.size());
+    for (const auto& e : filed) {
+        auto ins = idx.buckets.emplace(e.first, Index::Range{(uint32_t)idx.bucketFilters.size(), 0});
+        ins.first->second.count++;
+        idx.bucketFilters.push_back(e.second);
+    }
+    idx.literals.build(literals);
+}
+
+// Without a public suffix list: the last two labels, or three under a
+// two-letter country code with a short second level (co.uk, com.au).
+static std::string_view site_of(std::string_view host) {
+    if (host.find(':') != std::string_view::npos) return host;  // IPv6 literal
+    size_t last = host.rfind('.');
+    if (last == std::string_view::npos || last == 0) return host;
+    if (host.find_first_not_of("0123456789.") == std::string_view::npos) return host;  // IPv4 literal
+    size_t second = host.rfind('.', last - 1);
+    if (second == std::string_view::npos) return host;
+    if (host.size() - last - 1 == 2 && last - second - 1 <= 3 && second > 0) {
+        size_t third = host.rfind('.', second - 1);
+        return third == std::string_view::npos ? host : host.substr(third + 1);
+    }
+    return host.substr(second + 1);
+}
+
+static bool domain_matches(std::string_view host, std::string_view d) {
+    if (d.size() > 2 && d.compare(d.size() - 2, 2, ".*") == 0) {
+        // entity: "google.*" covers google.com, google.co.uk and their subdomains
+        std::string_view name = d.substr(0, d.size() - 1);
+        for (size_t p = host.find(name); p != std::string_view::npos; p = host.find(name, p + 1)) {
+            if ((p == 0 || host[p - 1] == '.') && p + name.size() < host.size()) return true;
+        }
+        return false;
+    }
+    if (host.size() < d.size() || host.compare(host.size() - d.size(), d.size(), d) != 0) return false;
+    return host.size() == d.size() || host[host.size() - d.size() - 1] == '.';
+}
+
+// One `*`-free piece of a pattern at exactly `pos`. `^` also matches the end
+// of the URL, as the last character of the piece.
+static bool part_at(std::string_view u, size_t pos, std::string_view part) {
+    for (size_t i = 0; i < part.size(); ++i) {
+        char p = part[i];
+        if (pos + i >= u.size()) return p == '^' && i + 1 == part.size();
+        char c = u[pos + i];
+        if (p == '^' ? !is_separator(c) : p != c) return false;
+    }
+    return true;
+}
+
+static size_t find_part(std::string_view u, size_t from, std::string_view part) {
+    if (part.find('^') == std::string_view::npos) return u.find(part, from);
+    for (size_t i = from; i <= u.size(); ++i) {
+        if (part_at(u, i, part)) return i;
+    }
+    return std::string_view::npos;
+}
+
+// The pieces of `pat` in order at or after `pos`, each as far left as it
+// goes; for pieces without backtracking that is as good as any placement.
+static bool match_from(std::string_view u, size_t pos, std::string_view pat, bool right) {
+    bool star = false;
+    while (true) {
+        while (!pat.empty() && pat.front() == '*') {
+            pat.remove_prefix(1);
+            star = true;
+        }
+        if (pat.empty()) return !right || star || pos >= u.size();
+        size_t next = pat.find('*');
+        std::string_view part = pat.substr(0, next);
+        if (next == std::string_view::npos && right) {
+            // the last piece has to end the URL; a trailing `^` may be the end itself
+            size_t n = part.size();
+            size_t end = u.size();
+            if (n <= end && end - n >= pos && part_at(u, end - n, part)) return true;
+            return part.back() == '^' && n - 1 <= end && end - (n - 1) >= pos && part_at(u, end - (n - 1), part);
+        }
+        size_t at = find_part(u, pos, part);
+        if (at == std::string_view::npos) return false;
+        pos = std::min(at + part.size(), u.size());
+        if (next == std::string_view::npos) return true;
+        pat.remove_prefix(next);
+    }
+}
+
+static bool pattern_matches(const NetworkFilter& f, std::string_view pat, std::string_view u, size_t hostBegin,
+                            size_t hostEnd) {
+    bool right = (f.anchors & NetworkFilter::kAnchorRight) != 0;
+    if (!(f.anchors & (NetworkFilter::kAnchorHost | NetworkFilter::kAnchorLeft))) return match_from(u, 0, pat, right);
+
+    size_t star = pat.find('*');
+    std::string_view first = pat.substr(0, star);
+    std::string_view rest = star == std::string_view::npos ? std::string_view() : pat.substr(star);
+    if (f.anchors & NetworkFilter::kAnchorLeft) {
+        return part_at(u, 0, first) && match_from(u, std::min(first.size(), u.size()), rest, right);
+    }
+    // `||`: starts at a label boundary of the host
+    for (size_t s = hostBegin; s < hostEnd; ++s) {
+        if (s != hostBegin && u[s - 1] != '.') continue;
+        if (part_at(u, s, first) && match_from(u, std::min(s + first.size(), u.size()), rest, right)) return true;
+    }
+    return false;
+}
+
+bool NetworkFilterSet::find(const Index& idx, MatchContext& ctx) const {
+    if (idx.filters.empty()) return false;
+    auto hit = [&](uint32_t i, bool patternMatched) {
+        if (!applies(idx.filters[i], ctx, patternMatched)) return false;
+        ctx.rule = &idx.filters[i];
+        return true;
+    };
+    for (uint32_t t : ctx.tokens) {
+        auto it = idx.buckets.find(t);
+        if (it == idx.buckets.end()) continue;
+        const uint32_t* run = idx.bucketFilters.data() + it->second.begin;
+        for (uint32_t k = 0; k < it->second.count; ++k) {
+            if (hit(run[k], false)) return true;
+        }
+    }
+    for (uint32_t i : idx.anywhere) {
+        if (hit(i, false)) return true;
+    }
+    return idx.literals.scan(ctx.lower, [&](uint32_t id) { return hit(idx.literalFilter[id], true); });
+}
+
+bool NetworkFilterSet::applies(const NetworkFilter& f, const MatchContext& ctx, bool patternMatched) const {
+    if (!(f.types & ctx.type)) return false;
+    if (f.party != kAnyParty && !(f.party & ctx.party)) return false;
+    if (f.domainCount || f.notDomainCount) {
+        if (ctx.source.empty()) {
+            if (f.domainCount) return false;
+        } else {
+            const StringPool::Ref* on = domains_.data() + f.domains;
+            const StringPool::Ref* off = on + f.domainCount;
+            for (uint32_t i = 0; i < f.notDomainCount; ++i) {
+                if (domain_matches(ctx.source, strings_.view(off[i]))) return false;
+            }
+            if (f.domainCount && std::none_of(on, off, [&](StringPool::Ref d) {
+                    return domain_matches(ctx.source, strings_.view(d));
+                })) {
+                return false;
+            }
+        }
+    }
+    return patternMatched || pattern_matches(f, pattern(f), f.matchCase ? ctx.url : std::string_view(ctx.lower),
+                                             ctx.hostBegin, ctx.hostEnd);
+}
+
+FilterVerdict NetworkFilterSet::match(const FilterRequest& req, const DomainIndex* extraHosts) const {
+    MatchContext ctx;
+    return match(req, ctx, extraHosts);
+}
+
+void NetworkFilterSet::prepare(const FilterRequest& req, MatchContext& ctx) {
+    ctx.url = req.url;
+    assign_lower(ctx.lower, req.url);
+    std::string_view host = url_host(ctx.lower);
+    ctx.hostBegin = (size_t)(host.data() - ctx.lower.data());
+    ctx.hostEnd = ctx.hostBegin + host.size();
+    assign_lower(ctx.source, url_host(req.sourceHost));
+    ctx.type = req.type;
+    ctx.party = 0;
+    ctx.tokens.clear();
+    ctx.rule = nullptr;
+    if (!ctx.source.empty() && !host.empty()) {
+        ctx.party = site_of(host) == site_of(ctx.source) ? NetworkFilter::kFirstParty : NetworkFilter::kThirdParty;
+    }
+    const std::string& u = ctx.lower;
+    for (size_t i = 0; i < u.size();) {
+        if (!is_token_char(u[i])) {
+            ++i;
+            continue;
+        }
+        size_t j = i;
+        while (j < u.size() && is_token_char(u[j])) ++j;
+        ctx.tokens.push_back(token_hash(u.data() + i, j - i));
+        i = j;
+    }
+    std::sort(ctx.tokens.begin(), ctx.tokens.end());
+    ctx.tokens.erase(std::unique(ctx.tokens.begin(), ctx.tokens.end()), ctx.tokens.end());
+}
+
+bool NetworkFilterSet::blocks(MatchContext& ctx) const {
+    std::string_view host(ctx.lower.data() + ctx.hostBegin, ctx.hostEnd - ctx.hostBegin);
+    return hosts_.match(host) || find(block_, ctx);
+}
+
+FilterVerdict NetworkFilterSet::match(const FilterRequest& req, MatchContext& ctx,
+                                      const DomainIndex* extraHosts) const {
+    prepare(req, ctx);
+    if (important(ctx)) return FilterVerdict::Blocked;
+    std::string_view host(ctx.lower.data() + ctx.hostBegin, ctx.hostEnd - ctx.hostBegin);
+    bool blocked = (extraHosts && extraHosts->match(host)) || blocks(ctx);
+    if (!blocked) return FilterVerdict::None;
+    return excepted(ctx) ? FilterVerdict::Allowed : FilterVerdict::Blocked;
+}
+
+size_t NetworkFilterSet::memory_bytes() const {
+    size_t n = strings_.memory_bytes() + domains_.capacity() * sizeof(StringPool::Ref) + hosts_.memory_bytes();
+    for (const Index* idx : {&important_, &block_, &exceptions_}) {
+        n += idx->filters.capacity() * sizeof(NetworkFilter) + idx->bucketFilters.capacity() * sizeof(uint32_t)
+             + idx->buckets.size() * (sizeof(uint32_t) + sizeof(Index::Range) + 2 * sizeof(void*))
+             + idx->buckets.bucket_count() * sizeof(void*)
+             + (idx->anywhere.capacity() + idx->literalFilter.capacity()) * sizeof(uint32_t)
+             + idx->literals.memory_bytes();
+    }
+    return n;
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "domain_index.h"
+#include "pattern_matcher.h"
+#include "string_pool.h"
+
+// Adblock Plus / uBlock Origin network filters, compiled for matching.
+//
+// Supported: `||` hostname anchors, `|` start and end anchors, `*` wildcards,
+// `^` separators, `@@` exceptions and the options third-party / first-party
+// (and their 3p / 1p aliases), domain= (from=), match-case, important,
+// badfilter, redirect (blocks) and the resource types. A filter with an
+// option we do not understand is dropped rather than applied more broadly
+// than its author meant, as are regular expressions and cosmetic filters.
+//
+// Filters of the form `||host^` and plain host lines go to a DomainIndex.
+// Plain substrings (no anchors, wildcards or separators) go to one
+// PatternMatcher that finds all of them in a single pass over the URL.
+// Every other filter is filed under the rarest token (a run of [a-z0-9%])
+// that any URL it matches must contain whole. A URL is split into tokens
+// once and only the filters filed under those tokens are tried.
+
+enum RequestType : uint32_t {
+    kTypeOther = 1u << 0,
+    kTypeScript = 1u << 1,
+    kTypeImage = 1u << 2,
+    kTypeStylesheet = 1u << 3,
+    kTypeObject = 1u << 4,
+    kTypeXhr = 1u << 5,
+    kTypeSubdocument = 1u << 6,
+    kTypePing = 1u << 7,
+    kTypeMedia = 1u << 8,
+    kTypeFont = 1u << 9,
+    kTypeWebsocket = 1u << 10,
+    kTypeDocument = 1u << 11,
+};
+static constexpr uint32_t kTypeAll = (1u << 12) - 1;
+
+// "SCRIPT", "xhr", "sub_frame", ... as passed down from Kotlin; kTypeOther if
+// unknown. An empty name means the type is not known and filters of every
+// type apply.
+uint32_t request_type_from_name(std::string_view name);
+
+struct FilterRequest {
+    std::string_view url;         // absolute URL of the request
+    std::string_view sourceHost;  // host of the page that made it; empty if unknown
+    uint32_t type = kTypeOther;
+};
+
+enum class FilterVerdict {
+    None,     // no blocking filter matched
+    Blocked,
+    Allowed,  // a blocking filter matched but an exception overrides it
+};
+
+struct NetworkFilter {
+    static constexpr uint8_t kAnchorLeft = 1;   // |pattern
+    static constexpr uint8_t kAnchorRight = 2;  // pattern|
+    static constexpr uint8_t kAnchorHost = 4;   // ||pattern
+    static constexpr uint8_t kFirstParty = 1;
+    static constexpr uint8_t kThirdParty = 2;
+
+    // Strings live in the owning set's pool; see NetworkFilterSet::pattern().
+    StringPool::Ref pattern;      // anchors stripped; lowercase unless matchCase
+    uint32_t domains = 0;         // first entry in the set's domain list
+    uint16_t domainCount = 0;     // domain= entries that enable the filter
+    uint16_t notDomainCount = 0;  // ~entries that disable it, right after them
+    StringPool::Ref text;         // the list line, only when the set keeps text
+    uint32_t types = kTypeAll & ~kTypeDocument;
+    uint8_t anchors = 0;
+    uint8_t party = kFirstParty | kThirdParty;
+    bool matchCase = false;
+    bool important = false;
+    bool exception = false;
+};
+
+#ifdef ADBLOCK_KEEP_RULE_TEXT
+static constexpr bool kKeepRuleText = true;
+#else
+static constexpr bool kKeepRuleText = false;
+#endif
+
+class NetworkFilterSet {
+public:
+    // With `keepText` every filter remembers its list line (rule_text()), for
+    // debugging which rule decided a request. Off unless the build defines
+    // ADBLOCK_KEEP_RULE_TEXT: the lines are most of a list's size.
+    explicit NetworkFilterSet(bool keepText = kKeepRuleText) : keepText_(keepText) {}
+    NetworkFilterSet(NetworkFilterSet&&) = default;
+    NetworkFilterSet& operator=(NetworkFilterSet&&) = default;
+
+    // Parses one list line. Returns false for comments, cosmetic filters and
+    // anything we cannot apply faithfully.
+    bool add(std::string_view line);
+
+    // Indexes what was added; call once after the last add(). With
+    // `hostsOut`, `||host^` and plain host filters go there instead of to
+    // hosts(), for callers that keep them in a separate (mapped) index.
+    void build(DomainIndexBuilder* hostsOut = nullptr);
+
+    // Per-request working state. Passing the same one to every match() of a
+    // batch reuses its buffers, so matching stops allocating once they have
+    // grown to the longest URL. Not shared between threads.
+    struct MatchContext {
+        std::string_view url;  // as given, for match-case filters
+        std::string lower;
+        size_t hostBegin = 0;
+        size_t hostEnd = 0;
+        std::string source;  // lowercase host of the page
+        uint32_t type = kTypeOther;
+        uint8_t party = 0;  // 0 when the page is unknown
+        std::vector<uint32_t> tokens;
+        const NetworkFilter* rule = nullptr;  // filter behind the last positive step
+    };
+
+    // Verdict for one request. Hosts in `extraHosts` (e.g. the mapped DNS
+    // blocklist) count as blocking filters; exceptions still override them.
+    FilterVerdict match(const FilterRequest& req, const DomainIndex* extraHosts = nullptr) const;
+    FilterVerdict match(const FilterRequest& req, MatchContext& ctx,
+                        const DomainIndex* extraHosts = nullptr) const;
+
+    // The steps of match(), for combining several sets (e.g. one per
+    // subscription) into one verdict: prepare the context once, then a request
+    // is blocked if any set has an important match, or if any set blocks it
+    // and none has an exception.
+    static void prepare(const FilterRequest& req, MatchContext& ctx);
+    bool important(MatchContext& ctx) const { return find(important_, ctx); }
+    bool blocks(MatchContext& ctx) const;
+    bool excepted(MatchContext& ctx) const { return find(exceptions_, ctx); }
+
+    // Hosts blocked outright by `||host^` and plain host lines.
+    const DomainIndex& hosts() const { return hosts_; }
+
+    size_t size() const { return hosts_.size() + important_.filters.size() + block_.filters.size()
+                                 + exceptions_.filters.size(); }
+    size_t memory_bytes() const;
+
+    std::string_view pattern(const NetworkFilter& f) const { return strings_.view(f.pattern); }
+    // Empty unless the set keeps text.
+    std::string_view rule_text(const NetworkFilter& f) const { return strings_.view(f.text); }
+
+private:
+    struct Index {
+        struct Range {
+            uint32_t begin;
+            uint32_t count;
+        };
+        std::vector<NetworkFilter> filters;
+        std::unordered_map<uint32_t, Range> buckets;  // token hash -> run of bucketFilters
+        std::vector<uint32_t> bucketFilters;
+        std::vector<uint32_t> anywhere;  // no usable token: tried for every URL
+        PatternMatcher literals;          // plain substrings
+        std::vector<uint32_t> literalFilter;  // matcher pattern id -> filter
+    };
+    struct Pending {
+        NetworkFilter filter;  // domains index pendingDomains_
+        uint64_t textHash;     // of the line as written, for $badfilter
+        bool host;             // hostname fast path: the pattern minus its `^`
+    };
+
+    void index(Index& idx, std::vector<NetworkFilter>&& filters,
+               const std::unordered_map<uint32_t, uint32_t>& counts) const;
+    bool find(const Index& idx, MatchContext& ctx) const;
+    bool applies(const NetworkFilter& f, const MatchContext& ctx, bool patternMatched = false) const;
+
+    bool keepText_;
+    std::vector<Pending> pending_;
+    std::vector<StringPool::Ref> pendingDomains_;
+    std::unordered_set<uint64_t> badfilters_;
+    std::string scratch_;
+
+    // After build(): only the strings of kept filters, deduplicated.
+    StringPool strings_;
+    std::vector<StringPool::Ref> domains_;
+    DomainIndex hosts_;
+    Index important_;
+    Index block_;
+    Index exceptions_;
+};
+
+// Element hiding and scriptlet lines (`##`, `#@#`, `#?#`, `#$#`, ...).
+bool is_cosmetic_filter(std::string_view line);
+
+// Host part of an absolute URL (or of a bare host), without userinfo or port.
+std::string_view url_host(std::string_view url);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fixed slab of equally sized packet buffers for the TUN engine.
+//
+// Buffers are cache-line aligned and recycled through a LIFO free list, so
+// the packet path never allocates and the most recently used (still cached)
+// buffer is handed out first. A buffer is named by a small handle and is
+// reference counted: the engine holds a reference while it processes a
+// packet, and a flow that keeps part of it (an out-of-order TCP segment)
+// takes one more instead of copying the bytes out.
+class PacketPool {
+public:
+    using Handle = uint32_t;
+    static constexpr Handle kNone = UINT32_MAX;
+    static constexpr size_t kAlign = 64;
+
+    // `bufSize` is rounded up to a whole number of cache lines.
+    PacketPool(size_t count, size_t bufSize);
+    ~PacketPool();
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    bool valid() const { return slab_ != nullptr; }
+
+    // A free buffer with one reference, or kNone when all are in use.
+    Handle acquire();
+    void retain(Handle h) { ++refs_[h]; }
+    void release(Handle h);
+
+    uint8_t* data(Handle h) const { return slab_ + (size_t)h * bufSize_; }
+    size_t buf_size() const { return bufSize_; }
+    size_t capacity() const { return refs_.size(); }
+    size_t available() const { return free_.size(); }
+
+private:
+    uint8_t* slab_ = nullptr;
+    size_t bufSize_;
+    std::vector<Handle> free_;
+    std::vector<uint16_t> refs_;
+};
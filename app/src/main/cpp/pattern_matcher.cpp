@@ -0,0 +1,195 @@
+#include "pattern_matcher.h"
+
+#include <algorithm>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// Skipping only pays off when few bytes can start a pattern; past this many
+// distinct start bytes nearly every URL byte is a candidate anyway.
+static constexpr size_t kMaxPrefilterStarts = 48;
+
+void PatternMatcher::build(const std::vector<std::string_view>& patterns) {
+    *this = PatternMatcher();
+    patterns_ = patterns.size();
+    sameNext_.assign(patterns_, kNone);
+
+    // classes follow byte order, so sorting raw bytes sorts class strings too
+    bool used[256] = {};
+    for (std::string_view p : patterns) {
+        for (unsigned char b : p) used[b] = true;
+    }
+    for (int b = 0; b < 256; ++b) {
+        if (used[b]) class_[b] = (uint16_t)++classes_;
+    }
+    std::vector<uint32_t> order;
+    order.reserve(patterns_);
+    for (uint32_t i = 0; i < (uint32_t)patterns_; ++i) {
+        if (!patterns[i].empty()) order.push_back(i);
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return patterns[a] < patterns[b]; });
+
+    // Free slots form a circular doubly linked list through slot 0 (the
+    // root, never free), so the base search only visits free slots.
+    std::vector<uint32_t> nextFree{0}, prevFree{0};
+    units_.assign(1, Unit{0, 0});
+    fail_.assign(1, 0);
+    out_.assign(1, kNone);
+    outLink_.assign(1, kNone);
+    auto grow = [&](size_t n) {
+        size_t old = units_.size();
+        if (old >= n) return;
+        n = std::max(n, old * 2);
+        units_.resize(n, Unit{0, kNone});
+        fail_.resize(n, 0);
+        out_.resize(n, kNone);
+        outLink_.resize(n, kNone);
+        nextFree.resize(n);
+        prevFree.resize(n);
+        for (size_t i = old; i < n; ++i) {
+            uint32_t tail = prevFree[0];
+            nextFree[tail] = (uint32_t)i;
+            prevFree[i] = tail;
+            nextFree[i] = 0;
+            prevFree[0] = (uint32_t)i;
+        }
+    };
+    grow(256 + classes_ + 1);
+    states_ = 1;
+
+    struct Item {
+        uint32_t state, lo, hi, depth;  // patterns [lo, hi) of `order` share the state's prefix
+    };
+    struct Child {
+        uint32_t cls, lo, hi;
+    };
+    std::vector<Item> queue{{0, 0, (uint32_t)order.size(), 0}};
+    std::vector<Child> kids;
+    uint32_t maxBase = 0;
+    // breadth first, so failure targets always exist before the states that need them
+    for (size_t qi = 0; qi < queue.size(); ++qi) {
+        Item it = queue[qi];
+        kids.clear();
+        uint32_t i = it.lo;
+        while (i < it.hi && patterns[order[i]].size() == it.depth) ++i;  // end here; sorted first
+        while (i < it.hi) {
+            uint8_t b = (uint8_t)patterns[order[i]][it.depth];
+            uint32_t j = i + 1;
+            while (j < it.hi && (uint8_t)patterns[order[j]][it.depth] == b) ++j;
+            kids.push_back(Child{class_[b], i, j});
+            i = j;
+        }
+        if (kids.empty()) continue;
+
+        // first base at which every child slot is free
+        uint32_t base = 0;
+        for (uint32_t pos = nextFree[0];; pos = nextFree[pos]) {
+            if (pos == 0) {
+                pos = (uint32_t)units_.size();  // no free slot left: the new ones are
+                grow(pos + 1);
+            }
+            if (pos < kids[0].cls) continue;
+            base = pos - kids[0].cls;
+            grow(base + classes_ + 1);
+            bool fits = true;
+            for (const Child& k : kids) {
+                if (units_[base + k.cls].check != kNone) {
+                    fits = false;
+                    break;
+                }
+            }
+            if (fits) break;
+        }
+        units_[it.state].base = base;
+        maxBase = std::max(maxBase, base);
+
+        for (const Child& k : kids) {
+            uint32_t t = base + k.cls;
+            units_[t].check = it.state;
+            nextFree[prevFree[t]] = nextFree[t];
+            prevFree[nextFree[t]] = prevFree[t];
+            ++states_;
+            // patterns that end here come first in the group
+            uint32_t j = k.lo;
+            uint32_t* link = &out_[t];
+            for (; j < k.hi && patterns[order[j]].size() == it.depth + 1; ++j) {
+                *link = order[j];
+                link = &sameNext_[order[j]];
+            }
+            uint32_t f = 0;
+            if (it.state != 0) {
+                for (uint32_t s = fail_[it.state];; s = fail_[s]) {
+                    uint32_t g = units_[s].base + k.cls;
+                    if (units_[g].check == s) {
+                        f = g;
+                        break;
+                    }
+                    if (s == 0) break;
+                }
+            }
+            fail_[t] = f;
+            outLink_[t] = out_[f] != kNone ? f : outLink_[f];
+            if (j < k.hi) queue.push_back(Item{t, k.lo, k.hi, it.depth + 1});
+        }
+    }
+
+    // every base + class lookup stays in range
+    size_t n = maxBase + classes_ + 1;
+    units_.resize(n);
+    units_.shrink_to_fit();
+    for (auto* v : {&fail_, &out_, &outLink_}) {
+        v->resize(n);
+        v->shrink_to_fit();
+    }
+
+    size_t starts = 0;
+    for (uint32_t id : order) {
+        uint8_t b = (uint8_t)patterns[id][0];
+        if (!start_[b]) ++starts;
+        start_[b] = true;
+        lo_[b & 15] |= (uint8_t)(1u << ((b >> 4) & 7));
+    }
+    for (int h = 0; h < 16; ++h) hi_[h] = (uint8_t)(1u << (h & 7));  // exact for ASCII, a superset above
+    prefilter_ = starts <= kMaxPrefilterStarts;
+}
+
+size_t PatternMatcher::memory_bytes() const {
+    return units_.size() * sizeof(Unit) + (fail_.size() + out_.size() + outLink_.size() + sameNext_.size()) * 4;
+}
+
+size_t PatternMatcher::skip(const uint8_t* p, size_t i, size_t n) const {
+#if defined(__SSSE3__)
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lo_));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hi_));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(v, nibble));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+        __m128i none = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+        unsigned m = ~(unsigned)_mm_movemask_epi8(none) & 0xffff;
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+#elif defined(__aarch64__)
+    const uint8x16_t lo = vld1q_u8(lo_);
+    const uint8x16_t hi = vld1q_u8(hi_);
+    const uint8x16_t nibble = vdupq_n_u8(0x0f);
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(p + i);
+        uint8x16_t m = vandq_u8(vqtbl1q_u8(lo, vandq_u8(v, nibble)), vqtbl1q_u8(hi, vshrq_n_u8(v, 4)));
+        uint64x2_t w = vreinterpretq_u64_u8(vtstq_u8(m, m));
+        uint64_t a = vgetq_lane_u64(w, 0);
+        uint64_t b = vgetq_lane_u64(w, 1);
+        if (a) return i + (size_t)(__builtin_ctzll(a) >> 3);
+        if (b) return i + 8 + (size_t)(__builtin_ctzll(b) >> 3);
+    }
+#endif
+    for (; i < n; ++i) {
+        if (start_[p[i]]) return i;
+    }
+    return n;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Multi-pattern substring search (Aho-Corasick) over flat arrays.
+//
+// The goto function is a double-array trie over byte classes: every byte
+// that occurs in some pattern gets its own class, all others share class 0,
+// which always returns the automaton to the root. A state's children sit at
+// base + class and are recognised by their check entry, so a transition is
+// two loads from one array. Failure and output links are plain index arrays.
+//
+// While the automaton is at the root, bytes that start no pattern are skipped
+// 16 at a time with a nibble-table lookup (SSSE3 pshufb / NEON tbl), so text
+// that shares few bytes with the pattern set is scanned at memory speed.
+class PatternMatcher {
+public:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    // Pattern i is reported as id i. Empty patterns never match; duplicates
+    // all report.
+    void build(const std::vector<std::string_view>& patterns);
+
+    bool empty() const { return patterns_ == 0; }
+    size_t pattern_count() const { return patterns_; }
+    size_t state_count() const { return states_; }
+    size_t memory_bytes() const;
+
+    // Calls fn(id) for every occurrence, in order of where it ends, until fn
+    // returns true. Returns whether it did.
+    template <typename Fn>
+    bool scan(std::string_view text, Fn fn) const {
+        if (patterns_ == 0) return false;
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(text.data());
+        size_t n = text.size();
+        uint32_t s = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (s == 0 && prefilter_) {
+                i = skip(p, i, n);
+                if (i == n) break;
+            }
+            uint32_t c = class_[p[i]];
+            if (c == 0) {
+                s = 0;
+                continue;
+            }
+            s = step(s, c);
+            for (uint32_t o = out_[s] != kNone ? s : outLink_[s]; o != kNone; o = outLink_[o]) {
+                for (uint32_t id = out_[o]; id != kNone; id = sameNext_[id]) {
+                    if (fn(id)) return true;
+                }
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Unit {
+        uint32_t base;
+        uint32_t check;  // parent state, kNone while the slot is free
+    };
+
+    uint32_t step(uint32_t s, uint32_t c) const {
+        while (true) {
+            uint32_t t = units_[s].base + c;
+            if (units_[t].check == s) return t;
+            if (s == 0) return 0;
+            s = fail_[s];
+        }
+    }
+
+    // First index >= i whose byte may start a pattern, or n.
+    size_t skip(const uint8_t* p, size_t i, size_t n) const;
+
+    uint16_t class_[256] = {};
+    uint32_t classes_ = 0;
+    size_t patterns_ = 0;
+    size_t states_ = 0;
+    std::vector<Unit> units_;
+    std::vector<uint32_t> fail_;
+    std::vector<uint32_t> out_;       // first pattern ending in this state
+    std::vector<uint32_t> outLink_;   // nearest state on the failure chain with an output
+    std::vector<uint32_t> sameNext_;  // next pattern with the same text
+
+    // start-byte set as two 16-entry nibble tables: byte b may start a
+    // pattern iff lo_[b & 15] & hi_[b >> 4] != 0
+    uint8_t lo_[16] = {};
+    uint8_t hi_[16] = {};
+    bool start_[256] = {};
+    bool prefilter_ = false;
+};
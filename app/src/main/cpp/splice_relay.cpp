@@ -0,0 +1,199 @@
+#include "splice_relay.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static constexpr size_t kSpliceChunk = 64 * 1024;
+static constexpr unsigned kSpliceFlags = SPLICE_F_MOVE | SPLICE_F_NONBLOCK;
+
+static bool would_block(int err) {
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
+
+PipePool& PipePool::instance() {
+    static PipePool pool;
+    return pool;
+}
+
+bool PipePool::acquire(int fds[2]) {
+    {
+        std::lock_guard<std::mutex> g(lock_);
+        if (free_.size() >= 2) {
+            fds[1] = free_.back(); free_.pop_back();
+            fds[0] = free_.back(); free_.pop_back();
+            return true;
+        }
+    }
+    return pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+void PipePool::release(int fds[2], bool drained) {
+    if (drained) {
+        std::lock_guard<std::mutex> g(lock_);
+        if (free_.size() < kMaxPooled * 2) {
+            free_.push_back(fds[0]);
+            free_.push_back(fds[1]);
+            return;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void RelayFlow::setup(bool useSplice) {
+    if (useSplice && PipePool::instance().acquire(pipe)) return;
+    pipe[0] = pipe[1] = -1;
+    fall_back_to_copy();
+}
+
+void RelayFlow::release() {
+    if (pipe[0] < 0) return;
+    PipePool::instance().release(pipe, inPipe == 0);
+    pipe[0] = pipe[1] = -1;
+    inPipe = 0;
+}
+
+void RelayFlow::fall_back_to_copy() {
+    release();
+    if (buf.size() < kRelayCopyBufSize) buf.resize(kRelayCopyBufSize);
+}
+
+bool RelayFlow::wants_read() const {
+    if (srcEof) return false;
+    if (pipe[0] >= 0) return start == end && !pipeFull;
+    return end < buf.size() || start > 0;
+}
+
+bool RelayFlow::flush_buf(int dst, bool* progress) {
+    if (start == end) return true;
+    ssize_t w = send(dst, buf.data() + start, end - start, MSG_NOSIGNAL);
+    if (w > 0) {
+        start += (size_t)w;
+        written += (uint64_t)w;
+        *progress = true;
+    } else if (w < 0 && !would_block(errno)) {
+        return false;
+    }
+    if (start == end) start = end = 0;
+    return true;
+}
+
+bool RelayFlow::copy(int src, int dst, bool* progress) {
+    (void)dst;
+    if (start > 0 && end == buf.size()) {
+        memmove(buf.data(), buf.data() + start, end - start);
+        end -= start;
+        start = 0;
+    }
+    if (srcEof || end == buf.size()) return true;
+    ssize_t r = recv(src, buf.data() + end, buf.size() - end, 0);
+    if (r > 0) {
+        end += (size_t)r;
+        *progress = true;
+    } else if (r == 0) {
+        srcEof = true;
+        *progress = true;
+    } else if (!would_block(errno)) {
+        return false;
+    }
+    return true;
+}
+
+bool RelayFlow::splice_through(int src, int dst, bool* progress) {
+    if (inPipe > 0) {
+        ssize_t n = splice(pipe[0], nullptr, dst, nullptr, inPipe, kSpliceFlags);
+        if (n > 0) {
+            inPipe -= (size_t)n;
+            written += (uint64_t)n;
+            pipeFull = false;
+            *progress = true;
+        } else if (n < 0 && !would_block(errno)) {
+            return false;
+        }
+    }
+    if (srcEof || pipeFull) return true;
+    ssize_t n = splice(src, nullptr, pipe[1], nullptr, kSpliceChunk, kSpliceFlags);
+    if (n > 0) {
+        inPipe += (size_t)n;
+        *progress = true;
+    } else if (n == 0) {
+        srcEof = true;
+        *progress = true;
+    } else if (would_block(errno)) {
+        // with data already queued this may be the pipe, not the socket
+        if (inPipe > 0) pipeFull = true;
+    } else if ((errno == EINVAL || errno == ENOSYS) && inPipe == 0) {
+        fall_back_to_copy();
+        *progress = true;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool RelayFlow::pump(int src, int dst, bool* progressed) {
+    while (true) {
+        bool progress = false;
+        if (!flush_buf(dst, &progress)) return false;
+        if (pipe[0] >= 0) {
+            // the prefix has to be out before spliced bytes can follow it
+            if (start == end && !splice_through(src, dst, &progress)) return false;
+        } else if (!copy(src, dst, &progress)) {
+            return false;
+        }
+        if (!progress) break;
+        *progressed = true;
+    }
+    if (srcEof && pending() == 0 && !dstShut) {
+        shutdown(dst, SHUT_WR);
+        dstShut = true;
+    }
+    return true;
+}
+
+void relay_blocking(int in, int out) {
+    int fds[2];
+    if (PipePool::instance().acquire(fds)) {
+        size_t queued = 0;
+        bool ok = true;
+        while (ok) {
+            // blocks on the socket; the pipe is always drained before the next read
+            ssize_t n = splice(in, nullptr, fds[1], nullptr, kSpliceChunk, SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) break;  // copy instead
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            queued = (size_t)n;
+            while (queued > 0) {
+                ssize_t w = splice(fds[0], nullptr, out, nullptr, queued, SPLICE_F_MOVE);
+                if (w < 0 && errno == EINTR) continue;
+                if (w <= 0) {
+                    ok = false;
+                    break;
+                }
+                queued -= (size_t)w;
+            }
+        }
+        PipePool::instance().release(fds, queued == 0);
+        if (!ok) return;
+    }
+
+    std::vector<char> buf(kRelayCopyBufSize);
+    while (true) {
+        ssize_t r = recv(in, buf.data(), buf.size(), 0);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        size_t off = 0;
+        while (off < (size_t)r) {
+            ssize_t s = send(out, buf.data() + off, (size_t)r - off, MSG_NOSIGNAL);
+            if (s < 0 && errno == EINTR) continue;
+            if (s <= 0) return;
+            off += (size_t)s;
+        }
+    }
+}
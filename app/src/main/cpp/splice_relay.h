@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Socket-to-socket relaying for connections whose payload is no longer
+// inspected. Bytes move socket -> pipe -> socket with splice(), so they never
+// cross into userspace; the pipes come from a process-wide pool. Without a
+// pipe (fd limit) or when the kernel refuses to splice a socket, the relay
+// copies through a large buffer instead.
+
+static constexpr size_t kRelayCopyBufSize = 64 * 1024;
+
+class PipePool {
+public:
+    static PipePool& instance();
+
+    // Hands out a non-blocking pipe; false if none could be created.
+    bool acquire(int fds[2]);
+
+    // Pooled again only if drained, otherwise closed.
+    void release(int fds[2], bool drained);
+
+private:
+    static constexpr size_t kMaxPooled = 64;
+
+    std::mutex lock_;
+    std::vector<int> free_;  // read/write fds, pairwise
+};
+
+// One direction of a non-blocking relay.
+struct RelayFlow {
+    // Copy path; also holds bytes read before relaying started (request
+    // head, CONNECT reply), which always go out before any spliced data.
+    std::vector<uint8_t> buf;
+    size_t start = 0;
+    size_t end = 0;
+
+    int pipe[2] = {-1, -1};
+    size_t inPipe = 0;
+    bool pipeFull = false;
+
+    bool srcEof = false;
+    bool dstShut = false;
+    uint64_t written = 0;  // bytes delivered to dst
+
+    RelayFlow() = default;
+    ~RelayFlow() { release(); }
+    RelayFlow(const RelayFlow&) = delete;
+    RelayFlow& operator=(const RelayFlow&) = delete;
+
+    // Takes a pooled pipe when `useSplice`, else sizes the copy buffer.
+    void setup(bool useSplice);
+
+    // Moves bytes src -> dst until both would block, then half-closes dst
+    // once the source hit EOF and everything was written. Returns false on
+    // a socket error. Reading stops while nothing more can be buffered,
+    // which is what pushes back on a fast source.
+    bool pump(int src, int dst, bool* progressed);
+
+    size_t pending() const { return end - start + inPipe; }
+    bool wants_read() const;
+
+    void release();
+
+private:
+    bool flush_buf(int dst, bool* progress);
+    bool copy(int src, int dst, bool* progress);
+    bool splice_through(int src, int dst, bool* progress);
+    void fall_back_to_copy();
+};
+
+// Blocking relay from `in` to `out` until EOF or an error, for thread-per-
+// connection callers. Returns once `in` is drained; does not shut down either fd.
+void relay_blocking(int in, int out);
@@ -0,0 +1,58 @@
+#include "string_pool.h"
+
+#include <utility>
+
+size_t StringPool::Hash::operator()(uint64_t key) const {
+    // FNV-1a
+    uint32_t h = 2166136261u;
+    for (char c : pool->key_view(key)) h = (h ^ (uint8_t)c) * 16777619u;
+    return h;
+}
+
+bool StringPool::Eq::operator()(uint64_t a, uint64_t b) const {
+    return pool->key_view(a) == pool->key_view(b);
+}
+
+StringPool::StringPool() : index_(0, Hash{this}, Eq{this}) {}
+
+StringPool::StringPool(StringPool&& o) noexcept : index_(0, Hash{this}, Eq{this}) {
+    adopt(std::move(o));
+}
+
+StringPool& StringPool::operator=(StringPool&& o) noexcept {
+    if (this != &o) adopt(std::move(o));
+    return *this;
+}
+
+// The set's functors point at their pool, so entries are re-inserted here
+// rather than moved with the table.
+void StringPool::adopt(StringPool&& o) {
+    bytes_ = std::move(o.bytes_);
+    index_ = Index(o.index_.size(), Hash{this}, Eq{this});
+    for (uint64_t key : o.index_) index_.insert(key);
+    o.bytes_.clear();
+    o.index_ = Index(0, Hash{&o}, Eq{&o});
+}
+
+StringPool::Ref StringPool::intern(std::string_view s) {
+    // The candidate is appended first so it can be looked up like any stored
+    // string, and taken back off if it was already there.
+    uint32_t off = (uint32_t)bytes_.size();
+    bytes_.insert(bytes_.end(), s.begin(), s.end());
+    uint64_t key = (uint64_t)off << 32 | (uint32_t)s.size();
+    auto ins = index_.insert(key);
+    if (!ins.second) {
+        bytes_.resize(off);
+        key = *ins.first;
+    }
+    return Ref{(uint32_t)(key >> 32), (uint32_t)key};
+}
+
+void StringPool::freeze() {
+    index_ = Index(0, Hash{this}, Eq{this});
+    bytes_.shrink_to_fit();
+}
+
+size_t StringPool::memory_bytes() const {
+    return bytes_.capacity() + index_.bucket_count() * sizeof(void*) + index_.size() * (sizeof(uint64_t) + 2 * sizeof(void*));
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Append-only arena of deduplicated strings.
+//
+// Strings are packed back to back in one buffer and referred to by a 32-bit
+// offset and length, so a stored string costs its bytes and an 8-byte Ref
+// instead of a heap block per std::string. While the pool is being filled, a
+// hash set of the stored strings makes intern() return the existing copy of
+// a repeated string; freeze() drops that set once no more strings are coming.
+class StringPool {
+public:
+    struct Ref {
+        uint32_t off = 0;
+        uint32_t len = 0;
+    };
+
+    StringPool();
+    StringPool(StringPool&& o) noexcept;
+    StringPool& operator=(StringPool&& o) noexcept;
+    StringPool(const StringPool&) = delete;
+    StringPool& operator=(const StringPool&) = delete;
+
+    Ref intern(std::string_view s);
+    std::string_view view(Ref r) const { return std::string_view(bytes_.data() + r.off, r.len); }
+
+    // Frees the dedup table and spare capacity. Strings added afterwards are
+    // still stored, just no longer deduplicated.
+    void freeze();
+
+    size_t size() const { return bytes_.size(); }
+    size_t memory_bytes() const;
+
+private:
+    // Set entries are packed refs (offset << 32 | length) hashed by content.
+    struct Hash {
+        const StringPool* pool;
+        size_t operator()(uint64_t key) const;
+    };
+    struct Eq {
+        const StringPool* pool;
+        bool operator()(uint64_t a, uint64_t b) const;
+    };
+    using Index = std::unordered_set<uint64_t, Hash, Eq>;
+
+    std::string_view key_view(uint64_t key) const {
+        return std::string_view(bytes_.data() + (key >> 32), (uint32_t)key);
+    }
+    void adopt(StringPool&& o);
+
+    std::vector<char> bytes_;
+    Index index_;
+};
@@ -0,0 +1,336 @@
+#include "subscription_compiler.h"
+
+#include <android/log.h>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "blocklist_file.h"
+
+#define LOG_TAG "subscription_compiler"
+#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+uint64_t line_hash(std::string_view s) {
+    // FNV-1a 64: collisions among a few hundred thousand rules are negligible
+    uint64_t h = 14695981039346656037ull;
+    for (char c : s) h = (h ^ (uint8_t)c) * 1099511628211ull;
+    return h;
+}
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+bool is_ip_literal(std::string_view s) {
+    char buf[64];
+    if (s.empty() || s.size() >= sizeof(buf)) return false;
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = 0;
+    in6_addr a;
+    return inet_pton(AF_INET, buf, &a) == 1 || inet_pton(AF_INET6, buf, &a) == 1;
+}
+
+// "0.0.0.0 ads.example.com" -> "ads.example.com". True for any line that
+// starts with an address; `host` is left empty unless it names a domain that
+// can be blocked, so hosts-file preambles ("127.0.0.1 localhost") and
+// address-to-address lines never block anything.
+bool hosts_file_entry(std::string_view line, std::string_view* host) {
+    size_t sp = line.find_first_of(" \t");
+    if (sp == std::string_view::npos || sp == 0) return false;
+    if (!is_ip_literal(line.substr(0, sp))) return false;
+    std::string_view rest = trim(line.substr(sp));
+    std::string_view h = rest.substr(0, rest.find_first_of(" \t#"));
+    *host = std::string_view();
+    if (h.find('.') == std::string_view::npos || is_ip_literal(h)) return true;
+    static const std::string_view kLocalNames[] = {"localhost", "localhost.localdomain", "broadcasthost", "local"};
+    for (std::string_view n : kLocalNames) {
+        if (h.size() == n.size() && strncasecmp(h.data(), n.data(), n.size()) == 0) return true;
+    }
+    *host = h;
+    return true;
+}
+
+// Same 8 bytes at a time; only used to notice that a list changed.
+uint64_t content_hash(const char* p, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32;
+    }
+    for (; i < n; ++i) h = (h ^ (uint8_t)p[i]) * 1099511628211ull;
+    return h;
+}
+
+struct Mapping {
+    const char* data = nullptr;
+    size_t len = 0;
+    ~Mapping() {
+        if (data) munmap(const_cast<char*>(data), len);
+    }
+};
+
+bool map_file(int fd, size_t len, Mapping* m) {
+    if (len == 0) return true;
+    void* addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) return false;
+    madvise(addr, len, MADV_SEQUENTIAL);
+    m->data = static_cast<const char*>(addr);
+    m->len = len;
+    return true;
+}
+
+class Compiler {
+public:
+    explicit Compiler(SubscriptionSegment* seg) : seg_(seg), stats_(&seg->stats) {}
+
+    void add_text(const char* p, size_t len) {
+        const char* end = p + len;
+        while (p < end) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', (size_t)(end - p)));
+            if (!nl) nl = end;
+            add_line(std::string_view(p, (size_t)(nl - p)));
+            p = nl + 1;
+        }
+        stats_->files = 1;
+        stats_->compiled = 1;
+        stats_->bytes = len;
+    }
+
+    void finish() {
+        seg_->filters.build(&hosts_);
+        seg_->hosts = hosts_.build();
+        stats_->hosts = seg_->hosts.size();
+    }
+
+private:
+    void add_line(std::string_view line) {
+        stats_->lines++;
+        line = trim(line);
+        if (line.empty() || line.front() == '!' || line.front() == '['
+            || (line.front() == '#' && !is_cosmetic_filter(line))) {
+            stats_->skipped++;
+            return;
+        }
+        if (!seen_.insert(line_hash(line)).second) {
+            stats_->duplicates++;
+            return;
+        }
+        if (is_cosmetic_filter(line)) {
+            stats_->cosmetic++;
+            return;
+        }
+        // hosts-file entries only ever block their exact domain (and its
+        // subdomains), never as a substring of some URL
+        std::string_view host;
+        if (hosts_file_entry(line, &host)) {
+            if (!host.empty() && hosts_.add(host)) stats_->filters++;
+            else stats_->skipped++;
+            return;
+        }
+        if (seg_->filters.add(line)) stats_->filters++;
+        else stats_->skipped++;
+    }
+
+    SubscriptionSegment* seg_;
+    SubscriptionStats* stats_;
+    std::unordered_set<uint64_t> seen_;
+    DomainIndexBuilder hosts_;
+};
+
+void add_stats(SubscriptionStats* total, const SubscriptionStats& s) {
+    total->files += s.files;
+    total->bytes += s.bytes;
+    total->lines += s.lines;
+    total->duplicates += s.duplicates;
+    total->cosmetic += s.cosmetic;
+    total->filters += s.filters;
+    total->skipped += s.skipped;
+}
+
+// Text copy of the host list, next to the compiled one.
+bool write_host_list(const DomainIndex& index, const std::string& tmp) {
+    FILE* f = fopen(tmp.c_str(), "we");
+    if (!f) {
+        ALOGE("cannot create %s: %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    index.for_each([&](std::string_view d) {
+        ok = ok && fwrite(d.data(), 1, d.size(), f) == d.size() && fputc('\n', f) != EOF;
+    });
+    ok = fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+    return ok;
+}
+
+// Union of the segments' host rules, written for the proxies and mapped back.
+bool write_hosts(const std::vector<const SubscriptionSegment*>& segs, const std::string& hostsPath, DomainIndex* out) {
+    DomainIndexBuilder builder;
+    for (const SubscriptionSegment* s : segs) {
+        s->hosts.for_each([&](std::string_view d) { builder.add(d); });
+    }
+    DomainIndex index = builder.build();
+
+    // The proxies' reload watcher follows the text file and maps "<file>.bin"
+    // when it is newer, so the compiled image is written (and renamed) first.
+    static std::atomic<uint32_t> seq{0};
+    std::string tmp = hostsPath + ".tmp." + std::to_string(getpid()) + "." + std::to_string(seq.fetch_add(1));
+    std::string bin = hostsPath + ".bin";
+    if (!write_host_list(index, tmp) || !blocklist_write(index, bin) || rename(tmp.c_str(), hostsPath.c_str()) != 0) {
+        ALOGE("failed to write host list %s", hostsPath.c_str());
+        unlink(tmp.c_str());
+        return false;
+    }
+    DomainIndex mapped = blocklist_map(bin);
+    *out = mapped.node_count() > 0 ? std::move(mapped) : std::move(index);
+    return true;
+}
+
+} // namespace
+
+std::shared_ptr<const SubscriptionSet> SubscriptionSet::from_filters(NetworkFilterSet&& filters) {
+    auto seg = std::make_shared<SubscriptionSegment>();
+    seg->filters = std::move(filters);
+    auto set = std::make_shared<SubscriptionSet>();
+    set->sources_.push_back(Source{std::string(), FileStamp(), 0, std::move(seg)});
+    return set;
+}
+
+FilterVerdict SubscriptionSet::match(const FilterRequest& req, NetworkFilterSet::MatchContext& ctx,
+                                     const DomainIndex* extraHosts) const {
+    NetworkFilterSet::prepare(req, ctx);
+    for (const Source& s : sources_) {
+        if (s.segment->filters.important(ctx)) return FilterVerdict::Blocked;
+    }
+    std::string_view host(ctx.lower.data() + ctx.hostBegin, ctx.hostEnd - ctx.hostBegin);
+    bool blocked = hosts_.match(host) || (extraHosts && extraHosts->match(host));
+    for (size_t i = 0; !blocked && i < sources_.size(); ++i) blocked = sources_[i].segment->filters.blocks(ctx);
+    if (!blocked) return FilterVerdict::None;
+    for (const Source& s : sources_) {
+        if (s.segment->filters.excepted(ctx)) return FilterVerdict::Allowed;
+    }
+    return FilterVerdict::Blocked;
+}
+
+bool SubscriptionSet::match_host(std::string_view host) const {
+    if (hosts_.match(host)) return true;
+    for (const Source& s : sources_) {
+        if (s.segment->filters.hosts().match(host)) return true;
+    }
+    return false;
+}
+
+size_t SubscriptionSet::memory_bytes() const {
+    size_t n = hosts_.memory_bytes();
+    for (const Source& s : sources_) n += s.segment->filters.memory_bytes() + s.segment->hosts.memory_bytes();
+    return n;
+}
+
+std::shared_ptr<const SubscriptionSet> update_subscriptions(
+    const std::shared_ptr<const SubscriptionSet>& current, const std::vector<std::string>& paths,
+    const std::string& hostsPath, SubscriptionStats* stats) {
+    using Source = SubscriptionSet::Source;
+    *stats = SubscriptionStats();
+    static const std::vector<Source> kNoSources;
+    const std::vector<Source>& prev = current ? current->sources_ : kNoSources;
+    auto next = std::make_shared<SubscriptionSet>();
+
+    for (const std::string& path : paths) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            ALOGI("Subscription file not found: %s", path.c_str());
+            continue;
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            continue;
+        }
+        Source src;
+        src.path = path;
+        src.stamp = SubscriptionSet::FileStamp{(uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_size,
+                                               (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec};
+        const Source* same = nullptr;
+        for (const Source& p : prev) {
+            if (p.path == path && p.stamp == src.stamp) same = &p;
+        }
+        if (!same) {
+            Mapping m;
+            if (!map_file(fd, (size_t)st.st_size, &m)) {
+                ALOGE("mmap failed for %s", path.c_str());
+                close(fd);
+                continue;
+            }
+            src.hash = content_hash(m.data, m.len);
+            // touched but unchanged, or moved: keep the compiled segment
+            for (const Source& p : prev) {
+                if (p.hash == src.hash && p.segment && !p.path.empty()) {
+                    src.segment = p.segment;
+                    break;
+                }
+            }
+            if (!src.segment) {
+                auto seg = std::make_shared<SubscriptionSegment>();
+                Compiler c(seg.get());
+                c.add_text(m.data, m.len);
+                c.finish();
+                src.segment = std::move(seg);
+            }
+        } else {
+            src.hash = same->hash;
+            src.segment = same->segment;
+        }
+        close(fd);
+        next->sources_.push_back(std::move(src));
+    }
+    if (next->sources_.empty()) return nullptr;
+
+    bool segmentsChanged = next->sources_.size() != prev.size();
+    bool stampsChanged = segmentsChanged;
+    for (size_t i = 0; !segmentsChanged && i < prev.size(); ++i) {
+        segmentsChanged = next->sources_[i].segment != prev[i].segment;
+        stampsChanged = stampsChanged || !(next->sources_[i].stamp == prev[i].stamp);
+    }
+    std::vector<const SubscriptionSegment*> segs;
+    for (const Source& s : next->sources_) {
+        bool reused = false;
+        for (const Source& p : prev) reused = reused || p.segment == s.segment;
+        if (!reused) stats->compiled++;
+        add_stats(stats, s.segment->stats);
+        segs.push_back(s.segment.get());
+    }
+    if (!segmentsChanged && !stampsChanged) {
+        stats->hosts = current->hosts_.size();
+        return current;
+    }
+
+    // Unchanged segments: the list on disk is still ours, map it again.
+    if (!segmentsChanged) {
+        DomainIndex mapped = blocklist_map(hostsPath + ".bin");
+        if (mapped.node_count() > 0 && mapped.size() == current->hosts_.size()) next->hosts_ = std::move(mapped);
+        else segmentsChanged = true;
+    }
+    if (segmentsChanged && !write_hosts(segs, hostsPath, &next->hosts_)) return nullptr;
+    stats->hosts = next->hosts_.size();
+    ALOGI("Subscriptions: %zu lists, %zu compiled (%llu bytes, %zu lines): %zu rules, %zu duplicates, %zu cosmetic, %zu skipped, %zu hosts",
+          stats->files, stats->compiled, (unsigned long long)stats->bytes, stats->lines, stats->filters,
+          stats->duplicates, stats->cosmetic, stats->skipped, stats->hosts);
+    return next;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "network_filter.h"
+
+// Compiles downloaded subscription lists straight from disk.
+//
+// Every file is mapped read-only and parsed line by line in place, so the
+// raw text is never copied onto the heap: what stays resident is the
+// compiled output plus one 64-bit hash per distinct rule, used to drop
+// repeated rules. Lines are sorted into three buckets: host-only rules
+// (`||host^`, plain hosts and hosts-file lines), network filters, and
+// cosmetic filters, which are only counted since nothing here can apply
+// them.
+//
+// Each list compiles into its own segment, remembered with the file's stat
+// and a hash of its text. An update recompiles only the lists whose text
+// changed and shares the other segments with the previous set, so a round of
+// 304s costs a few stat() calls and a small edit costs one list.
+struct SubscriptionStats {
+    size_t files = 0;       // lists that could be read
+    size_t compiled = 0;    // lists parsed in this update; the rest were reused
+    uint64_t bytes = 0;
+    size_t lines = 0;
+    size_t duplicates = 0;  // rule lines already seen in the same list
+    size_t cosmetic = 0;
+    size_t filters = 0;     // accepted rules, host-only ones included
+    size_t skipped = 0;     // comments and rules we cannot apply
+    size_t hosts = 0;       // domains in the written host list
+};
+
+// One compiled list.
+struct SubscriptionSegment {
+    NetworkFilterSet filters;  // without the host-only rules
+    DomainIndex hosts;         // host-only rules
+    SubscriptionStats stats;   // of this list alone
+};
+
+// Everything compiled from the current lists. Immutable once built; the
+// engine publishes a new set per update.
+class SubscriptionSet {
+public:
+    // Combined verdict over all segments: important filters first, then
+    // blocking filters, host rules and `extraHosts`, then exceptions from
+    // any list.
+    FilterVerdict match(const FilterRequest& req, NetworkFilterSet::MatchContext& ctx,
+                        const DomainIndex* extraHosts = nullptr) const;
+    bool match_host(std::string_view host) const;
+
+    const DomainIndex& hosts() const { return hosts_; }
+    size_t segment_count() const { return sources_.size(); }
+    // Compiled rules and host indexes, mapped host list included.
+    size_t memory_bytes() const;
+
+    // A set holding one filter set, e.g. rules passed in as text.
+    static std::shared_ptr<const SubscriptionSet> from_filters(NetworkFilterSet&& filters);
+
+private:
+    struct FileStamp {
+        uint64_t dev = 0, ino = 0, size = 0;
+        int64_t mtimeNs = 0;
+        bool operator==(const FileStamp& o) const {
+            return dev == o.dev && ino == o.ino && size == o.size && mtimeNs == o.mtimeNs;
+        }
+    };
+    struct Source {
+        std::string path;
+        FileStamp stamp;
+        uint64_t hash = 0;  // of the text the segment was compiled from
+        std::shared_ptr<const SubscriptionSegment> segment;
+    };
+
+    friend std::shared_ptr<const SubscriptionSet> update_subscriptions(
+        const std::shared_ptr<const SubscriptionSet>& current, const std::vector<std::string>& paths,
+        const std::string& hostsPath, SubscriptionStats* stats);
+
+    std::vector<Source> sources_;
+    DomainIndex hosts_;  // union of the segments' hosts, mapped from the written list
+};
+
+// Brings `current` (may be null) up to date with the lists at `paths`. A
+// list whose file has the same stat, or the same content hash, keeps its
+// segment; others are compiled. When the host rules changed, their union is
+// written as a text list to `hostsPath` and as a compiled image to
+// "<hostsPath>.bin" for the proxies' reload watcher. Returns `current` itself
+// if nothing changed, null if no list was readable or the host list could
+// not be written. Unreadable files are skipped.
+std::shared_ptr<const SubscriptionSet> update_subscriptions(
+    const std::shared_ptr<const SubscriptionSet>& current, const std::vector<std::string>& paths,
+    const std::string& hostsPath, SubscriptionStats* stats);
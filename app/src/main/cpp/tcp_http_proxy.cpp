@@ -4,263 +4,478 @@
 #include <thread>
 #include <vector>
 #include <atomic>
+#include <unordered_map>
 #include <android/log.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
-#include <sstream>
-#include <set>
-#include <fstream>
+#include <string_view>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+
+#include "async_resolver.h"
+#include "blocklist_snapshot.h"
+#include "event_log.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include "splice_relay.h"
+#include "tls_client_hello.h"
 
 #define LOG_TAG "tcp_http_proxy"
 #define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #define ALOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 
-static std::thread* proxyThread = nullptr;
 static std::atomic_bool proxyRunning(false);
-static std::set<std::string> blockedDomains;
 
-static void load_blocklist(const std::string& path) {
-    blockedDomains.clear();
-    std::ifstream ifs(path);
-    if (!ifs.good()) {
-        ALOGI("Proxy blocklist file not found: %s", path.c_str());
+static constexpr int kMaxProxyLoops = 16;
+static constexpr size_t kMaxHeadBytes = 64 * 1024;
+static constexpr uint64_t kSniffTimeoutMs = 5000;
+static constexpr uint64_t kConnectTimeoutMs = 10000;
+static constexpr uint64_t kIdleTimeoutMs = 5 * 60 * 1000;
+
+// Handle returned to Kotlin by startAdvancedProxy
+struct AdvancedProxy {
+    std::vector<std::thread> loops;
+};
+
+static bool host_blocked(std::string_view host, std::string_view* entry) {
+    return blocklist_match(host, entry);
+}
+
+static uint64_t now_ms() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// "host", "host:port", "[v6]" or "[v6]:port"
+static void split_host_port(std::string_view in, std::string_view defPort, std::string_view& host, std::string_view& port) {
+    port = defPort;
+    if (!in.empty() && in.front() == '[') {
+        size_t close = in.find(']');
+        if (close == std::string_view::npos) {
+            host = {};
+            return;
+        }
+        host = in.substr(1, close - 1);
+        if (close + 1 < in.size() && in[close + 1] == ':') port = in.substr(close + 2);
         return;
     }
-    std::string line;
-    while (std::getline(ifs, line)) {
-        std::string s;
-        for (char c : line) {
-            if (c == '\r' || c == '\n') break;
-            s += c;
-        }
-        if (s.empty()) continue;
-        for (auto &ch : s) ch = tolower(ch);
-        blockedDomains.insert(s);
+    size_t colon = in.find(':');
+    if (colon != std::string_view::npos && in.find(':', colon + 1) == std::string_view::npos) {
+        host = in.substr(0, colon);
+        port = in.substr(colon + 1);
+    } else {
+        host = in;
     }
-    ALOGI("Proxy loaded %zu blocked domains", blockedDomains.size());
 }
 
-static bool host_blocked(const std::string& host) {
-    std::string h = host;
-    for (auto &c : h) c = tolower(c);
-    if (blockedDomains.find(h) != blockedDomains.end()) return true;
-    for (const auto& bd : blockedDomains) {
-        if (bd.size() > 0 && h.size() >= bd.size()) {
-            if (h.compare(h.size()-bd.size(), bd.size(), bd) == 0) return true;
-        }
-    }
-    return false;
+enum class ConnState { Sniff, Resolve, Connect, Relay };
+
+struct Conn;
+
+// epoll user data: which socket of which connection fired
+struct ConnSide {
+    Conn* conn;
+    bool remote;
+};
+
+// sniff -> parse/SNI -> resolve -> connect -> relay -> close
+struct Conn {
+    uint64_t id = 0;
+    ConnState state = ConnState::Sniff;
+    int client = -1;
+    int remote = -1;
+    ConnSide clientSide{this, false};
+    ConnSide remoteSide{this, true};
+    uint32_t clientEvents = 0;
+    uint32_t remoteEvents = 0;
+    uint64_t deadlineMs = 0;
+    uint64_t connectStartUs = 0;  // for the ProxyConnect latency
+    uint32_t hostId = 0;          // event log: where the client asked to go
+    EventKind kind = EventKind::Http;
+    bool closed = false;
+
+    std::vector<uint8_t> head;  // bytes read while sniffing (request head or ClientHello)
+    size_t headScanned = 0;     // http_parse_request() resume point
+    size_t headEnd = 0;         // end of the request head (CRLFCRLF)
+    bool tunnel = false;        // CONNECT: answer 200 and forward what follows the head;
+                                // otherwise (HTTP, direct TLS) the whole head is forwarded
+    addrinfo* addrs = nullptr;
+    addrinfo* nextAddr = nullptr;
+
+    RelayFlow up;    // client -> remote
+    RelayFlow down;  // remote -> client
+};
+
+struct ProxyLoop {
+    int index = 0;
+    int ep = -1;
+    int listenFd = -1;
+    AsyncResolver resolver;
+    std::unordered_map<uint64_t, Conn*> conns;
+    std::vector<Conn*> dead;
+    std::vector<AsyncResolver::Result> resolved;
+    std::vector<uint8_t> tlsScratch = std::vector<uint8_t>(kTlsMaxHelloLen);
+    uint64_t nextId = 1;
+};
+
+// epoll tags for the two non-connection fds of a loop
+static char listenTag, resolverTag;
+
+static void set_interest(ProxyLoop& L, int fd, uint32_t& current, uint32_t want, ConnSide* side) {
+    if (fd < 0 || current == want) return;
+    struct epoll_event ev{};
+    ev.events = want;
+    ev.data.ptr = side;
+    epoll_ctl(L.ep, EPOLL_CTL_MOD, fd, &ev);
+    current = want;
 }
 
-// Read a line from socket until CRLF
-static bool read_line(int fd, std::string& out) {
-    out.clear();
-    char c;
-    bool gotCR = false;
-    while (true) {
-        ssize_t n = recv(fd, &c, 1, 0);
-        if (n <= 0) return false;
-        out.push_back(c);
-        if (out.size() >= 2 && out[out.size()-2] == '\r' && out[out.size()-1] == '\n') break;
+static bool add_fd(ProxyLoop& L, int fd, uint32_t events, void* tag) {
+    struct epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = tag;
+    return epoll_ctl(L.ep, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+static void close_conn(ProxyLoop& L, Conn* c) {
+    if (c->closed) return;
+    c->closed = true;
+    metric_add(Metric::ProxyBytesUp, c->up.written);
+    metric_add(Metric::ProxyBytesDown, c->down.written);
+    // closing the fd also drops it from the epoll set
+    if (c->client >= 0) close(c->client);
+    if (c->remote >= 0) close(c->remote);
+    c->client = c->remote = -1;
+    if (c->addrs) freeaddrinfo(c->addrs);
+    c->addrs = c->nextAddr = nullptr;
+    c->up.release();
+    c->down.release();
+    L.conns.erase(c->id);
+    // other events from this epoll_wait batch may still point at it
+    L.dead.push_back(c);
+}
+
+static void relay(ProxyLoop& L, Conn* c, uint64_t now) {
+    bool progressed = false;
+    if (!c->up.pump(c->client, c->remote, &progressed) || !c->down.pump(c->remote, c->client, &progressed)) {
+        close_conn(L, c);
+        return;
+    }
+    if (c->up.dstShut && c->down.dstShut) {
+        close_conn(L, c);
+        return;
     }
-    return true;
+    if (progressed) c->deadlineMs = now + kIdleTimeoutMs;
+
+    uint32_t cw = 0, rw = 0;
+    if (c->up.wants_read()) cw |= EPOLLIN;
+    if (c->down.pending() > 0) cw |= EPOLLOUT;
+    if (c->down.wants_read()) rw |= EPOLLIN;
+    if (c->up.pending() > 0) rw |= EPOLLOUT;
+    set_interest(L, c->client, c->clientEvents, cw, &c->clientSide);
+    set_interest(L, c->remote, c->remoteEvents, rw, &c->remoteSide);
 }
 
-// Simple function to parse Host header and the request line for HTTP proxying
-static bool parse_http_request(int clientFd, std::string& method, std::string& target, std::string& host, std::vector<char>& initialBuffer) {
-    // read request headers into buffer until empty line
-    std::string line;
-    std::string headers;
-    while (true) {
-        if (!read_line(clientFd, line)) return false;
-        headers += line;
-        if (line == "\r\n") break;
-        if (headers.size() > 64*1024) return false; // too large
+static void start_relay(ProxyLoop& L, Conn* c, uint64_t now) {
+    freeaddrinfo(c->addrs);
+    c->addrs = c->nextAddr = nullptr;
+    c->state = ConnState::Relay;
+    uint64_t connectUs = metrics_now_us() - c->connectStartUs;
+    metric_record(Latency::ProxyConnect, connectUs);
+    event_log_record(EventComponent::HttpProxy, c->kind, c->hostId, EventVerdict::Allowed, 0, (uint32_t)connectUs);
+
+    // the head buffer becomes the upstream prefix so nothing already read is lost
+    c->up.buf = std::move(c->head);
+    c->up.end = c->up.buf.size();
+    c->up.start = c->tunnel ? c->headEnd : 0;
+    if (c->tunnel) {
+        static const char ok[] = "HTTP/1.1 200 Connection Established\r\n\r\n";
+        c->down.buf.assign(ok, ok + sizeof(ok) - 1);
+        c->down.end = c->down.buf.size();
     }
-    // parse first line
-    std::istringstream ss(headers);
-    ss >> method;
-    ss >> target;
-    // find Host header
-    std::string hdrLine;
-    while (std::getline(ss, hdrLine)) {
-        if (hdrLine.size() >= 5) {
-            std::string lower = hdrLine;
-            for (auto &c : lower) c = tolower(c);
-            if (lower.find("host:") == 0) {
-                // extract value
-                size_t colon = hdrLine.find(':');
-                if (colon != std::string::npos) {
-                    host = hdrLine.substr(colon+1);
-                    // trim spaces and CRLF
-                    while (!host.empty() && (host.back() == '\r' || host.back() == '\n' || host.back() == ' ')) host.pop_back();
-                    while (!host.empty() && host.front() == ' ') host.erase(0,1);
-                }
-                break;
-            }
+    // the payload is not looked at again, so splice it between the sockets
+    c->up.setup(true);
+    c->down.setup(true);
+    c->deadlineMs = now + kIdleTimeoutMs;
+    relay(L, c, now);
+}
+
+static void log_connect_failure(Conn* c) {
+    event_log_record(EventComponent::HttpProxy, c->kind, c->hostId, EventVerdict::Failed, 0,
+                     (uint32_t)(metrics_now_us() - c->connectStartUs));
+}
+
+// Starts a non-blocking connect to the next candidate address.
+static void try_connect(ProxyLoop& L, Conn* c, uint64_t now) {
+    while (c->nextAddr) {
+        addrinfo* a = c->nextAddr;
+        c->nextAddr = a->ai_next;
+        int fd = socket(a->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+        if (fd < 0) continue;
+        int rv = connect(fd, a->ai_addr, a->ai_addrlen);
+        if (rv != 0 && errno != EINPROGRESS) {
+            close(fd);
+            continue;
         }
+        c->remote = fd;
+        c->remoteEvents = EPOLLOUT;
+        if (!add_fd(L, fd, EPOLLOUT, &c->remoteSide)) break;
+        c->state = ConnState::Connect;
+        if (rv == 0) start_relay(L, c, now);
+        return;
     }
-    // save headers into initialBuffer to forward later
-    initialBuffer.assign(headers.begin(), headers.end());
-    return true;
+    log_connect_failure(c);
+    close_conn(L, c);
 }
 
-// Basic SNI parsing from TLS ClientHello (not fully robust but works for many cases)
-// Returns server name or empty
-static std::string parse_tls_sni(const unsigned char* data, size_t len) {
-    if (len < 5) return "";
-    // TLS record header: type(1), version(2), length(2)
-    if (data[0] != 0x16) return ""; // handshake
-    size_t pos = 5;
-    if (pos + 4 > len) return "";
-    // Handshake: msg_type(1), length(3)
-    if (data[pos] != 0x01) return ""; // ClientHello
-    // skip handshake header
-    pos += 4;
-    if (pos + 34 > len) return ""; // minimal ClientHello length
-    // skip: version(2), random(32)
-    pos += 34;
-    // session id
-    if (pos + 1 > len) return "";
-    size_t sid_len = data[pos];
-    pos += 1 + sid_len;
-    if (pos + 2 > len) return "";
-    // cipher suites
-    size_t cs_len = (data[pos] << 8) | data[pos+1];
-    pos += 2 + cs_len;
-    if (pos + 1 > len) return "";
-    // compression
-    size_t comp_len = data[pos];
-    pos += 1 + comp_len;
-    if (pos + 2 > len) return "";
-    // extensions length
-    size_t ext_len = (data[pos] << 8) | data[pos+1];
-    pos += 2;
-    size_t end = pos + ext_len;
-    while (pos + 4 <= end && pos + 4 <= len) {
-        uint16_t ext_type = (data[pos] << 8) | data[pos+1];
-        uint16_t ext_len = (data[pos+2] << 8) | data[pos+3];
-        pos += 4;
-        if (ext_type == 0x00) { // server_name
-            size_t sn_pos = pos;
-            if (sn_pos + 2 > len) return "";
-            size_t sn_list_len = (data[sn_pos] << 8) | data[sn_pos+1];
-            sn_pos += 2;
-            while (sn_pos + 3 <= pos + ext_len && sn_pos + 3 <= len) {
-                uint8_t name_type = data[sn_pos];
-                uint16_t name_len = (data[sn_pos+1] << 8) | data[sn_pos+2];
-                sn_pos += 3;
-                if (name_type == 0 && sn_pos + name_len <= len) {
-                    std::string s((const char*)(data + sn_pos), name_len);
-                    return s;
-                }
-                sn_pos += name_len;
-            }
+static void on_connect_ready(ProxyLoop& L, Conn* c, uint64_t now) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(c->remote, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        close(c->remote);
+        c->remote = -1;
+        try_connect(L, c, now);
+        return;
+    }
+    start_relay(L, c, now);
+}
+
+static void on_resolved(ProxyLoop& L, const AsyncResolver::Result& r, uint64_t now) {
+    auto it = L.conns.find(r.tag);
+    if (it == L.conns.end() || r.error != 0 || !r.addrs) {
+        if (r.addrs) freeaddrinfo(r.addrs);
+        if (it != L.conns.end()) {
+            ALOGE("getaddrinfo failed for connection %llu", (unsigned long long)r.tag);
+            log_connect_failure(it->second);
+            close_conn(L, it->second);
         }
-        pos += ext_len;
+        return;
     }
-    return "";
+    Conn* c = it->second;
+    c->addrs = c->nextAddr = r.addrs;
+    try_connect(L, c, now);
+}
+
+static void begin_connect(ProxyLoop& L, Conn* c, uint64_t now, std::string_view host, std::string_view port) {
+    c->hostId = event_host_id(host);
+    c->state = ConnState::Resolve;
+    c->deadlineMs = now + kConnectTimeoutMs;
+    c->connectStartUs = metrics_now_us();
+    // nothing more is read from the client until the remote side is up
+    set_interest(L, c->client, c->clientEvents, 0, &c->clientSide);
+    L.resolver.submit(c->id, std::string(host), std::string(port));
 }
 
-static void handle_client(int clientFd, const std::string& blocklistPath) {
-    // set a recv timeout
-    struct timeval tv; tv.tv_sec = 5; tv.tv_usec = 0;
-    setsockopt(clientFd, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
-
-    // peek initial bytes
-    unsigned char buf[8192];
-    ssize_t n = recv(clientFd, buf, sizeof(buf), MSG_PEEK);
-    if (n <= 0) { close(clientFd); return; }
-
-    // Check if TLS ClientHello (record type 0x16) -> parse SNI
-    std::string sni = parse_tls_sni(buf, n);
-    if (!sni.empty()) {
-        if (host_blocked(sni)) {
-            ALOGI("Blocking TLS by SNI: %s", sni.c_str());
-            close(clientFd);
+// Reads what the client sent so far and decides what to do with it.
+static void sniff(ProxyLoop& L, Conn* c, uint64_t now) {
+    while (c->head.size() < kMaxHeadBytes) {
+        size_t have = c->head.size();
+        size_t want = std::min<size_t>(4096, kMaxHeadBytes - have);
+        c->head.resize(have + want);
+        ssize_t n = recv(c->client, c->head.data() + have, want, 0);
+        c->head.resize(have + (n > 0 ? (size_t)n : 0));
+        if (n == 0) {
+            close_conn(L, c);
+            return;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            close_conn(L, c);
             return;
         }
-        // Not blocked: establish direct tunnel to remote (client will use CONNECT through proxy, but this handles direct TLS)
     }
+    if (c->head.empty()) return;
 
-    // Try to parse as HTTP request line and host header
-    std::string method, target, host;
-    std::vector<char> initialBuf;
-    if (parse_http_request(clientFd, method, target, host, initialBuf)) {
-        ALOGI("HTTP proxy request: method=%s target=%s host=%s", method.c_str(), target.c_str(), host.c_str());
-        std::string hostOnly = host;
-        // remove possible port
-        size_t colon = hostOnly.find(':');
-        if (colon != std::string::npos) hostOnly = hostOnly.substr(0, colon);
-        if (host_blocked(hostOnly)) {
-            ALOGI("Blocking HTTP host: %s", hostOnly.c_str());
-            close(clientFd);
+    // TLS handshake record: wait for the whole ClientHello, then route on SNI
+    if (c->head[0] == 0x16) {
+        TlsClientHello hello;
+        TlsParseResult res = tls_parse_client_hello(c->head.data(), c->head.size(), L.tlsScratch.data(), &hello);
+        if (res == TlsParseResult::Incomplete) {
+            if (c->head.size() >= kMaxHeadBytes) close_conn(L, c);
             return;
         }
-        // For simplicity, treat as forward proxy: resolve host and connect
-        struct addrinfo hints{}, *res = nullptr;
-        hints.ai_family = AF_UNSPEC;
-        hints.ai_socktype = SOCK_STREAM;
-        char portBuf[16];
-        // decide port based on target or default 80
-        const char* port = "80";
-        if (method == "CONNECT") port = "443";
-        int rv = getaddrinfo(hostOnly.c_str(), port, &hints, &res);
-        if (rv != 0 || res == nullptr) {
-            ALOGE("getaddrinfo failed for host %s", hostOnly.c_str());
-            close(clientFd);
+        if (res != TlsParseResult::Complete || hello.sni.empty()) {
+            // nothing to route on
+            close_conn(L, c);
             return;
         }
-        int remoteSock = -1;
-        for (struct addrinfo* p = res; p != nullptr; p = p->ai_next) {
-            remoteSock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-            if (remoteSock < 0) continue;
-            if (connect(remoteSock, p->ai_addr, p->ai_addrlen) == 0) break;
-            close(remoteSock);
-            remoteSock = -1;
-        }
-        freeaddrinfo(res);
-        if (remoteSock < 0) { close(clientFd); return; }
-
-        if (method == "CONNECT") {
-            // Proxy CONNECT: respond 200 OK and then tunnel
-            const char* ok = "HTTP/1.1 200 Connection Established\r\n\r\n";
-            send(clientFd, ok, strlen(ok), 0);
-        } else {
-            // forward the initial request bytes we already read (headers)
-            send(remoteSock, initialBuf.data(), initialBuf.size(), 0);
+        std::string_view entry;
+        if (host_blocked(hello.sni, &entry)) {
+            metric_add(Metric::ProxyBlocked);
+            event_log(EventComponent::HttpProxy, EventKind::Tls, hello.sni, EventVerdict::Blocked, entry);
+            if (log_events()) ALOGI("Blocking TLS by SNI: %.*s", (int)hello.sni.size(), hello.sni.data());
+            close_conn(L, c);
+            return;
         }
+        if (log_events()) ALOGI("TLS passthrough: sni=%.*s alpn=%.*s ech=%d", (int)hello.sni.size(), hello.sni.data(),
+              (int)hello.alpn.size(), hello.alpn.data(), hello.hasEch ? 1 : 0);
+        c->tunnel = false;
+        c->headEnd = 0;
+        c->kind = EventKind::Tls;
+        begin_connect(L, c, now, hello.sni, "443");
+        return;
+    }
 
-        // relay loop
-        std::thread t1([clientFd, remoteSock]() {
-            char buffer[4096];
-            ssize_t r;
-            while ((r = recv(clientFd, buffer, sizeof(buffer), 0)) > 0) {
-                if (send(remoteSock, buffer, r, 0) <= 0) break;
-            }
-            shutdown(remoteSock, SHUT_WR);
-        });
-        std::thread t2([clientFd, remoteSock]() {
-            char buffer[4096];
-            ssize_t r;
-            while ((r = recv(remoteSock, buffer, sizeof(buffer), 0)) > 0) {
-                if (send(clientFd, buffer, r, 0) <= 0) break;
-            }
-            shutdown(clientFd, SHUT_WR);
-        });
-        t1.join(); t2.join();
-        close(remoteSock);
-        close(clientFd);
+    // only the new bytes are scanned for the blank line
+    HttpRequestHead req;
+    HttpParseResult res = http_parse_request((const char*)c->head.data(), c->head.size(), &c->headScanned, &req);
+    if (res == HttpParseResult::Incomplete) {
+        if (c->head.size() >= kMaxHeadBytes) close_conn(L, c); // too large
         return;
-    } else {
+    }
+    if (res == HttpParseResult::Invalid) {
         // Not an HTTP request; close
-        close(clientFd);
+        close_conn(L, c);
         return;
     }
+    c->headEnd = req.headEnd;
+    if (log_events()) ALOGI("HTTP proxy request: method=%.*s target=%.*s host=%.*s", (int)req.method.size(), req.method.data(),
+          (int)req.target.size(), req.target.data(), (int)req.host.size(), req.host.data());
+    c->tunnel = req.method == "CONNECT";
+    std::string_view hostOnly, port;
+    split_host_port(req.host, c->tunnel ? "443" : "80", hostOnly, port);
+    std::string_view entry;
+    if (hostOnly.empty() || host_blocked(hostOnly, &entry)) {
+        if (!hostOnly.empty()) {
+            metric_add(Metric::ProxyBlocked);
+            event_log(EventComponent::HttpProxy, EventKind::Http, hostOnly, EventVerdict::Blocked, entry);
+            if (log_events()) ALOGI("Blocking HTTP host: %.*s", (int)hostOnly.size(), hostOnly.data());
+        }
+        close_conn(L, c);
+        return;
+    }
+    begin_connect(L, c, now, hostOnly, port);
+}
+
+static void accept_clients(ProxyLoop& L, uint64_t now) {
+    while (true) {
+        int fd = accept4(L.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;  // EAGAIN, or out of fds until something closes
+        }
+        Conn* c = new Conn();
+        c->id = L.nextId++;
+        c->client = fd;
+        c->clientEvents = EPOLLIN;
+        c->deadlineMs = now + kSniffTimeoutMs;
+        if (!add_fd(L, fd, EPOLLIN, &c->clientSide)) {
+            close(fd);
+            delete c;
+            continue;
+        }
+        L.conns[c->id] = c;
+        metric_add(Metric::ProxyConnections);
+    }
+}
+
+static void on_event(ProxyLoop& L, ConnSide* side, uint32_t events, uint64_t now) {
+    Conn* c = side->conn;
+    if (c->closed) return;
+    switch (c->state) {
+    case ConnState::Sniff:
+        if (events & (EPOLLERR | EPOLLHUP)) close_conn(L, c);
+        else sniff(L, c, now);
+        break;
+    case ConnState::Resolve:
+        // only the client is registered; anything here means it went away
+        close_conn(L, c);
+        break;
+    case ConnState::Connect:
+        if (!side->remote) close_conn(L, c);
+        else on_connect_ready(L, c, now);
+        break;
+    case ConnState::Relay:
+        if (events & EPOLLERR) close_conn(L, c);
+        else relay(L, c, now);
+        break;
+    }
+}
+
+static void expire_conns(ProxyLoop& L, uint64_t now) {
+    std::vector<Conn*> expired;
+    for (auto& kv : L.conns) {
+        if (kv.second->deadlineMs <= now) expired.push_back(kv.second);
+    }
+    for (Conn* c : expired) close_conn(L, c);
+}
+
+static void proxy_loop(ProxyLoop* loop) {
+    ProxyLoop& L = *loop;
+    struct epoll_event events[64];
+    uint64_t lastSweep = now_ms();
+    while (proxyRunning.load(std::memory_order_relaxed)) {
+        // the timeout bounds the stop latency
+        int ne = epoll_wait(L.ep, events, 64, 100);
+        uint64_t now = now_ms();
+        for (int i = 0; i < ne; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &listenTag) {
+                accept_clients(L, now);
+            } else if (tag == &resolverTag) {
+                L.resolved.clear();
+                L.resolver.collect(L.resolved);
+                for (const auto& r : L.resolved) on_resolved(L, r, now);
+            } else {
+                on_event(L, static_cast<ConnSide*>(tag), events[i].events, now);
+            }
+        }
+        if (now - lastSweep >= 1000) {
+            expire_conns(L, now);
+            lastSweep = now;
+        }
+        for (Conn* c : L.dead) delete c;
+        L.dead.clear();
+    }
+
+    std::vector<Conn*> all;
+    for (auto& kv : L.conns) all.push_back(kv.second);
+    for (Conn* c : all) close_conn(L, c);
+    for (Conn* c : L.dead) delete c;
+    close(L.listenFd);
+    close(L.ep);
+    ALOGI("Advanced proxy loop %d exiting", L.index);
+    delete loop;
+}
+
+// One listening socket per loop; SO_REUSEPORT spreads accepts across them.
+static int open_listen_socket(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static ProxyLoop* create_loop(int index, int listenFd) {
+    auto* L = new ProxyLoop();
+    L->index = index;
+    L->listenFd = listenFd;
+    L->ep = epoll_create1(EPOLL_CLOEXEC);
+    if (L->ep < 0 || !L->resolver.start() || !add_fd(*L, listenFd, EPOLLIN, &listenTag)
+        || !add_fd(*L, L->resolver.fd(), EPOLLIN, &resolverTag)) {
+        if (L->ep >= 0) close(L->ep);
+        close(listenFd);
+        delete L;
+        return nullptr;
+    }
+    return L;
 }
 
 extern "C" JNIEXPORT jlong JNICALL
@@ -274,66 +489,42 @@ Java_com_example_adblocker_native_NativeProxy_startAdvancedProxy(JNIEnv* env, jc
         ALOGI("Advanced proxy already running");
         return 0;
     }
-    load_blocklist(blp);
-    proxyRunning.store(true);
 
-    proxyThread = new std::thread([lp, blp]() {
-        int serverFd = socket(AF_INET, SOCK_STREAM, 0);
-        if (serverFd < 0) {
-            ALOGE("Failed to create proxy server socket");
-            proxyRunning.store(false);
-            return;
-        }
-        int opt = 1;
-        setsockopt(serverFd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
-        struct sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = INADDR_ANY;
-        addr.sin_port = htons(lp);
-        if (bind(serverFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
-            ALOGE("Bind failed");
-            close(serverFd);
-            proxyRunning.store(false);
-            return;
-        }
-        if (listen(serverFd, 16) != 0) {
-            ALOGE("Listen failed");
-            close(serverFd);
-            proxyRunning.store(false);
-            return;
-        }
-        ALOGI("Advanced proxy listening on %d", lp);
-        while (proxyRunning.load()) {
-            int clientFd = accept(serverFd, nullptr, nullptr);
-            if (clientFd < 0) break;
-            std::thread(handle_client, clientFd, blp).detach();
-        }
-        close(serverFd);
-        proxyRunning.store(false);
-        ALOGI("Advanced proxy exiting");
-    });
+    int n = (int)std::thread::hardware_concurrency();
+    if (n < 1) n = 1;
+    if (n > kMaxProxyLoops) n = kMaxProxyLoops;
+    std::vector<ProxyLoop*> loops;
+    for (int i = 0; i < n; ++i) {
+        int fd = open_listen_socket(lp);
+        if (fd < 0) break;
+        ProxyLoop* L = create_loop(i, fd);
+        if (!L) break;
+        loops.push_back(L);
+    }
+    if (loops.empty()) {
+        ALOGE("Bind failed");
+        return 0;
+    }
 
-    return reinterpret_cast<jlong>(proxyThread);
+    blocklist_watch_start(blp);
+    proxyRunning.store(true);
+    auto* proxy = new AdvancedProxy();
+    for (ProxyLoop* L : loops) proxy->loops.emplace_back(proxy_loop, L);
+    ALOGI("Advanced proxy listening on %d with %zu loops", lp, loops.size());
+    return reinterpret_cast<jlong>(proxy);
 }
 
 extern "C" JNIEXPORT void JNICALL
 Java_com_example_adblocker_native_NativeProxy_stopAdvancedProxy(JNIEnv* env, jclass clazz, jlong ptr) {
     if (!proxyRunning.load()) return;
     proxyRunning.store(false);
-    // wake accept by connecting
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock >= 0) {
-        struct sockaddr_in addr{};
-        addr.sin_family = AF_INET;
-        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
-        addr.sin_port = htons(8888);
-        connect(sock, (struct sockaddr*)&addr, sizeof(addr));
-        close(sock);
-    }
-    std::thread* t = reinterpret_cast<std::thread*>(ptr);
-    if (t) {
-        if (t->joinable()) t->join();
-        delete t;
+    AdvancedProxy* proxy = reinterpret_cast<AdvancedProxy*>(ptr);
+    if (proxy) {
+        for (auto& t : proxy->loops) {
+            if (t.joinable()) t.join();
+        }
+        delete proxy;
     }
+    blocklist_watch_stop();
     ALOGI("Advanced proxy stopped");
 }
@@ -0,0 +1,29 @@
+#pragma once
+
+// Assertions for the host tests in test/, run by ctest from the host profile
+// in CMakeLists.txt. A failed CHECK reports and carries on, so one run lists
+// every broken case; main() returns test_result().
+
+#include <cstdio>
+
+inline int& test_failures() {
+    static int n = 0;
+    return n;
+}
+
+#define CHECK(cond)                                                                   \
+    do {                                                                              \
+        if (!(cond)) {                                                                \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++test_failures();                                                        \
+        }                                                                             \
+    } while (0)
+
+inline int test_result(const char* name) {
+    if (test_failures() == 0) {
+        std::printf("%s: ok\n", name);
+        return 0;
+    }
+    std::printf("%s: %d failed\n", name, test_failures());
+    return 1;
+}
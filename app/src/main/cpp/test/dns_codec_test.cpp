@@ -0,0 +1,293 @@
+// dns_parse_query on well-formed, truncated and malformed packets, and the
+// answer sections dns_build_block_response writes under each block policy.
+
+#include "check.h"
+#include "dns_codec.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+uint16_t rd16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+uint32_t rd32(const uint8_t* p) { return ((uint32_t)rd16(p) << 16) | rd16(p + 2); }
+
+void put16(std::vector<uint8_t>& m, uint16_t v) {
+    m.push_back((uint8_t)(v >> 8));
+    m.push_back((uint8_t)v);
+}
+
+void put_name(std::vector<uint8_t>& m, const std::string& name) {
+    size_t b = 0;
+    while (b < name.size()) {
+        size_t e = name.find('.', b);
+        if (e == std::string::npos) e = name.size();
+        m.push_back((uint8_t)(e - b));
+        m.insert(m.end(), name.begin() + (ptrdiff_t)b, name.begin() + (ptrdiff_t)e);
+        b = e + 1;
+    }
+    m.push_back(0);
+}
+
+// One-question query; with `edns` an OPT record advertising 1232 bytes and DO.
+std::vector<uint8_t> query(const std::string& name, uint16_t qtype, bool edns = false) {
+    std::vector<uint8_t> m = {0xab, 0xcd, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, (uint8_t)(edns ? 1 : 0)};
+    put_name(m, name);
+    put16(m, qtype);
+    put16(m, 1);
+    if (edns) {
+        m.push_back(0);
+        put16(m, kDnsTypeOPT);
+        put16(m, 1232);
+        m.insert(m.end(), {0, 0, 0x80, 0});
+        put16(m, 0);
+    }
+    return m;
+}
+
+bool parses(const std::vector<uint8_t>& m, DnsQuery* q) {
+    return dns_parse_query(m.data(), m.size(), q);
+}
+
+void well_formed() {
+    DnsQuery q;
+    std::vector<uint8_t> m = query("Ads.Example.COM", kDnsTypeAAAA, true);
+    CHECK(parses(m, &q));
+    CHECK(q.id == 0xabcd);
+    CHECK(q.qtype == kDnsTypeAAAA);
+    CHECK(q.qclass == 1);
+    CHECK(q.host() == "ads.example.com");
+    CHECK(q.labelCount == 3);
+    CHECK(q.label(1) == "example");
+    CHECK(q.questionEnd == 12 + 17 + 4);
+    CHECK(!q.questionCompressed);
+    CHECK(q.hasEdns && q.dnssecOk && q.ednsUdpSize == 1232);
+
+    CHECK(parses(query("plain.test", kDnsTypeA), &q));
+    CHECK(!q.hasEdns && !q.dnssecOk);
+}
+
+void root_name() {
+    DnsQuery q;
+    std::vector<uint8_t> m = query("", kDnsTypeSOA);
+    CHECK(m.size() == 12 + 1 + 4);
+    CHECK(parses(m, &q));
+    CHECK(q.nameLen == 0 && q.labelCount == 0);
+    CHECK(q.host().empty());
+    CHECK(q.questionEnd == m.size());
+}
+
+void truncated() {
+    std::vector<uint8_t> m = query("ads.example.com", kDnsTypeA);
+    DnsQuery q;
+    // every cut through the header or question fails cleanly
+    for (size_t n = 0; n < m.size(); ++n) {
+        CHECK(!dns_parse_query(m.data(), n, &q));
+    }
+    CHECK(parses(m, &q));
+    // a cut inside the OPT record leaves the question usable, without EDNS
+    std::vector<uint8_t> e = query("ads.example.com", kDnsTypeA, true);
+    CHECK(dns_parse_query(e.data(), e.size() - 5, &q));
+    CHECK(!q.hasEdns);
+}
+
+void malformed() {
+    DnsQuery q;
+    std::vector<uint8_t> m = query("ads.example.com", kDnsTypeA);
+
+    std::vector<uint8_t> response = m;
+    response[2] |= 0x80;  // QR
+    CHECK(!parses(response, &q));
+
+    std::vector<uint8_t> opcode = m;
+    opcode[2] |= 0x28;  // opcode 5 (UPDATE)
+    CHECK(!parses(opcode, &q));
+
+    std::vector<uint8_t> two = m;
+    two[5] = 2;  // QDCOUNT 2
+    CHECK(!parses(two, &q));
+    std::vector<uint8_t> none = m;
+    none[5] = 0;
+    CHECK(!parses(none, &q));
+
+    std::vector<uint8_t> label = m;
+    label[12] = 64;  // label length past 63, not a pointer
+    CHECK(!parses(label, &q));
+    label[12] = 0x80;  // reserved label type
+    CHECK(!parses(label, &q));
+
+    std::vector<uint8_t> longLabel = m;
+    longLabel[12] = 40;  // runs past the end of the packet
+    CHECK(!parses(longLabel, &q));
+
+    // a pointer to itself, and one past the end
+    std::vector<uint8_t> loop = {0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0xC0, 12, 0, 1, 0, 1};
+    CHECK(!parses(loop, &q));
+    std::vector<uint8_t> wild = {0, 1, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0xC0, 200, 0, 1, 0, 1};
+    CHECK(!parses(wild, &q));
+
+    // a name over 255 bytes
+    std::string big;
+    for (int i = 0; i < 5; ++i) big += std::string(60, 'a') + ".";
+    big += "test";
+    CHECK(!parses(query(big, kDnsTypeA), &q));
+    std::string fits;
+    for (int i = 0; i < 4; ++i) fits += std::string(62, 'b') + ".";
+    fits += "a";
+    CHECK(fits.size() == 253);
+    CHECK(parses(query(fits, kDnsTypeA), &q));
+    CHECK(q.nameLen == 253);
+}
+
+void compressed_question() {
+    // the question's name points at a copy of "example.test" after the
+    // header; nothing requires that, so the parser must follow it
+    std::vector<uint8_t> m = {0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+    m.push_back(3);
+    m.insert(m.end(), {'a', 'd', 's'});
+    m.push_back(0xC0);
+    m.push_back((uint8_t)(m.size() + 5));  // the name right after this question
+    put16(m, kDnsTypeA);
+    put16(m, 1);
+    put_name(m, "example.test");
+    DnsQuery q;
+    CHECK(parses(m, &q));
+    CHECK(q.questionCompressed);
+    CHECK(q.host() == "ads.example.test");
+    CHECK(q.questionEnd == 12 + 4 + 2 + 4);
+
+    // and a blocked answer writes the question out in full
+    uint8_t out[512];
+    size_t n = dns_build_block_response(m.data(), q, DnsBlockPolicy::NxDomain, out, sizeof(out));
+    CHECK(n > 0);
+    CHECK(rd16(out + 4) == 1);
+    std::vector<uint8_t> plain;
+    put_name(plain, "ads.example.test");
+    CHECK(n >= 12 + plain.size() && memcmp(out + 12, plain.data(), plain.size()) == 0);
+}
+
+struct Answer {
+    uint8_t rcode;
+    uint16_t an, ns, ar;
+    uint16_t type;     // of the first answer or authority record
+    uint32_t ttl;
+    std::vector<uint8_t> rdata;
+    bool opt;
+};
+
+Answer block(const std::vector<uint8_t>& m, DnsBlockPolicy policy) {
+    DnsQuery q;
+    Answer a{};
+    if (!parses(m, &q)) return a;
+    uint8_t out[512];
+    size_t n = dns_build_block_response(m.data(), q, policy, out, sizeof(out));
+    CHECK(n > q.questionEnd);
+    if (n <= q.questionEnd) return a;
+    CHECK(rd16(out) == q.id);
+    CHECK((out[2] & 0x80) && (out[2] & 0x01) == (m[2] & 0x01));  // QR, RD echoed
+    CHECK(rd16(out + 4) == 1);
+    CHECK(memcmp(out + 12, m.data() + 12, q.questionEnd - 12) == 0);
+    a.rcode = out[3] & 0x0f;
+    a.an = rd16(out + 6);
+    a.ns = rd16(out + 8);
+    a.ar = rd16(out + 10);
+    size_t pos = q.questionEnd;
+    CHECK(out[pos] == 0xC0 && out[pos + 1] == 0x0C);  // owned by the question name
+    a.type = rd16(out + pos + 2);
+    a.ttl = rd32(out + pos + 6);
+    size_t rdlen = rd16(out + pos + 10);
+    a.rdata.assign(out + pos + 12, out + pos + 12 + rdlen);
+    pos += 12 + rdlen;
+    a.opt = a.ar == 1 && pos + 11 <= n && out[pos] == 0 && rd16(out + pos + 1) == kDnsTypeOPT;
+    CHECK(pos + (a.ar ? 11 : 0) == n);
+    return a;
+}
+
+void block_policies() {
+    std::vector<uint8_t> a = query("ads.example.com", kDnsTypeA);
+    std::vector<uint8_t> aaaa = query("ads.example.com", kDnsTypeAAAA, true);
+    std::vector<uint8_t> txt = query("ads.example.com", 16);
+
+    for (DnsBlockPolicy p : {DnsBlockPolicy::NullIpNoData, DnsBlockPolicy::NullIpNxDomain}) {
+        Answer r = block(a, p);
+        CHECK(r.rcode == kDnsNoError && r.an == 1 && r.ns == 0 && r.ar == 0);
+        CHECK(r.type == kDnsTypeA && r.ttl == kDnsBlockTtl);
+        CHECK(r.rdata == std::vector<uint8_t>(4, 0));
+
+        r = block(aaaa, p);
+        CHECK(r.rcode == kDnsNoError && r.an == 1 && r.ns == 0 && r.ar == 1 && r.opt);
+        CHECK(r.type == kDnsTypeAAAA && r.rdata == std::vector<uint8_t>(16, 0));
+    }
+
+    // other types: NODATA or NXDOMAIN, with an SOA whose MINIMUM is the TTL
+    Answer nodata = block(txt, DnsBlockPolicy::NullIpNoData);
+    CHECK(nodata.rcode == kDnsNoError && nodata.an == 0 && nodata.ns == 1 && nodata.ar == 0);
+    Answer nx = block(txt, DnsBlockPolicy::NullIpNxDomain);
+    CHECK(nx.rcode == kDnsNxDomain && nx.an == 0 && nx.ns == 1);
+    for (const Answer& r : {nodata, nx}) {
+        CHECK(r.type == kDnsTypeSOA && r.ttl == kDnsBlockTtl && r.rdata.size() == 24);
+        if (r.rdata.size() == 24) CHECK(rd32(r.rdata.data() + 20) == kDnsBlockTtl);
+    }
+
+    // NxDomain answers every type that way, A and AAAA included
+    for (const auto* m : {&a, &aaaa, &txt}) {
+        Answer r = block(*m, DnsBlockPolicy::NxDomain);
+        CHECK(r.rcode == kDnsNxDomain && r.an == 0 && r.ns == 1 && r.type == kDnsTypeSOA);
+        CHECK(r.ar == (m == &aaaa ? 1 : 0));
+    }
+
+    // the root name too
+    Answer root = block(query("", kDnsTypeA), DnsBlockPolicy::NxDomain);
+    CHECK(root.rcode == kDnsNxDomain && root.type == kDnsTypeSOA);
+
+    // too small a buffer writes nothing
+    DnsQuery q;
+    CHECK(parses(a, &q));
+    uint8_t small[40];
+    CHECK(dns_build_block_response(a.data(), q, DnsBlockPolicy::NullIpNoData, small, sizeof(small)) == 0);
+}
+
+void servfail() {
+    std::vector<uint8_t> m = query("ads.example.com", kDnsTypeA, true);
+    uint8_t out[512];
+    size_t n = dns_build_servfail(m.data(), m.size(), out, sizeof(out));
+    DnsQuery q;
+    CHECK(parses(m, &q));
+    CHECK(n == q.questionEnd);
+    CHECK(rd16(out) == 0xabcd && (out[2] & 0x80) && (out[3] & 0x0f) == kDnsServFail);
+    CHECK(rd16(out + 4) == 1 && rd16(out + 6) == 0 && rd16(out + 8) == 0 && rd16(out + 10) == 0);
+
+    // a broken question still gets a header-only answer; responses get none
+    std::vector<uint8_t> bad = m;
+    bad[12] = 64;
+    CHECK(dns_build_servfail(bad.data(), bad.size(), out, sizeof(out)) == 12);
+    CHECK(rd16(out + 4) == 0);
+    bad[2] |= 0x80;
+    CHECK(dns_build_servfail(bad.data(), bad.size(), out, sizeof(out)) == 0);
+    CHECK(dns_build_servfail(m.data(), 11, out, sizeof(out)) == 0);
+}
+
+void skip_name() {
+    std::vector<uint8_t> m = query("a.bc", kDnsTypeA);
+    CHECK(dns_skip_name(m.data(), m.size(), 12) == 12 + 6);
+    uint8_t ptr[] = {0xC0, 0x0C};
+    CHECK(dns_skip_name(ptr, 2, 0) == 2);
+    CHECK(dns_skip_name(ptr, 1, 0) == 0);
+    uint8_t cut[] = {3, 'a', 'b'};
+    CHECK(dns_skip_name(cut, sizeof(cut), 0) == 0);
+}
+
+}  // namespace
+
+int main() {
+    well_formed();
+    root_name();
+    truncated();
+    malformed();
+    compressed_question();
+    block_policies();
+    servfail();
+    skip_name();
+    return test_result("dns_codec");
+}
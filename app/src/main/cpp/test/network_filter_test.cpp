@@ -0,0 +1,213 @@
+// FilterVerdict for each anchor form and option NetworkFilterSet supports.
+
+#include "check.h"
+#include "network_filter.h"
+
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+
+namespace {
+
+const char* name(FilterVerdict v) {
+    switch (v) {
+        case FilterVerdict::None: return "none";
+        case FilterVerdict::Blocked: return "blocked";
+        case FilterVerdict::Allowed: return "allowed";
+    }
+    return "?";
+}
+
+NetworkFilterSet compile(std::initializer_list<const char*> lines) {
+    NetworkFilterSet set;
+    for (const char* l : lines) {
+        if (!set.add(l)) {
+            std::fprintf(stderr, "rejected: %s\n", l);
+            ++test_failures();
+        }
+    }
+    set.build();
+    return set;
+}
+
+void expect(const NetworkFilterSet& set, const char* url, const char* source, uint32_t type, FilterVerdict want,
+            int line) {
+    FilterRequest req;
+    req.url = url;
+    req.sourceHost = source;
+    req.type = type;
+    FilterVerdict got = set.match(req);
+    if (got != want) {
+        std::fprintf(stderr, "%s:%d: %s from '%s': %s, expected %s\n", __FILE__, line, url, source, name(got),
+                     name(want));
+        ++test_failures();
+    }
+}
+
+#define EXPECT(set, url, source, type, want) expect(set, url, source, type, FilterVerdict::want, __LINE__)
+
+void host_anchor() {
+    auto s = compile({"||ads.example.com^"});
+    EXPECT(s, "http://ads.example.com/x", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "https://sub.ads.example.com/", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://ads.example.com:8080/x", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://notads.example.com/x", "page.test", kTypeScript, None);
+    EXPECT(s, "http://example.com/ads.example.com", "page.test", kTypeScript, None);
+}
+
+void host_anchor_with_path() {
+    auto s = compile({"||cdn.example.com/ads/*.js"});
+    EXPECT(s, "https://cdn.example.com/ads/x.js", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "https://img.cdn.example.com/ads/big/x.js", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "https://cdn.example.com/img/x.js", "page.test", kTypeScript, None);
+    EXPECT(s, "https://evilcdn.example.com/ads/x.js", "page.test", kTypeScript, None);
+}
+
+void start_and_end_anchors() {
+    auto s = compile({"|https://start.example/", "banner.gif|"});
+    EXPECT(s, "https://start.example/a", "page.test", kTypeImage, Blocked);
+    EXPECT(s, "http://x.test/?u=https://start.example/", "page.test", kTypeImage, None);
+    EXPECT(s, "http://a.test/banner.gif", "page.test", kTypeImage, Blocked);
+    EXPECT(s, "http://a.test/banner.gif?x=1", "page.test", kTypeImage, None);
+}
+
+void separator() {
+    auto s = compile({"/track^"});
+    EXPECT(s, "http://a.test/track?x=1", "page.test", kTypeXhr, Blocked);
+    EXPECT(s, "http://a.test/track/", "page.test", kTypeXhr, Blocked);
+    EXPECT(s, "http://a.test/track", "page.test", kTypeXhr, Blocked);  // the end counts
+    EXPECT(s, "http://a.test/tracker", "page.test", kTypeXhr, None);
+    EXPECT(s, "http://a.test/track-me", "page.test", kTypeXhr, None);  // - _ . % are not separators
+    EXPECT(s, "http://a.test/track&x", "page.test", kTypeXhr, Blocked);
+}
+
+void wildcard_and_substring() {
+    auto s = compile({"/ad*banner.", "adserver"});
+    EXPECT(s, "http://a.test/ad/big/banner.png", "page.test", kTypeImage, Blocked);
+    EXPECT(s, "http://a.test/banner.png/ad", "page.test", kTypeImage, None);
+    EXPECT(s, "http://x.test/adserver/1", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://x.test/ADSERVER/1", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://x.test/ad-server/1", "page.test", kTypeScript, None);
+}
+
+void exception() {
+    auto s = compile({"/ads/*", "@@||good.example^"});
+    EXPECT(s, "http://good.example/ads/1", "page.test", kTypeImage, Allowed);
+    EXPECT(s, "http://other.example/ads/1", "page.test", kTypeImage, Blocked);
+    EXPECT(s, "http://good.example/img/1", "page.test", kTypeImage, None);
+}
+
+void important() {
+    auto s = compile({"||imp.example^$important", "@@||imp.example^", "||plain.example^", "@@||plain.example^"});
+    EXPECT(s, "http://imp.example/x", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://plain.example/x", "page.test", kTypeScript, Allowed);
+}
+
+void badfilter() {
+    auto s = compile({"||bad.example^", "||bad.example^$badfilter", "/bad-ad.js$script", "/bad-ad.js$script,badfilter",
+                      "||kept.example^"});
+    EXPECT(s, "http://bad.example/x", "page.test", kTypeScript, None);
+    EXPECT(s, "http://a.test/bad-ad.js", "page.test", kTypeScript, None);
+    EXPECT(s, "http://kept.example/x", "page.test", kTypeScript, Blocked);
+}
+
+void party() {
+    auto s = compile({"||tp.example^$third-party", "||fp.example/x$first-party", "||tp3.example^$3p"});
+    EXPECT(s, "http://tp.example/x", "tp.example", kTypeScript, None);
+    EXPECT(s, "http://tp.example/x", "www.tp.example", kTypeScript, None);
+    EXPECT(s, "http://tp.example/x", "other.test", kTypeScript, Blocked);
+    EXPECT(s, "http://cdn.tp3.example/x", "other.test", kTypeScript, Blocked);
+    EXPECT(s, "http://cdn.tp3.example/x", "tp3.example", kTypeScript, None);
+    EXPECT(s, "http://fp.example/x", "fp.example", kTypeScript, Blocked);
+    EXPECT(s, "http://fp.example/x", "other.test", kTypeScript, None);
+}
+
+void domain_option() {
+    auto s = compile({"/dom-ad.js$domain=a.test|~sub.a.test", "/neg-ad.js$domain=~b.test"});
+    EXPECT(s, "http://cdn.test/dom-ad.js", "a.test", kTypeScript, Blocked);
+    EXPECT(s, "http://cdn.test/dom-ad.js", "www.a.test", kTypeScript, Blocked);
+    EXPECT(s, "http://cdn.test/dom-ad.js", "sub.a.test", kTypeScript, None);
+    EXPECT(s, "http://cdn.test/dom-ad.js", "x.sub.a.test", kTypeScript, None);
+    EXPECT(s, "http://cdn.test/dom-ad.js", "b.test", kTypeScript, None);
+    EXPECT(s, "http://cdn.test/dom-ad.js", "aa.test", kTypeScript, None);
+    EXPECT(s, "http://cdn.test/neg-ad.js", "c.test", kTypeScript, Blocked);
+    EXPECT(s, "http://cdn.test/neg-ad.js", "b.test", kTypeScript, None);
+    EXPECT(s, "http://cdn.test/neg-ad.js", "www.b.test", kTypeScript, None);
+}
+
+void types() {
+    auto s = compile({"/typed.js$script", "/notimg$~image", "/frame-ad$subdocument,xhr"});
+    EXPECT(s, "http://a.test/typed.js", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://a.test/typed.js", "page.test", kTypeImage, None);
+    EXPECT(s, "http://a.test/notimg", "page.test", kTypeImage, None);
+    EXPECT(s, "http://a.test/notimg", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://a.test/frame-ad", "page.test", kTypeSubdocument, Blocked);
+    EXPECT(s, "http://a.test/frame-ad", "page.test", kTypeXhr, Blocked);
+    EXPECT(s, "http://a.test/frame-ad", "page.test", kTypeStylesheet, None);
+    // documents only match filters that ask for them
+    EXPECT(s, "http://a.test/notimg", "page.test", kTypeDocument, None);
+    CHECK(request_type_from_name("SCRIPT") == kTypeScript);
+    CHECK(request_type_from_name("sub_frame") == kTypeSubdocument);
+    CHECK(request_type_from_name("") == kTypeAll);
+}
+
+void match_case() {
+    auto s = compile({"/CaseAd$match-case"});
+    EXPECT(s, "http://a.test/CaseAd", "page.test", kTypeScript, Blocked);
+    EXPECT(s, "http://a.test/casead", "page.test", kTypeScript, None);
+}
+
+void extra_hosts() {
+    DomainIndexBuilder b;
+    b.add("mapped.example");
+    DomainIndex extra = b.build();
+    auto s = compile({"@@||mapped.example/ok^"});
+    FilterRequest req;
+    req.url = "http://cdn.mapped.example/x";
+    req.sourceHost = "page.test";
+    CHECK(s.match(req, &extra) == FilterVerdict::Blocked);
+    req.url = "http://mapped.example/ok/1";
+    CHECK(s.match(req, &extra) == FilterVerdict::Allowed);
+    req.url = "http://other.example/x";
+    CHECK(s.match(req, &extra) == FilterVerdict::None);
+}
+
+void rejected_lines() {
+    NetworkFilterSet s;
+    CHECK(!s.add("! a comment"));
+    CHECK(!s.add("[Adblock Plus 2.0]"));
+    CHECK(!s.add("example.com##.ad"));
+    CHECK(!s.add("example.com#@#.ad"));
+    CHECK(!s.add("/ads[0-9]+/"));
+    CHECK(!s.add("/x$no-such-option"));
+    CHECK(!s.add(""));
+    CHECK(is_cosmetic_filter("##.banner"));
+    CHECK(!is_cosmetic_filter("||a.test^"));
+}
+
+void url_hosts() {
+    CHECK(url_host("https://user:pw@Host.test:8443/p?q") == "Host.test");
+    CHECK(url_host("http://[2001:db8::1]:80/") == "2001:db8::1");
+    CHECK(url_host("bare.test") == "bare.test");
+}
+
+}  // namespace
+
+int main() {
+    host_anchor();
+    host_anchor_with_path();
+    start_and_end_anchors();
+    separator();
+    wildcard_and_substring();
+    exception();
+    important();
+    badfilter();
+    party();
+    domain_option();
+    types();
+    match_case();
+    extra_hosts();
+    rejected_lines();
+    url_hosts();
+    return test_result("network_filter");
+}
@@ -0,0 +1,162 @@
+// PatternMatcher against std::string_view::find over random pattern sets and
+// texts. Built twice on x86: once as is (the scalar skip loop unless the
+// compiler targets SSSE3) and once with -mssse3 for the pshufb prefilter; on
+// aarch64 the default build takes the NEON one.
+
+#include "check.h"
+#include "pattern_matcher.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+
+#if defined(__SSSE3__)
+constexpr const char* kPath = "ssse3";
+#elif defined(__aarch64__)
+constexpr const char* kPath = "neon";
+#else
+constexpr const char* kPath = "scalar";
+#endif
+
+using Hit = std::pair<size_t, uint32_t>;  // end offset, pattern id
+
+std::vector<Hit> naive(const std::vector<std::string>& patterns, std::string_view text) {
+    std::vector<Hit> hits;
+    for (uint32_t id = 0; id < patterns.size(); ++id) {
+        const std::string& p = patterns[id];
+        if (p.empty()) continue;
+        for (size_t at = text.find(p); at != std::string_view::npos; at = text.find(p, at + 1)) {
+            hits.emplace_back(at + p.size(), id);
+        }
+    }
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+// Every hit scan() reports, with the end offsets recovered from the ids.
+std::vector<Hit> scanned(const PatternMatcher& m, const std::vector<std::string>& patterns, std::string_view text,
+                         bool* ordered) {
+    // scan() reports ids only; find each one's end by scanning prefixes
+    std::vector<Hit> hits;
+    std::vector<uint32_t> before;
+    *ordered = true;
+    for (size_t end = 0; end <= text.size(); ++end) {
+        std::vector<uint32_t> now;
+        m.scan(text.substr(0, end), [&](uint32_t id) {
+            now.push_back(id);
+            return false;
+        });
+        // the prefix one byte shorter reported a prefix of this list
+        if (now.size() < before.size() || !std::equal(before.begin(), before.end(), now.begin())) *ordered = false;
+        for (size_t i = std::min(before.size(), now.size()); i < now.size(); ++i) {
+            if (now[i] >= patterns.size()) *ordered = false;
+            hits.emplace_back(end, now[i]);
+        }
+        before = std::move(now);
+    }
+    std::sort(hits.begin(), hits.end());
+    return hits;
+}
+
+struct Alphabet {
+    const char* name;
+    std::string bytes;
+};
+
+std::vector<Alphabet> alphabets() {
+    std::string all;
+    for (int b = 0; b < 256; ++b) all.push_back((char)b);
+    std::string high;
+    for (int b = 0x70; b < 0x100; ++b) high.push_back((char)b);  // nibble table is a superset above ASCII
+    return {
+        {"ab", "ab"},
+        {"url", "abcdefghijklmnopqrstuvwxyz0123456789/.-_?=&%:"},
+        {"high", high},
+        {"bytes", all},
+    };
+}
+
+void random_sets() {
+    std::mt19937 rng(20240611);
+    size_t sets = 0, prefiltered = 0, hits = 0;
+    for (const Alphabet& a : alphabets()) {
+        for (int round = 0; round < 120; ++round) {
+            auto pick = [&](size_t n) { return (size_t)std::uniform_int_distribution<size_t>(0, n - 1)(rng); };
+            // few patterns (and few start bytes) keep the prefilter on; many turn it off
+            size_t count = 1 + pick(round % 3 == 0 ? 120 : 12);
+            std::vector<std::string> patterns(count);
+            for (auto& p : patterns) {
+                size_t len = pick(10) == 0 ? 0 : 1 + pick(8);
+                for (size_t i = 0; i < len; ++i) p.push_back(a.bytes[pick(a.bytes.size())]);
+            }
+            if (count > 1 && pick(4) == 0) patterns[pick(count)] = patterns[0];  // duplicates all report
+
+            std::vector<std::string_view> views(patterns.begin(), patterns.end());
+            PatternMatcher m;
+            m.build(views);
+            ++sets;
+
+            for (int t = 0; t < 8; ++t) {
+                // lengths around the 16-byte blocks the prefilter steps by
+                size_t len = t < 4 ? 15 + pick(4) + 16 * pick(4) : pick(200);
+                std::string text;
+                while (text.size() < len) {
+                    if (pick(6) == 0) text += patterns[pick(count)];
+                    else text.push_back(a.bytes[pick(a.bytes.size())]);
+                }
+                text.resize(len);
+
+                std::vector<Hit> want = naive(patterns, text);
+                bool ordered;
+                std::vector<Hit> got = scanned(m, patterns, text, &ordered);
+                hits += want.size();
+                CHECK(ordered);
+                if (got != want) {
+                    std::fprintf(stderr, "%s: set %zu (%zu patterns), text of %zu bytes: %zu hits, expected %zu\n",
+                                 a.name, sets, count, len, got.size(), want.size());
+                    ++test_failures();
+                }
+                bool any = m.scan(text, [](uint32_t) { return true; });
+                CHECK(any == !want.empty());
+            }
+            std::vector<bool> starts(256);
+            for (const auto& p : patterns) {
+                if (!p.empty()) starts[(uint8_t)p[0]] = true;
+            }
+            if (std::count(starts.begin(), starts.end(), true) <= 48) ++prefiltered;
+        }
+    }
+    // both sides of the prefilter cutoff were exercised
+    CHECK(prefiltered > 0 && prefiltered < sets);
+    CHECK(hits > 0);
+}
+
+void edges() {
+    PatternMatcher m;
+    CHECK(!m.scan("anything", [](uint32_t) { return true; }));
+    m.build({"", "needle"});
+    CHECK(m.pattern_count() == 2);
+    std::vector<uint32_t> ids;
+    std::string text(64, 'x');
+    text += "needle";  // past several skipped blocks
+    m.scan(text, [&](uint32_t id) {
+        ids.push_back(id);
+        return false;
+    });
+    CHECK(ids == std::vector<uint32_t>{1});
+    CHECK(!m.scan("", [](uint32_t) { return true; }));
+}
+
+}  // namespace
+
+int main() {
+    std::printf("pattern_matcher: %s prefilter\n", kPath);
+    edges();
+    random_sets();
+    return test_result("pattern_matcher");
+}
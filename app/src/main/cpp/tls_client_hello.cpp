@@ -0,0 +1,167 @@
+#include "tls_client_hello.h"
+
+#include <cstring>
+
+static constexpr uint8_t kRecordHandshake = 22;
+static constexpr uint8_t kHandshakeClientHello = 1;
+static constexpr uint16_t kExtServerName = 0;
+static constexpr uint16_t kExtAlpn = 16;
+static constexpr uint16_t kExtEch = 0xfe0d;
+
+static inline uint16_t rd16(const uint8_t* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline uint32_t rd24(const uint8_t* p) { return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2]; }
+
+// Bounds-checked cursor over the ClientHello body.
+struct Reader {
+    const uint8_t* p;
+    size_t n;
+
+    bool skip(size_t k) {
+        if (k > n) return false;
+        p += k;
+        n -= k;
+        return true;
+    }
+    bool u8(uint8_t* v) {
+        if (n < 1) return false;
+        *v = p[0];
+        return skip(1);
+    }
+    bool u16(uint16_t* v) {
+        if (n < 2) return false;
+        *v = rd16(p);
+        return skip(2);
+    }
+    // Splits off a length-prefixed vector.
+    bool vec(size_t lenBytes, Reader* out) {
+        size_t l;
+        if (lenBytes == 1) {
+            uint8_t v;
+            if (!u8(&v)) return false;
+            l = v;
+        } else {
+            uint16_t v;
+            if (!u16(&v)) return false;
+            l = v;
+        }
+        if (l > n) return false;
+        *out = Reader{p, l};
+        return skip(l);
+    }
+};
+
+static bool parse_server_name(Reader ext, TlsClientHello* out) {
+    Reader list;
+    if (!ext.vec(2, &list)) return false;
+    while (list.n > 0) {
+        uint8_t type;
+        Reader name;
+        if (!list.u8(&type) || !list.vec(2, &name)) return false;
+        if (type == 0 && out->sni.empty()) {
+            if (name.n == 0 || name.n > 255) return false;
+            out->sni = std::string_view((const char*)name.p, name.n);
+        }
+    }
+    return true;
+}
+
+static bool parse_alpn(Reader ext, TlsClientHello* out) {
+    Reader list;
+    if (!ext.vec(2, &list)) return false;
+    out->alpnList = std::string_view((const char*)list.p, list.n);
+    Reader proto;
+    if (list.n > 0) {
+        if (!list.vec(1, &proto)) return false;
+        out->alpn = std::string_view((const char*)proto.p, proto.n);
+    }
+    return true;
+}
+
+static bool parse_body(const uint8_t* body, size_t len, TlsClientHello* out) {
+    Reader r{body, len};
+    Reader sid, suites, comp, exts;
+    if (!r.u16(&out->legacyVersion) || !r.skip(32)) return false;  // version, random
+    if (!r.vec(1, &sid) || sid.n > 32) return false;
+    if (!r.vec(2, &suites) || suites.n < 2 || (suites.n & 1)) return false;
+    if (!r.vec(1, &comp) || comp.n < 1) return false;
+    if (r.n == 0) return true;  // no extensions at all
+    if (!r.vec(2, &exts)) return false;
+    while (exts.n > 0) {
+        uint16_t type;
+        Reader ext;
+        if (!exts.u16(&type) || !exts.vec(2, &ext)) return false;
+        switch (type) {
+        case kExtServerName:
+            if (!parse_server_name(ext, out)) return false;
+            break;
+        case kExtAlpn:
+            if (!parse_alpn(ext, out)) return false;
+            break;
+        case kExtEch:
+            out->hasEch = true;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+TlsParseResult tls_parse_client_hello(const uint8_t* data, size_t len, uint8_t* scratch, TlsClientHello* out) {
+    *out = TlsClientHello{};
+    if (len < 1) return TlsParseResult::Incomplete;
+    if (data[0] != kRecordHandshake) return TlsParseResult::NotTls;
+    if (len < 5) return TlsParseResult::Incomplete;
+    if (data[1] != 3) return TlsParseResult::NotTls;
+
+    // Walk record headers until the handshake message is covered.
+    size_t pos = 0;
+    size_t have = 0;       // handshake bytes seen so far
+    size_t need = 0;       // 4 + handshake length, once known
+    size_t records = 0;
+    while (true) {
+        if (pos + 5 > len) return TlsParseResult::Incomplete;
+        if (data[pos] != kRecordHandshake || data[pos + 1] != 3) return TlsParseResult::Invalid;
+        size_t rlen = rd16(data + pos + 3);
+        if (rlen == 0 || rlen > kTlsMaxRecordLen) return TlsParseResult::Invalid;
+        if (pos + 5 + rlen > len) {
+            // the header is only in the first record; decide early on an oversize message
+            if (records == 0 && rlen >= 4 && len >= 9 && data[5] == kHandshakeClientHello
+                && rd24(data + 6) + 4 > kTlsMaxHelloLen) {
+                return TlsParseResult::Invalid;
+            }
+            return TlsParseResult::Incomplete;
+        }
+        if (records == 0) {
+            if (rlen < 4) return TlsParseResult::Invalid;  // keeps the header in one record
+            if (data[5] != kHandshakeClientHello) return TlsParseResult::Invalid;
+            need = 4 + rd24(data + 6);
+            if (need > kTlsMaxHelloLen) return TlsParseResult::Invalid;
+        }
+        have += rlen;
+        pos += 5 + rlen;
+        ++records;
+        if (have >= need) break;
+    }
+
+    const uint8_t* msg;
+    if (records == 1) {
+        msg = data + 5;
+    } else {
+        size_t off = 0, p = 0;
+        while (off < need) {
+            size_t rlen = rd16(data + p + 3);
+            size_t take = rlen < need - off ? rlen : need - off;
+            memcpy(scratch + off, data + p + 5, take);
+            off += take;
+            p += 5 + rlen;
+        }
+        msg = scratch;
+    }
+    if (!parse_body(msg + 4, need - 4, out)) {
+        *out = TlsClientHello{};
+        return TlsParseResult::Invalid;
+    }
+    out->consumed = pos;
+    return TlsParseResult::Complete;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Streaming TLS ClientHello parser for SNI-based blocking.
+//
+// The caller keeps appending bytes from the connection and calls
+// tls_parse_client_hello() again until it stops returning Incomplete. Only
+// record headers are looked at until the whole handshake message has
+// arrived, so repeated calls are cheap. A ClientHello in a single record is
+// parsed in place; one fragmented over several records (large post-quantum
+// key shares) is first joined into the caller's scratch buffer.
+
+struct TlsClientHello {
+    std::string_view sni;        // host_name from server_name, empty if absent
+    std::string_view alpn;       // first ALPN protocol, empty if absent
+    std::string_view alpnList;   // raw ProtocolNameList
+    bool hasEch = false;         // encrypted_client_hello: sni is the public name
+    uint16_t legacyVersion = 0;
+    size_t consumed = 0;         // bytes of records making up the ClientHello
+};
+
+enum class TlsParseResult {
+    Complete,
+    Incomplete,
+    NotTls,   // first record is not a handshake
+    Invalid,  // malformed, or larger than the caps below
+};
+
+// Largest ClientHello handshake message accepted, and per-record payload.
+static constexpr size_t kTlsMaxHelloLen = 32 * 1024;
+static constexpr size_t kTlsMaxRecordLen = 16384 + 2048;
+
+// Views in `out` point into `data`, or into `scratch` (kTlsMaxHelloLen bytes)
+// when the message spans records.
+TlsParseResult tls_parse_client_hello(const uint8_t* data, size_t len, uint8_t* scratch, TlsClientHello* out);
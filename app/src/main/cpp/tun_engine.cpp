@@ -0,0 +1,633 @@
+#include "tun_engine.h"
+
+#include <android/log.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <random>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "blocklist_snapshot.h"
+#include "dns_cache.h"
+#include "dns_codec.h"
+#include "dns_forwarder.h"
+#include "event_log.h"
+#include "metrics.h"
+#include "http_parser.h"
+#include "ip_packet.h"
+#include "packet_pool.h"
+#include "tls_client_hello.h"
+#include "tun_tcp.h"
+
+#define LOG_TAG "tun_engine"
+#define ALOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+static constexpr size_t kTunReadBatch = 64;  // reads between processing passes
+static constexpr size_t kPoolBuffers = 512;   // MTU-sized, shared by all flows
+static constexpr size_t kTunMaxPacket = 65536;
+static constexpr uint64_t kSniffTimeoutMs = 2000;  // then connect without a verdict
+static constexpr uint64_t kConnectTimeoutMs = 10000;
+static constexpr uint64_t kTcpIdleTimeoutMs = 10 * 60 * 1000;
+static constexpr uint64_t kUdpIdleTimeoutMs = 60 * 1000;
+static constexpr uint64_t kLingerMs = 2000;  // closed flows still ACK a retransmitted FIN
+static constexpr uint64_t kTimerTickMs = 50;
+static constexpr uint16_t kDnsPort = 53;
+static constexpr uint16_t kHttpPort = 80;
+static constexpr uint16_t kHttpsPort = 443;
+
+// The forwarder carries the packet's flow key in place of a client address.
+static_assert(sizeof(FlowKey) <= sizeof(sockaddr_storage), "flow key must fit a sockaddr_storage");
+
+static uint64_t now_ms() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+enum class FlowPhase { Sniff, Connect, Relay, Closed };
+
+// epoll user data for a flow's outbound socket
+struct FlowSide {
+    bool udp;
+    void* flow;
+};
+
+// sniff (80/443 only) -> connect -> relay -> closed (lingers) -> deleted
+struct TcpFlow {
+    TcpFlow(const FlowKey& k, TcpEmitter* out, PacketPool* pool) : tcp(k, out, pool) {}
+
+    TcpConn tcp;
+    FlowSide side{false, this};
+    FlowPhase phase = FlowPhase::Sniff;
+    int remote = -1;
+    uint32_t remoteEvents = 0;
+    bool sniffFirst = false;  // handshake with the client before connecting
+    size_t headScanned = 0;   // http_parse_request() resume point
+    bool remoteEof = false;
+    bool remoteShut = false;  // client FIN passed on as shutdown(SHUT_WR)
+    uint64_t deadlineMs = 0;  // sniff/connect deadline, idle or linger expiry
+    bool dirty = false;       // needs a flush at the end of this turn
+    bool dead = false;
+};
+
+struct UdpFlow {
+    FlowKey key;
+    FlowSide side{true, this};
+    int fd = -1;
+    uint64_t lastMs = 0;
+};
+
+// epoll tags for the engine's own fds
+static char tunTag, forwarderTag;
+
+class TunEngine : public TcpEmitter {
+public:
+    explicit TunEngine(const TunConfig& cfg)
+        : cfg_(cfg), tun_(cfg.tunFd), rng_(std::random_device{}()), pool_(kPoolBuffers, cfg.mtu) {}
+    ~TunEngine();
+
+    bool init();
+    void run(const std::atomic_bool& running);
+
+    void emit_segment(const FlowKey& key, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+                      const uint8_t* opts, size_t optsLen, const uint8_t* payload, size_t len) override;
+
+private:
+    void read_tun();
+    void on_packet(PacketPool::Handle h, size_t len);
+    void on_tcp(const PacketView& p);
+    void on_udp(const PacketView& p);
+    void on_dns(const PacketView& p);
+    void on_forwarder();
+    void on_remote(FlowSide* side, uint32_t events);
+
+    void sniff(TcpFlow* f);
+    void begin_connect(TcpFlow* f);
+    void on_connected(TcpFlow* f);
+    void relay(TcpFlow* f);
+    void update(TcpFlow* f);
+    void set_interest(TcpFlow* f, uint32_t want);
+    void mark_dirty(TcpFlow* f);
+    void close_flow(TcpFlow* f);
+    void close_udp(UdpFlow* u);
+    void reset_unknown(const PacketView& p);
+    void send_udp(const FlowKey& key, size_t payloadLen);
+    void on_timers();
+
+    uint8_t* out_payload() { return out_.data() + kMaxHeaderRoom; }
+    void write_packet(const struct iovec* iov, int cnt);
+
+    TunConfig cfg_;
+    int tun_;
+    int ep_ = -1;
+    int fwdEp_ = -1;
+    uint64_t now_ = 0;
+    std::mt19937 rng_;
+    PacketPool pool_;  // inbound packets; outlives the flows holding its buffers
+
+    DnsForwarder forwarder_;
+    DnsCache cache_;
+
+    std::unordered_map<FlowKey, TcpFlow*, FlowKeyHash> tcp_;
+    std::unordered_map<FlowKey, UdpFlow*, FlowKeyHash> udp_;
+    std::vector<TcpFlow*> dirty_;
+    std::vector<TcpFlow*> dead_;
+
+    // outbound UDP is built here; TCP headers are built on the stack
+    std::vector<uint8_t> out_ = std::vector<uint8_t>(kMaxHeaderRoom + kTunMaxPacket);
+    std::vector<uint8_t> tlsScratch_ = std::vector<uint8_t>(kTlsMaxHelloLen);
+};
+
+static bool add_fd(int ep, int fd, uint32_t events, void* tag) {
+    struct epoll_event ev{};
+    ev.events = events;
+    ev.data.ptr = tag;
+    return epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+TunEngine::~TunEngine() {
+    for (auto& kv : tcp_) {
+        if (kv.second->remote >= 0) close(kv.second->remote);
+        delete kv.second;
+    }
+    for (TcpFlow* f : dead_) delete f;
+    for (auto& kv : udp_) {
+        close(kv.second->fd);
+        delete kv.second;
+    }
+    if (fwdEp_ >= 0) close(fwdEp_);
+    if (ep_ >= 0) close(ep_);
+    close(tun_);
+}
+
+bool TunEngine::init() {
+    if (!pool_.valid()) return false;
+    int fl = fcntl(tun_, F_GETFL);
+    if (fl < 0 || fcntl(tun_, F_SETFL, fl | O_NONBLOCK) != 0) return false;
+    ep_ = epoll_create1(EPOLL_CLOEXEC);
+    // the forwarder tags its sockets with data.fd, so it gets an epoll set of its own
+    fwdEp_ = epoll_create1(EPOLL_CLOEXEC);
+    if (ep_ < 0 || fwdEp_ < 0) return false;
+    if (!forwarder_.init(fwdEp_, cfg_.upstream)) return false;
+    forwarder_.set_event_component(EventComponent::Tun);
+    return add_fd(ep_, tun_, EPOLLIN, &tunTag) && add_fd(ep_, fwdEp_, EPOLLIN, &forwarderTag);
+}
+
+void TunEngine::write_packet(const struct iovec* iov, int cnt) {
+    // a full tun queue drops the packet; TCP retransmits, DNS clients retry
+    while (writev(tun_, iov, cnt) < 0 && errno == EINTR) {
+    }
+}
+
+void TunEngine::emit_segment(const FlowKey& key, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+                             const uint8_t* opts, size_t optsLen, const uint8_t* payload, size_t len) {
+    // every write to a tun fd is exactly one packet, so writev() cannot merge
+    // segments; it does let the payload go out straight from the flow's send
+    // queue behind headers built here
+    alignas(8) uint8_t hdr[kMaxHeaderRoom];
+    size_t hdrLen;
+    uint8_t* pkt = tcp_build(hdr + sizeof(hdr), payload, len, key, seq, ack, flags, window, opts, optsLen, &hdrLen);
+    struct iovec iov[2] = {{pkt, hdrLen}, {const_cast<uint8_t*>(payload), len}};
+    write_packet(iov, len ? 2 : 1);
+}
+
+void TunEngine::send_udp(const FlowKey& key, size_t payloadLen) {
+    size_t pktLen;
+    uint8_t* pkt = udp_build(out_payload(), payloadLen, key, &pktLen);
+    struct iovec iov = {pkt, pktLen};
+    write_packet(&iov, 1);
+}
+
+// Drains the tun queue until EAGAIN. Packets are read into pool buffers a
+// batch at a time and then processed where they landed.
+void TunEngine::read_tun() {
+    PacketPool::Handle bufs[kTunReadBatch];
+    size_t lens[kTunReadBatch];
+    bool drained = false;
+    while (!drained) {
+        size_t n = 0;
+        while (n < kTunReadBatch) {
+            PacketPool::Handle h = pool_.acquire();
+            if (h == PacketPool::kNone) {
+                drained = true;  // the rest waits for the next turn
+                break;
+            }
+            ssize_t r = read(tun_, pool_.data(h), pool_.buf_size());
+            if (r <= 0) {
+                pool_.release(h);
+                if (r < 0 && errno == EINTR) continue;
+                drained = true;  // EAGAIN
+                break;
+            }
+            bufs[n] = h;
+            lens[n++] = (size_t)r;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            on_packet(bufs[i], lens[i]);
+            pool_.release(bufs[i]);
+        }
+    }
+}
+
+void TunEngine::on_packet(PacketPool::Handle h, size_t len) {
+    PacketView p;
+    // a packet longer than a buffer was truncated and fails the length checks
+    if (!ip_parse(pool_.data(h), len, &p)) return;  // ICMP, fragments, malformed
+    p.buf = h;
+    if (p.key.proto == kIpProtoTcp) on_tcp(p);
+    else on_udp(p);
+}
+
+void TunEngine::mark_dirty(TcpFlow* f) {
+    if (f->dirty) return;
+    f->dirty = true;
+    dirty_.push_back(f);
+}
+
+void TunEngine::close_flow(TcpFlow* f) {
+    if (f->dead) return;
+    f->dead = true;
+    // closing the fd also drops it from the epoll set
+    if (f->remote >= 0) close(f->remote);
+    f->remote = -1;
+    tcp_.erase(f->tcp.key());
+    // the dirty list or later events of this turn may still point at it
+    dead_.push_back(f);
+}
+
+void TunEngine::reset_unknown(const PacketView& p) {
+    if (p.flags & kTcpRst) return;
+    uint32_t seq = (p.flags & kTcpAck) ? p.ack : 0;
+    uint32_t ack = p.seq + (uint32_t)p.payloadLen + ((p.flags & kTcpSyn) ? 1 : 0) + ((p.flags & kTcpFin) ? 1 : 0);
+    emit_segment(p.key, seq, ack, kTcpRst | kTcpAck, 0, nullptr, 0, nullptr, 0);
+}
+
+void TunEngine::on_tcp(const PacketView& p) {
+    auto it = tcp_.find(p.key);
+    if (it == tcp_.end()) {
+        if ((p.flags & (kTcpSyn | kTcpAck | kTcpRst)) != kTcpSyn) {
+            reset_unknown(p);
+            return;
+        }
+        auto* f = new TcpFlow(p.key, this, &pool_);
+        f->tcp.accept_syn(p, (uint32_t)rng_(), cfg_.mtu);
+        tcp_.emplace(p.key, f);
+        metric_add(Metric::TunConnections);
+        f->sniffFirst = p.key.dport == kHttpPort || p.key.dport == kHttpsPort;
+        if (f->sniffFirst) {
+            f->tcp.send_syn_ack(now_);
+            f->deadlineMs = now_ + kSniffTimeoutMs;
+        } else {
+            begin_connect(f);
+        }
+        return;
+    }
+    TcpFlow* f = it->second;
+    f->tcp.on_segment(p, now_);
+    update(f);
+}
+
+// Runs the flow's state after anything changed on either side.
+void TunEngine::update(TcpFlow* f) {
+    if (f->tcp.reset()) {
+        close_flow(f);
+        return;
+    }
+    switch (f->phase) {
+    case FlowPhase::Sniff:
+        sniff(f);
+        break;
+    case FlowPhase::Relay:
+        relay(f);
+        break;
+    case FlowPhase::Connect:
+    case FlowPhase::Closed:
+        break;
+    }
+    if (!f->dead) mark_dirty(f);
+}
+
+// Decides on the first bytes of an HTTP or HTTPS flow.
+void TunEngine::sniff(TcpFlow* f) {
+    ByteQueue& rx = f->tcp.rx();
+    bool full = rx.space() == 0;
+    if (rx.size() == 0) {
+        if (f->tcp.peer_fin()) begin_connect(f);
+        return;
+    }
+    const uint8_t* d = rx.data();
+    std::string_view host;
+    if (d[0] == 0x16) {
+        TlsClientHello hello;
+        TlsParseResult res = tls_parse_client_hello(d, rx.size(), tlsScratch_.data(), &hello);
+        if (res == TlsParseResult::Incomplete && !full && !f->tcp.peer_fin()) return;
+        if (res == TlsParseResult::Complete) host = hello.sni;
+        std::string_view entry;
+        if (!host.empty() && blocklist_match(host, &entry)) {
+            metric_add(Metric::TunBlocked);
+            event_log(EventComponent::Tun, EventKind::Tls, host, EventVerdict::Blocked, entry);
+            if (log_events()) ALOGI("Blocking TLS by SNI: %.*s", (int)host.size(), host.data());
+            f->tcp.abort();
+            close_flow(f);
+            return;
+        }
+        if (!host.empty()) event_log(EventComponent::Tun, EventKind::Tls, host, EventVerdict::Allowed);
+    } else {
+        HttpRequestHead req;
+        HttpParseResult res = http_parse_request((const char*)d, rx.size(), &f->headScanned, &req);
+        if (res == HttpParseResult::Incomplete && !full && !f->tcp.peer_fin()) return;
+        std::string_view port;
+        if (res == HttpParseResult::Complete) {
+            // same rules as the proxy: host may carry a port or be a bracketed v6 literal
+            host = req.host;
+            if (!host.empty() && host.front() == '[') host = host.substr(1, host.find(']') - 1);
+            else if (host.find(':') == host.rfind(':')) host = host.substr(0, host.find(':'));
+        }
+        std::string_view entry;
+        if (!host.empty() && blocklist_match(host, &entry)) {
+            metric_add(Metric::TunBlocked);
+            event_log(EventComponent::Tun, EventKind::Http, host, EventVerdict::Blocked, entry);
+            if (log_events()) ALOGI("Blocking HTTP host: %.*s", (int)host.size(), host.data());
+            f->tcp.abort();
+            close_flow(f);
+            return;
+        }
+        if (!host.empty()) event_log(EventComponent::Tun, EventKind::Http, host, EventVerdict::Allowed);
+    }
+    // allowed, or nothing to decide on: connect to where the client was going anyway
+    begin_connect(f);
+}
+
+void TunEngine::begin_connect(TcpFlow* f) {
+    const FlowKey& k = f->tcp.key();
+    sockaddr_storage dst;
+    socklen_t dstLen = flow_dst_sockaddr(k, &dst);
+    int fd = socket(dst.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        f->tcp.abort();
+        close_flow(f);
+        return;
+    }
+    int rv = connect(fd, (const sockaddr*)&dst, dstLen);
+    if ((rv != 0 && errno != EINPROGRESS) || !add_fd(ep_, fd, EPOLLOUT, &f->side)) {
+        close(fd);
+        f->tcp.abort();
+        close_flow(f);
+        return;
+    }
+    f->remote = fd;
+    f->remoteEvents = EPOLLOUT;
+    f->phase = FlowPhase::Connect;
+    f->deadlineMs = now_ + kConnectTimeoutMs;
+    if (rv == 0) on_connected(f);
+}
+
+void TunEngine::on_connected(TcpFlow* f) {
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(f->remote, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+        f->tcp.abort();
+        close_flow(f);
+        return;
+    }
+    f->phase = FlowPhase::Relay;
+    f->deadlineMs = now_ + kTcpIdleTimeoutMs;
+    if (!f->sniffFirst) f->tcp.send_syn_ack(now_);
+    update(f);
+}
+
+void TunEngine::set_interest(TcpFlow* f, uint32_t want) {
+    if (f->remote < 0 || f->remoteEvents == want) return;
+    struct epoll_event ev{};
+    ev.events = want;
+    ev.data.ptr = &f->side;
+    epoll_ctl(ep_, EPOLL_CTL_MOD, f->remote, &ev);
+    f->remoteEvents = want;
+}
+
+void TunEngine::relay(TcpFlow* f) {
+    TcpConn& c = f->tcp;
+    bool progressed = false;
+
+    // client -> remote straight out of the receive queue
+    ByteQueue& rx = c.rx();
+    while (rx.size() > 0) {
+        ssize_t n = send(f->remote, rx.data(), rx.size(), MSG_NOSIGNAL);
+        if (n > 0) {
+            c.read_done((size_t)n);
+            progressed = true;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        c.abort();
+        close_flow(f);
+        return;
+    }
+    if (c.peer_fin() && rx.size() == 0 && !f->remoteShut) {
+        shutdown(f->remote, SHUT_WR);
+        f->remoteShut = true;
+    }
+
+    // remote -> client into the send queue; the window decides how fast it drains
+    while (!f->remoteEof && c.tx_space() > 0) {
+        size_t avail;
+        uint8_t* dst = c.tx().tail(&avail);
+        ssize_t n = recv(f->remote, dst, avail, 0);
+        if (n > 0) {
+            c.tx().commit((size_t)n);
+            progressed = true;
+            continue;
+        }
+        if (n == 0) {
+            f->remoteEof = true;
+            c.close_send();
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        c.abort();
+        close_flow(f);
+        return;
+    }
+    if (progressed) f->deadlineMs = now_ + kTcpIdleTimeoutMs;
+
+    if (c.done() && f->remoteShut && f->remoteEof) {
+        // both FINs exchanged; keep answering retransmissions for a moment
+        close(f->remote);
+        f->remote = -1;
+        f->phase = FlowPhase::Closed;
+        f->deadlineMs = now_ + kLingerMs;
+        return;
+    }
+    uint32_t want = 0;
+    if (!f->remoteEof && c.tx_space() > 0) want |= EPOLLIN;
+    if (rx.size() > 0) want |= EPOLLOUT;
+    set_interest(f, want);
+}
+
+void TunEngine::on_remote(FlowSide* side, uint32_t events) {
+    if (side->udp) {
+        auto* u = static_cast<UdpFlow*>(side->flow);
+        while (true) {
+            ssize_t n = recv(u->fd, out_payload(), kTunMaxPacket - 48, 0);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) break;
+            u->lastMs = now_;
+            send_udp(u->key, (size_t)n);
+        }
+        return;
+    }
+    auto* f = static_cast<TcpFlow*>(side->flow);
+    if (f->dead) return;
+    if (f->phase == FlowPhase::Connect) {
+        if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) on_connected(f);
+        return;
+    }
+    if (f->phase == FlowPhase::Relay) update(f);
+}
+
+void TunEngine::on_udp(const PacketView& p) {
+    if (p.key.dport == kDnsPort) {
+        on_dns(p);
+        return;
+    }
+    if (p.key.dport == kHttpsPort) return;  // QUIC: the browser falls back to TCP
+
+    UdpFlow* u;
+    auto it = udp_.find(p.key);
+    if (it != udp_.end()) {
+        u = it->second;
+    } else {
+        sockaddr_storage dst;
+        socklen_t dstLen = flow_dst_sockaddr(p.key, &dst);
+        int fd = socket(dst.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return;
+        u = new UdpFlow();
+        u->key = p.key;
+        u->fd = fd;
+        if (connect(fd, (const sockaddr*)&dst, dstLen) != 0 || !add_fd(ep_, fd, EPOLLIN, &u->side)) {
+            close(fd);
+            delete u;
+            return;
+        }
+        udp_.emplace(p.key, u);
+    }
+    u->lastMs = now_;
+    send(u->fd, p.payload, p.payloadLen, 0);
+}
+
+void TunEngine::close_udp(UdpFlow* u) {
+    close(u->fd);
+    udp_.erase(u->key);
+    delete u;
+}
+
+void TunEngine::on_dns(const PacketView& p) {
+    const uint8_t* q = p.payload;
+    size_t n = p.payloadLen;
+    if (n == 0 || n > kUdpSlotSize) return;
+    DnsQuery query;
+    bool parsed = dns_parse_query(q, n, &query);
+    size_t respLen = 0;
+    metric_add(Metric::DnsQueries);
+    std::string_view entry;
+    if (parsed && blocklist_match(query.host(), &entry)) {
+        metric_add(Metric::DnsBlocked);
+        event_log(EventComponent::Tun, EventKind::Dns, query.host(), EventVerdict::Blocked, entry);
+        respLen = dns_build_block_response(q, query, dns_block_policy(), out_payload(), kUdpSlotSize);
+    } else if (!parsed || (respLen = cache_.lookup(q, n, out_payload(), kUdpSlotSize, now_)) == 0) {
+        sockaddr_storage client{};
+        memcpy(&client, &p.key, sizeof(FlowKey));
+        if (forwarder_.forward(q, n, client, sizeof(FlowKey), now_, parsed ? event_host_id(query.host()) : 0)) return;
+        respLen = dns_build_servfail(q, n, out_payload(), kUdpSlotSize);
+    } else {
+        metric_add(Metric::DnsCacheHits);
+        if (parsed) event_log(EventComponent::Tun, EventKind::Dns, query.host(), EventVerdict::Cached);
+    }
+    if (respLen > 0) send_udp(p.key, respLen);
+}
+
+void TunEngine::on_forwarder() {
+    struct epoll_event events[8];
+    int ne = epoll_wait(fwdEp_, events, 8, 0);
+    auto deliver = [this](const uint8_t* resp, size_t len, const sockaddr_storage& client, socklen_t) {
+        cache_.insert(resp, len, now_);
+        if (len > kTunMaxPacket - 48) return;
+        FlowKey key;
+        memcpy(static_cast<void*>(&key), &client, sizeof(FlowKey));
+        memcpy(out_payload(), resp, len);
+        send_udp(key, len);
+    };
+    for (int i = 0; i < ne; ++i) forwarder_.drain(events[i].data.fd, deliver);
+}
+
+void TunEngine::on_timers() {
+    std::vector<TcpFlow*> expired;
+    for (auto& kv : tcp_) {
+        TcpFlow* f = kv.second;
+        f->tcp.on_timer(now_);
+        if (f->tcp.reset() || now_ >= f->deadlineMs) expired.push_back(f);
+    }
+    for (TcpFlow* f : expired) {
+        if (f->dead) continue;
+        if (f->phase == FlowPhase::Sniff && !f->tcp.reset()) {
+            begin_connect(f);  // no verdict in time: let it through
+            continue;
+        }
+        if (f->phase != FlowPhase::Closed) f->tcp.abort();
+        close_flow(f);
+    }
+
+    std::vector<UdpFlow*> idle;
+    for (auto& kv : udp_) {
+        if (now_ - kv.second->lastMs >= kUdpIdleTimeoutMs) idle.push_back(kv.second);
+    }
+    for (UdpFlow* u : idle) close_udp(u);
+    forwarder_.expire(now_);
+}
+
+void TunEngine::run(const std::atomic_bool& running) {
+    struct epoll_event events[64];
+    uint64_t lastTimers = now_ms();
+    while (running.load(std::memory_order_relaxed)) {
+        // the timeout bounds the retransmission timer granularity and the stop latency
+        int ne = epoll_wait(ep_, events, 64, (int)kTimerTickMs);
+        now_ = now_ms();
+        for (int i = 0; i < ne; ++i) {
+            void* tag = events[i].data.ptr;
+            if (tag == &tunTag) read_tun();
+            else if (tag == &forwarderTag) on_forwarder();
+            else on_remote(static_cast<FlowSide*>(tag), events[i].events);
+        }
+        if (now_ - lastTimers >= kTimerTickMs) {
+            on_timers();
+            lastTimers = now_;
+        }
+        // one ACK per flow per turn covers every segment that arrived in it
+        for (TcpFlow* f : dirty_) {
+            f->dirty = false;
+            if (!f->dead) f->tcp.flush(now_);
+        }
+        dirty_.clear();
+        for (TcpFlow* f : dead_) delete f;
+        dead_.clear();
+    }
+}
+
+bool tun_engine_run(const TunConfig& cfg, const std::atomic_bool& running) {
+    TunEngine engine(cfg);
+    if (!engine.init()) {
+        ALOGE("tun engine setup failed: %s", strerror(errno));
+        return false;
+    }
+    ALOGI("tun engine running, mtu=%zu", cfg.mtu);
+    engine.run(running);
+    return true;
+}
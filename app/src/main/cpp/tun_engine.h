@@ -0,0 +1,27 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "dns_upstream.h"
+
+// Packet engine behind the VPN interface.
+//
+// One epoll thread reads IP packets from the TUN fd and terminates them:
+//  - UDP/53 is answered inline from the blocklist and a DNS cache, or sent
+//    on to the upstream resolver through a DnsForwarder;
+//  - TCP is terminated by a small userspace stack (tun_tcp.h). Flows to 80
+//    and 443 are accepted first so the request head or ClientHello can be
+//    checked against the blocklist before anything leaves the device; other
+//    ports are only accepted once the real destination answered;
+//  - UDP/443 (QUIC) is dropped so browsers fall back to TCP, where SNI is
+//    visible; other UDP is relayed through one connected socket per flow.
+// Outbound sockets must bypass the VPN, e.g. by excluding the app from it.
+struct TunConfig {
+    int tunFd = -1;  // owned by the engine, closed on return
+    size_t mtu = 1500;
+    DnsUpstream upstream;
+};
+
+// Runs until `running` is cleared. Returns false if setup failed.
+bool tun_engine_run(const TunConfig& cfg, const std::atomic_bool& running);
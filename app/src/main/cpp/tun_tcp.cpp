@@ -0,0 +1,339 @@
+#include "tun_tcp.h"
+
+#include <algorithm>
+#include <cstring>
+
+uint8_t* ByteQueue::tail(size_t* avail) {
+    if (end_ == buf_.size()) {
+        if (start_ > 0) {
+            memmove(buf_.data(), buf_.data() + start_, size());
+            end_ -= start_;
+            start_ = 0;
+        }
+        if (end_ == buf_.size() && buf_.size() < cap_) {
+            buf_.resize(std::min(cap_, std::max<size_t>(16384, buf_.size() * 2)));
+        }
+    }
+    *avail = std::min(buf_.size() - end_, space());
+    return buf_.data() + end_;
+}
+
+void ByteQueue::consume(size_t n) {
+    start_ += n;
+    if (start_ == end_) start_ = end_ = 0;
+}
+
+static constexpr uint8_t kOptEnd = 0;
+static constexpr uint8_t kOptNop = 1;
+static constexpr uint8_t kOptMss = 2;
+static constexpr uint8_t kOptWscale = 3;
+static constexpr uint8_t kOptSackPermitted = 4;
+static constexpr uint8_t kOptSack = 5;
+static constexpr size_t kMaxSackBlocks = 3;
+
+// Shift we announce when the client scales: 128 KB buffers need two bits.
+static constexpr uint8_t kOurWscale = 2;
+
+TcpConn::~TcpConn() {
+    for (const Segment& s : ooo_) pool_->release(s.buf);
+}
+
+void TcpConn::accept_syn(const PacketView& p, uint32_t iss, size_t mtu) {
+    uint16_t peerMss = key_.family == 4 ? 536 : 1220;
+    bool peerScales = false;
+    uint8_t peerShift = 0;
+    const uint8_t* o = p.options;
+    size_t n = p.optionsLen;
+    size_t i = 0;
+    while (i < n) {
+        uint8_t kind = o[i];
+        if (kind == kOptEnd) break;
+        if (kind == kOptNop) {
+            ++i;
+            continue;
+        }
+        if (i + 1 >= n || o[i + 1] < 2 || i + o[i + 1] > n) break;
+        uint8_t len = o[i + 1];
+        if (kind == kOptMss && len == 4) peerMss = (uint16_t)((o[i + 2] << 8) | o[i + 3]);
+        if (kind == kOptSackPermitted && len == 2) sackOk_ = true;
+        if (kind == kOptWscale && len == 3) {
+            peerScales = true;
+            peerShift = std::min<uint8_t>(o[i + 2], 14);
+        }
+        i += len;
+    }
+
+    size_t ourMss = mtu - (key_.family == 4 ? 40 : 60);
+    mss_ = (uint16_t)std::max<size_t>(64, std::min<size_t>(peerMss, ourMss));
+    sndWscale_ = peerScales ? peerShift : 0;
+    rcvWscale_ = peerScales ? kOurWscale : 0;
+    sndWnd_ = p.window;  // never scaled in a SYN
+    rcvNxt_ = p.seq + 1;
+    iss_ = sndUna_ = sndNxt_ = sndMax_ = iss;
+}
+
+uint16_t TcpConn::advertised_window() {
+    uint32_t w = (uint32_t)(rx_.space() >> rcvWscale_);
+    if (w > 65535) w = 65535;
+    lastWindow_ = w << rcvWscale_;
+    return (uint16_t)w;
+}
+
+// Ranges held in the out-of-order queue, lowest first.
+size_t TcpConn::sack_option(uint8_t* out) {
+    if (!sackOk_ || ooo_.empty()) return 0;
+    size_t n = 0;
+    uint8_t* b = out + 4;
+    for (size_t i = 0; i < ooo_.size() && n < kMaxSackBlocks;) {
+        uint32_t left = ooo_[i].seq;
+        uint32_t right = left + ooo_[i].len;
+        for (++i; i < ooo_.size() && seq_le(ooo_[i].seq, right); ++i) {
+            uint32_t end = ooo_[i].seq + ooo_[i].len;
+            if (seq_gt(end, right)) right = end;
+        }
+        uint32_t v[2] = {left, right};
+        for (uint32_t x : v) {
+            *b++ = (uint8_t)(x >> 24);
+            *b++ = (uint8_t)(x >> 16);
+            *b++ = (uint8_t)(x >> 8);
+            *b++ = (uint8_t)x;
+        }
+        ++n;
+    }
+    out[0] = kOptNop;
+    out[1] = kOptNop;
+    out[2] = kOptSack;
+    out[3] = (uint8_t)(2 + 8 * n);
+    return 4 + 8 * n;
+}
+
+void TcpConn::emit(uint32_t seq, uint8_t flags, const uint8_t* payload, size_t len) {
+    uint8_t opts[4 + 8 * kMaxSackBlocks];
+    size_t optsLen = sack_option(opts);
+    out_->emit_segment(key_, seq, rcvNxt_, flags, advertised_window(), opts, optsLen, payload, len);
+    ackPending_ = false;
+}
+
+void TcpConn::send_syn_ack(uint64_t nowMs) {
+    uint8_t opts[12];
+    size_t optsLen = 4;
+    opts[0] = kOptMss;
+    opts[1] = 4;
+    opts[2] = (uint8_t)(mss_ >> 8);
+    opts[3] = (uint8_t)mss_;
+    if (rcvWscale_) {
+        opts[4] = kOptNop;
+        opts[5] = kOptWscale;
+        opts[6] = 3;
+        opts[7] = rcvWscale_;
+        optsLen = 8;
+    }
+    if (sackOk_) {
+        opts[optsLen++] = kOptNop;
+        opts[optsLen++] = kOptNop;
+        opts[optsLen++] = kOptSackPermitted;
+        opts[optsLen++] = 2;
+    }
+    uint32_t w = (uint32_t)std::min<size_t>(rx_.space(), 65535);
+    lastWindow_ = w;
+    out_->emit_segment(key_, iss_, rcvNxt_, kTcpSyn | kTcpAck, (uint16_t)w, opts, optsLen, nullptr, 0);
+    ackPending_ = false;
+    synAckSent_ = true;
+    sndNxt_ = sndMax_ = iss_ + 1;
+    rtoDeadline_ = nowMs + rtoMs_;
+}
+
+void TcpConn::on_segment(const PacketView& p, uint64_t nowMs) {
+    if (reset_) return;
+    if (p.flags & kTcpRst) {
+        // only a RST inside the receive window is believed
+        if (seq_le(rcvNxt_, p.seq) && seq_lt(p.seq, rcvNxt_ + std::max<uint32_t>(lastWindow_, 1))) reset_ = true;
+        return;
+    }
+    if (p.flags & kTcpSyn) {
+        // our SYN-ACK was lost: the client retransmits its SYN
+        if (!synAckSent_) return;
+        if (!synAcked_ && p.seq + 1 == rcvNxt_) send_syn_ack(nowMs);
+        else ackPending_ = true;
+        return;
+    }
+    if (!(p.flags & kTcpAck)) return;
+
+    uint32_t ack = p.ack;
+    uint32_t wnd = (uint32_t)p.window << sndWscale_;
+    if (!synAcked_) {
+        if (!synAckSent_ || ack != iss_ + 1) return;
+        synAcked_ = true;
+        sndUna_ = iss_ + 1;
+        sndWnd_ = wnd;
+        retries_ = 0;
+        rtoMs_ = kInitialRtoMs;
+        rtoDeadline_ = 0;
+    } else if (seq_gt(ack, sndMax_)) {
+        // acks something never sent
+        ackPending_ = true;
+        return;
+    } else if (seq_gt(ack, sndUna_)) {
+        size_t acked = std::min<size_t>(ack - sndUna_, tx_.size());
+        tx_.consume(acked);
+        sndUna_ += (uint32_t)acked;
+        if (finSent_ && ack == finSeq_ + 1) {
+            finAcked_ = true;
+            sndUna_ = ack;
+        }
+        if (seq_lt(sndNxt_, sndUna_)) sndNxt_ = sndUna_;
+        sndWnd_ = wnd;
+        retries_ = 0;
+        dupAcks_ = 0;
+        rtoMs_ = kInitialRtoMs;
+        rtoDeadline_ = sndMax_ != sndUna_ ? nowMs + rtoMs_ : 0;
+    } else if (ack == sndUna_) {
+        if (p.payloadLen == 0 && !(p.flags & kTcpFin) && wnd == sndWnd_ && sndMax_ != sndUna_) {
+            // fast retransmit: resend everything from the hole
+            if (++dupAcks_ == 3) sndNxt_ = sndUna_;
+        }
+        sndWnd_ = wnd;
+    }
+
+    size_t len = p.payloadLen;
+    bool fin = (p.flags & kTcpFin) != 0;
+    if (len == 0 && !fin) return;
+    if (!peerFin_ && seq_gt(p.seq, rcvNxt_)) {
+        // a hole: hold the segment and send the duplicate ACK now so the
+        // client can fast-retransmit
+        if (len > 0) queue_out_of_order(p);
+        emit(sndNxt_, kTcpAck, nullptr, 0);
+        return;
+    }
+    ackPending_ = true;
+    if (peerFin_) return;  // retransmission
+
+    uint32_t skip = rcvNxt_ - p.seq;
+    if (skip > len || (skip == len && !fin)) return;  // nothing new
+    len -= skip;
+    size_t take = std::min(len, rx_.space());
+    append_rx(p.payload + skip, take);
+    if (fin && take == len) {
+        rcvNxt_++;
+        peerFin_ = true;
+        return;
+    }
+    drain_out_of_order();
+}
+
+void TcpConn::append_rx(const uint8_t* d, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        size_t avail;
+        uint8_t* dst = rx_.tail(&avail);
+        size_t n = std::min(avail, len - done);
+        memcpy(dst, d + done, n);
+        rx_.commit(n);
+        done += n;
+    }
+    rcvNxt_ += (uint32_t)len;
+}
+
+void TcpConn::queue_out_of_order(const PacketView& p) {
+    uint32_t seq = p.seq;
+    size_t len = p.payloadLen;
+    // only what fits the window we advertised, so the queue drains into rx_
+    if (seq_gt(seq + (uint32_t)len, rcvNxt_ + (uint32_t)rx_.space())) return;
+    if (ooo_.size() >= kMaxOutOfOrder || oooBytes_ + len > rx_.space()) return;
+    // a quarter of the pool stays free for reading; the client retransmits what we drop
+    if (p.buf == PacketPool::kNone || pool_->available() < pool_->capacity() / 4) return;
+    auto it = ooo_.begin();
+    while (it != ooo_.end() && seq_lt(it->seq, seq)) ++it;
+    if (it != ooo_.end() && it->seq == seq) return;  // duplicate
+    pool_->retain(p.buf);
+    ooo_.insert(it, Segment{seq, p.buf, p.payload, (uint32_t)len});
+    oooBytes_ += len;
+}
+
+void TcpConn::drain_out_of_order() {
+    while (!ooo_.empty() && seq_le(ooo_.front().seq, rcvNxt_)) {
+        Segment& s = ooo_.front();
+        uint32_t skip = rcvNxt_ - s.seq;
+        if (skip < s.len) {
+            size_t take = std::min<size_t>(s.len - skip, rx_.space());
+            append_rx(s.data + skip, take);
+        }
+        oooBytes_ -= s.len;
+        pool_->release(s.buf);
+        ooo_.erase(ooo_.begin());
+    }
+}
+
+void TcpConn::read_done(size_t n) {
+    rx_.consume(n);
+    // window update once the client could send noticeably more than we last told it
+    if (lastWindow_ < kBufCap / 2 && rx_.space() >= (size_t)lastWindow_ + 2u * mss_) ackPending_ = true;
+}
+
+void TcpConn::flush(uint64_t nowMs) {
+    if (reset_ || !synAckSent_) return;  // nothing may reach a client before its SYN is answered
+    if (synAcked_) {
+        while (true) {
+            uint32_t off = sndNxt_ - sndUna_;
+            if (off > tx_.size()) break;  // FIN already out
+            size_t avail = tx_.size() - off;
+            size_t usable = sndWnd_ > off ? sndWnd_ - off : 0;
+            // SACK blocks ride along and must not push the packet past the MTU
+            size_t room = mss_ - (sackOk_ && !ooo_.empty() ? 4 + 8 * kMaxSackBlocks : 0);
+            size_t n = std::min(std::min(avail, usable), room);
+            if (n == 0) {
+                if (finQueued_ && avail == 0 && (!finSent_ || sndNxt_ == finSeq_)) {
+                    finSeq_ = sndNxt_;
+                    finSent_ = true;
+                    emit(sndNxt_, kTcpFin | kTcpAck, nullptr, 0);
+                    sndNxt_++;
+                    if (seq_gt(sndNxt_, sndMax_)) sndMax_ = sndNxt_;
+                    if (!rtoDeadline_) rtoDeadline_ = nowMs + rtoMs_;
+                }
+                break;
+            }
+            emit(sndNxt_, kTcpAck | (n == avail ? kTcpPsh : 0), tx_.data() + off, n);
+            sndNxt_ += (uint32_t)n;
+            if (seq_gt(sndNxt_, sndMax_)) sndMax_ = sndNxt_;
+            if (!rtoDeadline_) rtoDeadline_ = nowMs + rtoMs_;
+        }
+        // zero window with data waiting: the timer sends probes
+        if (!rtoDeadline_ && sndWnd_ == 0 && tx_.size() > sndNxt_ - sndUna_) rtoDeadline_ = nowMs + rtoMs_;
+    }
+    if (ackPending_) emit(sndNxt_, kTcpAck, nullptr, 0);
+}
+
+void TcpConn::abort() {
+    if (reset_) return;
+    out_->emit_segment(key_, sndNxt_, rcvNxt_, kTcpRst | kTcpAck, 0, nullptr, 0, nullptr, 0);
+    reset_ = true;
+}
+
+void TcpConn::on_timer(uint64_t nowMs) {
+    if (reset_ || !rtoDeadline_ || nowMs < rtoDeadline_) return;
+    // a client advertising a zero window is alive; probing it does not count as a retry
+    bool probe = synAcked_ && sndWnd_ == 0 && tx_.size() > 0;
+    if (!probe && ++retries_ > kMaxRetries) {
+        abort();
+        return;
+    }
+    rtoMs_ = std::min(rtoMs_ * 2, kMaxRtoMs);
+    rtoDeadline_ = nowMs + rtoMs_;
+    if (!synAcked_) {
+        if (synAckSent_) send_syn_ack(nowMs);
+        return;
+    }
+    sndNxt_ = sndUna_;
+    dupAcks_ = 0;
+    if (probe) {
+        emit(sndUna_, kTcpAck, tx_.data(), 1);
+        sndNxt_ = sndUna_ + 1;
+        if (seq_gt(sndNxt_, sndMax_)) sndMax_ = sndNxt_;
+        return;
+    }
+    if (sndMax_ == sndUna_) {
+        rtoDeadline_ = 0;
+        return;
+    }
+    flush(nowMs);  // go-back-N
+}
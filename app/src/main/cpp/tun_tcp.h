@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ip_packet.h"
+
+// Byte FIFO used for the send and receive side of a terminated TCP flow.
+// Storage grows lazily up to `cap`, so idle flows cost almost nothing.
+class ByteQueue {
+public:
+    explicit ByteQueue(size_t cap) : cap_(cap) {}
+
+    size_t size() const { return end_ - start_; }
+    size_t space() const { return cap_ - size(); }
+    const uint8_t* data() const { return buf_.data() + start_; }
+
+    // Writable span at the tail (at most space() bytes); commit() what was filled.
+    uint8_t* tail(size_t* avail);
+    void commit(size_t n) { end_ += n; }
+
+    void consume(size_t n);
+
+private:
+    std::vector<uint8_t> buf_;
+    size_t start_ = 0;
+    size_t end_ = 0;
+    size_t cap_;
+};
+
+// Where a TcpConn sends its segments; the TUN engine builds and writes the packet.
+class TcpEmitter {
+public:
+    virtual void emit_segment(const FlowKey& key, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t window,
+                              const uint8_t* opts, size_t optsLen, const uint8_t* payload, size_t len) = 0;
+
+protected:
+    ~TcpEmitter() = default;
+};
+
+// Server side of one TCP connection from the device, terminated in userspace.
+//
+// Only what a mostly loss-free local link needs is implemented: a small
+// out-of-order queue reported through SACK blocks and immediate duplicate
+// ACKs, window scaling, go-back-N retransmission on timeout with exponential
+// backoff, fast retransmit after three duplicate ACKs, zero-window probes
+// and delayed ACKs that the engine flushes once per batch of packets.
+class TcpConn {
+public:
+    static constexpr size_t kBufCap = 128 * 1024;
+    static constexpr uint32_t kInitialRtoMs = 300;
+    static constexpr uint32_t kMaxRtoMs = 8000;
+    static constexpr int kMaxRetries = 8;
+    static constexpr size_t kMaxOutOfOrder = 64;  // segments held past a hole
+
+    // Out-of-order segments stay in the pool buffers they arrived in.
+    TcpConn(const FlowKey& key, TcpEmitter* out, PacketPool* pool) : key_(key), out_(out), pool_(pool) {}
+    ~TcpConn();
+    TcpConn(const TcpConn&) = delete;
+    TcpConn& operator=(const TcpConn&) = delete;
+
+    // Takes the client's SYN. `mtu` bounds the MSS we announce.
+    void accept_syn(const PacketView& p, uint32_t iss, size_t mtu);
+    void send_syn_ack(uint64_t nowMs);
+
+    // Processes a segment from the client; data lands in rx().
+    void on_segment(const PacketView& p, uint64_t nowMs);
+
+    // Client -> app bytes. Call read_done() after consuming from it.
+    ByteQueue& rx() { return rx_; }
+    void read_done(size_t n);
+
+    // App -> client bytes. Append to tx() and call flush().
+    ByteQueue& tx() { return tx_; }
+    size_t tx_space() const { return tx_.space(); }
+
+    // Sends whatever the window allows plus any pending ACK.
+    void flush(uint64_t nowMs);
+
+    // Queues a FIN after the pending data.
+    void close_send() { finQueued_ = true; }
+
+    // Sends RST and marks the connection dead.
+    void abort();
+
+    // Retransmission and probe timer; call periodically.
+    void on_timer(uint64_t nowMs);
+
+    const FlowKey& key() const { return key_; }
+    bool established() const { return synAcked_; }
+    bool peer_fin() const { return peerFin_; }
+    bool fin_acked() const { return finAcked_; }
+    bool reset() const { return reset_; }
+    bool done() const { return reset_ || (peerFin_ && finAcked_); }
+    bool unacked() const { return sndMax_ != sndUna_; }
+
+private:
+    // a payload still sitting in the pool buffer it was read into
+    struct Segment {
+        uint32_t seq;
+        PacketPool::Handle buf;
+        const uint8_t* data;
+        uint32_t len;
+    };
+
+    void append_rx(const uint8_t* d, size_t len);
+    void queue_out_of_order(const PacketView& p);
+    void drain_out_of_order();
+    size_t sack_option(uint8_t* out);
+    void emit(uint32_t seq, uint8_t flags, const uint8_t* payload, size_t len);
+    uint16_t advertised_window();
+
+    FlowKey key_;
+    TcpEmitter* out_;
+    PacketPool* pool_;
+
+    ByteQueue rx_{kBufCap};
+    ByteQueue tx_{kBufCap};  // starts at sndUna_
+    std::vector<Segment> ooo_;  // sorted by seq, never overlapping rcvNxt_
+    size_t oooBytes_ = 0;
+
+    uint32_t iss_ = 0;
+    uint32_t sndUna_ = 0;
+    uint32_t sndNxt_ = 0;
+    uint32_t sndMax_ = 0;
+    uint32_t sndWnd_ = 0;
+    uint32_t finSeq_ = 0;
+    uint8_t sndWscale_ = 0;
+    uint8_t rcvWscale_ = 0;
+    uint32_t rcvNxt_ = 0;
+    uint32_t lastWindow_ = 0;  // bytes, as last advertised
+    uint16_t mss_ = 536;
+
+    uint32_t rtoMs_ = kInitialRtoMs;
+    uint64_t rtoDeadline_ = 0;
+    int retries_ = 0;
+    int dupAcks_ = 0;
+
+    bool synAckSent_ = false;
+    bool synAcked_ = false;
+    bool peerFin_ = false;
+    bool finQueued_ = false;
+    bool finSent_ = false;
+    bool finAcked_ = false;
+    bool ackPending_ = false;
+    bool sackOk_ = false;
+    bool reset_ = false;
+};
@@ -0,0 +1,115 @@
+#include "udp_batch.h"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+
+UdpRecvBatch::UdpRecvBatch()
+    : bufs_(kUdpMaxBatch * kUdpSlotSize), msgs_(kUdpMaxBatch), iovs_(kUdpMaxBatch), addrs_(kUdpMaxBatch) {
+    for (size_t i = 0; i < kUdpMaxBatch; ++i) {
+        iovs_[i].iov_base = data(i);
+        iovs_[i].iov_len = kUdpSlotSize;
+    }
+}
+
+void UdpRecvBatch::reset(size_t n) {
+    // the kernel overwrites msg_namelen and msg_flags, so reset them per call
+    for (size_t i = 0; i < n; ++i) {
+        msghdr& h = msgs_[i].msg_hdr;
+        memset(&h, 0, sizeof(h));
+        h.msg_name = &addrs_[i];
+        h.msg_namelen = sizeof(sockaddr_storage);
+        h.msg_iov = &iovs_[i];
+        h.msg_iovlen = 1;
+        msgs_[i].msg_len = 0;
+    }
+}
+
+size_t UdpRecvBatch::recv(int fd, size_t batch) {
+    if (batch < 1) batch = 1;
+    if (batch > kUdpMaxBatch) batch = kUdpMaxBatch;
+    reset(batch);
+
+    if (batch == 1) {
+        msghdr& h = msgs_[0].msg_hdr;
+        ssize_t n = recvfrom(fd, data(0), kUdpSlotSize, MSG_DONTWAIT | MSG_TRUNC, (sockaddr*)&addrs_[0], &h.msg_namelen);
+        ++calls_;
+        if (n < 0) return 0;
+        msgs_[0].msg_len = (size_t)n > kUdpSlotSize ? 0 : (unsigned)n;
+        ++packets_;
+        return 1;
+    }
+
+    int n;
+    do {
+        n = recvmmsg(fd, msgs_.data(), (unsigned)batch, MSG_DONTWAIT, nullptr);
+    } while (n < 0 && errno == EINTR);
+    ++calls_;
+    if (n <= 0) return 0;
+    for (int i = 0; i < n; ++i) {
+        if (msgs_[i].msg_hdr.msg_flags & MSG_TRUNC) msgs_[i].msg_len = 0;
+    }
+    packets_ += (uint64_t)n;
+    return (size_t)n;
+}
+
+UdpSendBatch::UdpSendBatch()
+    : bufs_(kUdpMaxBatch * kUdpSlotSize), msgs_(kUdpMaxBatch), iovs_(kUdpMaxBatch), addrs_(kUdpMaxBatch) {}
+
+void UdpSendBatch::push(int fd, size_t len, const sockaddr_storage& to, socklen_t toLen, size_t batch) {
+    if (len > kUdpSlotSize) len = kUdpSlotSize;
+    size_t i = count_++;
+    addrs_[i] = to;
+    iovs_[i].iov_base = bufs_.data() + i * kUdpSlotSize;
+    iovs_[i].iov_len = len;
+    msghdr& h = msgs_[i].msg_hdr;
+    memset(&h, 0, sizeof(h));
+    h.msg_name = &addrs_[i];
+    h.msg_namelen = toLen;
+    h.msg_iov = &iovs_[i];
+    h.msg_iovlen = 1;
+    if (count_ >= batch || count_ == kUdpMaxBatch) flush(fd);
+}
+
+void UdpSendBatch::push(int fd, const uint8_t* data, size_t len, const sockaddr_storage& to, socklen_t toLen,
+                        size_t batch) {
+    if (len > kUdpSlotSize) return;
+    memcpy(slot(), data, len);
+    push(fd, len, to, toLen, batch);
+}
+
+void UdpSendBatch::flush(int fd) {
+    if (count_ == 0) return;
+    if (count_ == 1) {
+        const msghdr& h = msgs_[0].msg_hdr;
+        ++calls_;
+        if (sendto(fd, iovs_[0].iov_base, iovs_[0].iov_len, MSG_DONTWAIT, (const sockaddr*)h.msg_name, h.msg_namelen) < 0) {
+            ++dropped_;
+        } else {
+            ++packets_;
+        }
+        count_ = 0;
+        return;
+    }
+
+    size_t off = 0;
+    while (off < count_) {
+        int n = sendmmsg(fd, msgs_.data() + off, (unsigned)(count_ - off), MSG_DONTWAIT);
+        ++calls_;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                // socket buffer full: UDP replies are best effort
+                dropped_ += count_ - off;
+                break;
+            }
+            // the first message was refused (e.g. unreachable client); skip it
+            ++dropped_;
+            ++off;
+            continue;
+        }
+        packets_ += (uint64_t)n;
+        off += (size_t)n;
+    }
+    count_ = 0;
+}
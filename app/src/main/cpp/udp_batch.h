@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <vector>
+
+// Preallocated rings of datagram buffers for recvmmsg/sendmmsg.
+//
+// A ring is sized once for kMaxBatch messages; the batch actually used per
+// call can be lowered at runtime. With a batch of one, or when only a single
+// datagram is queued, the plain recvfrom/sendto path is taken instead.
+
+static constexpr size_t kUdpMaxBatch = 64;
+static constexpr size_t kUdpSlotSize = 4096;
+
+class UdpRecvBatch {
+public:
+    UdpRecvBatch();
+    UdpRecvBatch(const UdpRecvBatch&) = delete;
+    UdpRecvBatch& operator=(const UdpRecvBatch&) = delete;
+
+    // Reads up to `batch` waiting datagrams without blocking and returns how
+    // many were received (0 on EAGAIN or error). Truncated datagrams are
+    // reported with length 0.
+    size_t recv(int fd, size_t batch);
+
+    uint8_t* data(size_t i) { return bufs_.data() + i * kUdpSlotSize; }
+    size_t len(size_t i) const { return msgs_[i].msg_len; }
+    const sockaddr_storage& addr(size_t i) const { return addrs_[i]; }
+    socklen_t addr_len(size_t i) const { return msgs_[i].msg_hdr.msg_namelen; }
+
+    uint64_t calls() const { return calls_; }
+    uint64_t packets() const { return packets_; }
+
+private:
+    void reset(size_t n);
+
+    std::vector<uint8_t> bufs_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovs_;
+    std::vector<sockaddr_storage> addrs_;
+    uint64_t calls_ = 0;
+    uint64_t packets_ = 0;
+};
+
+class UdpSendBatch {
+public:
+    UdpSendBatch();
+    UdpSendBatch(const UdpSendBatch&) = delete;
+    UdpSendBatch& operator=(const UdpSendBatch&) = delete;
+
+    // Buffer for the next datagram; fill it and call push().
+    uint8_t* slot() { return bufs_.data() + count_ * kUdpSlotSize; }
+
+    // Queues the datagram written to slot(); flushes once `batch` are queued.
+    void push(int fd, size_t len, const sockaddr_storage& to, socklen_t toLen, size_t batch);
+
+    // Copies `data` into the next slot and queues it.
+    void push(int fd, const uint8_t* data, size_t len, const sockaddr_storage& to, socklen_t toLen, size_t batch);
+
+    // Sends everything queued. Datagrams the socket will not take are dropped.
+    void flush(int fd);
+
+    size_t pending() const { return count_; }
+    uint64_t calls() const { return calls_; }
+    uint64_t packets() const { return packets_; }
+    uint64_t dropped() const { return dropped_; }
+
+private:
+    std::vector<uint8_t> bufs_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<iovec> iovs_;
+    std::vector<sockaddr_storage> addrs_;
+    size_t count_ = 0;
+    uint64_t calls_ = 0;
+    uint64_t packets_ = 0;
+    uint64_t dropped_ = 0;
+};
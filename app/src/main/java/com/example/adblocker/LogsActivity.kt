@@ -1,11 +1,35 @@
 package com.example.adblocker
 
+import android.graphics.Typeface
 import android.os.Bundle
+import android.os.Handler
+import android.os.Looper
 import android.widget.LinearLayout
+import android.widget.ScrollView
 import android.widget.TextView
 import androidx.appcompat.app.AppCompatActivity
+import com.example.adblocker.native.NativeEvent
+import com.example.adblocker.native.NativeEventReader
+import java.text.SimpleDateFormat
+import java.util.ArrayDeque
+import java.util.Date
+import java.util.Locale
 
 class LogsActivity : AppCompatActivity() {
+    private val reader = NativeEventReader()
+    private val recent = ArrayDeque<NativeEvent>()  // newest first
+    private val handler = Handler(Looper.getMainLooper())
+    private val timeFormat = SimpleDateFormat("HH:mm:ss.SSS", Locale.US)
+    private lateinit var info: TextView
+    private lateinit var list: TextView
+
+    private val poll = object : Runnable {
+        override fun run() {
+            refresh()
+            handler.postDelayed(this, POLL_MS)
+        }
+    }
+
     override fun onCreate(savedInstanceState: Bundle?) {
         super.onCreate(savedInstanceState)
 
@@ -13,9 +37,65 @@ class LogsActivity : AppCompatActivity() {
             orientation = LinearLayout.VERTICAL
             val title = TextView(context).apply { text = "Logs"; textSize = 20f }
             addView(title)
-            val info = TextView(context).apply { text = "Runtime logs are written to logcat. Implement persistent log storage for production." }
+            info = TextView(context).apply { text = "Requests seen by the DNS proxy, HTTP proxy and VPN engine." }
             addView(info)
+            list = TextView(context).apply { typeface = Typeface.MONOSPACE; textSize = 12f }
+            addView(ScrollView(context).apply { addView(list) })
         }
         setContentView(layout)
     }
+
+    override fun onResume() {
+        super.onResume()
+        handler.post(poll)
+    }
+
+    override fun onPause() {
+        handler.removeCallbacks(poll)
+        super.onPause()
+    }
+
+    private fun refresh() {
+        // each native thread's events come out in order; interleave them by time
+        val batch = reader.drain().sortedBy { it.timeMillis }
+        if (batch.isEmpty() && recent.isNotEmpty()) return
+        for (e in batch) {
+            recent.addFirst(e)
+            if (recent.size > MAX_SHOWN) recent.removeLast()
+        }
+        val blocked = recent.count { it.verdict == NativeEvent.VERDICT_BLOCKED }
+        info.text = "Last ${recent.size} requests, $blocked blocked"
+        list.text = recent.joinToString("\n") { format(it) }
+    }
+
+    private fun format(e: NativeEvent): String {
+        val verdict = when (e.verdict) {
+            NativeEvent.VERDICT_BLOCKED -> "BLOCK"
+            NativeEvent.VERDICT_CACHED -> "cache"
+            NativeEvent.VERDICT_FAILED -> "fail "
+            else -> "allow"
+        }
+        val source = when (e.component) {
+            NativeEvent.COMPONENT_DNS_PROXY -> "dns"
+            NativeEvent.COMPONENT_HTTP_PROXY -> "proxy"
+            else -> "vpn"
+        }
+        val kind = when (e.kind) {
+            NativeEvent.KIND_DNS -> "dns"
+            NativeEvent.KIND_TLS -> "tls"
+            else -> "http"
+        }
+        val sb = StringBuilder()
+        sb.append(timeFormat.format(Date(e.timeMillis))).append(' ').append(verdict).append(' ')
+            .append(source).append('/').append(kind).append(' ').append(e.host)
+        if (e.rule != null && e.rule != e.host) sb.append(" (").append(e.rule).append(')')
+        if (e.latencyMicros > 0) sb.append(' ').append(e.latencyMicros / 1000).append('.')
+            .append((e.latencyMicros % 1000) / 100).append(" ms")
+        return sb.toString()
+    }
+
+    private companion object {
+        const val POLL_MS = 1000L
+        const val MAX_SHOWN = 500
+    }
 }
@@ -1,11 +1,11 @@
 package com.example.adblocker.filter
 
+import java.nio.ByteBuffer
+
 /**
- * Optional native adblock engine bridge.
- * This is a placeholder JNI wrapper that will call into a C++ stub (adblock_bridge.cpp).
+ * Optional native adblock engine bridge (adblock_bridge.cpp).
+ * Rules are compiled into an ABP/uBO network filter engine; see network_filter.h.
  * If the native layer is not available, all calls are no-ops and return false.
- *
- * Later, this bridge can be wired to a Rust-based engine (adblock-rust) via FFI.
  */
 object AdblockEngine {
     init {
@@ -22,20 +22,89 @@ object AdblockEngine {
     private var ptr: Long = 0L
 
     private external fun nativeCreateEngine(): Long
-    private external fun nativeLoadRules(ptr: Long, rules: Array<String>): Boolean
+    private external fun nativeLoadRulesBuffer(ptr: Long, text: ByteBuffer, length: Int): Boolean
+    private external fun nativeLoadRulesFile(ptr: Long, path: String): Boolean
+    private external fun nativeCompileSubscriptions(ptr: Long, paths: Array<String>, hostsPath: String): Int
+    private external fun nativeLoadBlocklist(ptr: Long, path: String): Boolean
+    private external fun nativeCompileBlocklist(textPath: String, outPath: String): Boolean
     private external fun nativeMatchHostname(ptr: Long, host: String): Boolean
     private external fun nativeShouldBlock(ptr: Long, url: String, sourceHost: String, resourceType: String): Boolean
+    private external fun nativeMatchHostsPacked(ptr: Long, items: ByteBuffer, count: Int, out: ByteBuffer): Int
+    private external fun nativeShouldBlockPacked(ptr: Long, items: ByteBuffer, count: Int, out: ByteBuffer): Int
+    private external fun nativeGetStats(ptr: Long): LongArray
     private external fun nativeRelease(ptr: Long)
 
     fun isReady(): Boolean = ptr != 0L
 
+    fun tryInit(rules: List<String>): Boolean = tryInitText(rules.joinToString("\n"))
+
+    /** Loads list text (one rule per line) with a single native call. */
+    @Synchronized
+    fun tryInitText(text: String): Boolean {
+        return try {
+            if (ptr == 0L) {
+                ptr = nativeCreateEngine()
+            }
+            val bytes = text.toByteArray(Charsets.UTF_8)
+            val buf = ByteBuffer.allocateDirect(bytes.size).put(bytes)
+            nativeLoadRulesBuffer(ptr, buf, bytes.size)
+        } catch (_: Throwable) {
+            false
+        }
+    }
+
+    /** Loads a filter list file; the text never passes through the Java heap. */
+    @Synchronized
+    fun tryInitFile(path: String): Boolean {
+        return try {
+            if (ptr == 0L) {
+                ptr = nativeCreateEngine()
+            }
+            nativeLoadRulesFile(ptr, path)
+        } catch (_: Throwable) {
+            false
+        }
+    }
+
+    /**
+     * Compiles downloaded subscription lists natively, reading them straight
+     * from disk: network filters replace the engine's rules and host-only
+     * rules are written to [hostsPath] (plus its compiled ".bin") for the DNS
+     * and HTTP proxies. Lists whose text did not change since the previous
+     * call are not parsed again. Returns the number of blocked domains, or -1.
+     */
+    @Synchronized
+    fun compileSubscriptions(paths: List<String>, hostsPath: String): Int {
+        return try {
+            if (ptr == 0L) {
+                ptr = nativeCreateEngine()
+            }
+            nativeCompileSubscriptions(ptr, paths.toTypedArray(), hostsPath)
+        } catch (_: Throwable) {
+            -1
+        }
+    }
+
+    /**
+     * Compiles a host-only text list into the binary format that the native
+     * DNS/HTTP proxies and this engine map read-only.
+     */
+    fun compileBlocklist(textPath: String, outPath: String): Boolean {
+        return try {
+            nativeCompileBlocklist(textPath, outPath)
+        } catch (_: Throwable) {
+            false
+        }
+    }
+
+    /** Switches host matching to a compiled (or text) blocklist file. */
     @Synchronized
-    fun tryInit(rules: List<String>): Boolean {
+    fun loadBlocklist(path: String): Boolean {
         return try {
             if (ptr == 0L) {
                 ptr = nativeCreateEngine()
             }
-            nativeLoadRules(ptr, rules.toTypedArray())
+            nativeLoadBlocklist(ptr, path)
         } catch (_: Throwable) {
             false
         }
@@ -51,6 +120,12 @@ object AdblockEngine {
         }
     }
 
+    /**
+     * True if a blocking filter matches [url] and no exception overrides it.
+     * [sourceHost] is the page making the request (empty if unknown; filters
+     * restricted by party or `$domain=` then do not apply). [resourceType] is a
+     * [ResourceType] name or an ABP type such as "script" or "xmlhttprequest".
+     */
     fun shouldBlock(url: String, sourceHost: String, resourceType: String = "OTHER"): Boolean {
         val p = ptr
         if (p == 0L) return false
@@ -61,6 +136,114 @@ object AdblockEngine {
         }
     }
 
+    /**
+     * Context-free check of a URL or bare host, for callers that know neither
+     * the page nor the resource type: filters of every type apply.
+     */
+    fun matches(urlOrHost: String): Boolean {
+        val p = ptr
+        if (p == 0L) return false
+        return try {
+            nativeShouldBlock(p, urlOrHost, "", "")
+        } catch (_: Throwable) {
+            false
+        }
+    }
+
+    /** A request for [shouldBlockAll]; fields as in [shouldBlock]. */
+    data class Query(val url: String, val sourceHost: String = "", val resourceType: String = "OTHER")
+
+    /** [matchHost] for every host, in one native call. */
+    fun matchHosts(hosts: List<String>): BooleanArray {
+        val p = ptr
+        if (p == 0L || hosts.isEmpty()) return BooleanArray(hosts.size)
+        val items = pack(hosts.map { it.toByteArray(Charsets.UTF_8) })
+        return runPacked(hosts.size) { out -> nativeMatchHostsPacked(p, items, hosts.size, out) }
+    }
+
+    /** [shouldBlock] for every query, in one native call. */
+    fun shouldBlockAll(queries: List<Query>): BooleanArray {
+        val p = ptr
+        if (p == 0L || queries.isEmpty()) return BooleanArray(queries.size)
+        val fields = ArrayList<ByteArray>(queries.size * 3)
+        for (q in queries) {
+            fields.add(q.url.toByteArray(Charsets.UTF_8))
+            fields.add(q.sourceHost.toByteArray(Charsets.UTF_8))
+            fields.add(q.resourceType.toByteArray(Charsets.UTF_8))
+        }
+        val items = pack(fields)
+        return runPacked(queries.size) { out -> nativeShouldBlockPacked(p, items, queries.size, out) }
+    }
+
+    /**
+     * Raw batch API for callers that keep their own buffers. [items] is a
+     * direct buffer of [count] entries, each a 4-byte big-endian length and
+     * that many bytes of UTF-8. Bit i (LSB first) of byte i / 8 in [out] is set
+     * if host i is blocked. Returns how many were, or -1 for a malformed batch.
+     */
+    fun matchHostsPacked(items: ByteBuffer, count: Int, out: ByteBuffer): Int {
+        val p = ptr
+        if (p == 0L) return -1
+        return try {
+            nativeMatchHostsPacked(p, items, count, out)
+        } catch (_: Throwable) {
+            -1
+        }
+    }
+
+    /** Same as [matchHostsPacked] with url, source host and type per request. */
+    fun shouldBlockPacked(items: ByteBuffer, count: Int, out: ByteBuffer): Int {
+        val p = ptr
+        if (p == 0L) return -1
+        return try {
+            nativeShouldBlockPacked(p, items, count, out)
+        } catch (_: Throwable) {
+            -1
+        }
+    }
+
+    /**
+     * Sizes of the native indexes. "blocklist" is the mapped DNS blocklist and
+     * "ruleHosts" the host rules from subscriptions; the "...FilterFpPpm"
+     * entries are the measured false positive rate of the prefilter in front
+     * of each, in parts per million. Empty if the engine is not loaded.
+     */
+    fun stats(): Map<String, Long> {
+        val p = ptr
+        if (p == 0L) return emptyMap()
+        val v = try {
+            nativeGetStats(p)
+        } catch (_: Throwable) {
+            return emptyMap()
+        }
+        return STAT_NAMES.zip(v.toList()).toMap()
+    }
+
+    private val STAT_NAMES = listOf(
+        "blocklistDomains", "blocklistBytes", "blocklistFilterBytes", "blocklistFilterFpPpm",
+        "ruleHosts", "ruleHostBytes", "ruleHostFilterBytes", "ruleHostFilterFpPpm", "ruleBytes",
+    )
+
+    private fun pack(fields: List<ByteArray>): ByteBuffer {
+        val buf = ByteBuffer.allocateDirect(fields.sumOf { 4 + it.size })
+        for (f in fields) buf.putInt(f.size).put(f)
+        return buf
+    }
+
+    private inline fun runPacked(count: Int, call: (ByteBuffer) -> Int): BooleanArray {
+        val result = BooleanArray(count)
+        try {
+            val out = ByteBuffer.allocateDirect((count + 7) / 8)
+            if (call(out) < 0) return result
+            for (i in 0 until count) {
+                result[i] = (out.get(i ushr 3).toInt() shr (i and 7) and 1) != 0
+            }
+        } catch (_: Throwable) {
+            // native layer missing: nothing blocked
+        }
+        return result
+    }
+
     @Synchronized
     fun release() {
         if (ptr != 0L) {
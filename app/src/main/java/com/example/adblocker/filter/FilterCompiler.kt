@@ -2,7 +2,8 @@ package com.example.adblocker.filter
 
 // Simple Aho-Corasick implementation to match multiple substrings against a target string.
 // This is optimized for URL / pattern matching but intentionally simplified for clarity.
-// For production you should replace this with a highly-optimized native or well-tested implementation.
+// Only used when the native library is missing; otherwise FilterManager delegates to AdblockEngine,
+// whose PatternMatcher (pattern_matcher.h) does the same job over flat arrays.
 
 class FilterCompiler {
     private val root = Node()
@@ -14,6 +14,8 @@ import okhttp3.OkHttpClient
 import okhttp3.Request
 import java.io.File
 import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
 import java.security.MessageDigest
 import java.util.concurrent.TimeUnit
 
@@ -41,6 +43,9 @@ class FilterManager(private val context: Context) {
         private set
 
     private var runtimeCompiler: FilterCompiler? = null
+    // the native engine holds the current rules; the Kotlin matcher is only built without it
+    @Volatile
+    private var nativeRules = false
     private val blockedHosts: MutableSet<String> = java.util.Collections.synchronizedSet(mutableSetOf<String>())
 
     // Defaults (uBO/Easylist family)
@@ -56,28 +61,56 @@ class FilterManager(private val context: Context) {
         loadFromText(text)
     }
 
-    fun loadFromText(text: String) {
-        val lines = text.lines()
-            .map { it.trim() }
-            .filter { it.isNotEmpty() && !it.startsWith("#") && !it.startsWith("!") }
-        val comp = FilterCompiler()
-        for (l in lines) {
-            comp.add(l)
+    /**
+     * [source], if given, is a file holding [text]; the native engine then
+     * maps it instead of receiving a copy.
+     */
+    fun loadFromText(text: String, source: File? = null) {
+        // Initialize optional native engine with the whole list in one call (no-op if native not present)
+        val native = try {
+            if (source != null) AdblockEngine.tryInitFile(source.absolutePath) else AdblockEngine.tryInitText(text)
+        } catch (_: Throwable) { false }
+        var patterns = 0
+        val comp = if (native) null else FilterCompiler().apply {
+            for (l in text.lines()) {
+                val rule = l.trim()
+                if (rule.isEmpty() || rule.startsWith("#") || rule.startsWith("!")) continue
+                add(rule)
+                patterns++
+            }
+            build()
         }
-        comp.build()
-        // Initialize optional native engine with full rule set (no-op if native not present)
-        try { AdblockEngine.tryInit(lines) } catch (_: Throwable) { }
         val domains = extractDomainsFromLists(text)
         synchronized(this) {
             runtimeCompiler = comp
+            nativeRules = native
             blockedHosts.clear()
             blockedHosts.addAll(domains)
             loaded = true
         }
-        Log.i("FilterManager", "Loaded ${lines.size} patterns")
+        Log.i("FilterManager", if (native) "Loaded rules into native engine" else "Loaded $patterns patterns")
+    }
+
+    /**
+     * Compiles subscription files natively without reading them into memory.
+     * Host-only rules go to [hostsOut] for the native proxies. Returns the
+     * number of exported domains, or -1 if the native engine is unavailable.
+     */
+    fun loadFromFiles(files: List<File>, hostsOut: File): Int {
+        val count = AdblockEngine.compileSubscriptions(files.map { it.absolutePath }, hostsOut.absolutePath)
+        if (count < 0) return -1
+        synchronized(this) {
+            runtimeCompiler = null
+            nativeRules = true
+            blockedHosts.clear()  // now held natively
+            loaded = true
+        }
+        Log.i("FilterManager", "Compiled ${files.size} subscriptions natively, $count domains")
+        return count
     }
 
     fun matches(urlOrHost: String): Boolean {
+        if (nativeRules) return AdblockEngine.matches(urlOrHost)
         val rc = runtimeCompiler
         val host = extractHost(urlOrHost) ?: urlOrHost
         // Host-level check first
@@ -89,6 +122,13 @@ class FilterManager(private val context: Context) {
     // Export a host-only blocklist derived from enabled subscriptions
     fun exportBlockedDomains(destFile: File): Int {
         val snapshot = synchronized(this) { if (loaded && blockedHosts.isNotEmpty()) blockedHosts.toSet() else emptySet() }
+        if (snapshot.isEmpty()) {
+            val files = enabledSubscriptionFiles(readSubscriptions())
+            if (files.isNotEmpty()) {
+                val n = loadFromFiles(files, destFile)
+                if (n >= 0) return n
+            }
+        }
         val domains: Set<String> = if (snapshot.isNotEmpty()) {
             snapshot
         } else {
@@ -105,8 +145,19 @@ class FilterManager(private val context: Context) {
             }
             extractDomainsFromLists(combined)
         }
-        destFile.writeText(domains.joinToString("\n"))
+        // Write-then-rename so the native reload thread never maps a half-written list
+        val tmp = File(destFile.absolutePath + ".tmp")
+        tmp.writeText(domains.joinToString("\n"))
+        if (!tmp.renameTo(destFile)) {
+            destFile.writeText(domains.joinToString("\n"))
+            tmp.delete()
+        }
         Log.i("FilterManager", "Exported ${domains.size} domains to ${destFile.absolutePath}")
+        // Compile next to the text file; native components map "<file>.bin" instead of parsing
+        val compiled = File(destFile.absolutePath + ".bin")
+        if (AdblockEngine.compileBlocklist(destFile.absolutePath, compiled.absolutePath)) {
+            AdblockEngine.loadBlocklist(compiled.absolutePath)
+        }
         return domains.size
     }
 
@@ -173,13 +224,23 @@ class FilterManager(private val context: Context) {
                                     anySuccess = true
                                 }
                                 resp.isSuccessful -> {
-                                    val body = resp.body?.string() ?: ""
-                                    if (body.isEmpty() || body.length > 10_000_000) {
-                                        throw IOException("Invalid body size")
-                                    }
                                     val fileName = sha1(s.url) + ".txt"
                                     val outFile = File(subsDir, fileName)
-                                    outFile.writeText(body)
+                                    // streamed to disk, so a multi-MB list never sits on the Java heap;
+                                    // the old file stays in place until the new one is complete
+                                    val tmp = File(subsDir, "$fileName.tmp")
+                                    val size = try {
+                                        resp.body?.byteStream()?.use { input ->
+                                            tmp.outputStream().use { copyLimited(input, it, MAX_LIST_BYTES) }
+                                        } ?: 0L
+                                    } catch (t: Throwable) {
+                                        tmp.delete()
+                                        throw t
+                                    }
+                                    if (size == 0L || !tmp.renameTo(outFile)) {
+                                        tmp.delete()
+                                        throw IOException("Invalid body size")
+                                    }
                                     s.localPath = outFile.absolutePath
                                     s.etag = resp.header("ETag") ?: s.etag
                                     s.lastModified = resp.header("Last-Modified") ?: s.lastModified
@@ -199,7 +260,12 @@ class FilterManager(private val context: Context) {
                 }
                 writeSubscriptions(updated)
 
-                // Rebuild engine from all enabled local files
+                // Rebuild engine from all enabled local files, natively from disk if possible
+                val files = enabledSubscriptionFiles(updated)
+                val hostsOut = File(applicationContext.filesDir, "blocked_domains.txt")
+                if (files.isNotEmpty() && loadFromFiles(files, hostsOut) >= 0) {
+                    return if (anySuccess) Result.success() else Result.retry()
+                }
                 val text = buildString {
                     for (s in updated) {
                         if (!s.enabled) continue
@@ -212,7 +278,7 @@ class FilterManager(private val context: Context) {
                 }
                 if (text.isNotBlank()) {
                     mergedFile.writeText(text)
-                    loadFromText(text)
+                    loadFromText(text, mergedFile)
                     // Export host-only blocklist file for native DNS proxy to consume
                     try {
                         this@FilterManager.exportBlockedDomains(File(applicationContext.filesDir, "blocked_domains.txt"))
@@ -226,6 +292,9 @@ class FilterManager(private val context: Context) {
         }
     }
 
+    private fun enabledSubscriptionFiles(subs: List<Subscription>): List<File> =
+        subs.filter { it.enabled }.mapNotNull { s -> s.localPath?.let { File(it) }?.takeIf { it.exists() } }
+
     // Subscriptions persistence
     private fun readSubscriptions(): List<Subscription> {
         return try {
@@ -241,6 +310,19 @@ class FilterManager(private val context: Context) {
         subsFile.writeText(gson.toJson(list))
     }
 
+    // Copies at most `limit` bytes; throws if the stream is longer.
+    private fun copyLimited(input: InputStream, output: OutputStream, limit: Long): Long {
+        val buf = ByteArray(64 * 1024)
+        var total = 0L
+        while (true) {
+            val n = input.read(buf)
+            if (n < 0) return total
+            total += n
+            if (total > limit) throw IOException("Invalid body size")
+            output.write(buf, 0, n)
+        }
+    }
+
     private fun sha1(s: String): String {
         val md = MessageDigest.getInstance("SHA-1")
         val bytes = md.digest(s.toByteArray())
@@ -292,4 +374,9 @@ class FilterManager(private val context: Context) {
         // very simple validation
         return if (x.any { it == '.' } && x.all { it.isLetterOrDigit() || it == '.' || it == '-' }) x else ""
     }
+
+    companion object {
+        // Larger downloads are rejected
+        private const val MAX_LIST_BYTES = 10_000_000L
+    }
 }
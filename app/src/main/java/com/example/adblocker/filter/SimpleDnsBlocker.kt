@@ -3,10 +3,12 @@ package com.example.adblocker.filter
 import android.content.Context
 import android.util.Log
 import java.util.concurrent.ConcurrentHashMap
+import java.util.concurrent.atomic.AtomicLong
 
 class SimpleDnsBlocker(context: Context) : FilterEngine {
     private val blocked = ConcurrentHashMap.newKeySet<String>()
-    private val stats = ConcurrentHashMap<String, Long>()
+    private val blockedCount = AtomicLong()
+    private val allowedCount = AtomicLong()
     private val manager = FilterManager(context)
 
     init {
@@ -28,13 +30,18 @@ class SimpleDnsBlocker(context: Context) : FilterEngine {
     override fun decide(context: RequestContext): FilterDecision {
         val d = context.domain.lowercase()
         if (manager.matches(d)) {
-            stats["blocked"] = stats.getOrDefault("blocked", 0L) + 1
-            Log.i("SimpleDnsBlocker", "Blocking domain via manager: $d")
+            blockedCount.incrementAndGet()
+            if (Log.isLoggable(TAG, Log.DEBUG)) Log.d(TAG, "Blocking domain via manager: $d")
             return FilterDecision.Block
         }
-        stats["allowed"] = stats.getOrDefault("allowed", 0L) + 1
+        allowedCount.incrementAndGet()
         return FilterDecision.Allow
     }
 
-    override fun getStats(): Map<String, Long> = stats
+    override fun getStats(): Map<String, Long> =
+        mapOf("blocked" to blockedCount.get(), "allowed" to allowedCount.get())
+
+    private companion object {
+        const val TAG = "SimpleDnsBlocker"
+    }
 }
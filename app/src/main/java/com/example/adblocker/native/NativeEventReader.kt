@@ -0,0 +1,127 @@
+package com.example.adblocker.native
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/** One DNS query or proxied connection, as logged by the native side. */
+data class NativeEvent(
+    val timeMillis: Long,
+    val component: Int,
+    val kind: Int,
+    val verdict: Int,
+    val host: String,
+    /** Blocklist entry that matched, or null. */
+    val rule: String?,
+    val latencyMicros: Long,
+) {
+    companion object {
+        // EventComponent, EventKind and EventVerdict in event_log.h
+        const val COMPONENT_DNS_PROXY = 1
+        const val COMPONENT_HTTP_PROXY = 2
+        const val COMPONENT_TUN = 3
+
+        const val KIND_DNS = 1
+        const val KIND_HTTP = 2
+        const val KIND_TLS = 3
+
+        const val VERDICT_ALLOWED = 0
+        const val VERDICT_BLOCKED = 1
+        const val VERDICT_CACHED = 2
+        const val VERDICT_FAILED = 3
+    }
+}
+
+/**
+ * Pulls events from the native rings in batches. The buffers are reused and
+ * host names are fetched once per id, so a steady drain allocates only the
+ * returned events. Not thread-safe; use one reader per consumer.
+ *
+ * Host ids carry the native table's generation (see event_log.h). Names are
+ * cached for the newest generation seen and the one before it; when a newer
+ * one shows up the older cache is dropped, as the native side recycles it.
+ */
+class NativeEventReader(maxEvents: Int = 4096) {
+    private val records = ByteBuffer.allocateDirect(maxEvents * RECORD_SIZE).order(ByteOrder.nativeOrder())
+    private val names = ByteBuffer.allocateDirect(64 * 1024)
+    private var generation = 0
+    private var hosts = ArrayList<String>()     // slot - 1 -> name, for generation
+    private var previous = ArrayList<String>()  // for the generation before
+
+    /** Everything logged since the last call, up to maxEvents; oldest first per native thread. */
+    fun drain(): List<NativeEvent> {
+        val n = try {
+            NativeProxy.drainEvents(records)
+        } catch (_: Throwable) {
+            return emptyList()
+        }
+        if (n <= 0) return emptyList()
+        val out = ArrayList<NativeEvent>(n)
+        for (i in 0 until n) {
+            val base = i * RECORD_SIZE
+            val hostId = records.getInt(base + 8)
+            val ruleId = records.getInt(base + 12)
+            out.add(
+                NativeEvent(
+                    timeMillis = records.getLong(base) / 1000,
+                    component = records.get(base + 20).toInt(),
+                    kind = records.get(base + 21).toInt(),
+                    verdict = records.get(base + 22).toInt(),
+                    host = hostName(hostId) ?: "?",
+                    rule = if (ruleId != 0) hostName(ruleId) else null,
+                    latencyMicros = records.getInt(base + 16).toLong() and 0xffffffffL,
+                )
+            )
+        }
+        return out
+    }
+
+    private fun hostName(id: Int): String? {
+        if (id == 0) return null
+        val gen = id ushr GEN_SHIFT
+        val slot = id and SLOT_MASK
+        if (gen != generation && gen != before(generation)) {
+            // ids from a recycled generation cannot be resolved any more
+            val ahead = Math.floorMod(gen - generation, GENERATIONS)
+            if (generation != 0 && ahead >= GENERATIONS / 2) return null
+            previous = if (gen == after(generation)) hosts else ArrayList()
+            hosts = ArrayList()
+            generation = gen
+        }
+        val list = if (gen == generation) hosts else previous
+        if (slot > list.size) fetchHosts(gen, list)
+        return list.getOrNull(slot - 1)
+    }
+
+    private fun fetchHosts(gen: Int, list: ArrayList<String>) {
+        while (true) {
+            names.clear()
+            val n = try {
+                NativeProxy.drainEventHosts((gen shl GEN_SHIFT) or (list.size + 1), names)
+            } catch (_: Throwable) {
+                return
+            }
+            if (n <= 0) return
+            var pos = 0
+            repeat(n) {
+                val len = names.getInt(pos)
+                val bytes = ByteArray(len)
+                names.position(pos + 4)
+                names.get(bytes)
+                list.add(String(bytes, Charsets.UTF_8))
+                pos += 4 + len
+            }
+        }
+    }
+
+    private companion object {
+        const val RECORD_SIZE = 24
+
+        // kEventHostGenShift and the generations 1..65535 in event_log.cpp
+        const val GEN_SHIFT = 16
+        const val SLOT_MASK = (1 shl GEN_SHIFT) - 1
+        const val GENERATIONS = 0xffff
+
+        fun before(gen: Int) = if (gen <= 1) GENERATIONS else gen - 1
+        fun after(gen: Int) = if (gen >= GENERATIONS) 1 else gen + 1
+    }
+}
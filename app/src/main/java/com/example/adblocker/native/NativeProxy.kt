@@ -1,5 +1,7 @@
 package com.example.adblocker.native
 
+import java.nio.ByteBuffer
+
 object NativeProxy {
     init {
         System.loadLibrary("nativeproxy")
@@ -8,12 +10,106 @@ object NativeProxy {
     external fun startTcpProxy(listenPort: Int, remoteHost: String, remotePort: Int): Long
     external fun stopTcpProxy(ptr: Long)
 
-    external fun startTun(tunFd: Int): Long
+    /**
+     * Runs the native packet engine on the VPN interface: DNS is answered inline,
+     * TCP is terminated and checked by host/SNI. [upstreamDns] is "host[:port]"
+     * for plain UDP, "tls://host[:port][#name]" for DNS over TLS or
+     * "https://host[:port][/path][#name]" for DNS over HTTPS; #name is the
+     * certificate name when host is an IP address.
+     */
+    external fun startTun(tunFd: Int, mtu: Int, blocklistPath: String, upstreamDns: String): Long
     external fun stopTun(ptr: Long)
 
-    external fun startDnsProxy(listenPort: Int, blocklistPath: String, upstreamDns: String): Long
+    /**
+     * [workers] SO_REUSEPORT sockets each served by its own thread; 0 = one per core.
+     * [upstreamDns] as for [startTun].
+     */
+    external fun startDnsProxy(listenPort: Int, blocklistPath: String, upstreamDns: String, workers: Int): Long
     external fun stopDnsProxy(ptr: Long)
+    /**
+     * [queries, blocked, cacheHits, cacheMisses, cacheEntries, cacheBytes, upstreamTimeouts,
+     *  recvCalls, recvPackets, sendCalls, sendPackets]; packets / calls is the average batch size.
+     */
+    external fun getDnsStats(): LongArray
+    /** Datagrams per recvmmsg/sendmmsg call (1..64, default 16); 1 disables batching. */
+    external fun setDnsBatchSize(size: Int)
+
+    // Answers for blocked names; see DnsBlockPolicy in dns_codec.h
+    const val BLOCK_POLICY_NULL_IP_NODATA = 0
+    const val BLOCK_POLICY_NULL_IP_NXDOMAIN = 1
+    const val BLOCK_POLICY_NXDOMAIN = 2
+    external fun setDnsBlockPolicy(policy: Int)
+
+    /**
+     * Totals for one [upstreamDns] string passed to [startTun] or [startDnsProxy],
+     * or null if it was never used: [transport (0 udp, 1 tls, 2 https), queries,
+     * answers, timeouts, failed, connects, resumed, open, srttUs, rttVarUs, minRttUs, dropped].
+     */
+    external fun getDnsUpstreamStats(upstream: String): LongArray?
+    /** Whether the library was built with TLS, i.e. takes "tls://" and "https://" upstreams. */
+    external fun isDnsTlsAvailable(): Boolean
+    /** Also trusts the PEM certificates in [pemPath] for encrypted upstreams, e.g. a test resolver's. */
+    external fun setDnsTrustAnchors(pemPath: String): Boolean
 
     external fun startAdvancedProxy(listenPort: Int, blocklistPath: String): Long
     external fun stopAdvancedProxy(ptr: Long)
+
+    /**
+     * Process-wide totals since the library was loaded (see metrics.h):
+     * [layout, counterCount, latencyCount, counters..., then per latency
+     *  count, sumUs, maxUs, p50Us, p90Us, p99Us, p999Us]. Use [metrics].
+     */
+    external fun getMetrics(): LongArray
+
+    /** Logs every DNS query and blocked or passed-through request; off by default. */
+    external fun setEventLogging(enabled: Boolean)
+
+    /**
+     * Moves recent DNS and proxy events into the direct [buffer] as 24-byte
+     * records in native byte order (see event_log.h); returns the count, or
+     * -1 if [buffer] is not direct. Use [NativeEventReader].
+     */
+    external fun drainEvents(buffer: ByteBuffer): Int
+
+    /**
+     * Names of event host ids [fromId], [fromId] + 1, ... of [fromId]'s table
+     * generation (its high 16 bits) packed into the direct [buffer] (4-byte
+     * big-endian length, then UTF-8); returns how many, 0 once the generation
+     * was recycled.
+     */
+    external fun drainEventHosts(fromId: Int, buffer: ByteBuffer): Int
+
+    /**
+     * [getMetrics] by name, e.g. "dnsQueries" or "dnsUpstreamRttP99Us".
+     * Counters only grow; diff two snapshots for rates.
+     */
+    fun metrics(): Map<String, Long> {
+        val v = try {
+            getMetrics()
+        } catch (_: Throwable) {
+            return emptyMap()
+        }
+        if (v.size < 3 || v[0] != METRICS_LAYOUT) return emptyMap()
+        val counters = v[1].toInt()
+        val latencies = v[2].toInt()
+        val out = LinkedHashMap<String, Long>()
+        for (i in 0 until minOf(counters, COUNTER_NAMES.size)) out[COUNTER_NAMES[i]] = v[3 + i]
+        for (l in 0 until minOf(latencies, LATENCY_NAMES.size)) {
+            val base = 3 + counters + l * LATENCY_FIELDS.size
+            if (base + LATENCY_FIELDS.size > v.size) break
+            LATENCY_FIELDS.forEachIndexed { f, field -> out[LATENCY_NAMES[l] + field] = v[base + f] }
+        }
+        return out
+    }
+
+    private const val METRICS_LAYOUT = 1L
+
+    // Same order as Metric and Latency in metrics.h
+    private val COUNTER_NAMES = listOf(
+        "dnsQueries", "dnsBlocked", "dnsCacheHits", "dnsUpstreamQueries", "dnsUpstreamTimeouts",
+        "proxyConnections", "proxyBlocked", "proxyBytesUp", "proxyBytesDown",
+        "tunConnections", "tunBlocked", "blocklistReloads", "eventsOverwritten",
+    )
+    private val LATENCY_NAMES = listOf("dnsUpstreamRtt", "proxyConnect", "blocklistReload")
+    private val LATENCY_FIELDS = listOf("Count", "SumUs", "MaxUs", "P50Us", "P90Us", "P99Us", "P999Us")
 }
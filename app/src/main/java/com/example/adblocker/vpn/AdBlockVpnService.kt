@@ -66,16 +66,20 @@ class AdBlockVpnService : VpnService() {
 
     private fun startTun() {
         try {
+            // The blocklist has to exist before the native engines load it
+            val blockFile = prepareBlocklist()
+
             val builder = Builder()
             builder.addAddress("10.0.0.2", 32)
+            builder.addAddress("fd00::2", 128)
             builder.addRoute("0.0.0.0", 0)
+            builder.addRoute("::", 0)
+            builder.setMtu(TUN_MTU)
             builder.setSession("AdBlockVPN")
-            builder.setBlocking(true)
-            // Important note:
-            // Setting DNS to localhost (127.0.0.1) and running a DNS proxy inside the app is a common technique.
-            // However, routing DNS through the VPN to the app's local listener requires careful routing and privileges.
-            // Here we set a public DNS server as a placeholder.
-            builder.addDnsServer("127.0.0.1") // route DNS to local proxy (dns proxy listens on 5353)
+            // Virtual resolver inside the tunnel; the native engine answers it (and any other UDP/53)
+            builder.addDnsServer(VIRTUAL_DNS)
+            // Our own sockets must not be routed back into the tunnel
+            builder.addDisallowedApplication(packageName)
 
             vpnInterface = builder.establish()
             Log.i("AdBlockVpnService", "VPN established: $vpnInterface")
@@ -88,46 +92,20 @@ class AdBlockVpnService : VpnService() {
                 t.printStackTrace()
             }
 
-            // Pass the TUN file descriptor to native code to begin reading packets
+            // Hand the TUN fd to the native packet engine; it runs on its own thread
             try {
-                vpnInterface?.fileDescriptor?.let { fd ->
-                    val intFd = fd.fd
-                    tunPtr = NativeProxy.startTun(intFd)
-                    Log.i("AdBlockVpnService", "Started native TUN reader: ptr=$tunPtr fd=$intFd")
+                vpnInterface?.let { pfd ->
+                    val intFd = pfd.fd
+                    tunPtr = NativeProxy.startTun(intFd, TUN_MTU, blockFile.absolutePath, upstreamDns())
+                    Log.i("AdBlockVpnService", "Started native TUN engine: ptr=$tunPtr fd=$intFd")
                 }
             } catch (t: Throwable) {
                 t.printStackTrace()
             }
 
-            // Write current blocklist to app files and start native DNS proxy
             try {
-                val fm = FilterManager(this)
-                // Ensure default subscriptions and schedule periodic updates (6 hours)
-                fm.ensureDefaultSubscriptions()
-                fm.scheduleUpdates(
-                    listOf(
-                        "https://easylist.to/easylist/easylist.txt",
-                        "https://easylist.to/easylist/easyprivacy.txt",
-                        "https://ublockorigin.github.io/uAssets/filters/filters.txt",
-                        "https://ublockorigin.github.io/uAssets/filters/privacy.txt"
-                    ),
-                    360
-                )
-                // Export a host-only blocklist for the native proxies
-                val blockFile = File(filesDir, "blocked_domains.txt")
-                var exported = 0
-                try {
-                    exported = fm.exportBlockedDomains(blockFile)
-                } catch (_: Throwable) { }
-                if (exported == 0 || !blockFile.exists() || blockFile.length() == 0L) {
-                    // fallback to bundled asset on first run
-                    assets.open("filters/basic_blocklist.txt").use { ins ->
-                        blockFile.outputStream().use { out -> ins.copyTo(out) }
-                    }
-                }
-
-                // Start DNS proxy on 5353 listening on all interfaces; VPN will use 127.0.0.1 (note: user-space apps typically cannot bind to port 53)
-                dnsPtr = NativeProxy.startDnsProxy(5353, blockFile.absolutePath, "8.8.8.8:53")
+                // Standalone DNS proxy on 5353 for clients outside the tunnel (user-space apps cannot bind to port 53)
+                dnsPtr = NativeProxy.startDnsProxy(5353, blockFile.absolutePath, upstreamDns(), 0)
                 Log.i("AdBlockVpnService", "Started native DNS proxy: ptr=$dnsPtr")
 
                 // Start advanced HTTP proxy for request-level blocking (listens on 8888)
@@ -138,25 +116,43 @@ class AdBlockVpnService : VpnService() {
             } catch (t: Throwable) {
                 t.printStackTrace()
             }
+        } catch (t: Throwable) {
+            t.printStackTrace()
+            stopSelf()
+        }
+    }
 
-            vpnInterface?.fileDescriptor?.let { fd ->
-                // ***** PRODUCTION NOTE *****
-                // Real packet handling and request-level blocking requires:
-                //  - reading packets from the file descriptor
-                //  - reassembling TCP streams or implementing a user-space TCP proxy
-                //  - parsing HTTP requests and applying the filter decisions
-                //  - handling UDP (DNS) requests and responding appropriately
-                //
-                // This is non-trivial and typically implemented in native code (NDK) for performance.
-                // This starter keeps the service alive and integrates the FilterManager + scheduler.
-                while (!scope.isCancelled) {
-                    Thread.sleep(1000)
+    // Writes the current blocklist to app files for the native engines.
+    private fun prepareBlocklist(): File {
+        val blockFile = File(filesDir, "blocked_domains.txt")
+        try {
+            val fm = FilterManager(this)
+            // Ensure default subscriptions and schedule periodic updates (6 hours)
+            fm.ensureDefaultSubscriptions()
+            fm.scheduleUpdates(
+                listOf(
+                    "https://easylist.to/easylist/easylist.txt",
+                    "https://easylist.to/easylist/easyprivacy.txt",
+                    "https://ublockorigin.github.io/uAssets/filters/filters.txt",
+                    "https://ublockorigin.github.io/uAssets/filters/privacy.txt"
+                ),
+                360
+            )
+            // Export a host-only blocklist for the native proxies
+            var exported = 0
+            try {
+                exported = fm.exportBlockedDomains(blockFile)
+            } catch (_: Throwable) { }
+            if (exported == 0 || !blockFile.exists() || blockFile.length() == 0L) {
+                // fallback to bundled asset on first run
+                assets.open("filters/basic_blocklist.txt").use { ins ->
+                    blockFile.outputStream().use { out -> ins.copyTo(out) }
                 }
             }
         } catch (t: Throwable) {
             t.printStackTrace()
-            stopSelf()
         }
+        return blockFile
     }
 
     override fun onRevoke() {
@@ -166,13 +162,13 @@ class AdBlockVpnService : VpnService() {
 
     override fun onDestroy() {
         scope.cancel()
+        if (tunPtr != 0L) {
+            try { NativeProxy.stopTun(tunPtr) } catch (t: Throwable) { t.printStackTrace() }
+        }
         vpnInterface?.close()
         if (nativeServerPtr != 0L) {
             try { NativeProxy.stopTcpProxy(nativeServerPtr) } catch (t: Throwable) { t.printStackTrace() }
         }
-        if (tunPtr != 0L) {
-            try { NativeProxy.stopTun(tunPtr) } catch (t: Throwable) { t.printStackTrace() }
-        }
         if (dnsPtr != 0L) {
             try { NativeProxy.stopDnsProxy(dnsPtr) } catch (t: Throwable) { t.printStackTrace() }
         }
@@ -195,4 +191,15 @@ class AdBlockVpnService : VpnService() {
             mgr?.createNotificationChannel(channel)
         }
     }
+
+    // DNS over TLS when the native library was built with TLS, plain UDP otherwise
+    private fun upstreamDns(): String =
+        if (NativeProxy.isDnsTlsAvailable()) UPSTREAM_DNS_TLS else UPSTREAM_DNS_UDP
+
+    companion object {
+        private const val TUN_MTU = 1500
+        private const val VIRTUAL_DNS = "10.0.0.53"
+        private const val UPSTREAM_DNS_TLS = "tls://8.8.8.8#dns.google"
+        private const val UPSTREAM_DNS_UDP = "8.8.8.8"
+    }
 }